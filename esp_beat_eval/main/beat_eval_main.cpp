@@ -0,0 +1,313 @@
+#include <dirent.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+#include "beat.h"
+#include "beat_tracks.h"
+#include "bench.h"
+
+// Runs BeatTracker over labeled tracks, the way the firmware's analyzer does
+// (mono blocks of MIX_BLOCK_FRAMES as they are played), and prints how well
+// it found the onsets and beats and how quickly. On the Linux target:
+//
+//   ./build/McHacksBeatEval.elf                        # the built-in tracks
+//   MCHACKS_BEAT_TRACKS=~/beats ./build/McHacksBeatEval.elf
+//   MCHACKS_BEAT_FORMAT=json MCHACKS_BEAT_FILTER=rock ./build/McHacksBeatEval.elf
+//
+// Scoring follows the usual beat-tracking evaluations: a detection is
+// correct within ONSET_TOLERANCE_S / BEAT_TOLERANCE_S of a label, each label
+// matches once, and beats in the first EVAL_SKIP_S (while the tracker is
+// still listening) don't count towards the F-measure.
+//
+// Latency is measured against the stream: how far past an onset the tracker
+// had been fed when it reported it, and for beats how far ahead of the beat
+// the event came (negative: after). A beat event also predicts the next
+// beat; the error of that prediction is what a game scheduling on it sees.
+
+#define EVAL_TASK_PRIORITY 20
+#define EVAL_TASK_STACK 8192
+#define EVAL_TASK_CORE 1
+
+#define BLOCK_FRAMES 128                // speaker.cpp's MIX_BLOCK_FRAMES
+#define ONSET_TOLERANCE_S 0.05f
+#define BEAT_TOLERANCE_S 0.07f
+#define EVAL_SKIP_S 5.0f
+#define LOCK_RUN 4                      // correct beats in a row that count as locked
+#define MAX_EVENTS 2048
+#define MAX_RESULTS 64
+
+typedef struct {
+    char name[TRACK_NAME_MAX];
+    uint32_t sample_rate;
+    float bpm_labeled;
+    float bpm_found;
+    // Onsets; -1 where the track has no onset labels
+    float onset_precision;
+    float onset_recall;
+    float onset_f;
+    float onset_latency_ms;             // mean, fed position at report minus the onset
+    // Beats
+    float beat_precision;
+    float beat_recall;
+    float beat_f;
+    float beat_error_ms;                // mean absolute, of the correct ones
+    float beat_lead_ms;                 // mean, report ahead of the beat
+    float next_error_ms;                // mean absolute, predicted next beat
+    float lock_s;                       // start of the first LOCK_RUN correct beats, -1 never
+    // Cost of one push(), bench counter units (see bench.h)
+    double block_mean;
+    uint64_t block_max;
+} eval_result_t;
+
+// Events of the track being scored, with how much had been fed when each came
+typedef struct {
+    beat_event_t event;
+    uint64_t fed;
+} timed_event_t;
+
+static track_t track;
+static BeatTracker tracker;
+static timed_event_t onsets[MAX_EVENTS];
+static timed_event_t beats[MAX_EVENTS];
+static bool label_used[TRACK_MAX_LABELS];
+static eval_result_t results[MAX_RESULTS];
+
+static const char *env(const char *name)
+{
+#if CONFIG_IDF_TARGET_LINUX
+    return getenv(name);
+#else
+    return NULL;
+#endif
+}
+
+// Label within tolerance of t not yet matched, nearest first; -1 if none
+static int match(const float *labels, size_t n, float t, float tolerance)
+{
+    int best = -1;
+    for (size_t i = 0; i < n; i++) {
+        float d = fabsf(labels[i] - t);
+        if (!label_used[i] && d <= tolerance && (best < 0 || d < fabsf(labels[best] - t))) {
+            best = (int)i;
+        }
+    }
+    return best;
+}
+
+static float f_measure(float precision, float recall)
+{
+    return precision + recall > 0 ? 2 * precision * recall / (precision + recall) : 0;
+}
+
+static void score_onsets(const track_t *t, size_t n, eval_result_t *r)
+{
+    if (t->n_onsets == 0) {
+        r->onset_precision = r->onset_recall = r->onset_f = r->onset_latency_ms = -1;
+        return;
+    }
+    memset(label_used, 0, sizeof(label_used));
+    size_t correct = 0;
+    double latency = 0;
+    for (size_t i = 0; i < n; i++) {
+        float at = (float)onsets[i].event.sample / t->sample_rate;
+        int m = match(t->onsets, t->n_onsets, at, ONSET_TOLERANCE_S);
+        if (m >= 0) {
+            label_used[m] = true;
+            correct++;
+            latency += (double)onsets[i].fed / t->sample_rate - t->onsets[m];
+        }
+    }
+    r->onset_precision = n > 0 ? (float)correct / n : 0;
+    r->onset_recall = (float)correct / t->n_onsets;
+    r->onset_f = f_measure(r->onset_precision, r->onset_recall);
+    r->onset_latency_ms = correct > 0 ? (float)(latency * 1000 / correct) : -1;
+}
+
+static void score_beats(const track_t *t, size_t n, eval_result_t *r)
+{
+    memset(label_used, 0, sizeof(label_used));
+    size_t counted = 0, correct = 0, run = 0, labels_counted = 0;
+    double error = 0, lead = 0, next_error = 0;
+    size_t next_scored = 0;
+    r->lock_s = -1;
+    for (size_t i = 0; i < t->n_beats; i++) {
+        labels_counted += t->beats[i] >= EVAL_SKIP_S;
+    }
+    for (size_t i = 0; i < n; i++) {
+        const beat_event_t *e = &beats[i].event;
+        float at = (float)e->sample / t->sample_rate;
+        int m = match(t->beats, t->n_beats, at, BEAT_TOLERANCE_S);
+        if (m >= 0) {
+            label_used[m] = true;
+            run++;
+            if (run == LOCK_RUN && r->lock_s < 0) {
+                r->lock_s = (float)beats[i + 1 - LOCK_RUN].event.sample / t->sample_rate;
+            }
+            error += fabsf(at - t->beats[m]);
+            lead += t->beats[m] - (double)beats[i].fed / t->sample_rate;
+            if ((size_t)m + 1 < t->n_beats) {
+                next_error += fabsf((float)e->next_sample / t->sample_rate - t->beats[m + 1]);
+                next_scored++;
+            }
+        } else {
+            run = 0;
+        }
+        if (at >= EVAL_SKIP_S) {
+            counted++;
+            correct += m >= 0;
+        }
+    }
+    r->beat_precision = counted > 0 ? (float)correct / counted : 0;
+    r->beat_recall = labels_counted > 0 ? (float)correct / labels_counted : 0;
+    r->beat_f = f_measure(r->beat_precision, r->beat_recall);
+    size_t matched = 0;
+    for (size_t i = 0; i < t->n_beats; i++) {
+        matched += label_used[i];
+    }
+    r->beat_error_ms = matched > 0 ? (float)(error * 1000 / matched) : -1;
+    r->beat_lead_ms = matched > 0 ? (float)(lead * 1000 / matched) : 0;
+    r->next_error_ms = next_scored > 0 ? (float)(next_error * 1000 / next_scored) : -1;
+}
+
+static void evaluate(track_t *t, eval_result_t *r)
+{
+    memset(r, 0, sizeof(*r));
+    snprintf(r->name, sizeof(r->name), "%s", t->name);
+    r->sample_rate = t->sample_rate;
+    r->bpm_labeled = t->bpm;
+
+    tracker.init(t->sample_rate);
+    size_t n_onsets = 0, n_beats = 0, blocks = 0;
+    int16_t block[BLOCK_FRAMES];
+    beat_event_t events[4];
+    double total = 0;
+    size_t got;
+    while ((got = track_read(t, block, BLOCK_FRAMES)) > 0) {
+        uint64_t start = bench_now();
+        size_t n = tracker.push(block, got, events, sizeof(events) / sizeof(events[0]));
+        uint64_t took = bench_now() - start;
+        total += (double)took;
+        blocks++;
+        if (took > r->block_max) {
+            r->block_max = took;
+        }
+        for (size_t i = 0; i < n; i++) {
+            timed_event_t te = {events[i], tracker.position()};
+            if (events[i].kind == BEAT_EVENT_ONSET && n_onsets < MAX_EVENTS) {
+                onsets[n_onsets++] = te;
+            } else if (events[i].kind == BEAT_EVENT_BEAT && n_beats < MAX_EVENTS) {
+                beats[n_beats++] = te;
+            }
+        }
+    }
+    r->block_mean = blocks > 0 ? total / blocks : 0;
+    r->bpm_found = tracker.bpm();
+    score_onsets(t, n_onsets, r);
+    score_beats(t, n_beats, r);
+}
+
+static bool wanted(const char *name)
+{
+    const char *only = env("MCHACKS_BEAT_FILTER");
+    return only == NULL || strstr(name, only) != NULL;
+}
+
+static size_t run_all(void)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < SYNTH_TRACK_COUNT && n < MAX_RESULTS; i++) {
+        if (!wanted(SYNTH_TRACKS[i].name)) {
+            continue;
+        }
+        track_open_synth(&track, &SYNTH_TRACKS[i]);
+        evaluate(&track, &results[n++]);
+        track_close(&track);
+    }
+
+    const char *dir = env("MCHACKS_BEAT_TRACKS");
+    DIR *d = dir != NULL ? opendir(dir) : NULL;
+    if (dir != NULL && d == NULL) {
+        fprintf(stderr, "can't open %s\n", dir);
+    }
+    struct dirent *entry;
+    while (d != NULL && (entry = readdir(d)) != NULL && n < MAX_RESULTS) {
+        size_t len = strlen(entry->d_name);
+        if (len <= 4 || strcmp(entry->d_name + len - 4, ".wav") != 0) {
+            continue;
+        }
+        char name[TRACK_NAME_MAX];
+        snprintf(name, sizeof(name), "%.*s", (int)(len - 4), entry->d_name);
+        if (!wanted(name)) {
+            continue;
+        }
+        esp_err_t err = track_open_wav(&track, dir, name);
+        if (err != ESP_OK) {
+            fprintf(stderr, "skipping %s: %s\n", name, esp_err_to_name(err));
+            continue;
+        }
+        evaluate(&track, &results[n++]);
+        track_close(&track);
+    }
+    if (d != NULL) {
+        closedir(d);
+    }
+    return n;
+}
+
+static void print_csv(const eval_result_t *r, size_t n)
+{
+    printf("track,rate,bpm,bpm_found,onset_p,onset_r,onset_f,onset_latency_ms,"
+           "beat_p,beat_r,beat_f,beat_error_ms,beat_lead_ms,next_error_ms,lock_s,block_mean,block_max,unit\n");
+    for (size_t i = 0; i < n; i++, r++) {
+        printf("%s,%lu,%.1f,%.1f,%.3f,%.3f,%.3f,%.1f,%.3f,%.3f,%.3f,%.1f,%.1f,%.1f,%.2f,%.0f,%llu,%s\n",
+               r->name, (unsigned long)r->sample_rate, r->bpm_labeled, r->bpm_found, r->onset_precision,
+               r->onset_recall, r->onset_f, r->onset_latency_ms, r->beat_precision, r->beat_recall, r->beat_f,
+               r->beat_error_ms, r->beat_lead_ms, r->next_error_ms, r->lock_s, r->block_mean,
+               (unsigned long long)r->block_max, bench_unit());
+    }
+}
+
+static void print_json(const eval_result_t *r, size_t n)
+{
+    printf("{\"unit\": \"%s\", \"tracks\": [\n", bench_unit());
+    for (size_t i = 0; i < n; i++, r++) {
+        printf("  {\"track\": \"%s\", \"rate\": %lu, \"bpm\": %.1f, \"bpm_found\": %.1f, "
+               "\"onset_p\": %.3f, \"onset_r\": %.3f, \"onset_f\": %.3f, \"onset_latency_ms\": %.1f, "
+               "\"beat_p\": %.3f, \"beat_r\": %.3f, \"beat_f\": %.3f, \"beat_error_ms\": %.1f, "
+               "\"beat_lead_ms\": %.1f, \"next_error_ms\": %.1f, \"lock_s\": %.2f, "
+               "\"block_mean\": %.0f, \"block_max\": %llu}%s\n",
+               r->name, (unsigned long)r->sample_rate, r->bpm_labeled, r->bpm_found, r->onset_precision,
+               r->onset_recall, r->onset_f, r->onset_latency_ms, r->beat_precision, r->beat_recall, r->beat_f,
+               r->beat_error_ms, r->beat_lead_ms, r->next_error_ms, r->lock_s, r->block_mean,
+               (unsigned long long)r->block_max, i + 1 < n ? "," : "");
+    }
+    printf("]}\n");
+}
+
+static void eval_task(void *pvParameters)
+{
+    size_t n = run_all();
+    const char *format = env("MCHACKS_BEAT_FORMAT");
+    if (format != NULL && strcmp(format, "json") == 0) {
+        print_json(results, n);
+    } else {
+        print_csv(results, n);
+    }
+    fflush(stdout);
+
+#if CONFIG_IDF_TARGET_LINUX
+    exit(0);
+#else
+    vTaskDelete(NULL);
+#endif
+}
+
+extern "C" void app_main(void)
+{
+    xTaskCreatePinnedToCore(eval_task, "beat_eval", EVAL_TASK_STACK, NULL,
+                            EVAL_TASK_PRIORITY, NULL, EVAL_TASK_CORE);
+}
@@ -0,0 +1,229 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "audio_dsp.h"
+#include "beat_tracks.h"
+
+#define STEPS_PER_BEAT 4
+#define STEPS_PER_BAR 16
+#define HIT_TAIL_S 0.4f             // longest sound; older hits are silent
+#define WAV_HEADER_SIZE 44
+#define READ_CHUNK 256
+
+enum {
+    HIT_CLICK,
+    HIT_KICK,
+    HIT_SNARE,
+    HIT_HAT,
+    HIT_BASS,
+    HIT_KINDS,
+};
+
+// Per pattern (in track_pattern_t order) and kind, the sixteenth steps of a
+// bar that get a hit; bit 0 is the downbeat
+static const uint16_t PATTERN_STEPS[][HIT_KINDS] = {
+    // click  kick    snare   hat     bass
+    {0x1111,  0,      0,      0,      0},         // PATTERN_CLICK
+    {0,       0x0501, 0x1010, 0x5555, 0},         // PATTERN_ROCK
+    {0,       0x1111, 0x1010, 0x4444, 0x4444},    // PATTERN_DANCE
+    {0,       0x0449, 0x1010, 0xFFFF, 0x0041},    // PATTERN_FUNK
+    {0,       0x0001, 0x0100, 0x1111, 0},         // PATTERN_BALLAD
+};
+
+const synth_track_t SYNTH_TRACKS[] = {
+    // name               rate   seconds  bpm    to     pattern         noise  pad
+    {"click_120",         44100, 30,      120,   120,   PATTERN_CLICK,  0,     0},
+    {"rock_96",           44100, 30,      96,    96,    PATTERN_ROCK,   0.01f, 0.05f},
+    {"dance_128",         44100, 30,      128,   128,   PATTERN_DANCE,  0.01f, 0.05f},
+    {"funk_105",          44100, 30,      105,   105,   PATTERN_FUNK,   0.01f, 0.05f},
+    {"ballad_72",         44100, 30,      72,    72,    PATTERN_BALLAD, 0.01f, 0.2f},
+    {"rock_ramp_90_140",  44100, 40,      90,    140,   PATTERN_ROCK,   0.01f, 0.05f},
+    {"rock_noisy_110",    44100, 30,      110,   110,   PATTERN_ROCK,   0.15f, 0.1f},
+    {"dance_22k_120",     22050, 30,      120,   120,   PATTERN_DANCE,  0.01f, 0.05f},
+};
+
+const size_t SYNTH_TRACK_COUNT = sizeof(SYNTH_TRACKS) / sizeof(SYNTH_TRACKS[0]);
+
+void track_open_synth(track_t *t, const synth_track_t *synth)
+{
+    memset(t, 0, sizeof(*t));
+    snprintf(t->name, sizeof(t->name), "%s", synth->name);
+    t->synth = synth;
+    t->sample_rate = synth->sample_rate;
+    t->samples = (uint64_t)(synth->seconds * synth->sample_rate);
+    t->bpm = (synth->bpm_start + synth->bpm_end) / 2;
+
+    // Walk the sixteenths, the tempo gliding with time
+    const uint16_t *steps = PATTERN_STEPS[synth->pattern];
+    float time_s = 0.5f;
+    for (uint32_t step = 0; time_s < synth->seconds - HIT_TAIL_S; step++) {
+        float bpm = synth->bpm_start + (synth->bpm_end - synth->bpm_start) * time_s / synth->seconds;
+        uint32_t in_bar = step % STEPS_PER_BAR;
+        if (in_bar % STEPS_PER_BEAT == 0 && t->n_beats < TRACK_MAX_LABELS) {
+            t->beats[t->n_beats++] = time_s;
+        }
+        for (uint8_t kind = 0; kind < HIT_KINDS; kind++) {
+            if (!(steps[kind] & (1u << in_bar)) || t->n_hits >= TRACK_MAX_HITS) {
+                continue;
+            }
+            t->hits[t->n_hits++] = {kind, time_s};
+            if (t->n_onsets < TRACK_MAX_LABELS &&
+                (t->n_onsets == 0 || t->onsets[t->n_onsets - 1] != time_s)) {
+                t->onsets[t->n_onsets++] = time_s;
+            }
+        }
+        time_s += 60.0f / bpm / STEPS_PER_BEAT;
+    }
+}
+
+// Repeatable white noise in [-1, 1], by sample index
+static float noise(uint64_t n, uint32_t salt)
+{
+    uint32_t x = (uint32_t)n * 0x9E3779B1u ^ salt;
+    x ^= x >> 15;
+    x *= 0x85EBCA77u;
+    x ^= x >> 13;
+    x *= 0xC2B2AE3Du;
+    x ^= x >> 16;
+    return (float)(int32_t)x / 2147483648.0f;
+}
+
+static float hit_sample(uint8_t kind, float t, uint64_t n)
+{
+    const float two_pi = 6.2831853f;
+    switch (kind) {
+    case HIT_CLICK:
+        return 0.6f * expf(-t / 0.003f) * sinf(two_pi * 2000.0f * t);
+    case HIT_KICK:
+        // Pitch falls from 150 Hz to 50 Hz
+        return 0.7f * expf(-t / 0.08f) * sinf(two_pi * (50.0f * t + 3.0f * (1.0f - expf(-t / 0.03f))));
+    case HIT_SNARE:
+        return 0.35f * expf(-t / 0.06f) * noise(n, 1) + 0.2f * expf(-t / 0.04f) * sinf(two_pi * 190.0f * t);
+    case HIT_HAT:
+        return 0.08f * expf(-t / 0.015f) * (noise(n, 2) - noise(n - 1, 2));
+    case HIT_BASS:
+        return 0.25f * expf(-t / 0.15f) * sinf(two_pi * 55.0f * t);
+    default:
+        return 0;
+    }
+}
+
+static size_t synth_read(track_t *t, int16_t *out, size_t max)
+{
+    const synth_track_t *s = t->synth;
+    const float two_pi = 6.2831853f;
+    size_t n = 0;
+    for (; n < max && t->position < t->samples; n++, t->position++) {
+        float time_s = (float)t->position / s->sample_rate;
+        while (t->first_active < t->n_hits && t->hits[t->first_active].time_s + HIT_TAIL_S < time_s) {
+            t->first_active++;
+        }
+        float v = 0;
+        for (size_t h = t->first_active; h < t->n_hits && t->hits[h].time_s <= time_s; h++) {
+            v += hit_sample(t->hits[h].kind, time_s - t->hits[h].time_s, t->position);
+        }
+        v += s->noise * noise(t->position, 3);
+        if (s->pad > 0) {
+            // A minor chord, slowly swelling so it never reads as an onset
+            float swell = 0.75f + 0.25f * sinf(two_pi * 0.1f * time_s);
+            v += s->pad * swell / 3 *
+                 (sinf(two_pi * 220.0f * time_s) + sinf(two_pi * 261.6f * time_s) + sinf(two_pi * 329.6f * time_s));
+        }
+        if (v > 1.0f) {
+            v = 1.0f;
+        } else if (v < -1.0f) {
+            v = -1.0f;
+        }
+        out[n] = (int16_t)(v * 32767.0f);
+    }
+    return n;
+}
+
+// One time in seconds per line; anything after it on the line is ignored
+static size_t read_labels(const char *path, float *out, size_t max)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return 0;
+    }
+    char line[64];
+    size_t n = 0;
+    while (n < max && fgets(line, sizeof(line), f) != NULL) {
+        char *end;
+        float v = strtof(line, &end);
+        if (end != line) {
+            out[n++] = v;
+        }
+    }
+    fclose(f);
+    return n;
+}
+
+esp_err_t track_open_wav(track_t *t, const char *dir, const char *name)
+{
+    memset(t, 0, sizeof(*t));
+    snprintf(t->name, sizeof(t->name), "%s", name);
+
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s.beats", dir, name);
+    t->n_beats = read_labels(path, t->beats, TRACK_MAX_LABELS);
+    if (t->n_beats == 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    snprintf(path, sizeof(path), "%s/%s.onsets", dir, name);
+    t->n_onsets = read_labels(path, t->onsets, TRACK_MAX_LABELS);
+    if (t->n_beats > 1) {
+        t->bpm = 60.0f * (t->n_beats - 1) / (t->beats[t->n_beats - 1] - t->beats[0]);
+    }
+
+    snprintf(path, sizeof(path), "%s/%s.wav", dir, name);
+    t->fh = fopen(path, "rb");
+    if (t->fh == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    uint8_t header[WAV_HEADER_SIZE];
+    if (fread(header, 1, sizeof(header), t->fh) != sizeof(header)) {
+        track_close(t);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    t->channels = header[22] | (header[23] << 8);
+    t->sample_rate = header[24] | (header[25] << 8) | (header[26] << 16) | ((uint32_t)header[27] << 24);
+    uint16_t bits = header[34] | (header[35] << 8);
+    uint32_t data_bytes = header[40] | (header[41] << 8) | (header[42] << 16) | ((uint32_t)header[43] << 24);
+    if (bits != 16 || t->channels == 0 || t->channels > 2 || t->sample_rate == 0) {
+        track_close(t);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    t->samples = data_bytes / (2 * t->channels);
+    return ESP_OK;
+}
+
+static size_t wav_read(track_t *t, int16_t *out, size_t max)
+{
+    int16_t chunk[READ_CHUNK * 2];
+    size_t n = 0;
+    while (n < max) {
+        size_t want = max - n < READ_CHUNK ? max - n : READ_CHUNK;
+        size_t got = fread(chunk, 2 * t->channels, want, t->fh);
+        audio_downmix_mono(chunk, got, t->channels, out + n);
+        n += got;
+        if (got < want) {
+            break;
+        }
+    }
+    t->position += n;
+    return n;
+}
+
+size_t track_read(track_t *t, int16_t *out, size_t max)
+{
+    return t->synth != NULL ? synth_read(t, out, max) : wav_read(t, out, max);
+}
+
+void track_close(track_t *t)
+{
+    if (t->fh != NULL) {
+        fclose(t->fh);
+        t->fh = NULL;
+    }
+}
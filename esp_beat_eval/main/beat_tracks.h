@@ -0,0 +1,95 @@
+#ifndef BEAT_TRACKS_H
+#define BEAT_TRACKS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "esp_err.h"
+
+/*
+ * Labeled test tracks
+ * -------------------
+ * The harness needs audio with known beat and onset times. A few drum
+ * patterns are synthesized here, block by block from a list of hits, so the
+ * labels are exact and nothing has to be stored. Recorded tracks can be
+ * added on the Linux target: a canonical 16-bit WAV with its beat times
+ * next to it (name.wav, name.beats, optionally name.onsets; one time in
+ * seconds per line, as the usual beat-tracking datasets ship them).
+ */
+
+#define TRACK_MAX_LABELS 1024
+#define TRACK_MAX_HITS 2048
+#define TRACK_NAME_MAX 48
+
+typedef enum {
+    PATTERN_CLICK,          // a click on every beat
+    PATTERN_ROCK,           // kick 1 and 3, snare 2 and 4, eighth hats
+    PATTERN_DANCE,          // kick on every beat, off-beat hats and bass, claps
+    PATTERN_FUNK,           // syncopated kick, snare 2 and 4, quiet sixteenth hats
+    PATTERN_BALLAD,         // kick 1, snare 3, quarter hats under a loud pad
+} track_pattern_t;
+
+typedef struct {
+    const char *name;
+    uint32_t sample_rate;
+    float seconds;
+    float bpm_start;
+    float bpm_end;          // tempo glides linearly from start to end
+    track_pattern_t pattern;
+    float noise;            // broadband noise, 0 to 1 of full scale
+    float pad;              // sustained chord, 0 to 1 of full scale
+} synth_track_t;
+
+typedef struct {
+    uint8_t kind;
+    float time_s;
+} track_hit_t;
+
+typedef struct {
+    char name[TRACK_NAME_MAX];
+    uint32_t sample_rate;
+    uint64_t samples;               // mono samples in the whole track
+    float bpm;                      // labeled average, 0 if not known
+
+    size_t n_beats;
+    float beats[TRACK_MAX_LABELS];  // seconds
+    size_t n_onsets;                // 0 if the track has no onset labels
+    float onsets[TRACK_MAX_LABELS];
+
+    // Source: a synthesized pattern or a WAV file
+    const synth_track_t *synth;
+    size_t n_hits;
+    track_hit_t hits[TRACK_MAX_HITS];
+    size_t first_active;
+    FILE *fh;
+    uint16_t channels;
+    uint64_t position;
+} track_t;
+
+// The built-in tracks, in output order
+extern const synth_track_t SYNTH_TRACKS[];
+extern const size_t SYNTH_TRACK_COUNT;
+
+/**
+ * @brief Lay out the hits and labels of a built-in track
+ */
+void track_open_synth(track_t *t, const synth_track_t *synth);
+
+/**
+ * @brief Open dir/name.wav and read its labels
+ *
+ * @return ESP_ERR_NOT_FOUND without a .beats file, ESP_ERR_NOT_SUPPORTED
+ *         unless the WAV is 16-bit PCM
+ */
+esp_err_t track_open_wav(track_t *t, const char *dir, const char *name);
+
+/**
+ * @brief The next mono samples of the track
+ *
+ * @return Samples written, less than max only at the end
+ */
+size_t track_read(track_t *t, int16_t *out, size_t max);
+
+void track_close(track_t *t);
+
+#endif // BEAT_TRACKS_H
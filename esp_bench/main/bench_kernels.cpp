@@ -0,0 +1,387 @@
+#include <stdlib.h>
+#include <string.h>
+#include "audio_dsp.h"
+#include "audio_pipeline.h"
+#include "beat.h"
+#include "bench_kernels.h"
+#include "color.h"
+#include "coro.h"
+#include "event_bus.h"
+#include "imu_decode.h"
+#include "imu_fusion.h"
+#include "lf_queue.h"
+#include "spectrum.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+// Sizes of the firmware's own buffers (speaker.cpp, game.h)
+#define AUDIO_CHUNK_SAMPLES 2048
+#define FRAME_WIDTH 240
+#define FRAME_HEIGHT 320
+#define IMU_BATCH 64
+
+static int16_t audio[AUDIO_CHUNK_SAMPLES];
+static uint16_t *frame = NULL;
+static uint8_t imu_raw[IMU_BATCH][IMU_BURST_SIZE];
+static IMU_DATA imu_out[IMU_BATCH];
+static uint8_t hue = 0;
+
+static esp_err_t audio_setup(void)
+{
+    // Values don't change the cost; any non-silent pattern will do
+    for (int i = 0; i < AUDIO_CHUNK_SAMPLES; i++) {
+        audio[i] = (int16_t)(i * 37);
+    }
+    return ESP_OK;
+}
+
+// stream_fill()'s conversion, specialized against generic, at the speeds the
+// old test sequence used: 44.1 kHz at 2x and 3x, where the PDM rate tops out
+// at 48 kHz, and an 8-bit stereo file at 1x. The source is converted into
+// a separate buffer so every run sees the same input.
+static int16_t audio_out[AUDIO_CHUNK_SAMPLES];
+static audio_pipeline_t pipeline;
+
+static void convert_chunk(void)
+{
+    size_t n = audio_pipeline_run(&pipeline, audio, AUDIO_CHUNK_SAMPLES / pipeline.channels, audio_out);
+    BENCH_KEEP(n);
+}
+
+#define PIPELINE_SETUP(fn, init, format, channels, ratio)       \
+    static esp_err_t fn(void)                                   \
+    {                                                           \
+        init(&pipeline, format, channels, ratio);               \
+        return audio_setup();                                   \
+    }
+
+PIPELINE_SETUP(stereo_2x_setup, audio_pipeline_init, AUDIO_FORMAT_PCM16, 2, 44100 * 2.0f / 48000)
+PIPELINE_SETUP(stereo_2x_generic_setup, audio_pipeline_init_generic, AUDIO_FORMAT_PCM16, 2, 44100 * 2.0f / 48000)
+PIPELINE_SETUP(stereo_3x_setup, audio_pipeline_init, AUDIO_FORMAT_PCM16, 2, 44100 * 3.0f / 48000)
+PIPELINE_SETUP(stereo_3x_generic_setup, audio_pipeline_init_generic, AUDIO_FORMAT_PCM16, 2, 44100 * 3.0f / 48000)
+PIPELINE_SETUP(pcm8_setup, audio_pipeline_init, AUDIO_FORMAT_PCM8, 2, 1.0f)
+PIPELINE_SETUP(pcm8_generic_setup, audio_pipeline_init_generic, AUDIO_FORMAT_PCM8, 2, 1.0f)
+
+static void gain_half(void)
+{
+    audio_apply_gain(audio, AUDIO_CHUNK_SAMPLES, 128);
+    BENCH_KEEP(audio);
+}
+
+static esp_err_t frame_setup(void)
+{
+    frame = (uint16_t *)malloc(FRAME_WIDTH * FRAME_HEIGHT * sizeof(uint16_t));
+    return frame != NULL ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+static void frame_teardown(void)
+{
+    free(frame);
+    frame = NULL;
+}
+
+// graphics_main()'s background: hue to RGB, then fillScreen() on the canvas
+static void hsv_fill(void)
+{
+    uint8_t r, g, b;
+    hue_to_rgb(hue++, 200, &r, &g, &b);
+    uint16_t c = rgb565_swapped(r, g, b);
+    for (int i = 0; i < FRAME_WIDTH * FRAME_HEIGHT; i++) {
+        frame[i] = c;
+    }
+    BENCH_KEEP(frame);
+}
+
+static esp_err_t imu_setup(void)
+{
+    for (int i = 0; i < IMU_BATCH; i++) {
+        for (int j = 0; j < IMU_BURST_SIZE; j++) {
+            imu_raw[i][j] = (uint8_t)(i * 31 + j * 7);
+        }
+    }
+    return ESP_OK;
+}
+
+static void imu_decode(void)
+{
+    for (int i = 0; i < IMU_BATCH; i++) {
+        imu_decode_burst(imu_raw[i], &imu_out[i]);
+    }
+    BENCH_KEEP(imu_out);
+}
+
+// One sample from every device into the fusion, 50 Hz each and staggered
+// across the 20 ms, so each push updates a pair per other device: the cost
+// per sample as the device count grows. Motion is precomputed; every
+// device moves, with the accelerometer in and out of its trusted band.
+#define FUSION_STEPS 64
+static ImuFusion fusion;
+static IMU_DATA fusion_samples[FUSION_STEPS][FUSION_MAX_DEVICES];
+static uint8_t fusion_devices = 0;
+static uint32_t fusion_step = 0;
+static int64_t fusion_time_us = 0;
+
+static esp_err_t fusion_setup(uint8_t devices)
+{
+    fusion_devices = devices;
+    fusion_step = 0;
+    fusion_time_us = 0;
+    fusion.init(devices);
+    for (int i = 0; i < FUSION_STEPS; i++) {
+        for (int d = 0; d < FUSION_MAX_DEVICES; d++) {
+            // A triangle wave per axis, out of phase between devices
+            int32_t w = (i * 4 + d * 9) % 64;
+            int32_t tri = (w < 32 ? w : 64 - w) - 16;
+            IMU_DATA *s = &fusion_samples[i][d];
+            s->accel_x = (int16_t)(tri * 600);
+            s->accel_y = (int16_t)(-tri * 300);
+            s->accel_z = (int16_t)(16384 - tri * 200);
+            s->gyro_x = (int16_t)(tri * 500);
+            s->gyro_y = (int16_t)(tri * (d & 1 ? -700 : 700));
+            s->gyro_z = (int16_t)(tri * 90);
+            s->device_id = d;
+        }
+    }
+    return ESP_OK;
+}
+
+#define FUSION_SETUP(fn, devices)         \
+    static esp_err_t fn(void)             \
+    {                                     \
+        return fusion_setup(devices);     \
+    }
+
+FUSION_SETUP(fusion_2_setup, 2)
+FUSION_SETUP(fusion_4_setup, 4)
+FUSION_SETUP(fusion_8_setup, 8)
+
+static void fusion_round(void)
+{
+    const IMU_DATA *step = fusion_samples[fusion_step++ % FUSION_STEPS];
+    for (uint8_t d = 0; d < fusion_devices; d++) {
+        fusion.push(d, &step[d], fusion_time_us + d * 20000 / fusion_devices);
+    }
+    fusion_time_us += 20000;
+    BENCH_KEEP(fusion.energy());
+}
+
+// The analyzer's two halves: what the audio task adds to every mix block
+// (a mono downmix of 128 stereo frames published on a topic nobody is
+// reading), and one window through the job's FFT and band sums
+#define PCM_BLOCK_FRAMES 128
+
+struct PcmBlock {
+    int64_t play_us;
+    uint32_t sample_rate;
+    uint16_t frames;
+    int16_t samples[PCM_BLOCK_FRAMES];
+};
+
+static BusTopic<PcmBlock, 16> pcm_topic("bench_pcm");
+static PcmBlock pcm_block;
+static spectrum_plan_t spectrum_plan;
+static spectrum_work_t spectrum_work;
+static uint8_t spectrum_levels[SPECTRUM_BANDS];
+
+static void pcm_tap(void)
+{
+    pcm_block.play_us = 1;
+    pcm_block.sample_rate = 44100;
+    pcm_block.frames = PCM_BLOCK_FRAMES;
+    audio_downmix_mono(audio, PCM_BLOCK_FRAMES, 2, pcm_block.samples);
+    pcm_topic.publish(pcm_block);
+}
+
+static esp_err_t spectrum_setup(void)
+{
+    spectrum_plan_init(&spectrum_plan);
+    return audio_setup();
+}
+
+static void spectrum_block(void)
+{
+    spectrum_analyze(&spectrum_plan, audio, &spectrum_work, spectrum_levels);
+    BENCH_KEEP(spectrum_levels);
+}
+
+// One hop of the beat tracker, locked onto a click every half second so the
+// phase comb runs too: the most a hop costs
+#define BEAT_CLICK_EVERY 22050
+static BeatTracker beat_tracker;
+static int16_t beat_hop_samples[BEAT_HOP];
+static uint64_t beat_position = 0;
+static beat_event_t beat_events[2];
+
+static void beat_fill(void)
+{
+    for (size_t i = 0; i < BEAT_HOP; i++, beat_position++) {
+        uint32_t in_beat = (uint32_t)(beat_position % BEAT_CLICK_EVERY);
+        beat_hop_samples[i] = in_beat < 64 ? (in_beat & 2 ? 20000 : -20000) : (int16_t)(beat_position * 37 % 256);
+    }
+}
+
+static esp_err_t beat_setup(void)
+{
+    beat_tracker.init(44100);
+    beat_position = 0;
+    for (uint32_t i = 0; i < 10 * 44100 / BEAT_HOP; i++) {
+        beat_fill();
+        beat_tracker.push(beat_hop_samples, BEAT_HOP, beat_events, 2);
+    }
+    return beat_tracker.locked() ? ESP_OK : ESP_FAIL;
+}
+
+static void beat_hop(void)
+{
+    beat_fill();
+    size_t n = beat_tracker.push(beat_hop_samples, BEAT_HOP, beat_events, 2);
+    BENCH_KEEP(n);
+}
+
+// Shared plumbing on every hot path: one message through each primitive
+struct BenchMessage {
+    int64_t time_us;
+    uint32_t a;
+    uint32_t b;
+};
+
+static LfQueue<BenchMessage, 16> queue;
+static BusTopic<BenchMessage, 16> topic("bench");
+static BusSubscriber subscriber;
+
+static void queue_push_pop(void)
+{
+    BenchMessage m = {1, 2, 3};
+    queue.push(m);
+    queue.pop(&m);
+    BENCH_KEEP(&m);
+}
+
+static esp_err_t topic_setup(void)
+{
+    return topic.subscribe(&subscriber, "bench", false);
+}
+
+static void topic_teardown(void)
+{
+    topic.unsubscribe(&subscriber);
+}
+
+static void topic_publish_poll(void)
+{
+    BenchMessage m = {1, 2, 3};
+    topic.publish(m);
+    topic.poll(&subscriber, &m);
+    BENCH_KEEP(&m);
+}
+
+// Waking an activity that waits for a value and getting control back, as a
+// coroutine job and as a task. The executor has no workers: the kernel
+// resumes the job itself, which is what a worker does between its waits.
+#define HANDOFF_TASK_STACK 2048
+
+static const char *TAG = "bench";
+
+static CoExecutor bench_jobs("bench");
+static CoChannel<uint32_t, 16> job_channel;
+static bool job_started = false;
+
+static CoJob job_consumer(void)
+{
+    uint32_t v;
+    while (1) {
+        co_await job_channel.pop(&v);
+        BENCH_KEEP(v);
+    }
+}
+
+static esp_err_t job_setup(void)
+{
+    if (job_started) {
+        return ESP_OK;
+    }
+    esp_err_t ret = bench_jobs.spawn(job_consumer());
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    bench_jobs.run_ready(1);    // up to its first wait
+    job_started = true;
+
+    co_stats_t st;
+    bench_jobs.stats(&st);
+    ESP_LOGI(TAG, "Waiting job: %lu-byte frame; waiting task: %u-byte stack + %u-byte TCB",
+             st.frame_bytes, HANDOFF_TASK_STACK, (unsigned)sizeof(StaticTask_t));
+    return ESP_OK;
+}
+
+static void job_handoff(void)
+{
+    job_channel.try_push(1);
+    bench_jobs.run_ready(1);
+}
+
+static QueueHandle_t task_queue = NULL;
+static TaskHandle_t consumer_task = NULL;
+
+static void task_consumer(void *pvParameters)
+{
+    uint32_t v;
+    while (xQueueReceive(task_queue, &v, portMAX_DELAY) == pdTRUE) {
+        BENCH_KEEP(v);
+    }
+}
+
+static esp_err_t task_setup(void)
+{
+    task_queue = xQueueCreate(16, sizeof(uint32_t));
+    if (task_queue == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    // One priority above the bench task on its core, so every send switches
+    // to the consumer and back
+    if (xTaskCreatePinnedToCore(task_consumer, "bench_consumer", HANDOFF_TASK_STACK, NULL,
+                                uxTaskPriorityGet(NULL) + 1, &consumer_task, xPortGetCoreID()) != pdPASS) {
+        vQueueDelete(task_queue);
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+static void task_teardown(void)
+{
+    vTaskDelete(consumer_task);
+    vQueueDelete(task_queue);
+}
+
+static void task_handoff(void)
+{
+    uint32_t v = 1;
+    xQueueSend(task_queue, &v, portMAX_DELAY);
+}
+
+const bench_kernel_t BENCH_KERNELS[] = {
+    // name                           setup                    run                 teardown        items                       item unit
+    {"audio_pcm16_stereo_2x",         stereo_2x_setup,         convert_chunk,      NULL,           AUDIO_CHUNK_SAMPLES,        "sample"},
+    {"audio_pcm16_stereo_2x_generic", stereo_2x_generic_setup, convert_chunk,      NULL,           AUDIO_CHUNK_SAMPLES,        "sample"},
+    {"audio_pcm16_stereo_3x",         stereo_3x_setup,         convert_chunk,      NULL,           AUDIO_CHUNK_SAMPLES,        "sample"},
+    {"audio_pcm16_stereo_3x_generic", stereo_3x_generic_setup, convert_chunk,      NULL,           AUDIO_CHUNK_SAMPLES,        "sample"},
+    {"audio_pcm8_stereo_1x",          pcm8_setup,              convert_chunk,      NULL,           AUDIO_CHUNK_SAMPLES,        "sample"},
+    {"audio_pcm8_stereo_1x_generic",  pcm8_generic_setup,      convert_chunk,      NULL,           AUDIO_CHUNK_SAMPLES,        "sample"},
+    {"audio_gain",                    audio_setup,             gain_half,          NULL,           AUDIO_CHUNK_SAMPLES,        "sample"},
+    {"audio_pcm_tap",                 audio_setup,             pcm_tap,            NULL,           1,                          "block"},
+    {"spectrum_analyze",              spectrum_setup,          spectrum_block,     NULL,           1,                          "block"},
+    {"beat_hop",                      beat_setup,              beat_hop,           NULL,           1,                          "hop"},
+    {"hsv_fill",                      frame_setup,             hsv_fill,           frame_teardown, FRAME_WIDTH * FRAME_HEIGHT, "pixel"},
+    {"imu_decode",                    imu_setup,               imu_decode,         NULL,           IMU_BATCH,                  "sample"},
+    {"imu_fusion_2",                  fusion_2_setup,          fusion_round,       NULL,           2,                          "sample"},
+    {"imu_fusion_4",                  fusion_4_setup,          fusion_round,       NULL,           4,                          "sample"},
+    {"imu_fusion_8",                  fusion_8_setup,          fusion_round,       NULL,           8,                          "sample"},
+    {"lf_queue_push_pop",             NULL,                    queue_push_pop,     NULL,           1,                          "message"},
+    {"bus_publish_poll",              topic_setup,             topic_publish_poll, topic_teardown, 1,                          "message"},
+    {"job_handoff",                   job_setup,               job_handoff,        NULL,           1,                          "handoff"},
+    {"task_handoff",                  task_setup,              task_handoff,       task_teardown,  1,                          "handoff"},
+};
+
+const size_t BENCH_KERNEL_COUNT = sizeof(BENCH_KERNELS) / sizeof(BENCH_KERNELS[0]);
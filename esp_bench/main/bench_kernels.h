@@ -0,0 +1,11 @@
+#ifndef BENCH_KERNELS_H
+#define BENCH_KERNELS_H
+
+#include <stddef.h>
+#include "bench.h"
+
+// Every kernel the bench app runs, in output order
+extern const bench_kernel_t BENCH_KERNELS[];
+extern const size_t BENCH_KERNEL_COUNT;
+
+#endif // BENCH_KERNELS_H
@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+#include "bench.h"
+#include "bench_kernels.h"
+
+// Runs every kernel in BENCH_KERNELS and prints the results to stdout.
+// On the Linux target the process exits when done, so it can run in
+// scripts:
+//
+//   MCHACKS_BENCH_FORMAT=json MCHACKS_BENCH_FILTER=audio ./build/McHacksBench.elf
+
+#define BENCH_TASK_PRIORITY 20
+#define BENCH_TASK_STACK 8192
+#define BENCH_TASK_CORE 1
+
+static bench_result_t results[32];
+
+static bool want_json(void)
+{
+#if CONFIG_IDF_TARGET_LINUX
+    const char *format = getenv("MCHACKS_BENCH_FORMAT");
+    if (format != NULL) {
+        return strcmp(format, "json") == 0;
+    }
+#endif
+#if CONFIG_MCHACKS_BENCH_JSON
+    return true;
+#else
+    return false;
+#endif
+}
+
+static const char *filter(void)
+{
+#if CONFIG_IDF_TARGET_LINUX
+    return getenv("MCHACKS_BENCH_FILTER");
+#else
+    return NULL;
+#endif
+}
+
+static void bench_task(void *pvParameters)
+{
+    const bench_config_t config = {CONFIG_MCHACKS_BENCH_WARMUP, CONFIG_MCHACKS_BENCH_RUNS};
+    const char *only = filter();
+    size_t n = 0;
+
+    for (size_t i = 0; i < BENCH_KERNEL_COUNT && n < sizeof(results) / sizeof(results[0]); i++) {
+        if (only != NULL && strstr(BENCH_KERNELS[i].name, only) == NULL) {
+            continue;
+        }
+        if (bench_run(&BENCH_KERNELS[i], &config, &results[n]) == ESP_OK) {
+            n++;
+        }
+        // Let the idle task run between kernels so the watchdog stays quiet
+        vTaskDelay(1);
+    }
+
+    if (want_json()) {
+        bench_print_json(stdout, results, n);
+    } else {
+        bench_print_csv(stdout, results, n);
+    }
+    fflush(stdout);
+
+#if CONFIG_IDF_TARGET_LINUX
+    exit(0);
+#else
+    vTaskDelete(NULL);
+#endif
+}
+
+extern "C" void app_main(void)
+{
+    // Pinned, and above anything else the app could run, so a kernel is
+    // never preempted or migrated mid-run
+    xTaskCreatePinnedToCore(bench_task, "bench", BENCH_TASK_STACK, NULL,
+                            BENCH_TASK_PRIORITY, NULL, BENCH_TASK_CORE);
+}
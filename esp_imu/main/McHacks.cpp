@@ -1,28 +1,274 @@
-#include "esp_client.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "mp6050.h"
-#include "portmacro.h"
+#include "esp_timer.h"
+#include "hal.h"
+#include "imu_backlog.h"
+#include "imu_control.h"
+#include "imu_features.h"
+#include <atomic>
 #include <inttypes.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if !CONFIG_IDF_TARGET_LINUX
+#include "console_repl.h"
+#include "esp_console.h"
+#include "esp_heap_caps.h"
+#endif
 
 // Change this to 1 for the second IMU device
 #define DEVICE_ID 1
 
+// Node counters for the "stats" console command, bumped by the sample loop
+static std::atomic<uint32_t> samples_read(0);
+static std::atomic<uint32_t> read_errors(0);
+static std::atomic<uint32_t> send_errors(0);
+static std::atomic<uint32_t> suppressed(0);   // inside the dead band, not sent
+static std::atomic<uint32_t> control_msgs(0);
+static std::atomic<uint32_t> events_sent(0);
+static std::atomic<uint32_t> backlog_held(0);
+static std::atomic<uint32_t> backlog_uploaded(0);
+static std::atomic<uint32_t> backlog_lost(0);
+static std::atomic<uint32_t> backlog_resends(0);
+static int64_t stats_since_us = 0;
+
+// Samples held while the link is down; about 10 KB, too much for the stack
+static ImuBacklog backlog;
+
+// Settings in effect, set by the main board (see imu_control.h). Only the
+// sample loop writes it; the console reads it whole or not at all.
+static imu_settings_t settings;
+static std::atomic<uint32_t> settings_seq(0);
+
 void imu_main();
+
+static void settings_put(const imu_settings_t &s) {
+  uint32_t seq = settings_seq.load(std::memory_order_relaxed);
+  settings_seq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  settings = s;
+  settings_seq.store(seq + 2, std::memory_order_release);
+}
+
+static void settings_get(imu_settings_t *out) {
+  while (1) {
+    uint32_t before = settings_seq.load(std::memory_order_acquire);
+    if (before & 1) {
+      continue;
+    }
+    *out = settings;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (settings_seq.load(std::memory_order_relaxed) == before) {
+      return;
+    }
+  }
+}
+
+#if !CONFIG_IDF_TARGET_LINUX
+static int cmd_stats(int argc, char **argv) {
+  if (argc > 1 && strcmp(argv[1], "reset") == 0) {
+    samples_read.store(0, std::memory_order_relaxed);
+    read_errors.store(0, std::memory_order_relaxed);
+    send_errors.store(0, std::memory_order_relaxed);
+    suppressed.store(0, std::memory_order_relaxed);
+    control_msgs.store(0, std::memory_order_relaxed);
+    events_sent.store(0, std::memory_order_relaxed);
+    stats_since_us = esp_timer_get_time();
+    printf("counters reset\n");
+    return 0;
+  }
+
+  double window_s = (esp_timer_get_time() - stats_since_us) / 1e6;
+  uint32_t samples = samples_read.load(std::memory_order_relaxed);
+  printf("window      %.1f s\n", window_s);
+  printf("imu         %" PRIu32 " samples, %.1f samples/s, %" PRIu32 " read errors, %" PRIu32 " send errors\n",
+         samples, window_s > 0 ? samples / window_s : 0.0,
+         read_errors.load(std::memory_order_relaxed),
+         send_errors.load(std::memory_order_relaxed));
+  imu_settings_t s;
+  settings_get(&s);
+  static const char *const uplinks[] = {"samples", "events", "both"};
+  printf("settings    %u Hz, batch %u, dead band %u, range %dg %d dps, %s\n",
+         s.rate_hz, s.batch, s.dead_band, 2 << s.accel_range, 250 << s.gyro_range,
+         s.uplink <= IMU_UPLINK_BOTH ? uplinks[s.uplink] : "?");
+  printf("control     %" PRIu32 " messages, %" PRIu32 " events sent, %" PRIu32 " samples inside the dead band\n",
+         control_msgs.load(std::memory_order_relaxed),
+         events_sent.load(std::memory_order_relaxed),
+         suppressed.load(std::memory_order_relaxed));
+  printf("backlog     %" PRIu32 " held, %" PRIu32 " uploaded, %" PRIu32 " lost, %" PRIu32 " resent since boot\n",
+         backlog_held.load(std::memory_order_relaxed),
+         backlog_uploaded.load(std::memory_order_relaxed),
+         backlog_lost.load(std::memory_order_relaxed),
+         backlog_resends.load(std::memory_order_relaxed));
+  printf("heap        %u free, %u min free, %u largest block\n",
+         (unsigned)heap_caps_get_free_size(MALLOC_CAP_INTERNAL),
+         (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL),
+         (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL));
+  return 0;
+}
+
+static void stats_console_start() {
+  const esp_console_cmd_t stats_cmd = {
+      .command = "stats",
+      .help = "IMU node counters since boot or the last 'stats reset'",
+      .hint = "[reset]",
+      .func = &cmd_stats,
+  };
+  ESP_ERROR_CHECK(esp_console_cmd_register(&stats_cmd));
+  console_repl_start("imu>", 2, 4096, tskNO_AFFINITY);
+}
+#endif
+
 extern "C" int app_main() {
-  client_app_main();
+  hal_net()->start();
+#if !CONFIG_IDF_TARGET_LINUX
+  stats_console_start();
+#endif
   imu_main();
   return 0;
 }
 
+// Answer whatever the main board sent since the last sample, and say hello
+// when it is time. Never waits: the socket is drained without blocking.
+static void control_step(ImuControlNode *control, ImuSource *imu, int64_t now_us,
+                         int64_t *next_hello_us) {
+  NetTransport *net = hal_net();
+  // The hello goes first: on the host, the first send is what gives a node
+  // a control socket of its own rather than the main board's port
+  if (now_us >= *next_hello_us) {
+    imu_control_msg_t hello;
+    control->hello(&hello);
+    net->send_control(NULL, &hello, sizeof(hello));
+    *next_hello_us = now_us + IMU_CONTROL_HELLO_US;
+  }
+
+  uint8_t buf[sizeof(imu_control_msg_t) + 1];
+  size_t len;
+  net_peer_t from;
+  while (net->receive_control(buf, sizeof(buf), &len, &from)) {
+    control_msgs.fetch_add(1, std::memory_order_relaxed);
+    imu_control_msg_t reply;
+    if (control->handle(buf, len, imu, &reply)) {
+      net->send_control(&from, &reply, sizeof(reply));
+      settings_put(control->settings());
+    } else if (imu_control_parse(buf, len, &reply) &&
+               reply.type == IMU_CONTROL_BACKLOG_ACK &&
+               reply.device == control->device()) {
+      backlog.ack(reply.seq, now_us);
+    }
+  }
+}
+
 void imu_main() {
-  imu_init();
+  ImuSource *imu = hal_imu_source();
+  NetTransport *net = hal_net();
+
+  int device_id = DEVICE_ID;
+#if CONFIG_IDF_TARGET_LINUX
+  // Several host nodes run side by side, so let the environment pick the identity
+  if (getenv("MCHACKS_DEVICE_ID")) {
+    device_id = atoi(getenv("MCHACKS_DEVICE_ID"));
+  }
+#endif
+
+  // The loop is paced by the tick, so that is as fast as it can go
+  ImuControlNode control;
+  control.init((uint8_t)device_id, configTICK_RATE_HZ);
+  settings_put(control.settings());
+
+  IMU_DATA batch[IMU_BATCH_MAX];
+  int64_t batch_time_us[IMU_BATCH_MAX];
+  size_t batched = 0;
+  int64_t batch_start_us = 0;
+  IMU_DATA last_sent = {};
+  int64_t last_sent_us = 0;
+  int64_t next_hello_us = 0;
+  ImuEdgeDetector edge;
+  edge.init();
+  uint16_t event_seq = 0;
+  backlog.init();
+
+  imu->init();
+  TickType_t last_wake = xTaskGetTickCount();
   while (1) {
-    IMU_DATA data = imu_read();
-    data.device_id = DEVICE_ID;
-    custom_queue_add(data);
-    vTaskDelay(20 / portTICK_PERIOD_MS);
+    int64_t now_us = esp_timer_get_time();
+    control_step(&control, imu, now_us, &next_hello_us);
+    const imu_settings_t &s = control.settings();
+
+    // A failed read leaves nothing worth sending: it is counted and the
+    // sample skipped, so it never reaches the batch, the backlog or the
+    // dead-band reference
+    IMU_DATA data;
+    bool link_up = net->link_up();
+    if (imu->read(&data) != ESP_OK) {
+      read_errors.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      samples_read.fetch_add(1, std::memory_order_relaxed);
+      data.device_id = device_id;
+
+      // Edge processing: the detector sees every sample, and only what it
+      // finds goes up. EVENT messages share the control socket.
+      if (s.uplink != IMU_UPLINK_SAMPLES) {
+        IMU_DATA normalized = data;
+        imu_settings_normalize(&s, &normalized);
+        imu_event_t event;
+        if (edge.push(&normalized, now_us, &event)) {
+          imu_event_msg_t msg;
+          imu_event_make(&msg, (uint8_t)device_id, event_seq++, &event);
+          if (net->send_control(NULL, &msg, sizeof(msg)) == ESP_OK) {
+            events_sent.fetch_add(1, std::memory_order_relaxed);
+          } else {
+            send_errors.fetch_add(1, std::memory_order_relaxed);
+          }
+        }
+      }
+
+      // Inside the dead band the sample is dropped, but the main board still
+      // hears from the node every IMU_KEEPALIVE_US. With events only, no raw
+      // sample goes up at all; the HELLOs keep the node known.
+      if (s.uplink == IMU_UPLINK_EVENTS) {
+        batched = 0;
+      } else if (s.dead_band > 0 && last_sent_us != 0 && now_us - last_sent_us < IMU_KEEPALIVE_US &&
+          !imu_dead_band_exceeded(&data, &last_sent, s.dead_band)) {
+        suppressed.fetch_add(1, std::memory_order_relaxed);
+      } else {
+        if (batched == 0) {
+          batch_start_us = now_us;
+        }
+        batch_time_us[batched] = now_us;
+        batch[batched++] = data;
+        last_sent = data;
+        last_sent_us = now_us;
+      }
+      // A batch slowed down by the dead band goes out part-full rather than
+      // late. With the link down it goes to the backlog instead.
+      if (batched > 0 && (batched >= s.batch || now_us - batch_start_us >= IMU_KEEPALIVE_US)) {
+        if (!link_up) {
+          for (size_t i = 0; i < batched; i++) {
+            backlog.push(&batch[i], batch_time_us[i]);
+          }
+        } else if (net->send_samples(batch, batched) != ESP_OK) {
+          send_errors.fetch_add(1, std::memory_order_relaxed);
+        }
+        batched = 0;
+      }
+    }
+
+    // The live batch has gone first; the backlog gets at most one message
+    // per IMU_BACKLOG_INTERVAL_US on top of it, or a resend of the one
+    // still awaiting its ACK (control_step() takes the ACKs in)
+    size_t len;
+    const imu_backlog_msg_t *held = link_up ? backlog.next(now_us, (uint8_t)device_id, &len) : NULL;
+    if (held != NULL && net->send_control(NULL, held, len) == ESP_OK) {
+      backlog.sent(now_us);
+    }
+    backlog_held.store(backlog.count(), std::memory_order_relaxed);
+    backlog_uploaded.store(backlog.uploaded(), std::memory_order_relaxed);
+    backlog_lost.store(backlog.lost(), std::memory_order_relaxed);
+    backlog_resends.store(backlog.resends(), std::memory_order_relaxed);
+
+    TickType_t period = pdMS_TO_TICKS(imu_settings_period_us(&s) / 1000);
+    vTaskDelayUntil(&last_wake, period > 0 ? period : 1);
   }
 }
@@ -0,0 +1,201 @@
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "driver/i2c.h"
+#include "esp_client.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_wifi.h"
+#include "hal.h"
+#include "imu_control.h"
+#include "mp6050.h"
+
+// ESP32 implementations of the HAL interfaces used by an IMU node
+
+static const char *TAG = "hal_esp";
+
+// Where the MP6050 component talks to the sensor
+#define MPU6050_I2C_PORT I2C_NUM_0
+#define MPU6050_I2C_ADDR 0x68
+#define MPU6050_GYRO_CONFIG 0x1B
+#define MPU6050_ACCEL_CONFIG 0x1C
+#define MPU6050_I2C_TIMEOUT_MS 10
+
+class Mp6050Source : public ImuSource {
+    static esp_err_t write_reg(uint8_t reg, uint8_t value)
+    {
+        uint8_t buf[2] = {reg, value};
+        return i2c_master_write_to_device(MPU6050_I2C_PORT, MPU6050_I2C_ADDR, buf, sizeof(buf),
+                                          pdMS_TO_TICKS(MPU6050_I2C_TIMEOUT_MS));
+    }
+
+public:
+    esp_err_t init() override
+    {
+        imu_init();
+        return ESP_OK;
+    }
+
+    esp_err_t read(IMU_DATA *out) override
+    {
+        *out = imu_read();
+        return ESP_OK;
+    }
+
+    // FS_SEL and AFS_SEL are bits 4:3 of their config registers; the
+    // self-test bits around them stay clear
+    esp_err_t set_range(uint8_t accel_range, uint8_t gyro_range) override
+    {
+        if (accel_range > IMU_ACCEL_16G || gyro_range > IMU_GYRO_2000DPS) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        esp_err_t err = write_reg(MPU6050_ACCEL_CONFIG, accel_range << 3);
+        if (err == ESP_OK) {
+            err = write_reg(MPU6050_GYRO_CONFIG, gyro_range << 3);
+        }
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Setting the sensor range failed: %s", esp_err_to_name(err));
+        }
+        return err;
+    }
+};
+
+// esp_client owns the WiFi connection and drains its own send queue.
+// Control messages have a socket of their own; they are broadcast until the
+// main board answers, then go straight to it.
+class ClientTransport : public NetTransport {
+    int _control_sock = -1;
+    bool _control_failed = false;
+    bool _have_main = false;
+    net_peer_t _main = {};
+
+    bool open_control()
+    {
+        if (_control_sock >= 0) {
+            return true;
+        }
+        if (_control_failed) {
+            return false;
+        }
+        _control_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        int on = 1;
+        if (_control_sock < 0 ||
+            setsockopt(_control_sock, SOL_SOCKET, SO_BROADCAST, &on, sizeof(on)) != 0) {
+            ESP_LOGE(TAG, "Control socket failed: errno %d", errno);
+            if (_control_sock >= 0) {
+                close(_control_sock);
+                _control_sock = -1;
+            }
+            _control_failed = true;
+            return false;
+        }
+        return true;
+    }
+
+public:
+    esp_err_t start() override
+    {
+        client_app_main();
+        return ESP_OK;
+    }
+
+    esp_err_t send_sample(const IMU_DATA &sample) override
+    {
+        custom_queue_add(sample);
+        return ESP_OK;
+    }
+
+    // esp_client frames its own messages, one sample each; a batch goes
+    // into its queue together so they leave back to back
+    esp_err_t send_samples(const IMU_DATA *samples, size_t count) override
+    {
+        for (size_t i = 0; i < count; i++) {
+            custom_queue_add(samples[i]);
+        }
+        return ESP_OK;
+    }
+
+    // esp_client reconnects on its own; until it is associated again its
+    // queue has nowhere to go
+    bool link_up() const override
+    {
+        wifi_ap_record_t ap;
+        return esp_wifi_sta_get_ap_info(&ap) == ESP_OK;
+    }
+
+    bool latest_sample(int device, IMU_DATA *out) override
+    {
+        return false;
+    }
+
+    uint32_t received(int device) const override
+    {
+        return 0;
+    }
+
+    uint32_t lost() const override
+    {
+        return 0;
+    }
+
+    int64_t arrival_us(int device) const override
+    {
+        return 0;
+    }
+
+    bool receive_audio(uint8_t *buf, size_t max, size_t *len, int64_t *arrival_us) override
+    {
+        return false;
+    }
+
+    esp_err_t send_control(const net_peer_t *to, const void *buf, size_t len) override
+    {
+        if (!open_control()) {
+            return ESP_FAIL;
+        }
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        if (to != NULL || _have_main) {
+            addr.sin_addr.s_addr = to != NULL ? to->addr : _main.addr;
+            addr.sin_port = to != NULL ? to->port : _main.port;
+        } else {
+            addr.sin_addr.s_addr = htonl(INADDR_BROADCAST);
+            addr.sin_port = htons(IMU_CONTROL_PORT);
+        }
+        int sent = sendto(_control_sock, buf, len, MSG_DONTWAIT, (struct sockaddr *)&addr, sizeof(addr));
+        return sent == (int)len ? ESP_OK : ESP_FAIL;
+    }
+
+    bool receive_control(void *buf, size_t max, size_t *len, net_peer_t *from) override
+    {
+        if (!open_control()) {
+            return false;
+        }
+        struct sockaddr_in addr = {};
+        socklen_t addr_len = sizeof(addr);
+        int n = recvfrom(_control_sock, buf, max, MSG_DONTWAIT, (struct sockaddr *)&addr, &addr_len);
+        if (n < 0) {
+            return false;
+        }
+        *len = (size_t)n;
+        from->addr = addr.sin_addr.s_addr;
+        from->port = addr.sin_port;
+        _main = *from;
+        _have_main = true;
+        return true;
+    }
+};
+
+ImuSource *hal_imu_source()
+{
+    static Mp6050Source source;
+    return &source;
+}
+
+NetTransport *hal_net()
+{
+    static ClientTransport transport;
+    return &transport;
+}
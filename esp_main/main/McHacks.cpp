@@ -1,50 +1,192 @@
-#include "esp_server.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "analyzer.h"
+#include "arenas.h"
+#include "boot.h"
+#include "calibration.h"
+#include "deadline.h"
+#include "game.h"
+#include "esp_random.h"
 #include "graphics.h"
-#include "sd_card.h"
+#include "hal.h"
+#include "jobs.h"
+#include "node_control.h"
+#include "replay.h"
 #include "speaker.h"
+#include "tasks.h"
+#include "telemetry_http.h"
+#if CONFIG_IDF_TARGET_LINUX
+#include "scenario.h"
+#else
+#include "stats_console.h"
+#endif
 #include <inttypes.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 
-extern "C" int app_main() {
-  printf("\n=== ESP32 DEVKIT V1 Starting ===\n");
+#define MUSIC_FILE HAL_STORAGE_ROOT "/test.wav"
+#define SFX_FILE HAL_STORAGE_ROOT "/hit.wav"  // short effect preloaded for hits
+
+// Boot steps. Display, storage and calibration have no dependencies and
+// come up side by side; WiFi waits for calibration only because both use
+// NVS, which calibration_load() initialises. The game waits for storage so
+// the recording starts with the first tick, and node control waits for the
+// game because it posts the nodes' gestures to it.
+enum {
+  STEP_DISPLAY,
+  STEP_STORAGE,
+  STEP_CALIBRATION,
+  STEP_NETWORK,
+  STEP_GRAPHICS,
+  STEP_GAME,
+  STEP_AUDIO,
+  STEP_CONSOLE,
+  STEP_JOBS,
+  STEP_HTTP,
+  STEP_CONTROL,
+};
 
-  // Initialize display first
+static bool storage_ok = false;
+
+static esp_err_t boot_display() {
   graphics_init();
+  return ESP_OK;
+}
 
-  // Start graphics task (will run continuously)
-  xTaskCreate(graphics_main, "graphics", 4096, NULL, 10, NULL);
+static esp_err_t boot_storage() {
+  esp_err_t err = hal_storage()->mount();
+  storage_ok = err == ESP_OK;
+  return err;
+}
 
+static esp_err_t boot_network() {
   // Start server (WiFi/network stuff)
-  server_app_main();
+  return hal_net()->start();
+}
+
+static esp_err_t boot_graphics() {
+  return task_start(TASK_GRAPHICS, graphics_main, NULL, NULL) == pdPASS
+             ? ESP_OK
+             : ESP_ERR_NO_MEM;
+}
+
+static esp_err_t boot_game() {
+#if CONFIG_IDF_TARGET_LINUX
+  // Replay mode: app_main drives the world itself, and recording would
+  // overwrite the very file being replayed
+  if (getenv("MCHACKS_REPLAY") != NULL) {
+    return ESP_OK;
+  }
+#endif
+
+  // Record every session so it can be replayed deterministically later
+  uint32_t seed = esp_random();
+  if (storage_ok) {
+    replay_record_start(SESSION_FILE, seed);
+  }
+
+  // Game simulation and graphics share core 1; the simulation ranks above
+  // graphics so a slow frame never holds up a tick (see tasks.h)
+  return task_start(TASK_GAME, game_task, (void *)(uintptr_t)seed, NULL) ==
+                 pdPASS
+             ? ESP_OK
+             : ESP_ERR_NO_MEM;
+}
+
+static esp_err_t boot_audio() {
+  esp_err_t err = audio_start();
+  if (err != ESP_OK) {
+    return err;
+  }
+  if (!storage_ok) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  // The service is up from here on; the game and console drive it with
+  // commands (see speaker.h)
+  sfx_load(SFX_FILE);
+#if CONFIG_MCHACKS_MUSIC_FROM_NET
+  audio_play_net();
+#else
+  audio_play(MUSIC_FILE);
+#endif
+  return ESP_OK;
+}
 
-  // Test audio playback with frame skipping for high speeds
-  printf("\n=== Testing Variable Playback Speed with Frame Skipping ===\n");
+static esp_err_t boot_console() {
+#if !CONFIG_IDF_TARGET_LINUX
+  // Live performance stats on the serial console ("help" lists the commands)
+  stats_console_start();
+#endif
+  return ESP_OK;
+}
 
-  printf("\n--- Playing at 1.0x speed (normal) ---\n");
-  set_playback_speed(1.0f);
-  speaker_main();
-  vTaskDelay(pdMS_TO_TICKS(1000));
+static esp_err_t boot_jobs() {
+  // Workers for the cooperative background jobs (see jobs.h), then the
+  // job that completes deadline miss snapshots and the audio analyzer
+  esp_err_t err = jobs_start();
+  if (err != ESP_OK) {
+    return err;
+  }
+  err = deadline_start();
+  if (err != ESP_OK) {
+    return err;
+  }
+  return analyzer_start();
+}
 
-  printf("\n--- Playing at 1.5x speed ---\n");
-  set_playback_speed(1.5f);
-  speaker_main();
-  vTaskDelay(pdMS_TO_TICKS(1000));
+static esp_err_t boot_http() {
+  // Stats for anyone on the network (see telemetry_http.h)
+  return telemetry_http_start();
+}
 
-  printf("\n--- Playing at 2.0x speed (frame skipping!) ---\n");
-  set_playback_speed(2.0f);
-  speaker_main();
-  vTaskDelay(pdMS_TO_TICKS(1000));
+static esp_err_t boot_control() {
+  // Live settings for the IMU nodes (see node_control.h)
+  return node_control_start();
+}
 
-  printf("\n--- Playing at 3.0x speed (heavy frame skipping!) ---\n");
-  set_playback_speed(3.0f);
-  speaker_main();
+static const boot_step_t BOOT_STEPS[] = {
+    // In STEP_ order
+    {"display", boot_display, 0},
+    {"storage", boot_storage, 0},
+    {"calibration", calibration_load, 0},
+    {"network", boot_network, BOOT_AFTER(STEP_CALIBRATION)},
+    {"graphics", boot_graphics, BOOT_AFTER(STEP_DISPLAY)},
+    {"game", boot_game, BOOT_AFTER(STEP_STORAGE) | BOOT_AFTER(STEP_CALIBRATION)},
+    {"audio", boot_audio, BOOT_AFTER(STEP_STORAGE)},
+    {"console", boot_console, 0},
+    {"jobs", boot_jobs, 0},
+    {"http", boot_http, BOOT_AFTER(STEP_NETWORK)},
+    {"control", boot_control, BOOT_AFTER(STEP_NETWORK) | BOOT_AFTER(STEP_JOBS) | BOOT_AFTER(STEP_GAME)},
+};
+
+extern "C" int app_main() {
+  printf("\n=== ESP32 DEVKIT V1 Starting ===\n");
+
+  // Reserve every subsystem's buffers before anything can fragment the heap
+  arenas_init();
+
+  boot_run(BOOT_STEPS, sizeof(BOOT_STEPS) / sizeof(BOOT_STEPS[0]));
 
-  printf("\n=== Playback Speed Test Complete ===\n");
   printf("\n=== System running, graphics task active ===\n");
 
+#if CONFIG_IDF_TARGET_LINUX
+  // MCHACKS_REPLAY=<file>: replay a recorded session instead of playing one,
+  // exit status 0 only if every tick matched the recording
+  const char *replay_path = getenv("MCHACKS_REPLAY");
+  if (replay_path != NULL) {
+    replay_result_t result;
+    esp_err_t err = replay_run(replay_path, &result);
+    replay_print_result(replay_path, err, &result);
+    exit(err == ESP_OK && result.diverged_ticks == 0 && result.gap_at < 0 ? 0 : 1);
+  }
+
+  // Performance scenario (tools/perf_scenarios.py): measure, report, exit
+  if (scenario_requested()) {
+    scenario_run();
+  }
+#endif
+
   // Keep app_main alive forever - don't return!
   while(1) {
     vTaskDelay(pdMS_TO_TICKS(1000));
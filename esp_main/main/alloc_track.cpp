@@ -0,0 +1,181 @@
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <new>
+#include "esp_log.h"
+#include "alloc_track.h"
+
+static const char *const region_names[ALLOC_REGION_COUNT] = {
+    "audio",
+    "render",
+    "imu",
+};
+
+const char *alloc_region_name(alloc_region_t region)
+{
+    return region < ALLOC_REGION_COUNT ? region_names[region] : "?";
+}
+
+#if CONFIG_MCHACKS_ALLOC_TRACK
+
+#if !CONFIG_IDF_TARGET_LINUX
+#include "esp_heap_caps.h"
+#endif
+
+static const char *TAG = "alloc_track";
+
+typedef struct {
+    std::atomic<uint32_t> iterations;
+    std::atomic<uint32_t> allocations;
+    std::atomic<uint32_t> violations;
+    std::atomic<uint32_t> last_violation_size;
+} region_counters_t;
+
+static region_counters_t counters[ALLOC_REGION_COUNT];
+
+// Region the calling task is inside, -1 for none. Also cleared while a
+// violation is being reported so the logging can allocate freely.
+static thread_local int current_region = -1;
+
+void alloc_region_begin(alloc_region_t region)
+{
+    counters[region].iterations.fetch_add(1, std::memory_order_relaxed);
+    current_region = region;
+}
+
+void alloc_region_end(alloc_region_t region)
+{
+    current_region = -1;
+}
+
+static void note_allocation(size_t size)
+{
+    int region = current_region;
+    if (region < 0) {
+        return;
+    }
+    region_counters_t *c = &counters[region];
+    c->allocations.fetch_add(1, std::memory_order_relaxed);
+    if (c->iterations.load(std::memory_order_relaxed) <= CONFIG_MCHACKS_ALLOC_WARMUP) {
+        return;
+    }
+
+    c->violations.fetch_add(1, std::memory_order_relaxed);
+    c->last_violation_size.store(size, std::memory_order_relaxed);
+
+    current_region = -1;
+    ESP_LOGE(TAG, "%u-byte allocation in the %s hot path after warm-up",
+             (unsigned)size, region_names[region]);
+#if CONFIG_MCHACKS_ALLOC_ABORT
+    abort();
+#endif
+    current_region = region;
+}
+
+#if CONFIG_IDF_TARGET_LINUX
+
+// Calls from every object in the link are routed here by -Wl,--wrap (see
+// main/CMakeLists.txt); operator new is replaced below since libstdc++'s own
+// calls to malloc happen outside the wrapped objects.
+extern "C" {
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    note_allocation(size);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+    note_allocation(count * size);
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    note_allocation(size);
+    return __real_realloc(ptr, size);
+}
+}
+
+void *operator new(size_t size)
+{
+    // Built without exceptions, so there is no bad_alloc to throw
+    void *p = malloc(size);
+    if (p == nullptr) {
+        abort();
+    }
+    return p;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    return malloc(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+    return malloc(size);
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+    free(p);
+}
+
+#else
+
+// IDF heap hook, called for every successful heap_caps allocation (malloc
+// and new included)
+extern "C" void esp_heap_trace_alloc_hook(void *ptr, size_t size, uint32_t caps)
+{
+    note_allocation(size);
+}
+
+extern "C" void esp_heap_trace_free_hook(void *ptr)
+{
+}
+
+#endif // CONFIG_IDF_TARGET_LINUX
+
+void alloc_track_stats(alloc_region_stats_t out[ALLOC_REGION_COUNT])
+{
+    for (int i = 0; i < ALLOC_REGION_COUNT; i++) {
+        out[i].iterations = counters[i].iterations.load(std::memory_order_relaxed);
+        out[i].allocations = counters[i].allocations.load(std::memory_order_relaxed);
+        out[i].violations = counters[i].violations.load(std::memory_order_relaxed);
+        out[i].last_violation_size = counters[i].last_violation_size.load(std::memory_order_relaxed);
+    }
+}
+
+#else
+
+void alloc_track_stats(alloc_region_stats_t out[ALLOC_REGION_COUNT])
+{
+    memset(out, 0, sizeof(alloc_region_stats_t) * ALLOC_REGION_COUNT);
+}
+
+#endif // CONFIG_MCHACKS_ALLOC_TRACK
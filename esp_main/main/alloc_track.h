@@ -0,0 +1,62 @@
+#ifndef ALLOC_TRACK_H
+#define ALLOC_TRACK_H
+
+#include <stdint.h>
+#include "sdkconfig.h"
+
+/*
+ * Hot-path allocation tracking
+ * ----------------------------
+ * Each steady-state loop marks one iteration with ALLOC_REGION_BEGIN/END.
+ * With CONFIG_MCHACKS_ALLOC_TRACK every malloc/calloc/realloc/new made
+ * inside an iteration is counted against that region. Once a region has run
+ * CONFIG_MCHACKS_ALLOC_WARMUP iterations it must not allocate any more; the
+ * first allocation after that is logged with its size and region and, with
+ * CONFIG_MCHACKS_ALLOC_ABORT, aborts, so a host run or a debug device run
+ * fails loudly instead of slowly fragmenting the heap.
+ *
+ * Device builds count through the IDF heap hooks (CONFIG_HEAP_USE_HOOKS),
+ * host builds by wrapping malloc at link time and replacing operator new.
+ * Without the option the macros compile to nothing.
+ */
+
+typedef enum {
+    ALLOC_REGION_AUDIO,     // one play_wav chunk
+    ALLOC_REGION_RENDER,    // one frame
+    ALLOC_REGION_IMU,       // one IMU ingest pass
+    ALLOC_REGION_COUNT,
+} alloc_region_t;
+
+typedef struct {
+    uint32_t iterations;
+    uint32_t allocations;       // inside the region, warm-up included
+    uint32_t violations;        // allocations after warm-up
+    uint32_t last_violation_size;
+} alloc_region_stats_t;
+
+#if CONFIG_MCHACKS_ALLOC_TRACK
+
+void alloc_region_begin(alloc_region_t region);
+void alloc_region_end(alloc_region_t region);
+
+#define ALLOC_REGION_BEGIN(region) alloc_region_begin(region)
+#define ALLOC_REGION_END(region) alloc_region_end(region)
+
+#else
+
+#define ALLOC_REGION_BEGIN(region) do {} while (0)
+#define ALLOC_REGION_END(region) do {} while (0)
+
+#endif
+
+/**
+ * @brief Copy out the counters of every region (all zero when tracking is off)
+ */
+void alloc_track_stats(alloc_region_stats_t out[ALLOC_REGION_COUNT]);
+
+/**
+ * @brief Region name for logs
+ */
+const char *alloc_region_name(alloc_region_t region);
+
+#endif // ALLOC_TRACK_H
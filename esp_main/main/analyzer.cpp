@@ -0,0 +1,257 @@
+#include <string.h>
+#include <atomic>
+#include <stdlib.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "analyzer.h"
+#include "bus.h"
+#include "jobs.h"
+
+// Mono samples kept, newest last. The I2S queue (512 frames) plus one
+// period's worth of blocks has to fit behind the sample playing now, with a
+// full window before it.
+#define HISTORY_SAMPLES 2048
+
+static const char *TAG = "analyzer";
+
+// A hit this far from the latest beat isn't scored; the tempo may be gone
+#define SCORE_BEATS 4
+
+// The job's own state; it runs on one worker at a time
+static spectrum_plan_t plan;
+static spectrum_work_t work;
+static BusSubscriber pcm_sub;
+static BusSubscriber hit_sub;
+static BeatTracker tracker;
+static bus_beat_t last_beat = {};
+static int64_t offset_sum_us = 0;
+static int16_t history[HISTORY_SAMPLES];
+static uint32_t written = 0;            // samples ever put in history
+static uint32_t analyzed_end = 0;       // window end of the last analysis
+static uint32_t rate = 0;
+static int64_t end_play_us = 0;         // when the sample after the newest plays
+static int16_t window[SPECTRUM_FFT_SIZE];
+static uint8_t levels[SPECTRUM_BANDS];
+
+static analyzer_snapshot_t snapshot = {};
+static std::atomic<uint32_t> snapshot_seq(0);
+
+static std::atomic<uint32_t> blocks_read(0);
+static std::atomic<uint32_t> last_us(0);
+static std::atomic<uint32_t> max_us(0);
+static std::atomic<uint32_t> track_max_us(0);
+static std::atomic<uint32_t> hits_scored(0);
+static std::atomic<uint32_t> hits_on_beat(0);
+static std::atomic<int32_t> mean_offset_us(0);
+
+static void store_max(std::atomic<uint32_t> *max, uint32_t v)
+{
+    if (v > max->load(std::memory_order_relaxed)) {
+        max->store(v, std::memory_order_relaxed);
+    }
+}
+
+static void publish(bool analyzed, int64_t play_us, const uint8_t *bands)
+{
+    uint32_t seq = snapshot_seq.load(std::memory_order_relaxed);
+    snapshot_seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    if (analyzed) {
+        snapshot.analyses++;
+        snapshot.play_us = play_us;
+        snapshot.sample_rate = rate;
+    }
+    memcpy(snapshot.bands, bands, SPECTRUM_BANDS);
+    snapshot.bpm = tracker.bpm();
+
+    snapshot_seq.store(seq + 2, std::memory_order_release);
+}
+
+static void publish_beat(const bus_beat_t *beat)
+{
+    bus_beat.publish(*beat);
+
+    uint32_t seq = snapshot_seq.load(std::memory_order_relaxed);
+    snapshot_seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    snapshot.beats++;
+    snapshot.beat = *beat;
+    snapshot.bpm = tracker.bpm();
+
+    snapshot_seq.store(seq + 2, std::memory_order_release);
+}
+
+// Run a block through the beat tracker; its first sample plays at play_us
+static void track_block(const bus_pcm_t *block)
+{
+    int64_t t0 = esp_timer_get_time();
+    int64_t start = (int64_t)tracker.position();
+    beat_event_t events[2];
+    size_t n = tracker.push(block->samples, block->frames, events, 2);
+    store_max(&track_max_us, (uint32_t)(esp_timer_get_time() - t0));
+
+    for (size_t i = 0; i < n; i++) {
+        if (events[i].kind != BEAT_EVENT_BEAT) {
+            continue;
+        }
+        bus_beat_t beat;
+        beat.time_us = block->play_us + ((int64_t)events[i].sample - start) * 1000000 / rate;
+        beat.next_us = block->play_us + ((int64_t)events[i].next_sample - start) * 1000000 / rate;
+        beat.period_us = (uint32_t)(events[i].period * 1000000 / rate);
+        beat.confidence = events[i].strength;
+        last_beat = beat;
+        publish_beat(&beat);
+    }
+}
+
+// Score every hit since the last pass against the nearest beat
+static void score_hits(void)
+{
+    HitEvent hit;
+    while (bus_hit.poll(&hit_sub, &hit)) {
+        if (last_beat.period_us == 0 ||
+            llabs(hit.sample_time_us - last_beat.time_us) > (int64_t)SCORE_BEATS * last_beat.period_us) {
+            continue;
+        }
+        // The grid runs on from the latest beat both ways
+        int64_t since = hit.sample_time_us - last_beat.time_us;
+        int64_t period = last_beat.period_us;
+        int64_t beats = (since + (since >= 0 ? period / 2 : -period / 2)) / period;
+        int64_t offset = since - beats * period;
+
+        uint32_t n = hits_scored.load(std::memory_order_relaxed) + 1;
+        offset_sum_us += offset;
+        hits_scored.store(n, std::memory_order_relaxed);
+        if (llabs(offset) <= ANALYZER_ON_BEAT_US) {
+            hits_on_beat.fetch_add(1, std::memory_order_relaxed);
+        }
+        mean_offset_us.store((int32_t)(offset_sum_us / n), std::memory_order_relaxed);
+    }
+}
+
+// Take every block published since the last pass into history
+static void read_blocks(void)
+{
+    bus_pcm_t block;
+    while (bus_pcm.poll(&pcm_sub, &block)) {
+        blocks_read.fetch_add(1, std::memory_order_relaxed);
+        if (block.sample_rate != rate) {
+            // New stream or speed: what's kept belongs to the old one
+            rate = block.sample_rate;
+            written = 0;
+            analyzed_end = 0;
+            tracker.init(rate);
+            last_beat = {};
+        }
+        track_block(&block);
+        for (size_t i = 0; i < block.frames; i++) {
+            history[(written + i) % HISTORY_SAMPLES] = block.samples[i];
+        }
+        written += block.frames;
+        end_play_us = block.play_us + (int64_t)block.frames * 1000000 / rate;
+    }
+}
+
+// One pass: analyze the window that is playing now, or let the levels fall
+static void analyzer_step(void)
+{
+    read_blocks();
+    score_hits();
+    int64_t now = esp_timer_get_time();
+
+    // The newest sample plays at end_play_us; count back from there
+    uint32_t end = written;
+    if (rate != 0 && end_play_us > now) {
+        uint32_t ahead = (uint32_t)((end_play_us - now) * rate / 1000000);
+        end = ahead < written ? written - ahead : 0;
+    }
+    uint32_t oldest = written > HISTORY_SAMPLES ? written - HISTORY_SAMPLES : 0;
+    if (end < oldest + SPECTRUM_FFT_SIZE) {
+        end = oldest + SPECTRUM_FFT_SIZE;
+    }
+
+    bool fresh = end > analyzed_end && end <= written;
+    bool falling = false;
+    int64_t t0 = esp_timer_get_time();
+    uint8_t fresh_levels[SPECTRUM_BANDS] = {};
+    if (fresh) {
+        for (size_t i = 0; i < SPECTRUM_FFT_SIZE; i++) {
+            window[i] = history[(end - SPECTRUM_FFT_SIZE + i) % HISTORY_SAMPLES];
+        }
+        spectrum_analyze(&plan, window, &work, fresh_levels);
+        analyzed_end = end;
+    }
+    for (size_t b = 0; b < SPECTRUM_BANDS; b++) {
+        uint8_t held = levels[b] > ANALYZER_DECAY ? levels[b] - ANALYZER_DECAY : 0;
+        uint8_t level = fresh_levels[b] > held ? fresh_levels[b] : held;
+        falling |= level != levels[b];
+        levels[b] = level;
+    }
+    if (!fresh && !falling) {
+        // Silent and settled; nothing new for the renderer
+        return;
+    }
+    int64_t play_us = fresh ? end_play_us - (int64_t)(written - end) * 1000000 / rate : 0;
+    publish(fresh, play_us, levels);
+
+    if (fresh) {
+        uint32_t took = (uint32_t)(esp_timer_get_time() - t0);
+        last_us.store(took, std::memory_order_relaxed);
+        store_max(&max_us, took);
+    }
+}
+
+static CoJob analyzer_job(void)
+{
+    while (1) {
+        co_await jobs.sleep_ms(ANALYZER_PERIOD_MS);
+        analyzer_step();
+    }
+}
+
+esp_err_t analyzer_start(void)
+{
+    spectrum_plan_init(&plan);
+    esp_err_t err = bus_pcm.subscribe(&pcm_sub, "analyzer", false);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Can't subscribe to the audio blocks: %s", esp_err_to_name(err));
+        return err;
+    }
+    err = bus_hit.subscribe(&hit_sub, "analyzer", false);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Can't subscribe to hits: %s", esp_err_to_name(err));
+        return err;
+    }
+    return jobs.spawn(analyzer_job());
+}
+
+void analyzer_get(analyzer_snapshot_t *out)
+{
+    while (1) {
+        uint32_t before = snapshot_seq.load(std::memory_order_acquire);
+        if (before & 1) {
+            continue;
+        }
+        memcpy(out, &snapshot, sizeof(*out));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (snapshot_seq.load(std::memory_order_relaxed) == before) {
+            break;
+        }
+    }
+}
+
+void analyzer_get_stats(analyzer_stats_t *out)
+{
+    analyzer_snapshot_t s;
+    analyzer_get(&s);
+    out->analyses = s.analyses;
+    out->blocks = blocks_read.load(std::memory_order_relaxed);
+    out->last_us = last_us.load(std::memory_order_relaxed);
+    out->max_us = max_us.load(std::memory_order_relaxed);
+    out->track_max_us = track_max_us.load(std::memory_order_relaxed);
+    out->hits = hits_scored.load(std::memory_order_relaxed);
+    out->on_beat = hits_on_beat.load(std::memory_order_relaxed);
+    out->mean_offset_us = mean_offset_us.load(std::memory_order_relaxed);
+}
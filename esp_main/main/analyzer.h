@@ -0,0 +1,80 @@
+#ifndef ANALYZER_H
+#define ANALYZER_H
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "beat.h"
+#include "bus.h"
+#include "spectrum.h"
+
+/*
+ * Audio analyzer
+ * --------------
+ * A background job (see jobs.h) that follows what the speaker is playing.
+ * The audio task publishes every mix block it hands to I2S on bus_pcm, mono
+ * and stamped with the time it will be heard; the job reads them every
+ * ANALYZER_PERIOD_MS, picks the SPECTRUM_FFT_SIZE samples playing right now
+ * and runs spectrum_analyze() on them (see spectrum.h).
+ *
+ * The audio task never waits for the analyzer: publishing is a copy into
+ * the topic's ring, and if the job falls behind it loses blocks (counted in
+ * the bus stats), not the I2S writer's time.
+ *
+ * Band levels reach the renderer through a seqlock snapshot, so reading
+ * them is a copy and never blocks either side. Levels are peaks that fall
+ * back ANALYZER_DECAY per analysis, which reads better on screen than the
+ * raw ~6 ms windows; they keep falling to 0 once playback stops.
+ *
+ * Every block also goes through a BeatTracker (see beat.h) as it is read,
+ * so the beat sees all of the music, not just the windows shown. Beats are
+ * moved from the stream's sample clock onto esp_timer by the play_us stamp
+ * of the block they fall in and published on bus_beat; the latest one and
+ * its predicted successor are in the snapshot too. Blocks reach the job
+ * about as long before they are heard as the tracker needs to confirm a
+ * beat, so beats arrive close to when they sound, and the prediction
+ * covers the rest.
+ *
+ * Hits (bus_hit) are scored against the beat: the offset of the IMU sample
+ * that made the hit from the nearest beat of the predicted grid.
+ */
+
+#define ANALYZER_PERIOD_MS 10
+#define ANALYZER_DECAY 4
+#define ANALYZER_ON_BEAT_US 70000       // a hit this close to a beat is on it
+
+typedef struct {
+    uint32_t analyses;                  // 0 until the first
+    int64_t play_us;                    // esp_timer time the analyzed window ended playing
+    uint32_t sample_rate;
+    uint8_t bands[SPECTRUM_BANDS];      // levels, lowest band first
+
+    uint32_t beats;                     // 0 until the first
+    bus_beat_t beat;                    // the latest
+    float bpm;                          // current estimate, 0 if none; beats only once confident
+} analyzer_snapshot_t;
+
+typedef struct {
+    uint32_t analyses;
+    uint32_t blocks;                    // bus_pcm blocks read
+    uint32_t last_us;                   // one analysis, window to snapshot
+    uint32_t max_us;
+    uint32_t track_max_us;              // one block through the beat tracker
+
+    uint32_t hits;                      // scored against a beat
+    uint32_t on_beat;                   // within ANALYZER_ON_BEAT_US
+    int32_t mean_offset_us;             // hit minus beat; negative is early
+} analyzer_stats_t;
+
+/**
+ * @brief Build the FFT tables and start the job; after jobs_start()
+ */
+esp_err_t analyzer_start(void);
+
+/**
+ * @brief Latest band levels and beat; never blocks
+ */
+void analyzer_get(analyzer_snapshot_t *out);
+
+void analyzer_get_stats(analyzer_stats_t *out);
+
+#endif // ANALYZER_H
@@ -0,0 +1,23 @@
+#include "esp_log.h"
+#include "arenas.h"
+
+// Sized from the buffers each subsystem takes at run time, plus alignment slack
+#define AUDIO_ARENA_SIZE (90 * 1024)    // 4 KB chunk buffer + 2 x 32 KB SFX banks + 17 KB network jitter buffer
+
+static const char *TAG = "arenas";
+
+MemArena audio_arena("audio");
+MemPool net_pool("net");
+MemPool job_frames("jobs");
+
+esp_err_t arenas_init(void)
+{
+    esp_err_t ret;
+    if ((ret = audio_arena.init(AUDIO_ARENA_SIZE)) != ESP_OK ||
+        (ret = net_pool.init(NET_BUFFER_SIZE, NET_BUFFER_COUNT)) != ESP_OK ||
+        (ret = job_frames.init(JOB_FRAME_SIZE, JOB_FRAME_COUNT)) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to reserve boot memory: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    return ESP_OK;
+}
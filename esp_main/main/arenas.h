@@ -0,0 +1,31 @@
+#ifndef ARENAS_H
+#define ARENAS_H
+
+#include "mem_pool.h"
+
+/*
+ * Memory plan for the main board
+ * ------------------------------
+ * Reserved once by arenas_init() before any task starts. Hot paths take their
+ * buffers from these instead of the heap.
+ *
+ *   audio_arena    playback chunk buffer, the two preloaded SFX banks and
+ *                  the network audio jitter buffer
+ *   job_frames     coroutine frames of the cooperative jobs (see jobs.h)
+ *   net_pool       datagram-sized buffers for the network paths (the
+ *                  network audio source holds one while it plays)
+ */
+
+#define NET_BUFFER_SIZE 1472    // one UDP payload on a 1500-byte MTU
+#define NET_BUFFER_COUNT 8
+
+#define JOB_FRAME_SIZE 512      // the largest job's frame, with room to grow
+#define JOB_FRAME_COUNT 8
+
+extern MemArena audio_arena;
+extern MemPool job_frames;
+extern MemPool net_pool;
+
+esp_err_t arenas_init(void);
+
+#endif // ARENAS_H
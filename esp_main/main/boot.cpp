@@ -0,0 +1,168 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <atomic>
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "boot.h"
+#include "tasks.h"
+
+static const char *TAG = "boot";
+
+static const char *const MILESTONE_NAMES[BOOT_MILESTONE_COUNT] = {
+    "first frame",
+    "first imu sample",
+};
+
+static const boot_step_t *boot_steps = NULL;
+static boot_step_time_t times[BOOT_MAX_STEPS];
+static int64_t boot_start_us = 0;
+static std::atomic<size_t> timeline_count(0);
+
+// One bit per finished step
+static StaticEventGroup_t done_storage;
+static EventGroupHandle_t done = NULL;
+
+static std::atomic<int64_t> milestones[BOOT_MILESTONE_COUNT];
+
+static void run_step(size_t i)
+{
+    const boot_step_t *step = &boot_steps[i];
+
+    if (step->after != 0) {
+        xEventGroupWaitBits(done, step->after, pdFALSE, pdTRUE, portMAX_DELAY);
+    }
+
+    times[i].start_us = esp_timer_get_time();
+    esp_err_t err = step->run();
+    times[i].end_us = esp_timer_get_time();
+    times[i].err = err;
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Step %s failed: %s", step->name, esp_err_to_name(err));
+    }
+
+    xEventGroupSetBits(done, BOOT_AFTER(i));
+}
+
+static void step_worker(void *pvParameters)
+{
+    run_step((size_t)(uintptr_t)pvParameters);
+    vTaskDelete(NULL);
+}
+
+esp_err_t boot_run(const boot_step_t *steps, size_t count)
+{
+    if (count == 0 || count > BOOT_MAX_STEPS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (size_t i = 0; i < count; i++) {
+        // Only earlier steps may be waited for, which rules out cycles
+        if (steps[i].after & ~(BOOT_AFTER(i) - 1)) {
+            ESP_LOGE(TAG, "Step %s waits for itself or a later step", steps[i].name);
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+    if (done == NULL) {
+        done = xEventGroupCreateStatic(&done_storage);
+    }
+    xEventGroupClearBits(done, BOOT_AFTER(BOOT_MAX_STEPS) - 1);
+
+    boot_steps = steps;
+    boot_start_us = esp_timer_get_time();
+    for (size_t i = 0; i < count; i++) {
+        times[i].name = steps[i].name;
+        times[i].start_us = 0;
+        times[i].end_us = 0;
+        times[i].err = ESP_OK;
+    }
+
+    // Workers come off the heap and give it back when they finish; boot is
+    // over before anything cares about fragmentation (see arenas.h)
+    EventBits_t all = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (task_start(TASK_BOOT, step_worker, (void *)(uintptr_t)i, NULL) != pdPASS) {
+            // Run it here instead, so its dependents still get to go
+            run_step(i);
+        }
+        all |= BOOT_AFTER(i);
+    }
+    xEventGroupWaitBits(done, all, pdFALSE, pdTRUE, portMAX_DELAY);
+    timeline_count.store(count, std::memory_order_release);
+
+    boot_print_timeline();
+    return ESP_OK;
+}
+
+void boot_milestone(boot_milestone_t milestone)
+{
+    if (milestones[milestone].load(std::memory_order_relaxed) != 0) {
+        return;
+    }
+    int64_t expected = 0;
+    int64_t now = esp_timer_get_time();
+    if (milestones[milestone].compare_exchange_strong(expected, now, std::memory_order_relaxed)) {
+        ESP_LOGI(TAG, "%s at %" PRId64 ".%" PRId64 " ms", MILESTONE_NAMES[milestone], now / 1000, (now / 100) % 10);
+    }
+}
+
+int64_t boot_milestone_us(boot_milestone_t milestone)
+{
+    return milestones[milestone].load(std::memory_order_relaxed);
+}
+
+size_t boot_timeline(boot_step_time_t *out, size_t max)
+{
+    size_t n = timeline_count.load(std::memory_order_acquire);
+    if (n > max) {
+        n = max;
+    }
+    for (size_t i = 0; i < n; i++) {
+        out[i] = times[i];
+    }
+    return n;
+}
+
+static void print_ms(int64_t us)
+{
+    printf(" %7" PRId64 ".%" PRId64, us / 1000, (us / 100) % 10);
+}
+
+void boot_print_timeline(void)
+{
+    size_t n = timeline_count.load(std::memory_order_acquire);
+    if (n == 0) {
+        printf("boot still running\n");
+        return;
+    }
+
+    int64_t last_us = boot_start_us;
+    printf("%-16s %9s %9s %9s\n", "step (ms)", "start", "end", "took");
+    for (size_t i = 0; i < n; i++) {
+        printf("%-16s", times[i].name);
+        print_ms(times[i].start_us);
+        print_ms(times[i].end_us);
+        print_ms(times[i].end_us - times[i].start_us);
+        printf("%s\n", times[i].err == ESP_OK ? "" : "  FAILED");
+        if (times[i].end_us > last_us) {
+            last_us = times[i].end_us;
+        }
+    }
+    printf("%-16s", "all steps");
+    print_ms(boot_start_us);
+    print_ms(last_us);
+    print_ms(last_us - boot_start_us);
+    printf("\n");
+
+    for (int m = 0; m < BOOT_MILESTONE_COUNT; m++) {
+        int64_t at = boot_milestone_us((boot_milestone_t)m);
+        printf("%-16s", MILESTONE_NAMES[m]);
+        if (at != 0) {
+            print_ms(at);
+            printf("\n");
+        } else {
+            printf(" %9s\n", "-");
+        }
+    }
+}
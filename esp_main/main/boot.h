@@ -0,0 +1,80 @@
+#ifndef BOOT_H
+#define BOOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/*
+ * Parallel boot
+ * -------------
+ * Init steps are declared in a table with the steps each one has to wait
+ * for. boot_run() starts every step on its own short-lived worker task as
+ * soon as its dependencies are done, so slow hardware (display reset, SD
+ * card negotiation, WiFi bring-up) comes up side by side instead of in a
+ * line. A failed step still counts as done: dependents run and check for
+ * themselves whether what they need is there.
+ *
+ * Every step's start and end time is kept for the boot timeline, together
+ * with the milestones the user actually notices (first frame on screen,
+ * first IMU sample accepted), which are reached after boot_run() returns.
+ */
+
+#define BOOT_MAX_STEPS 16
+
+// Dependency mask entry for step index i
+#define BOOT_AFTER(i) (1u << (i))
+
+typedef struct {
+    const char *name;
+    esp_err_t (*run)(void);
+    uint32_t after;          // BOOT_AFTER() of every step that must finish first;
+                             // only earlier entries of the table, so there are no cycles
+} boot_step_t;
+
+typedef enum {
+    BOOT_MILESTONE_FIRST_FRAME,
+    BOOT_MILESTONE_FIRST_IMU,
+    BOOT_MILESTONE_COUNT,
+} boot_milestone_t;
+
+typedef struct {
+    const char *name;
+    int64_t start_us;        // esp_timer time the step started, 0 if it never ran
+    int64_t end_us;
+    esp_err_t err;
+} boot_step_time_t;
+
+/**
+ * @brief Run a boot step table and wait until every step is done
+ *
+ * @return ESP_OK once all steps ran (individual failures are in the timeline
+ *         and the log), ESP_ERR_INVALID_ARG for a malformed table
+ */
+esp_err_t boot_run(const boot_step_t *steps, size_t count);
+
+/**
+ * @brief Note that a milestone was reached; only the first call counts
+ *
+ * Cheap enough to call from every frame or sample.
+ */
+void boot_milestone(boot_milestone_t milestone);
+
+/**
+ * @brief When a milestone was reached, 0 if not yet
+ */
+int64_t boot_milestone_us(boot_milestone_t milestone);
+
+/**
+ * @brief Copy out the step timings of the last boot_run()
+ *
+ * @return Number of entries written to out
+ */
+size_t boot_timeline(boot_step_time_t *out, size_t max);
+
+/**
+ * @brief Print the step timings and milestones, in ms since esp_timer start
+ */
+void boot_print_timeline(void);
+
+#endif // BOOT_H
@@ -0,0 +1,10 @@
+#include "bus.h"
+
+BusTopic<bus_imu_sample_t, 32> bus_imu("imu");
+BusTopic<bus_fusion_t, 32> bus_fusion("fusion");
+BusTopic<bus_gesture_t, 16> bus_gesture("gesture");
+BusTopic<HitEvent, 16> bus_hit("hit");
+BusTopic<audio_event_t, 16> bus_audio("audio");
+BusTopic<bus_frame_t, 8> bus_frame("frame");
+BusTopic<bus_pcm_t, 16> bus_pcm("pcm");
+BusTopic<bus_beat_t, 8> bus_beat("beat");
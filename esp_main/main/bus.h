@@ -0,0 +1,82 @@
+#ifndef BUS_H
+#define BUS_H
+
+#include <stdint.h>
+#include "event_bus.h"
+#include "game.h"
+#include "imu_fusion.h"
+#include "speaker.h"
+
+/*
+ * Main board topics
+ * -----------------
+ * Each topic has exactly one producer task; anyone may subscribe (see
+ * event_bus.h). Ring sizes cover a few ticks of the busiest producer, so a
+ * subscriber that wakes once per frame does not lose messages.
+ *
+ *   bus_imu     game task, every new IMU sample it accepts
+ *   bus_fusion  game task, the combined signals after each new IMU sample
+ *   bus_gesture game task, every gesture it takes off the gesture queue
+ *   bus_hit     game task, every cursor/junimo hit (not during replays)
+ *   bus_audio   audio task, every audio service event
+ *   bus_pcm     audio task, every mix block written to I2S, for the analyzer
+ *   bus_beat    analyzer job, every beat it finds in what is playing
+ *   bus_frame   graphics task, every frame presented
+ */
+
+typedef struct {
+    int64_t time_us;        // when the game picked it up
+    uint8_t device;
+    int16_t gyro_y;         // bias already removed (see calibration.h)
+    int16_t gyro_z;
+} bus_imu_sample_t;
+
+// What the IMUs add up to together (see imu_fusion.h), after a sample of device
+typedef struct {
+    int64_t time_us;        // of that sample
+    uint8_t device;
+    uint8_t active;         // devices fused
+    uint8_t partner;        // the other device of tilt and coherence, 0xFF if none yet
+    uint32_t motion;        // this device's, in gyro counts
+    uint32_t energy;        // every active device's motion summed
+    int16_t tilt_cdeg;      // angle between the two devices' gravity, 0 to 18000
+    int16_t coherence;      // Q14: +16384 moving together, -16384 mirrored
+} bus_fusion_t;
+
+typedef struct {
+    int64_t time_us;
+    GameGesture gesture;
+} bus_gesture_t;
+
+typedef struct {
+    int64_t time_us;
+    uint32_t tick;          // simulation tick drawn
+    uint32_t interval_us;   // since the previous frame, 0 for the first
+} bus_frame_t;
+
+// One mix block as it leaves for the speaker, SFX and volume included
+typedef struct {
+    int64_t play_us;        // esp_timer time its first frame is heard
+    uint32_t sample_rate;   // output rate
+    uint16_t frames;
+    int16_t samples[MIX_BLOCK_FRAMES];  // mono
+} bus_pcm_t;
+
+// A beat of the music, on the esp_timer clock (see beat.h)
+typedef struct {
+    int64_t time_us;        // when it is heard; may still be a few ms ahead
+    int64_t next_us;        // predicted next beat
+    uint32_t period_us;
+    float confidence;       // tempo peak over the average, BEAT_MIN_CONFIDENCE and up
+} bus_beat_t;
+
+extern BusTopic<bus_imu_sample_t, 32> bus_imu;
+extern BusTopic<bus_fusion_t, 32> bus_fusion;
+extern BusTopic<bus_gesture_t, 16> bus_gesture;
+extern BusTopic<HitEvent, 16> bus_hit;
+extern BusTopic<audio_event_t, 16> bus_audio;
+extern BusTopic<bus_frame_t, 8> bus_frame;
+extern BusTopic<bus_pcm_t, 16> bus_pcm;
+extern BusTopic<bus_beat_t, 8> bus_beat;
+
+#endif // BUS_H
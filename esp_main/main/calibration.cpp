@@ -0,0 +1,89 @@
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "calibration.h"
+#if !CONFIG_IDF_TARGET_LINUX
+#include "nvs.h"
+#include "nvs_flash.h"
+#endif
+
+#define NVS_NAMESPACE "imu_cal"
+#define NVS_KEY "bias"
+
+static const char *TAG = "calibration";
+
+// Written at boot before the game task starts, and by calibration_set()
+// from the console; a torn read costs one sample with a half-updated bias
+static imu_bias_t bias[N_CURSORS];
+
+esp_err_t calibration_load(void)
+{
+#if CONFIG_IDF_TARGET_LINUX
+    return ESP_OK;
+#else
+    esp_err_t err = nvs_flash_init();
+    if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        ESP_LOGW(TAG, "NVS partition unusable, erasing");
+        nvs_flash_erase();
+        err = nvs_flash_init();
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    nvs_handle_t handle;
+    err = nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle);
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGI(TAG, "No calibration stored, using zero bias");
+        return ESP_OK;
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    imu_bias_t stored[N_CURSORS];
+    size_t size = sizeof(stored);
+    err = nvs_get_blob(handle, NVS_KEY, stored, &size);
+    nvs_close(handle);
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGI(TAG, "No calibration stored, using zero bias");
+        return ESP_OK;
+    }
+    if (err != ESP_OK || size != sizeof(stored)) {
+        ESP_LOGW(TAG, "Stored calibration unreadable, using zero bias");
+        return ESP_OK;
+    }
+    for (int i = 0; i < N_CURSORS; i++) {
+        bias[i] = stored[i];
+    }
+    return ESP_OK;
+#endif
+}
+
+imu_bias_t calibration_bias(int device)
+{
+    return bias[device];
+}
+
+esp_err_t calibration_set(int device, imu_bias_t value)
+{
+    if (device < 0 || device >= N_CURSORS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    bias[device] = value;
+
+#if CONFIG_IDF_TARGET_LINUX
+    return ESP_OK;
+#else
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = nvs_set_blob(handle, NVS_KEY, bias, sizeof(bias));
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    return err;
+#endif
+}
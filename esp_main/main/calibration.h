@@ -0,0 +1,38 @@
+#ifndef CALIBRATION_H
+#define CALIBRATION_H
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "game.h"
+
+/*
+ * IMU calibration
+ * ---------------
+ * Per-device gyro bias, subtracted from every sample before the game sees
+ * it (and before it is recorded, so replays match). Kept in NVS on the
+ * device; the host build always runs with zero bias.
+ */
+
+typedef struct {
+    int16_t gyro_y;
+    int16_t gyro_z;
+} imu_bias_t;
+
+/**
+ * @brief Load the stored bias of every device (zero where none is stored)
+ *
+ * Also brings up the NVS partition, so later users (WiFi) find it ready.
+ */
+esp_err_t calibration_load(void);
+
+/**
+ * @brief Bias currently applied to a device's samples
+ */
+imu_bias_t calibration_bias(int device);
+
+/**
+ * @brief Apply and store a new bias for a device
+ */
+esp_err_t calibration_set(int device, imu_bias_t bias);
+
+#endif // CALIBRATION_H
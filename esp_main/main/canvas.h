@@ -0,0 +1,121 @@
+#ifndef CANVAS_H
+#define CANVAS_H
+
+#include "sdkconfig.h"
+
+// The renderer draws into a Canvas and hands its pixels to the DisplayPanel.
+// On device that is an LGFX sprite; LovyanGFX doesn't build for the Linux
+// target, so the host gets a minimal software canvas with the same subset of
+// the sprite API and the same (byte-swapped RGB565) pixel layout.
+
+#if CONFIG_IDF_TARGET_LINUX
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TFT_GREEN 0x07E0
+
+class HostCanvas {
+  uint16_t *_buffer = nullptr;
+  int32_t _width = 0;
+  int32_t _height = 0;
+
+  static uint16_t swap(uint16_t c) { return (uint16_t)((c >> 8) | (c << 8)); }
+
+  void hline(int32_t x0, int32_t x1, int32_t y, uint16_t c) {
+    if (y < 0 || y >= _height)
+      return;
+    if (x0 < 0)
+      x0 = 0;
+    if (x1 >= _width)
+      x1 = _width - 1;
+    for (int32_t x = x0; x <= x1; x++)
+      _buffer[y * _width + x] = c;
+  }
+
+  void pixel(int32_t x, int32_t y, uint16_t c) {
+    if (x >= 0 && x < _width && y >= 0 && y < _height)
+      _buffer[y * _width + x] = c;
+  }
+
+public:
+  ~HostCanvas() { free(_buffer); }
+
+  void setPsram(bool) {}
+  void setColorDepth(int) {}
+
+  void *createSprite(int32_t w, int32_t h) {
+    free(_buffer);
+    _buffer = (uint16_t *)calloc(w * h, sizeof(uint16_t));
+    _width = _buffer ? w : 0;
+    _height = _buffer ? h : 0;
+    return _buffer;
+  }
+
+  void *getBuffer() const { return _buffer; }
+  int32_t width() const { return _width; }
+  int32_t height() const { return _height; }
+
+  static uint16_t color565(uint8_t r, uint8_t g, uint8_t b) {
+    return (uint16_t)(((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3));
+  }
+
+  void fillScreen(uint16_t color) {
+    uint16_t c = swap(color);
+    for (int32_t i = 0; i < _width * _height; i++)
+      _buffer[i] = c;
+  }
+
+  void fillRect(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t color) {
+    uint16_t c = swap(color);
+    for (int32_t row = y; row < y + h; row++)
+      hline(x, x + w - 1, row, c);
+  }
+
+  void fillCircle(int32_t cx, int32_t cy, int32_t r, uint16_t color) {
+    uint16_t c = swap(color);
+    for (int32_t dy = -r; dy <= r; dy++) {
+      int32_t dx = 0;
+      while ((dx + 1) * (dx + 1) + dy * dy <= r * r)
+        dx++;
+      hline(cx - dx, cx + dx, cy + dy, c);
+    }
+  }
+
+  void drawCircle(int32_t cx, int32_t cy, int32_t r, uint16_t color) {
+    // Midpoint circle
+    uint16_t c = swap(color);
+    int32_t x = r, y = 0, err = 1 - r;
+    while (x >= y) {
+      pixel(cx + x, cy + y, c);
+      pixel(cx + y, cy + x, c);
+      pixel(cx - y, cy + x, c);
+      pixel(cx - x, cy + y, c);
+      pixel(cx - x, cy - y, c);
+      pixel(cx - y, cy - x, c);
+      pixel(cx + y, cy - x, c);
+      pixel(cx + x, cy - y, c);
+      y++;
+      if (err < 0) {
+        err += 2 * y + 1;
+      } else {
+        x--;
+        err += 2 * (y - x) + 1;
+      }
+    }
+  }
+};
+
+typedef HostCanvas Canvas;
+
+#else
+
+#define LGFX_USE_V1
+#include <LovyanGFX.hpp>
+
+typedef LGFX_Sprite Canvas;
+
+#endif
+
+#endif // CANVAS_H
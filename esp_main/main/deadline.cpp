@@ -0,0 +1,317 @@
+#include <inttypes.h>
+#include <string.h>
+#include <atomic>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "deadline.h"
+#include "jobs.h"
+
+static const char *TAG = "deadline";
+
+static const char *const deadline_names[DEADLINE_COUNT] = {
+    "audio",
+    "render",
+    "imu_ingest",
+};
+
+typedef struct {
+    std::atomic<uint32_t> period_us;
+    std::atomic<uint32_t> budget_us;
+    // Owner task only
+    int64_t begin_us;
+    int64_t prev_begin_us;          // 0 after deadline_idle()
+    uint32_t interval_us;
+    // Read by the console
+    std::atomic<uint32_t> passes;
+    std::atomic<uint32_t> late;
+    std::atomic<uint32_t> overruns;
+    std::atomic<uint32_t> max_interval_us;
+    std::atomic<uint32_t> max_duration_us;
+} deadline_t;
+
+// A slot goes FREE -> FILLING (the missing task) -> TRACED -> COMPLETING (the
+// capture job) -> COMPLETE, and back to FREE only through deadline_clear()
+enum {
+    SLOT_FREE,
+    SLOT_FILLING,
+    SLOT_TRACED,
+    SLOT_COMPLETING,
+    SLOT_COMPLETE,
+};
+
+static deadline_t deadlines[DEADLINE_COUNT];
+static deadline_snapshot_t snapshots[DEADLINE_SNAPSHOTS];
+static std::atomic<uint8_t> slot_state[DEADLINE_SNAPSHOTS];
+static std::atomic<uint32_t> claimed{0};
+static std::atomic<uint32_t> unrecorded{0};
+static CoEvent capture_event;
+
+void deadline_declare(deadline_id_t id, uint32_t period_us, uint32_t budget_us)
+{
+    deadlines[id].period_us.store(period_us, std::memory_order_relaxed);
+    deadlines[id].budget_us.store(budget_us, std::memory_order_relaxed);
+}
+
+void deadline_begin(deadline_id_t id)
+{
+    deadline_t *d = &deadlines[id];
+    int64_t now = esp_timer_get_time();
+    d->interval_us = d->prev_begin_us != 0 ? (uint32_t)(now - d->prev_begin_us) : 0;
+    d->prev_begin_us = now;
+    d->begin_us = now;
+}
+
+void deadline_idle(deadline_id_t id)
+{
+    deadlines[id].prev_begin_us = 0;
+}
+
+// The cheap half of a snapshot, taken by the task that missed
+static void record_miss(deadline_id_t id, uint8_t flags, uint32_t duration_us, int64_t now)
+{
+    TRACE_INSTANT(TRACE_DEADLINE_MISS, id);
+    // The slot must still be free as well: a deadline_clear() running
+    // between the claim and here can reset claimed and hand the same index
+    // to another miss, or not have freed the slot yet
+    uint32_t n = claimed.fetch_add(1, std::memory_order_relaxed);
+    uint8_t expected = SLOT_FREE;
+    if (n >= DEADLINE_SNAPSHOTS ||
+        !slot_state[n].compare_exchange_strong(expected, SLOT_FILLING, std::memory_order_acquire)) {
+        unrecorded.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    deadline_t *d = &deadlines[id];
+    deadline_snapshot_t *s = &snapshots[n];
+    s->id = id;
+    s->flags = flags;
+    s->time_us = now;
+    s->interval_us = d->interval_us;
+    s->duration_us = duration_us;
+    s->period_us = d->period_us.load(std::memory_order_relaxed);
+    s->budget_us = d->budget_us.load(std::memory_order_relaxed);
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        s->n_events[core] = (uint16_t)trace_recent(core, s->events[core], DEADLINE_TRACE_EVENTS);
+    }
+    s->details_us = 0;
+    s->n_tasks = 0;
+    s->n_queues = 0;
+
+    slot_state[n].store(SLOT_TRACED, std::memory_order_release);
+    capture_event.set();
+}
+
+void deadline_end(deadline_id_t id)
+{
+    deadline_t *d = &deadlines[id];
+    int64_t now = esp_timer_get_time();
+    uint32_t duration = (uint32_t)(now - d->begin_us);
+    uint32_t period = d->period_us.load(std::memory_order_relaxed);
+    uint32_t budget = d->budget_us.load(std::memory_order_relaxed);
+
+    d->passes.fetch_add(1, std::memory_order_relaxed);
+    if (d->interval_us > d->max_interval_us.load(std::memory_order_relaxed)) {
+        d->max_interval_us.store(d->interval_us, std::memory_order_relaxed);
+    }
+    if (duration > d->max_duration_us.load(std::memory_order_relaxed)) {
+        d->max_duration_us.store(duration, std::memory_order_relaxed);
+    }
+
+    uint8_t flags = 0;
+    if (period > 0 && d->interval_us > period) {
+        flags |= DEADLINE_LATE;
+        d->late.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (budget > 0 && duration > budget) {
+        flags |= DEADLINE_OVERRUN;
+        d->overruns.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (flags != 0) {
+        record_miss(id, flags, duration, now);
+    }
+}
+
+// The expensive half: the task list walk suspends the scheduler briefly
+static void fill_details(deadline_snapshot_t *s)
+{
+    static TaskStatus_t status[DEADLINE_MAX_TASKS];
+
+    UBaseType_t count = uxTaskGetSystemState(status, DEADLINE_MAX_TASKS, NULL);
+    for (UBaseType_t i = 0; i < count; i++) {
+        deadline_task_t *task = &s->tasks[i];
+        strncpy(task->name, status[i].pcTaskName, sizeof(task->name) - 1);
+        task->name[sizeof(task->name) - 1] = '\0';
+        task->number = (uint16_t)status[i].xTaskNumber;
+        task->state = (uint8_t)status[i].eCurrentState;
+        task->priority = (uint8_t)status[i].uxCurrentPriority;
+        BaseType_t core = xTaskGetCoreID(status[i].xHandle);
+        task->core = core == tskNO_AFFINITY ? -1 : (int16_t)core;
+        task->stack_free = status[i].usStackHighWaterMark;
+    }
+    s->n_tasks = count;
+    s->n_queues = telemetry_queue_depths(s->queues, TELEMETRY_MAX_QUEUES);
+    telemetry_heap(&s->heap);
+    s->details_us = esp_timer_get_time();
+}
+
+static CoJob capture_job(void)
+{
+    while (1) {
+        co_await capture_event;
+        for (size_t i = 0; i < DEADLINE_SNAPSHOTS; i++) {
+            uint8_t expected = SLOT_TRACED;
+            if (!slot_state[i].compare_exchange_strong(expected, SLOT_COMPLETING, std::memory_order_acquire)) {
+                continue;
+            }
+            deadline_snapshot_t *s = &snapshots[i];
+            fill_details(s);
+            slot_state[i].store(SLOT_COMPLETE, std::memory_order_release);
+            ESP_LOGW(TAG, "%s missed its deadline: gap %" PRIu32 " us (period %" PRIu32 "), "
+                     "ran %" PRIu32 " us (budget %" PRIu32 "); snapshot %u",
+                     deadline_names[s->id], s->interval_us, s->period_us, s->duration_us, s->budget_us,
+                     (unsigned)i);
+        }
+    }
+}
+
+esp_err_t deadline_start(void)
+{
+    return jobs.spawn(capture_job());
+}
+
+void deadline_get_stats(deadline_id_t id, deadline_stats_t *out)
+{
+    const deadline_t *d = &deadlines[id];
+    out->name = deadline_names[id];
+    out->period_us = d->period_us.load(std::memory_order_relaxed);
+    out->budget_us = d->budget_us.load(std::memory_order_relaxed);
+    out->passes = d->passes.load(std::memory_order_relaxed);
+    out->late = d->late.load(std::memory_order_relaxed);
+    out->overruns = d->overruns.load(std::memory_order_relaxed);
+    out->max_interval_us = d->max_interval_us.load(std::memory_order_relaxed);
+    out->max_duration_us = d->max_duration_us.load(std::memory_order_relaxed);
+}
+
+uint32_t deadline_unrecorded(void)
+{
+    return unrecorded.load(std::memory_order_relaxed);
+}
+
+bool deadline_get_snapshot(size_t i, deadline_snapshot_t *out)
+{
+    if (i >= DEADLINE_SNAPSHOTS || slot_state[i].load(std::memory_order_acquire) != SLOT_COMPLETE) {
+        return false;
+    }
+    memcpy(out, &snapshots[i], sizeof(*out));
+    return true;
+}
+
+static const char *const TASK_STATE_NAMES[] = {"running", "ready", "blocked", "suspended", "deleted", "invalid"};
+
+static const char *task_name(const deadline_snapshot_t *s, uint16_t number)
+{
+    for (size_t i = 0; i < s->n_tasks; i++) {
+        if (s->tasks[i].number == number) {
+            return s->tasks[i].name;
+        }
+    }
+    return "?";
+}
+
+static void print_snapshot(FILE *f, size_t index, const deadline_snapshot_t *s)
+{
+    fprintf(f, "\nsnapshot %u: %s%s%s at %" PRId64 ".%06" PRId64 " s\n", (unsigned)index, deadline_names[s->id],
+            s->flags & DEADLINE_LATE ? " late" : "", s->flags & DEADLINE_OVERRUN ? " overrun" : "",
+            s->time_us / 1000000, s->time_us % 1000000);
+    fprintf(f, "  gap %" PRIu32 " us (period %" PRIu32 "), ran %" PRIu32 " us (budget %" PRIu32 ")\n",
+            s->interval_us, s->period_us, s->duration_us, s->budget_us);
+    fprintf(f, "  details %" PRId64 " us after the miss\n", s->details_us - s->time_us);
+    fprintf(f, "  heap %u free, %u min free, %u largest block\n",
+            (unsigned)s->heap.free, (unsigned)s->heap.min_free, (unsigned)s->heap.largest_block);
+    for (size_t i = 0; i < s->n_queues; i++) {
+        fprintf(f, "  queue %-12s %" PRIu32 "/%" PRIu32 "\n", s->queues[i].name, s->queues[i].waiting, s->queues[i].capacity);
+    }
+
+    fprintf(f, "  %-16s %4s %-9s %4s %4s %6s\n", "task", "num", "state", "prio", "core", "stack");
+    for (size_t i = 0; i < s->n_tasks; i++) {
+        const deadline_task_t *t = &s->tasks[i];
+        fprintf(f, "  %-16s %4u %-9s %4u %4d %6" PRIu32 "\n", t->name, t->number,
+                t->state < sizeof(TASK_STATE_NAMES) / sizeof(TASK_STATE_NAMES[0]) ? TASK_STATE_NAMES[t->state] : "?",
+                t->priority, t->core, t->stack_free);
+    }
+
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        fprintf(f, "  trace core %d, %u events, us relative to the miss:\n", core, s->n_events[core]);
+        for (size_t i = 0; i < s->n_events[core]; i++) {
+            const trace_event_t *e = &s->events[core][i];
+            static const char type_chars[] = {'B', 'E', 'I'};
+            fprintf(f, "    %9" PRId64 " %c %-14s %-16s %" PRIu32 "\n", e->time_us - s->time_us,
+                    e->type < sizeof(type_chars) ? type_chars[e->type] : '?',
+                    trace_event_name(e->id), task_name(s, e->task), e->arg);
+        }
+    }
+}
+
+void deadline_print(FILE *f, int only_index)
+{
+    fprintf(f, "%-12s %8s %8s %9s %6s %8s %9s %9s\n",
+            "deadline", "period", "budget", "passes", "late", "overrun", "max gap", "max run");
+    for (int i = 0; i < DEADLINE_COUNT; i++) {
+        deadline_stats_t st;
+        deadline_get_stats((deadline_id_t)i, &st);
+        fprintf(f, "%-12s %8" PRIu32 " %8" PRIu32 " %9" PRIu32 " %6" PRIu32 " %8" PRIu32 " %9" PRIu32 " %9" PRIu32 "\n",
+                st.name, st.period_us, st.budget_us, st.passes, st.late, st.overruns, st.max_interval_us, st.max_duration_us);
+    }
+    fprintf(f, "misses without a free snapshot slot: %" PRIu32 "\n", deadline_unrecorded());
+
+    for (size_t i = 0; i < DEADLINE_SNAPSHOTS; i++) {
+        if (only_index >= 0 && (size_t)only_index != i) {
+            continue;
+        }
+        if (slot_state[i].load(std::memory_order_acquire) == SLOT_COMPLETE) {
+            print_snapshot(f, i, &snapshots[i]);
+        }
+    }
+}
+
+esp_err_t deadline_save(const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        ESP_LOGE(TAG, "Failed to open %s", path);
+        return ESP_FAIL;
+    }
+    deadline_print(f, -1);
+    bool ok = ferror(f) == 0;
+    fclose(f);
+    return ok ? ESP_OK : ESP_FAIL;
+}
+
+void deadline_clear(void)
+{
+    // Filling a snapshot takes microseconds and completing it a few ms; let
+    // either finish rather than free the slot under it
+    for (size_t i = 0; i < DEADLINE_SNAPSHOTS; i++) {
+        while (1) {
+            uint8_t state = slot_state[i].load(std::memory_order_acquire);
+            if (state == SLOT_FILLING || state == SLOT_COMPLETING) {
+                vTaskDelay(1);
+            } else if (slot_state[i].compare_exchange_strong(state, SLOT_FREE, std::memory_order_acq_rel)) {
+                break;
+            }
+        }
+    }
+    claimed.store(0, std::memory_order_release);
+    unrecorded.store(0, std::memory_order_relaxed);
+
+    for (int i = 0; i < DEADLINE_COUNT; i++) {
+        deadline_t *d = &deadlines[i];
+        d->passes.store(0, std::memory_order_relaxed);
+        d->late.store(0, std::memory_order_relaxed);
+        d->overruns.store(0, std::memory_order_relaxed);
+        d->max_interval_us.store(0, std::memory_order_relaxed);
+        d->max_duration_us.store(0, std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,137 @@
+#ifndef DEADLINE_H
+#define DEADLINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+#include "telemetry.h"
+#include "trace.h"
+
+/*
+ * Deadline monitor
+ * ----------------
+ * The periodic real-time loops declare how often they must run and how long
+ * one pass may take, then bracket every pass with deadline_begin() and
+ * deadline_end(). A pass misses its deadline when it starts more than
+ * period_us after the previous one (the loop was held up) or runs longer
+ * than budget_us (the loop itself was slow).
+ *
+ * A miss freezes a post-mortem snapshot in a fixed buffer: on the spot, the
+ * newest events of every trace ring (CONFIG_MCHACKS_TRACE), and within a
+ * few ms, from a background job so the late loop isn't held up further,
+ * the task states, watched queue depths and heap. Snapshots stay until
+ * deadline_clear(); while every slot is taken further misses are only
+ * counted. Read them with the "deadline" console command or
+ * deadline_save() to the SD card.
+ *
+ * begin/end cost two esp_timer reads and a few relaxed stores; each
+ * deadline belongs to one task.
+ */
+
+#define DEADLINE_SNAPSHOTS 4
+#define DEADLINE_TRACE_EVENTS 64     // newest events kept per core
+#define DEADLINE_MAX_TASKS 32
+
+// Keep deadline_names in deadline.cpp in the same order
+typedef enum {
+    DEADLINE_AUDIO,         // one mix block, from the stream step to the sink write
+    DEADLINE_RENDER,        // one frame, drawn and presented
+    DEADLINE_IMU_INGEST,    // one game tick's input capture
+    DEADLINE_COUNT,
+} deadline_id_t;
+
+#define DEADLINE_LATE (1u << 0)     // started more than period_us after the previous pass
+#define DEADLINE_OVERRUN (1u << 1)  // ran longer than budget_us
+
+typedef struct {
+    const char *name;
+    uint32_t period_us;             // 0 until declared
+    uint32_t budget_us;
+    uint32_t passes;
+    uint32_t late;
+    uint32_t overruns;
+    uint32_t max_interval_us;       // longest start-to-start gap seen
+    uint32_t max_duration_us;
+} deadline_stats_t;
+
+typedef struct {
+    char name[configMAX_TASK_NAME_LEN];
+    uint16_t number;                // matches trace_event_t::task
+    uint8_t state;                  // eTaskState
+    uint8_t priority;
+    int16_t core;                   // -1 if unpinned
+    uint32_t stack_free;            // high water mark, bytes
+} deadline_task_t;
+
+typedef struct {
+    uint8_t id;                     // deadline_id_t
+    uint8_t flags;                  // DEADLINE_LATE | DEADLINE_OVERRUN
+    int64_t time_us;                // end of the pass that missed
+    uint32_t interval_us;           // its start-to-start gap, 0 if none
+    uint32_t duration_us;
+    uint32_t period_us;
+    uint32_t budget_us;
+
+    uint16_t n_events[portNUM_PROCESSORS];
+    trace_event_t events[portNUM_PROCESSORS][DEADLINE_TRACE_EVENTS];
+
+    // Filled in shortly after the miss
+    int64_t details_us;             // when, 0 if not yet
+    size_t n_tasks;
+    deadline_task_t tasks[DEADLINE_MAX_TASKS];
+    size_t n_queues;
+    telemetry_queue_t queues[TELEMETRY_MAX_QUEUES];
+    telemetry_heap_t heap;
+} deadline_snapshot_t;
+
+/**
+ * @brief Set a loop's period and per-pass budget; 0 turns that check off
+ *
+ * May be called again when the loop's rate changes (a new audio stream).
+ */
+void deadline_declare(deadline_id_t id, uint32_t period_us, uint32_t budget_us);
+
+void deadline_begin(deadline_id_t id);
+void deadline_end(deadline_id_t id);
+
+/**
+ * @brief The loop stops on purpose (nothing to play); the next pass is not late
+ */
+void deadline_idle(deadline_id_t id);
+
+/**
+ * @brief Start the job that completes snapshots; after jobs_start()
+ */
+esp_err_t deadline_start(void);
+
+void deadline_get_stats(deadline_id_t id, deadline_stats_t *out);
+
+/**
+ * @brief Misses that found every snapshot slot taken
+ */
+uint32_t deadline_unrecorded(void);
+
+/**
+ * @brief Copy out snapshot i (0 = oldest); false if there is no such snapshot
+ */
+bool deadline_get_snapshot(size_t i, deadline_snapshot_t *out);
+
+/**
+ * @brief Print the per-deadline counters, then every snapshot (or only
+ *        snapshot only_index, if not -1)
+ */
+void deadline_print(FILE *f, int only_index);
+
+/**
+ * @brief Write deadline_print() output to a file, e.g. on the SD card
+ */
+esp_err_t deadline_save(const char *path);
+
+/**
+ * @brief Free every snapshot slot and zero the counters
+ */
+void deadline_clear(void);
+
+#endif // DEADLINE_H
@@ -0,0 +1,448 @@
+#include "game.h"
+#include "alloc_track.h"
+#include "boot.h"
+#include "bus.h"
+#include "calibration.h"
+#include "deadline.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "hal.h"
+#include "node_control.h"
+#include "replay.h"
+#include "telemetry.h"
+#include "trace.h"
+#include <atomic>
+#include <inttypes.h>
+#include <string.h>
+
+static const char *TAG = "game";
+
+#define IMU_INGEST_BUDGET_US 1000
+
+static Junimo junimos[N_JUNIMOS];
+static Cursor cursors[N_CURSORS];
+
+// Last raw reading per device, used to spot when the link delivered a new
+// sample (IMU_DATA carries no sequence number or timestamp of its own)
+static int32_t last_gyro_y[N_CURSORS];
+static int32_t last_gyro_z[N_CURSORS];
+// What fusion last took per device: the link's arrival time where it has
+// one, which also catches a still node's unchanged keepalives, otherwise
+// the whole reading
+static int64_t last_fused_us[N_CURSORS];
+static IMU_DATA last_fused[N_CURSORS];
+
+// The cursors' IMUs taken together, fed every new sample (see imu_fusion.h)
+static ImuFusion fusion;
+
+static uint8_t hue = 0;
+static uint32_t tick_count = 0;
+static uint16_t junimo_generation[N_JUNIMOS];
+
+static uint32_t rng_state = 1;
+static bool silent = false;
+
+// Gestures posted from other tasks, drained into the next tick's input. The
+// game task creates the queue in game_init(); until then posts are dropped.
+#define GESTURE_QUEUE_SIZE 8
+static StaticQueue_t gesture_queue_storage;
+static uint8_t gesture_queue_buffer[GESTURE_QUEUE_SIZE * sizeof(GameGesture)];
+static std::atomic<QueueHandle_t> gesture_queue(NULL);
+
+// Session control. game_session_end() parks the game task between two ticks
+// and game_session_start() wakes it into a fresh world; the semaphores are
+// created by the task itself, so neither works before it runs.
+static StaticSemaphore_t session_parked_storage;
+static StaticSemaphore_t session_resume_storage;
+static SemaphoreHandle_t session_parked = NULL;
+static SemaphoreHandle_t session_resume = NULL;
+static std::atomic<bool> session_running(false);
+static std::atomic<bool> session_park(false);
+static uint32_t session_seed = 0;
+
+// Two snapshot slots, each guarded by a sequence counter that is odd while
+// the slot is being written. The simulation always writes the slot the
+// renderer was not pointed at, so a reader only retries if it sleeps through
+// a whole tick mid-copy.
+static WorldSnapshot snapshots[2];
+static std::atomic<uint32_t> snapshot_seq[2];
+static std::atomic<int> snapshot_latest(-1);
+
+static uint32_t rng_next() {
+  // xorshift32
+  uint32_t x = rng_state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  rng_state = x;
+  return x;
+}
+
+static void junimo_spawn(Junimo *j) {
+  j->x = JUNIMO_RADIUS + rng_next() % (SCREEN_WIDTH - 2 * JUNIMO_RADIUS);
+  j->y = JUNIMO_RADIUS + rng_next() % (SCREEN_HEIGHT - 2 * JUNIMO_RADIUS);
+  j->dx = (int32_t)(rng_next() % 5) - 2;
+  j->dy = (int32_t)(rng_next() % 5) - 2;
+  j->anim_frame = 0;
+}
+
+static int32_t clamp(int32_t v, int32_t lo, int32_t hi) {
+  return v < lo ? lo : (v > hi ? hi : v);
+}
+
+void game_init(uint32_t seed) {
+  rng_state = seed ? seed : 1;
+  for (int i = 0; i < N_JUNIMOS; i++) {
+    junimo_spawn(&junimos[i]);
+  }
+  for (int i = 0; i < N_CURSORS; i++) {
+    cursors[i].x = SCREEN_WIDTH / 2;
+    cursors[i].y = SCREEN_HEIGHT / 2;
+    cursors[i].sample_time_us = 0;
+    cursors[i].overlap_mask = 0;
+    last_gyro_y[i] = 0;
+    last_gyro_z[i] = 0;
+    last_fused_us[i] = 0;
+    memset(&last_fused[i], 0, sizeof(last_fused[i]));
+  }
+  for (int i = 0; i < N_JUNIMOS; i++) {
+    junimo_generation[i] = 0;
+  }
+  fusion.init(N_CURSORS);
+  hue = 0;
+  tick_count = 0;
+
+  if (gesture_queue.load(std::memory_order_relaxed) == NULL) {
+    QueueHandle_t queue =
+        xQueueCreateStatic(GESTURE_QUEUE_SIZE, sizeof(GameGesture),
+                           gesture_queue_buffer, &gesture_queue_storage);
+    telemetry_watch_queue("gestures", queue);
+    gesture_queue.store(queue, std::memory_order_release);
+  }
+}
+
+void game_set_silent(bool s) { silent = s; }
+
+void game_post_gesture(uint8_t device, uint8_t kind) {
+  QueueHandle_t queue = gesture_queue.load(std::memory_order_acquire);
+  if (queue == NULL) {
+    return;
+  }
+  GameGesture gesture = {device, kind};
+  xQueueSend(queue, &gesture, 0);
+}
+
+static void publish_fusion(int device, const IMU_DATA *sample, int64_t time_us) {
+  fusion.push((uint8_t)device, sample, time_us);
+  bus_fusion_t msg = {time_us, (uint8_t)device, fusion.active(), 0xFF,
+                      fusion.device(device).motion, fusion.energy(), 0, 0};
+  for (int o = 0; o < N_CURSORS; o++) {
+    if (o != device && fusion.pair(device, o).valid) {
+      msg.partner = (uint8_t)o;
+      msg.tilt_cdeg = fusion.pair(device, o).tilt_cdeg;
+      msg.coherence = fusion.pair(device, o).coherence;
+      break;
+    }
+  }
+  bus_fusion.publish(msg);
+}
+
+void game_capture_input(GameInput *in, int64_t now_us) {
+  deadline_begin(DEADLINE_IMU_INGEST);
+  TRACE_BEGIN(TRACE_IMU_INGEST);
+  ALLOC_REGION_BEGIN(ALLOC_REGION_IMU);
+  in->new_sample_mask = 0;
+  in->time_us = now_us;
+
+  NetTransport *net = hal_net();
+  for (int c = 0; c < N_CURSORS; c++) {
+    IMU_DATA sample;
+    in->arrival_us[c] = 0;
+    if (!net->latest_sample(c, &sample)) {
+      in->gyro_y[c] = last_gyro_y[c];
+      in->gyro_z[c] = last_gyro_z[c];
+      continue;
+    }
+    // Counts at the node's range, then the bias measured at the default one
+    node_control_normalize(c, &sample);
+    imu_bias_t bias = calibration_bias(c);
+    int32_t gyro_y = sample.gyro_y - bias.gyro_y;
+    int32_t gyro_z = sample.gyro_z - bias.gyro_z;
+    in->gyro_y[c] = gyro_y;
+    in->gyro_z[c] = gyro_z;
+
+    // Fusion takes every new sample, accel-only changes included; the
+    // cursors only move on the gyro
+    int64_t arrived_us = net->arrival_us(c);
+    if (arrived_us > 0 ? arrived_us != last_fused_us[c]
+                       : memcmp(&sample, &last_fused[c], sizeof(sample)) != 0) {
+      last_fused_us[c] = arrived_us;
+      last_fused[c] = sample;
+      IMU_DATA fused = sample;
+      fused.gyro_y = (int16_t)gyro_y;
+      fused.gyro_z = (int16_t)gyro_z;
+      publish_fusion(c, &fused, arrived_us > 0 ? arrived_us : now_us);
+    }
+
+    if (gyro_y != last_gyro_y[c] || gyro_z != last_gyro_z[c]) {
+      in->new_sample_mask |= 1u << c;
+      telemetry_imu_sample(c);
+      in->arrival_us[c] = arrived_us > 0 ? arrived_us : 0;
+      if (arrived_us > 0) {
+        telemetry_imu_latency(now_us > arrived_us ? (uint32_t)(now_us - arrived_us) : 0);
+      }
+      TRACE_INSTANT(TRACE_IMU_SAMPLE, c);
+      bus_imu_sample_t msg = {now_us, (uint8_t)c, (int16_t)gyro_y, (int16_t)gyro_z};
+      bus_imu.publish(msg);
+      last_gyro_y[c] = gyro_y;
+      last_gyro_z[c] = gyro_z;
+    }
+  }
+
+  in->n_gestures = 0;
+  while (in->n_gestures < GAME_MAX_GESTURES &&
+         xQueueReceive(gesture_queue.load(std::memory_order_relaxed), &in->gestures[in->n_gestures], 0) ==
+             pdTRUE) {
+    bus_gesture_t msg = {now_us, in->gestures[in->n_gestures]};
+    bus_gesture.publish(msg);
+    in->n_gestures++;
+  }
+  ALLOC_REGION_END(ALLOC_REGION_IMU);
+  TRACE_END(TRACE_IMU_INGEST, in->new_sample_mask);
+  deadline_end(DEADLINE_IMU_INGEST);
+
+  // Outside the region: the first one logs
+  if (in->new_sample_mask != 0) {
+    boot_milestone(BOOT_MILESTONE_FIRST_IMU);
+  }
+}
+
+static void on_hit(const HitEvent *hit) {
+  // Publish first so the audio task can start the SFX; everything else can
+  // wait. Replays stay quiet.
+  if (!silent) {
+    bus_hit.publish(*hit);
+  }
+  TRACE_INSTANT(TRACE_HIT, hit->cursor << 8 | hit->junimo);
+
+  ESP_LOGD(TAG, "Hit: cursor %d junimo %d at (%" PRId32 ", %" PRId32 ")", hit->cursor,
+           hit->junimo, hit->x, hit->y);
+  junimo_spawn(&junimos[hit->junimo]);
+  junimo_generation[hit->junimo]++;
+}
+
+size_t game_step(const GameInput *in) {
+  size_t hits = 0;
+
+  for (int c = 0; c < N_CURSORS; c++) {
+    if (!(in->new_sample_mask & (1u << c))) {
+      continue;
+    }
+
+    Cursor *cursor = &cursors[c];
+    cursor->x = clamp(SCREEN_WIDTH / 2 + in->gyro_z[c] * (SCREEN_WIDTH / 2) / 20000,
+                      0, SCREEN_WIDTH - 1);
+    cursor->y = clamp(SCREEN_HEIGHT / 2 + in->gyro_y[c] * (SCREEN_HEIGHT / 2) / 20000,
+                      0, SCREEN_HEIGHT - 1);
+    // Hit latency runs from the sample reaching the board, not from the
+    // tick that noticed it
+    cursor->sample_time_us = in->arrival_us[c] != 0 ? in->arrival_us[c] : in->time_us;
+
+    for (int j = 0; j < N_JUNIMOS; j++) {
+      int32_t dx = cursor->x - junimos[j].x;
+      int32_t dy = cursor->y - junimos[j].y;
+      int32_t r = JUNIMO_RADIUS + CURSOR_RADIUS;
+      uint32_t bit = 1u << j;
+
+      if (dx * dx + dy * dy > r * r) {
+        cursor->overlap_mask &= ~bit;
+        continue;
+      }
+      if (cursor->overlap_mask & bit) {
+        continue;
+      }
+
+      HitEvent hit = {(uint8_t)c, (uint8_t)j, cursor->x, cursor->y,
+                      cursor->sample_time_us};
+      on_hit(&hit);
+      hits++;
+
+      // Until the cursor leaves it, the junimo can't be hit again, even if
+      // it respawns right underneath
+      cursor->overlap_mask |= bit;
+    }
+  }
+
+  return hits;
+}
+
+static void publish_snapshot(int64_t now_us) {
+  int latest = snapshot_latest.load(std::memory_order_relaxed);
+  int slot = latest == 0 ? 1 : 0;
+  WorldSnapshot *snap = &snapshots[slot];
+
+  uint32_t seq = snapshot_seq[slot].load(std::memory_order_relaxed);
+  snapshot_seq[slot].store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  snap->tick = tick_count;
+  snap->time_us = now_us;
+  snap->hue = hue;
+  for (int i = 0; i < N_JUNIMOS; i++) {
+    snap->junimos[i].x = junimos[i].x;
+    snap->junimos[i].y = junimos[i].y;
+    snap->junimos[i].generation = junimo_generation[i];
+  }
+  for (int i = 0; i < N_CURSORS; i++) {
+    snap->cursors[i].x = cursors[i].x;
+    snap->cursors[i].y = cursors[i].y;
+    snap->cursors[i].generation = 0;
+  }
+
+  snapshot_seq[slot].store(seq + 2, std::memory_order_release);
+  snapshot_latest.store(slot, std::memory_order_release);
+}
+
+bool game_read_snapshot(WorldSnapshot *out) {
+  while (1) {
+    int slot = snapshot_latest.load(std::memory_order_acquire);
+    if (slot < 0) {
+      return false;
+    }
+    uint32_t before = snapshot_seq[slot].load(std::memory_order_acquire);
+    if (before & 1) {
+      continue;
+    }
+    memcpy(out, &snapshots[slot], sizeof(*out));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (snapshot_seq[slot].load(std::memory_order_relaxed) == before) {
+      return true;
+    }
+  }
+}
+
+void game_tick(const GameInput *in) {
+  TRACE_BEGIN(TRACE_GAME_TICK);
+  for (int i = 0; i < N_JUNIMOS; i++) {
+    junimos[i].move();
+  }
+  game_step(in);
+
+  // Background cycles through the hue wheel every ~5s regardless of FPS
+  if (tick_count % 2 == 0) {
+    hue += 1;
+  }
+  tick_count++;
+  TRACE_END(TRACE_GAME_TICK, tick_count);
+}
+
+// FNV-1a over every field that influences future ticks
+static uint32_t hash_bytes(uint32_t h, const void *data, size_t len) {
+  const uint8_t *p = (const uint8_t *)data;
+  for (size_t i = 0; i < len; i++) {
+    h ^= p[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+uint32_t game_world_hash() {
+  uint32_t h = 2166136261u;
+  for (int i = 0; i < N_JUNIMOS; i++) {
+    h = hash_bytes(h, &junimos[i].x, sizeof(junimos[i].x));
+    h = hash_bytes(h, &junimos[i].y, sizeof(junimos[i].y));
+    h = hash_bytes(h, &junimos[i].dx, sizeof(junimos[i].dx));
+    h = hash_bytes(h, &junimos[i].dy, sizeof(junimos[i].dy));
+  }
+  for (int i = 0; i < N_CURSORS; i++) {
+    h = hash_bytes(h, &cursors[i].x, sizeof(cursors[i].x));
+    h = hash_bytes(h, &cursors[i].y, sizeof(cursors[i].y));
+    h = hash_bytes(h, &cursors[i].overlap_mask, sizeof(cursors[i].overlap_mask));
+  }
+  h = hash_bytes(h, &rng_state, sizeof(rng_state));
+  h = hash_bytes(h, &hue, sizeof(hue));
+  h = hash_bytes(h, &tick_count, sizeof(tick_count));
+  return h;
+}
+
+void game_task(void *pvParameters) {
+  // Seed is chosen by the caller so the session recorder can store it
+  game_init((uint32_t)(uintptr_t)pvParameters);
+
+  // With the default 100Hz FreeRTOS tick this is one tick per simulation step
+  const TickType_t period = pdMS_TO_TICKS(1000 / GAME_TICK_HZ) > 0
+                                ? pdMS_TO_TICKS(1000 / GAME_TICK_HZ)
+                                : 1;
+  int64_t next_tick_us = esp_timer_get_time();
+  TickType_t last_wake = xTaskGetTickCount();
+  // A whole tick late is a hitch in the cursor; polling the link is cheap
+  deadline_declare(DEADLINE_IMU_INGEST, 2 * GAME_TICK_US, IMU_INGEST_BUDGET_US);
+
+  session_parked = xSemaphoreCreateBinaryStatic(&session_parked_storage);
+  session_resume = xSemaphoreCreateBinaryStatic(&session_resume_storage);
+  session_running = true;
+
+  while (1) {
+    if (session_park.load()) {
+      xSemaphoreGive(session_parked);
+      xSemaphoreTake(session_resume, portMAX_DELAY);
+      game_init(session_seed);
+      next_tick_us = esp_timer_get_time();
+      last_wake = xTaskGetTickCount();
+    }
+
+    // Run every tick that is due. After a stall this catches up back to back,
+    // bounded so a long stall skips ahead instead of spiralling.
+    int64_t now = esp_timer_get_time();
+    int steps = 0;
+    while (next_tick_us <= now && steps < GAME_TICK_HZ / 4) {
+      GameInput input;
+      game_capture_input(&input, esp_timer_get_time());
+      game_tick(&input);
+      replay_record_tick(&input, game_world_hash());
+      next_tick_us += GAME_TICK_US;
+      steps++;
+    }
+    if (next_tick_us <= now) {
+      ESP_LOGW(TAG, "Simulation fell behind, dropping %" PRId64 " us",
+               now - next_tick_us);
+      next_tick_us = now + GAME_TICK_US;
+    }
+    if (steps > 0) {
+      publish_snapshot(next_tick_us - GAME_TICK_US);
+    }
+
+    vTaskDelayUntil(&last_wake, period);
+  }
+}
+
+esp_err_t game_session_end() {
+  bool running = true;
+  if (!session_running.compare_exchange_strong(running, false)) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  session_park = true;
+  xSemaphoreTake(session_parked, portMAX_DELAY);
+  replay_record_stop();
+  ESP_LOGI(TAG, "Session ended after %" PRIu32 " ticks", tick_count);
+  return ESP_OK;
+}
+
+esp_err_t game_session_start(uint32_t seed, const char *record_path) {
+  if (session_parked == NULL || session_running.load()) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (record_path != NULL) {
+    // A session that can't be recorded is still worth playing
+    replay_record_start(record_path, seed);
+  }
+  session_seed = seed;
+  session_park = false;
+  session_running = true;
+  xSemaphoreGive(session_resume);
+  return ESP_OK;
+}
@@ -0,0 +1,194 @@
+#ifndef GAME_H
+#define GAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#define SCREEN_WIDTH 240
+#define SCREEN_HEIGHT 320
+
+#define N_JUNIMOS 2
+#define N_CURSORS 2
+
+#define JUNIMO_RADIUS 14
+#define CURSOR_RADIUS 10
+
+// The simulation runs at a fixed rate on its own task, independent of how
+// fast the renderer manages to draw
+#define GAME_TICK_HZ 100
+#define GAME_TICK_US (1000000 / GAME_TICK_HZ)
+
+struct Junimo {
+  int32_t x;
+  int32_t y;
+  int32_t dx;
+  int32_t dy;
+
+  size_t anim_frame;
+
+  void move() {
+    x += dx;
+    y += dy;
+    if (x < 0) {
+      x = 0;
+      if (dx < 0)
+        dx = -dx;
+    } else if (x >= SCREEN_WIDTH) {
+      x = SCREEN_WIDTH - 1;
+      if (dx > 0)
+        dx = -dx;
+    }
+    if (y < 0) {
+      y = 0;
+      if (dy < 0)
+        dy = -dy;
+    } else if (y >= SCREEN_HEIGHT) {
+      y = SCREEN_HEIGHT - 1;
+      if (dy > 0)
+        dy = -dy;
+    }
+  }
+};
+
+struct Cursor {
+  int32_t x;
+  int32_t y;
+  // esp_timer time at which the sample driving this position was first seen
+  int64_t sample_time_us;
+  // bit i set while the cursor overlaps junimo i (hits fire on entry only)
+  uint32_t overlap_mask;
+};
+
+#define GAME_MAX_GESTURES 4
+
+struct GameGesture {
+  uint8_t device;
+  // imu_event_kind_t for the events a node detects (see imu_features.h)
+  uint8_t kind;
+};
+
+// Everything that feeds one simulation tick. A recorded stream of these plus
+// the seed reproduces a session exactly (see replay.h).
+struct GameInput {
+  // bit c set when device c delivered a new sample this tick
+  uint32_t new_sample_mask;
+  int32_t gyro_y[N_CURSORS];
+  int32_t gyro_z[N_CURSORS];
+  uint8_t n_gestures;
+  GameGesture gestures[GAME_MAX_GESTURES];
+  // When the tick's inputs were observed. Only used for latency stats, never
+  // for simulation state, so replays stay deterministic.
+  int64_t time_us;
+  // When each new sample reached the link, 0 if the link can't tell; for
+  // latency stats only, like time_us, and not recorded
+  int64_t arrival_us[N_CURSORS];
+};
+
+struct HitEvent {
+  uint8_t cursor;
+  uint8_t junimo;
+  int32_t x;
+  int32_t y;
+  int64_t sample_time_us;
+};
+
+struct SnapshotEntity {
+  int16_t x;
+  int16_t y;
+  // Bumped whenever the entity teleports (respawn), so the renderer knows
+  // not to interpolate across the jump
+  uint16_t generation;
+};
+
+// Everything the renderer needs from one simulation tick
+struct WorldSnapshot {
+  uint32_t tick;
+  int64_t time_us;
+  uint8_t hue;
+  SnapshotEntity junimos[N_JUNIMOS];
+  SnapshotEntity cursors[N_CURSORS];
+};
+
+/**
+ * @brief Place the junimos and reset cursor state
+ */
+void game_init(uint32_t seed);
+
+/**
+ * @brief Gather this tick's inputs from the live IMU data and gesture queue
+ */
+void game_capture_input(GameInput *in, int64_t now_us);
+
+/**
+ * @brief Queue a gesture for the next tick. Safe to call from any task.
+ *
+ * Dropped if the game task hasn't started yet.
+ */
+void game_post_gesture(uint8_t device, uint8_t kind);
+
+/**
+ * @brief Run one game step: apply the new IMU samples to the cursors, test
+ *        them against the junimos and publish a hit (bus_hit) for every new overlap
+ *
+ * Hits are published from inside the step as soon as they are found, so the
+ * SFX the audio task starts for them does not wait for the frame to be rendered.
+ *
+ * @return Number of hits found during this step
+ */
+size_t game_step(const GameInput *in);
+
+/**
+ * @brief Advance the whole simulation by one fixed tick
+ */
+void game_tick(const GameInput *in);
+
+/**
+ * @brief Hash of the full simulation state, for replay divergence checks
+ */
+uint32_t game_world_hash();
+
+/**
+ * @brief Suppress hit events and so their SFX (used while replaying)
+ */
+void game_set_silent(bool silent);
+
+/**
+ * @brief Fixed-timestep simulation task
+ *
+ * Moves the junimos, runs game_step() and publishes a WorldSnapshot every
+ * GAME_TICK_US. Ticks that were missed are caught up back to back so game
+ * speed does not depend on scheduling hiccups.
+ */
+void game_task(void *pvParameters);
+
+/**
+ * @brief End the running session: park game_task between two ticks and
+ *        close its recording
+ *
+ * Returns once the task is parked and the recording is complete, so the
+ * world can then be driven by something else (replay_run()).
+ *
+ * @return ESP_ERR_INVALID_STATE if game_task isn't running a session
+ */
+esp_err_t game_session_end();
+
+/**
+ * @brief Start a new session on a parked game_task
+ *
+ * @param seed        Seed for the fresh world
+ * @param record_path File to record the session to, NULL for none
+ * @return ESP_ERR_INVALID_STATE if no session was ended first
+ */
+esp_err_t game_session_start(uint32_t seed, const char *record_path);
+
+/**
+ * @brief Copy out the most recently published world snapshot
+ *
+ * Lock-free; safe to call from any task while the simulation is running.
+ *
+ * @return false if no tick has been published yet
+ */
+bool game_read_snapshot(WorldSnapshot *out);
+
+#endif // GAME_H
@@ -1,131 +1,61 @@
-#include "esp_server.h"
-#include "lgfx/v1/misc/enum.hpp"
 #include <cstdint>
 #include <sys/types.h>
-#define LGFX_USE_V1
 
+#include "alloc_track.h"
+#include "analyzer.h"
+#include "boot.h"
+#include "bus.h"
+#include "canvas.h"
+#include "color.h"
+#include "deadline.h"
 #include "esp_log.h"
-#include "freertos/projdefs.h"
-
-#include <LovyanGFX.hpp>
-
-#define SCREEN_WIDTH 240
-#define SCREEN_HEIGHT 320
-
-class LGFX : public lgfx::LGFX_Device {
-  lgfx::Panel_ST7789 _panel_instance;
-  lgfx::Bus_SPI _bus_instance;
-  lgfx::Light_PWM _light_instance;
-
-public:
-  LGFX(void) {
-    {
-      auto cfg = _bus_instance.config();
-
-      cfg.spi_host = SPI2_HOST;
-      cfg.spi_mode = 0;
-      cfg.freq_write = 320000000;
-      cfg.freq_read = 16000000;
-      cfg.spi_3wire = true;
-      cfg.use_lock = true;
-      cfg.dma_channel = SPI_DMA_CH_AUTO;
-      cfg.pin_sclk = 12;
-      cfg.pin_mosi = 11;
-      cfg.pin_miso = -1;
-      cfg.pin_dc = 9;
-
-      _bus_instance.config(cfg);
-      _panel_instance.setBus(&_bus_instance);
-    }
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "game.h"
+#include "hal.h"
+#include "telemetry.h"
+#include "trace.h"
 
-    {
-      auto cfg = _panel_instance.config();
-
-      cfg.pin_cs = 10;
-      cfg.pin_rst = 8;
-      cfg.pin_busy = -1;
-      cfg.panel_width = SCREEN_WIDTH;
-      cfg.panel_height = SCREEN_HEIGHT;
-      cfg.offset_x = 0;
-      cfg.offset_y = 0;
-      cfg.offset_rotation = 0;
-      cfg.dummy_read_pixel = 8;
-      cfg.dummy_read_bits = 1;
-      cfg.readable = true;
-      cfg.invert = true;
-      cfg.rgb_order = false;
-      cfg.dlen_16bit = false;
-      cfg.bus_shared = true;
-      _panel_instance.config(cfg);
-    }
+#define N_ANIM_FRAMES 8
 
-    {
-      auto cfg = _light_instance.config();
+// Below 20 fps counts as a hitch; drawing and presenting one frame gets 30 ms
+#define RENDER_PERIOD_US 50000
+#define RENDER_BUDGET_US 30000
 
-      cfg.pin_bl = 4;
-      cfg.invert = false;
-      cfg.freq = 44100;
-      cfg.pwm_channel = 7;
+// Spectrum levels at or below this are the FFT's rounding noise (see
+// spectrum.h) and draw nothing; bars along the bottom edge reach this high
+#define SPECTRUM_FLOOR 48
+#define SPECTRUM_BAR_HEIGHT 40
 
-      _light_instance.config(cfg);
-      _panel_instance.setLight(&_light_instance);
-    }
+// Junimos swell this much on each beat and shrink back over the pulse
+#define BEAT_PULSE_RADIUS 4
+#define BEAT_PULSE_US 150000
 
-    setPanel(&_panel_instance);
-  }
-};
-
-struct Junimo {
-  int32_t x;
-  int32_t y;
-  int32_t dx;
-  int32_t dy;
-
-  size_t anim_frame;
-
-  void move() {
-    x += dx;
-    y += dy;
-    if (x < 0) {
-      x = 0;
-      if (dx < 0)
-        dx = -dx;
-    } else if (x >= SCREEN_WIDTH) {
-      x = SCREEN_WIDTH - 1;
-      if (dx > 0)
-        dx = -dx;
-    }
-    if (y < 0) {
-      y = 0;
-      if (dy < 0)
-        dy = -dy;
-    } else if (y >= SCREEN_HEIGHT) {
-      y = SCREEN_HEIGHT - 1;
-      if (dy > 0)
-        dy = -dy;
-    }
-  }
-};
+// The players' combined motion (bus_fusion energy) turns the background's
+// hue by one step per this many gyro counts, up to MOTION_HUE_MAX
+#define MOTION_HUE_COUNTS 512
+#define MOTION_HUE_MAX 64
 
-#define N_ANIM_FRAMES 8
-#define N_JUNIMOS 2
+// A cursor is drawn filled for this long after a gesture from its device
+#define GESTURE_FLASH_US 200000
 
 const uint16_t TRANSPARENT = TFT_GREEN;
 
-static LGFX lcd;
-static LGFX_Sprite buffers[2];
+static DisplayPanel *panel;
+static Canvas buffers[2];
 static uint8_t currentBuffer = 0;
 
-static Junimo junimos[N_JUNIMOS];
-static LGFX_Sprite junimoAnimationFrames[N_ANIM_FRAMES];
+static Canvas junimoAnimationFrames[N_ANIM_FRAMES];
 
-void graphics_init() {
-  lcd.init();
-  lcd.setRotation(0);
-  lcd.setBrightness(128);
-  lcd.setColorDepth(16);
+// Picked up once per frame, so none of them ever wakes the task
+static BusSubscriber fusion_sub;
+static BusSubscriber gesture_sub;
+static BusSubscriber beat_sub;
 
-  lcd.clear();
+void graphics_init() {
+  panel = hal_display();
+  panel->init();
 
   for (int i = 0; i < 2; i++) {
     buffers[i].setPsram(false);
@@ -134,69 +64,185 @@ void graphics_init() {
   }
 }
 
-void graphics_main() {
-  lcd.startWrite();
-  uint8_t hue = 0;
+// Blend between two snapshot positions, alpha in 1/256ths
+static int32_t lerp(int32_t from, int32_t to, int32_t alpha) {
+  return from + (to - from) * alpha / 256;
+}
+
+static void entity_position(const SnapshotEntity &prev,
+                            const SnapshotEntity &cur, int32_t alpha,
+                            int32_t *x, int32_t *y) {
+  if (prev.generation != cur.generation) {
+    // Respawned between the snapshots; sliding across the screen would be wrong
+    *x = cur.x;
+    *y = cur.y;
+    return;
+  }
+  *x = lerp(prev.x, cur.x, alpha);
+  *y = lerp(prev.y, cur.y, alpha);
+}
+
+static uint8_t above_floor(uint8_t level) {
+  return level > SPECTRUM_FLOOR ? level - SPECTRUM_FLOOR : 0;
+}
+
+// Where the music's energy sits, 0 (all bass) to 255 (all treble)
+static uint8_t band_centroid(const uint8_t *bands) {
+  uint32_t sum = 0, weighted = 0;
+  for (int b = 0; b < SPECTRUM_BANDS; b++) {
+    sum += above_floor(bands[b]);
+    weighted += above_floor(bands[b]) * b;
+  }
+  return sum != 0 ? (uint8_t)(weighted * 255 / (sum * (SPECTRUM_BANDS - 1))) : 0;
+}
+
+// The background follows the music and the players: the game's hue shifted
+// by the spectral centroid and by how hard everyone is moving, brighter on
+// bass. Only the picture changes, never the game state, so replays still
+// match.
+static void draw_background(Canvas *canvas, uint8_t game_hue,
+                            const analyzer_snapshot_t *spectrum,
+                            uint32_t motion_energy) {
+  uint8_t bass = 0;
+  for (int b = 0; b < 4; b++) {
+    if (above_floor(spectrum->bands[b]) > bass)
+      bass = above_floor(spectrum->bands[b]);
+  }
+  uint32_t motion_hue = motion_energy / MOTION_HUE_COUNTS;
+  uint8_t hue = game_hue + band_centroid(spectrum->bands) / 2 +
+                (motion_hue < MOTION_HUE_MAX ? motion_hue : MOTION_HUE_MAX);
+  uint8_t value = 200 + bass * 55 / (255 - SPECTRUM_FLOOR);
+
+  uint8_t r, g, b;
+  hue_to_rgb(hue, value, &r, &g, &b);
+  canvas->fillScreen(canvas->color565(r, g, b));
+
+  // One bar per band in the opposite hue
+  hue_to_rgb(hue + 128, 255, &r, &g, &b);
+  uint16_t bar = canvas->color565(r, g, b);
+  int32_t width = SCREEN_WIDTH / SPECTRUM_BANDS;
+  for (int i = 0; i < SPECTRUM_BANDS; i++) {
+    int32_t h = above_floor(spectrum->bands[i]) * SPECTRUM_BAR_HEIGHT /
+                (255 - SPECTRUM_FLOOR);
+    if (h > 0)
+      canvas->fillRect(i * width, SCREEN_HEIGHT - h, width - 1, h, bar);
+  }
+}
+
+// Extra junimo radius for a frame shown at now_us, from the latest beat on
+// bus_beat. The predicted beat is used once it is due, so the pulse lands on
+// the beat rather than when the analyzer gets around to confirming it.
+static int32_t beat_pulse(const bus_beat_t *beat, int64_t now_us) {
+  if (beat->period_us == 0)
+    return 0;
+  int64_t beat_us = beat->next_us <= now_us ? beat->next_us : beat->time_us;
+  int64_t since = now_us - beat_us;
+  if (since < 0 || since >= BEAT_PULSE_US)
+    return 0;
+  return (int32_t)(BEAT_PULSE_RADIUS * (BEAT_PULSE_US - since) / BEAT_PULSE_US);
+}
+
+void graphics_main(void *pvParameters) {
+  // The two most recent distinct simulation snapshots seen by the renderer.
+  // Frames are drawn between them, one snapshot interval behind the
+  // simulation, so motion stays smooth whatever the frame rate.
+  WorldSnapshot prev = {};
+  WorldSnapshot cur = {};
+  bool have_cur = false;
+  int64_t last_frame_us = 0;
+  deadline_declare(DEADLINE_RENDER, RENDER_PERIOD_US, RENDER_BUDGET_US);
+
+  // Only the latest of each matters to a frame
+  uint32_t motion_energy = 0;
+  bus_beat_t beat = {};
+  int64_t gesture_us[N_CURSORS] = {};
+  bus_fusion.subscribe(&fusion_sub, "graphics", false);
+  bus_gesture.subscribe(&gesture_sub, "graphics", false);
+  bus_beat.subscribe(&beat_sub, "graphics", false);
 
   while (1) {
+    WorldSnapshot latest;
+    if (game_read_snapshot(&latest) && (!have_cur || latest.tick != cur.tick)) {
+      prev = have_cur ? cur : latest;
+      cur = latest;
+      have_cur = true;
+    }
+    if (!have_cur) {
+      vTaskDelay(1);
+      continue;
+    }
 
-    LGFX_Sprite *drawBuffer = &buffers[currentBuffer];
-
-    uint8_t region = hue / 43;
-    uint8_t remainder = (hue - (region * 43)) * 6;
-    uint8_t p = 0;
-    uint8_t q = (200 * (255 - remainder)) / 255;
-    uint8_t t = (200 * remainder) / 255;
-    uint8_t r, g, b;
-    switch (region) {
-    case 0:
-      r = 200;
-      g = t;
-      b = p;
-      break;
-    case 1:
-      r = q;
-      g = 200;
-      b = p;
-      break;
-    case 2:
-      r = p;
-      g = 200;
-      b = t;
-      break;
-    case 3:
-      r = p;
-      g = q;
-      b = 200;
-      break;
-    case 4:
-      r = t;
-      g = p;
-      b = 200;
-      break;
-    default:
-      r = 200;
-      g = p;
-      b = q;
-      break;
+    int64_t span = cur.time_us - prev.time_us;
+    int32_t alpha = 256;
+    if (span > 0) {
+      int64_t elapsed = esp_timer_get_time() - cur.time_us;
+      alpha = elapsed >= span ? 256 : (int32_t)(elapsed * 256 / span);
+      if (alpha < 0)
+        alpha = 0;
     }
 
-    // Device 0 - green circle
-    uint16_t x0 = 120 + (g_imu_data[0].gyro_z * 120 / 20000);
-    uint16_t y0 = 160 + (g_imu_data[0].gyro_y * 160 / 20000);
+    deadline_begin(DEADLINE_RENDER);
+    TRACE_BEGIN(TRACE_FRAME);
+    ALLOC_REGION_BEGIN(ALLOC_REGION_RENDER);
+    Canvas *drawBuffer = &buffers[currentBuffer];
 
-    // Device 1 - blue circle
-    uint16_t x1 = 120 + (g_imu_data[1].gyro_z * 120 / 20000);
-    uint16_t y1 = 160 + (g_imu_data[1].gyro_y * 160 / 20000);
+    bus_fusion_t fused;
+    while (bus_fusion.poll(&fusion_sub, &fused)) {
+      motion_energy = fused.energy;
+    }
+    bus_gesture_t gesture;
+    while (bus_gesture.poll(&gesture_sub, &gesture)) {
+      if (gesture.gesture.device < N_CURSORS)
+        gesture_us[gesture.gesture.device] = gesture.time_us;
+    }
+    while (bus_beat.poll(&beat_sub, &beat))
+      ;
+
+    analyzer_snapshot_t music;
+    analyzer_get(&music);
+    draw_background(drawBuffer, cur.hue, &music, motion_energy);
+    int64_t draw_us = esp_timer_get_time();
+    int32_t pulse = beat_pulse(&beat, draw_us);
+
+    int32_t x, y;
+    for (int i = 0; i < N_JUNIMOS; i++) {
+      entity_position(prev.junimos[i], cur.junimos[i], alpha, &x, &y);
+      drawBuffer->fillCircle(x, y, JUNIMO_RADIUS + pulse,
+                             drawBuffer->color565(255, 255, 255));
+    }
 
-    drawBuffer->fillScreen(drawBuffer->color565(r, g, b));
-    hue += 1;
-    drawBuffer->drawCircle(x0, y0, 10, drawBuffer->color565(100, 255, 100));
-    drawBuffer->drawCircle(x1, y1, 10, drawBuffer->color565(100, 100, 255));
+    // Device 0 - green circle, device 1 - blue; filled just after a gesture
+    static const uint8_t cursor_rgb[N_CURSORS][3] = {{100, 255, 100},
+                                                     {100, 100, 255}};
+    for (int c = 0; c < N_CURSORS; c++) {
+      entity_position(prev.cursors[c], cur.cursors[c], alpha, &x, &y);
+      uint16_t color = drawBuffer->color565(cursor_rgb[c][0], cursor_rgb[c][1],
+                                            cursor_rgb[c][2]);
+      if (gesture_us[c] != 0 && draw_us - gesture_us[c] < GESTURE_FLASH_US)
+        drawBuffer->fillCircle(x, y, CURSOR_RADIUS, color);
+      else
+        drawBuffer->drawCircle(x, y, CURSOR_RADIUS, color);
+    }
 
-    drawBuffer->pushSprite(&lcd, 0, 0);
+    TRACE_BEGIN(TRACE_PRESENT);
+    panel->present((const uint16_t *)drawBuffer->getBuffer(), SCREEN_WIDTH,
+                   SCREEN_HEIGHT);
+    TRACE_END(TRACE_PRESENT, 0);
+    ALLOC_REGION_END(ALLOC_REGION_RENDER);
+    TRACE_END(TRACE_FRAME, cur.tick);
+    deadline_end(DEADLINE_RENDER);
 
     currentBuffer = 1 - currentBuffer;
+    boot_milestone(BOOT_MILESTONE_FIRST_FRAME);
+
+    int64_t frame_us = esp_timer_get_time();
+    uint32_t interval_us = last_frame_us != 0 ? (uint32_t)(frame_us - last_frame_us) : 0;
+    if (last_frame_us != 0) {
+      telemetry_frame(interval_us);
+    }
+    last_frame_us = frame_us;
+    bus_frame_t frame = {frame_us, cur.tick, interval_us};
+    bus_frame.publish(frame);
 
     vTaskDelay(20 / portTICK_PERIOD_MS);
   }
@@ -1,2 +1,2 @@
 void graphics_init();
-void graphics_main();
+void graphics_main(void *pvParameters);
@@ -0,0 +1,452 @@
+// Copyright (c) 2023 Michael Heijmans
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <atomic>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_err.h"
+#include "esp_timer.h"
+#include "esp_server.h"
+#include "driver/i2s_pdm.h"
+#include "driver/gpio.h"
+#include "hal.h"
+#include "imu_control.h"
+#include "net_audio.h"
+#include "sd_card.h"
+
+#define LGFX_USE_V1
+#include <LovyanGFX.hpp>
+
+#include "game.h"
+
+// ESP32-S3 implementations of the HAL interfaces used by the main board
+
+// Setup Pins
+#define I2S_CLK_PIN GPIO_NUM_1  // PDM CLK (Bit Clock) - NOT CONNECTED to Amp
+#define I2S_DATA_PIN GPIO_NUM_2 // PDM DATA (DOUT) -> Connect to Amp Input with RC Filter
+
+/* WIRING GUIDE: PAM8403 (Analog Amp) + ESP32 (PDM Digital Out)
+ * -------------------------------------------------------------
+ * Since the ESP32-S3 doesn't have an internal DAC, we use PDM mode.
+ * The PAM8403 expects an ANALOG signal.
+ *
+ * To make this work, you need a simple RC Low-Pass Filter on the Data Pin.
+ *
+ * [ESP32 Side]                    [PAM8403 Amp Input Side]
+ * 5V / VBUS   ------------------>  5V +
+ * GND         ------------------>  5V -
+ * GND         ------------------>  ⊥ (Upside down T / Audio Ground)
+ *
+ * GPIO 2 (Data) -> [Resistor] -> + -> L (Left Input)
+ *                    (1k-4.7k)   |
+ *                                = [Capacitor] (10nF-100nF)
+ *                                |
+ *                               GND
+ *
+ * Note: If you don't have a resistor/capacitor, you can connect GPIO 2
+ * directly to "L", but the sound might be harsh/noisy.
+ *
+ * [Speaker Side]
+ * Connect your speaker wires to L+ and L- on the PAM8403.
+ * DO NOT CONNECT L- or R- to GROUND! The PAM8403 outputs are "Bridged" (BTL).
+ */
+
+// DMA queue depth. The defaults (6 x 240 frames) hold ~30ms of audio on their
+// own, which would blow the hit-to-sound budget before any SFX is mixed in.
+#define I2S_DMA_DESC_NUM 4
+#define I2S_DMA_FRAME_NUM 128
+
+// esp_server keeps one slot per IMU device in g_imu_data
+#define SERVER_IMU_DEVICES 2
+
+static const char *TAG = "hal_esp";
+
+// Runs in the I2S ISR when DMA found no fresh data to send
+static bool IRAM_ATTR on_send_underrun(i2s_chan_handle_t handle, i2s_event_data_t *event, void *user_ctx)
+{
+    ((std::atomic<uint32_t> *)user_ctx)->fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+class I2sPdmSink : public AudioSink {
+    i2s_chan_handle_t tx_handle = NULL;
+    std::atomic<uint32_t> underrun_count{0};
+
+public:
+    esp_err_t open(uint32_t sample_rate, uint16_t channels) override
+    {
+        i2s_slot_mode_t slot_mode = (channels == 2) ? I2S_SLOT_MODE_STEREO : I2S_SLOT_MODE_MONO;
+        ESP_LOGI(TAG, "Initializing I2S PDM TX channel with Rate: %ld, Mode: %s",
+                 sample_rate, slot_mode == I2S_SLOT_MODE_STEREO ? "Stereo" : "Mono");
+
+        // Channel should always be NULL here (cleaned up after each playback)
+        if (tx_handle != NULL) {
+            ESP_LOGW(TAG, "I2S channel handle is not NULL, this shouldn't happen!");
+            tx_handle = NULL;
+        }
+
+        // Create new I2S channel
+        i2s_chan_config_t chan_cfg = I2S_CHANNEL_DEFAULT_CONFIG(I2S_NUM_AUTO, I2S_ROLE_MASTER);
+        chan_cfg.dma_desc_num = I2S_DMA_DESC_NUM;
+        chan_cfg.dma_frame_num = I2S_DMA_FRAME_NUM;
+        ESP_ERROR_CHECK(i2s_new_channel(&chan_cfg, &tx_handle, NULL));
+
+        // Setup PDM TX configuration
+        i2s_pdm_tx_config_t pdm_tx_cfg = {
+            .clk_cfg = I2S_PDM_TX_CLK_DEFAULT_CONFIG(sample_rate),
+            .slot_cfg = I2S_PDM_TX_SLOT_DEFAULT_CONFIG(I2S_DATA_BIT_WIDTH_16BIT, slot_mode),
+            .gpio_cfg = {
+                .clk = I2S_CLK_PIN,
+                .dout = I2S_DATA_PIN,
+                .invert_flags = {
+                    .clk_inv = false,
+                },
+            },
+        };
+
+        esp_err_t ret = i2s_channel_init_pdm_tx_mode(tx_handle, &pdm_tx_cfg);
+        if (ret != ESP_OK) {
+            i2s_del_channel(tx_handle);
+            tx_handle = NULL;
+            return ret;
+        }
+
+        i2s_event_callbacks_t callbacks = {};
+        callbacks.on_send_q_ovf = on_send_underrun;
+        ESP_ERROR_CHECK(i2s_channel_register_event_callback(tx_handle, &callbacks, &underrun_count));
+        return i2s_channel_enable(tx_handle);
+    }
+
+    esp_err_t write(const int16_t *samples, size_t count) override
+    {
+        size_t bytes_written = 0;
+        return i2s_channel_write(tx_handle, samples, count * sizeof(int16_t), &bytes_written, portMAX_DELAY);
+    }
+
+    void close() override
+    {
+        if (tx_handle == NULL) {
+            return;
+        }
+        ESP_ERROR_CHECK(i2s_channel_disable(tx_handle));
+
+        // Delete the channel after playback to free resources
+        ESP_LOGI(TAG, "Cleaning up I2S channel");
+        esp_err_t ret = i2s_del_channel(tx_handle);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to delete I2S channel: %s", esp_err_to_name(ret));
+        }
+        tx_handle = NULL;  // Important: Set to NULL after deletion
+    }
+
+    uint32_t queued_frames() const override
+    {
+        return I2S_DMA_DESC_NUM * I2S_DMA_FRAME_NUM;
+    }
+
+    uint32_t underruns() const override
+    {
+        return underrun_count.load(std::memory_order_relaxed);
+    }
+};
+
+
+class LGFX : public lgfx::LGFX_Device {
+  lgfx::Panel_ST7789 _panel_instance;
+  lgfx::Bus_SPI _bus_instance;
+  lgfx::Light_PWM _light_instance;
+
+public:
+  LGFX(void) {
+    {
+      auto cfg = _bus_instance.config();
+
+      cfg.spi_host = SPI2_HOST;
+      cfg.spi_mode = 0;
+      cfg.freq_write = 320000000;
+      cfg.freq_read = 16000000;
+      cfg.spi_3wire = true;
+      cfg.use_lock = true;
+      cfg.dma_channel = SPI_DMA_CH_AUTO;
+      cfg.pin_sclk = 12;
+      cfg.pin_mosi = 11;
+      cfg.pin_miso = -1;
+      cfg.pin_dc = 9;
+
+      _bus_instance.config(cfg);
+      _panel_instance.setBus(&_bus_instance);
+    }
+
+    {
+      auto cfg = _panel_instance.config();
+
+      cfg.pin_cs = 10;
+      cfg.pin_rst = 8;
+      cfg.pin_busy = -1;
+      cfg.panel_width = SCREEN_WIDTH;
+      cfg.panel_height = SCREEN_HEIGHT;
+      cfg.offset_x = 0;
+      cfg.offset_y = 0;
+      cfg.offset_rotation = 0;
+      cfg.dummy_read_pixel = 8;
+      cfg.dummy_read_bits = 1;
+      cfg.readable = true;
+      cfg.invert = true;
+      cfg.rgb_order = false;
+      cfg.dlen_16bit = false;
+      cfg.bus_shared = true;
+      _panel_instance.config(cfg);
+    }
+
+    {
+      auto cfg = _light_instance.config();
+
+      cfg.pin_bl = 4;
+      cfg.invert = false;
+      cfg.freq = 44100;
+      cfg.pwm_channel = 7;
+
+      _light_instance.config(cfg);
+      _panel_instance.setLight(&_light_instance);
+    }
+
+    setPanel(&_panel_instance);
+  }
+};
+
+class LgfxPanel : public DisplayPanel {
+  LGFX lcd;
+
+public:
+  esp_err_t init() override {
+    lcd.init();
+    lcd.setRotation(0);
+    lcd.setBrightness(128);
+    lcd.setColorDepth(16);
+
+    lcd.clear();
+    lcd.startWrite();
+    return ESP_OK;
+  }
+
+  void present(const uint16_t *pixels, int32_t width, int32_t height) override {
+    // Same path pushSprite() takes: the sprite buffer is already byte-swapped
+    lcd.pushImage(0, 0, width, height, (const lgfx::swap565_t *)pixels);
+  }
+};
+
+class SdSpiStorage : public BlockStorage {
+public:
+    esp_err_t mount() override
+    {
+        return sd_card_init();
+    }
+
+    void unmount() override
+    {
+        sd_card_deinit();
+    }
+
+    bool mounted() const override
+    {
+        return sd_card_mounted;
+    }
+};
+
+// The server task fills g_imu_data as samples arrive; this just exposes it.
+// Network audio gets its own UDP socket on the interface esp_server brought up.
+class ServerTransport : public NetTransport {
+    int _audio_sock = -1;
+    bool _audio_failed = false;
+    int _control_sock = -1;
+    bool _control_failed = false;
+
+    bool open_control()
+    {
+        if (_control_sock >= 0) {
+            return true;
+        }
+        if (_control_failed) {
+            return false;
+        }
+        _control_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(IMU_CONTROL_PORT);
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        if (_control_sock < 0 || bind(_control_sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+            ESP_LOGE(TAG, "Node control socket failed: errno %d", errno);
+            if (_control_sock >= 0) {
+                close(_control_sock);
+                _control_sock = -1;
+            }
+            _control_failed = true;
+            return false;
+        }
+        ESP_LOGI(TAG, "Node control on UDP port %d", IMU_CONTROL_PORT);
+        return true;
+    }
+
+public:
+    esp_err_t start() override
+    {
+        server_app_main();
+        return ESP_OK;
+    }
+
+    esp_err_t send_sample(const IMU_DATA &sample) override
+    {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    esp_err_t send_samples(const IMU_DATA *samples, size_t count) override
+    {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    bool link_up() const override
+    {
+        return true;
+    }
+
+    bool latest_sample(int device, IMU_DATA *out) override
+    {
+        if (device < 0 || device >= SERVER_IMU_DEVICES) {
+            return false;
+        }
+        *out = g_imu_data[device];
+        return true;
+    }
+
+    // esp_server only keeps the latest sample per device
+    uint32_t received(int device) const override
+    {
+        return 0;
+    }
+
+    uint32_t lost() const override
+    {
+        return 0;
+    }
+
+    int64_t arrival_us(int device) const override
+    {
+        return 0;
+    }
+
+    // lwIP doesn't stamp datagrams; arrival is when the audio task drains
+    // the socket, once per mix block, which the jitter estimate absorbs
+    bool receive_audio(uint8_t *buf, size_t max, size_t *len, int64_t *arrival_us) override
+    {
+        if (_audio_sock < 0) {
+            if (_audio_failed) {
+                return false;
+            }
+            _audio_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+            struct sockaddr_in addr = {};
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(NET_AUDIO_PORT);
+            addr.sin_addr.s_addr = htonl(INADDR_ANY);
+            if (_audio_sock < 0 || bind(_audio_sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+                ESP_LOGE(TAG, "Network audio socket failed: errno %d", errno);
+                if (_audio_sock >= 0) {
+                    close(_audio_sock);
+                    _audio_sock = -1;
+                }
+                _audio_failed = true;
+                return false;
+            }
+            ESP_LOGI(TAG, "Network audio on UDP port %d", NET_AUDIO_PORT);
+        }
+
+        int n = recvfrom(_audio_sock, buf, max, MSG_DONTWAIT, NULL, NULL);
+        if (n < 0) {
+            return false;
+        }
+        *len = (size_t)n;
+        *arrival_us = esp_timer_get_time();
+        return true;
+    }
+
+    // Replies go back to wherever a node's messages come from
+    esp_err_t send_control(const net_peer_t *to, const void *buf, size_t len) override
+    {
+        if (to == NULL) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        if (!open_control()) {
+            return ESP_FAIL;
+        }
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = to->port;
+        addr.sin_addr.s_addr = to->addr;
+        int sent = sendto(_control_sock, buf, len, MSG_DONTWAIT, (struct sockaddr *)&addr, sizeof(addr));
+        return sent == (int)len ? ESP_OK : ESP_FAIL;
+    }
+
+    bool receive_control(void *buf, size_t max, size_t *len, net_peer_t *from) override
+    {
+        if (!open_control()) {
+            return false;
+        }
+        struct sockaddr_in addr = {};
+        socklen_t addr_len = sizeof(addr);
+        int n = recvfrom(_control_sock, buf, max, MSG_DONTWAIT, (struct sockaddr *)&addr, &addr_len);
+        if (n < 0) {
+            return false;
+        }
+        *len = (size_t)n;
+        from->addr = addr.sin_addr.s_addr;
+        from->port = addr.sin_port;
+        return true;
+    }
+};
+
+AudioSink *hal_audio_sink()
+{
+    static I2sPdmSink sink;
+    return &sink;
+}
+
+BlockStorage *hal_storage()
+{
+    static SdSpiStorage storage;
+    return &storage;
+}
+
+DisplayPanel *hal_display()
+{
+    static LgfxPanel panel;
+    return &panel;
+}
+
+NetTransport *hal_net()
+{
+    static ServerTransport transport;
+    return &transport;
+}
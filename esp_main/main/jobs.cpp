@@ -0,0 +1,20 @@
+#include "esp_log.h"
+#include "arenas.h"
+#include "jobs.h"
+#include "tasks.h"
+
+static const char *TAG = "jobs";
+
+CoExecutor jobs("jobs");
+
+esp_err_t jobs_start(void)
+{
+    co_set_frame_pool(&job_frames);
+    if (task_start(TASK_JOBS0, CoExecutor::worker, &jobs, NULL) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (task_start(TASK_JOBS1, CoExecutor::worker, &jobs, NULL) != pdPASS) {
+        ESP_LOGW(TAG, "Running jobs on one worker");
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,24 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include "esp_err.h"
+#include "coro.h"
+
+/*
+ * Background jobs
+ * ---------------
+ * The firmware's cooperative executor (see coro.h). Its two workers are
+ * TASK_JOBS0 and TASK_JOBS1, one per core at low priority, and its frames
+ * come from job_frames (see arenas.h). Work that mostly waits, like the SD
+ * byte reader and processor, is spawned here as a job instead of getting a
+ * task and stack of its own.
+ */
+
+extern CoExecutor jobs;
+
+/**
+ * @brief Point the frame allocator at job_frames and start both workers
+ */
+esp_err_t jobs_start(void);
+
+#endif // JOBS_H
@@ -0,0 +1,156 @@
+#include <string.h>
+#include <atomic>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "game.h"
+#include "jobs.h"
+#include "lf_queue.h"
+#include "node_control.h"
+#include "replay.h"
+
+static const char *TAG = "node_control";
+
+typedef struct {
+    uint8_t device;
+    imu_settings_t settings;
+} set_request_t;
+
+static LfQueue<set_request_t, NODE_CONTROL_QUEUE_SIZE> requests;
+
+// The job's own state; it runs on one worker at a time
+static ImuControlHub hub;
+// Big enough for a full BACKLOG message, the largest a node sends
+static uint8_t rx_buf[sizeof(imu_backlog_msg_t) + 1];
+static imu_backlog_msg_t backlog_msg;
+
+static imu_node_state_t snapshot[HAL_MAX_IMU_DEVICES];
+static std::atomic<uint32_t> snapshot_seq(0);
+
+// Acknowledged ranges per device, accel in the low nibble, for the game
+static std::atomic<uint8_t> ranges[HAL_MAX_IMU_DEVICES];
+
+static void publish(void)
+{
+    uint32_t seq = snapshot_seq.load(std::memory_order_relaxed);
+    snapshot_seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (uint8_t d = 0; d < HAL_MAX_IMU_DEVICES; d++) {
+        snapshot[d] = hub.node(d);
+    }
+    snapshot_seq.store(seq + 2, std::memory_order_release);
+
+    for (uint8_t d = 0; d < HAL_MAX_IMU_DEVICES; d++) {
+        const imu_settings_t &s = hub.node(d).effective;
+        ranges[d].store((uint8_t)(s.accel_range | (s.gyro_range << 4)), std::memory_order_relaxed);
+    }
+}
+
+// One pass: requests in, node messages in, SETs out. A node's events become
+// game gestures, so they reach the replay and bus_gesture like any other.
+// Backlogged samples are acknowledged and, the first time they arrive, go
+// into the session recording.
+static void control_step(void)
+{
+    NetTransport *net = hal_net();
+    bool changed = false;
+
+    set_request_t req;
+    while (requests.pop(&req)) {
+        hub.set(req.device, &req.settings);
+        changed = true;
+    }
+
+    size_t len;
+    net_peer_t from;
+    int64_t now = esp_timer_get_time();
+    while (net->receive_control(rx_buf, sizeof(rx_buf), &len, &from)) {
+        imu_event_msg_t event;
+        imu_control_msg_t ack;
+        bool fresh;
+        if (hub.handle(rx_buf, len, &from, now)) {
+            changed = true;
+        } else if (hub.handle_event(rx_buf, len, &from, now, &event)) {
+            game_post_gesture(event.device, event.kind);
+            changed = true;
+        } else if (hub.handle_backlog(rx_buf, len, &from, now, &backlog_msg, &fresh, &ack)) {
+            if (net->send_control(&from, &ack, sizeof(ack)) != ESP_OK) {
+                ESP_LOGW(TAG, "Backlog ACK for device %u not sent", ack.device);
+            }
+            if (fresh) {
+                replay_record_backlog(&backlog_msg);
+            }
+            changed = true;
+        }
+    }
+
+    imu_control_msg_t out[4];
+    net_peer_t to[4];
+    size_t n = hub.poll(now, out, to, 4);
+    for (size_t i = 0; i < n; i++) {
+        if (net->send_control(&to[i], &out[i], sizeof(out[i])) != ESP_OK) {
+            ESP_LOGW(TAG, "Settings for device %u not sent", out[i].device);
+        }
+    }
+    if (changed || n > 0) {
+        publish();
+    }
+}
+
+static CoJob node_control_job(void)
+{
+    while (1) {
+        co_await jobs.sleep_ms(NODE_CONTROL_PERIOD_MS);
+        control_step();
+    }
+}
+
+esp_err_t node_control_start(void)
+{
+    hub.init();
+    publish();
+    return jobs.spawn(node_control_job());
+}
+
+esp_err_t node_control_set(uint8_t device, const imu_settings_t *wanted)
+{
+    if (device >= HAL_MAX_IMU_DEVICES) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    set_request_t req = {device, *wanted};
+    return requests.push(req) ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+void node_control_get(uint8_t device, imu_node_state_t *out)
+{
+    if (device >= HAL_MAX_IMU_DEVICES) {
+        memset(out, 0, sizeof(*out));
+        return;
+    }
+    while (1) {
+        uint32_t before = snapshot_seq.load(std::memory_order_acquire);
+        if (before & 1) {
+            continue;
+        }
+        memcpy(out, &snapshot[device], sizeof(*out));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (snapshot_seq.load(std::memory_order_relaxed) == before) {
+            break;
+        }
+    }
+}
+
+void node_control_normalize(int device, IMU_DATA *sample)
+{
+    if (device < 0 || device >= HAL_MAX_IMU_DEVICES) {
+        return;
+    }
+    uint8_t r = ranges[device].load(std::memory_order_relaxed);
+    if (r == 0) {
+        // Power-on ranges, the common case
+        return;
+    }
+    imu_settings_t s = {};
+    s.accel_range = r & 0x0F;
+    s.gyro_range = r >> 4;
+    imu_settings_normalize(&s, sample);
+}
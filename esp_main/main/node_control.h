@@ -0,0 +1,65 @@
+#ifndef NODE_CONTROL_H
+#define NODE_CONTROL_H
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "hal.h"
+#include "imu_control.h"
+
+/*
+ * IMU node control
+ * ----------------
+ * The main board's end of the control channel (see imu_control.h). A
+ * background job (see jobs.h) drains the control socket every
+ * NODE_CONTROL_PERIOD_MS into an ImuControlHub and sends whatever SETs it
+ * has due, so new settings go out, and are resent until acknowledged,
+ * without any other task touching the socket.
+ *
+ * node_control_set() can be called from any task: requests queue for the
+ * job. What every node last reported reaches readers through a seqlock
+ * snapshot, and the game rescales each sample by the ranges its node
+ * acknowledged (node_control_normalize()), so calibration and cursor
+ * speed mean the same at every range.
+ *
+ * A node set to send events (IMU_UPLINK_EVENTS or _BOTH) reports taps,
+ * swings and stills it found itself; each is handed to game_post_gesture()
+ * with its imu_event_kind_t as the gesture kind.
+ *
+ * Samples a node held through a link outage (see imu_backlog.h) arrive
+ * late, with their own timestamps. The job ACKs every BACKLOG message by
+ * seq, repeats included, so the node can drop the batch; a repeat of the
+ * seq last seen from that node is a resend whose ACK got lost and is only
+ * counted. The first copy goes into the session recording as a side record
+ * (see replay.h), so the samples are kept at their own times without the
+ * game, which only ever wants the latest sample, seeing them. "node" on the
+ * console shows how far each node has caught up and how many repeats came.
+ */
+
+#define NODE_CONTROL_PERIOD_MS 20
+#define NODE_CONTROL_QUEUE_SIZE 8
+
+/**
+ * @brief Start the job; after jobs_start() and the network
+ */
+esp_err_t node_control_start(void);
+
+/**
+ * @brief Ask a node for new settings; sent once it has been heard from
+ *
+ * @return ESP_ERR_INVALID_ARG for a device out of range, ESP_ERR_NO_MEM if
+ *         the request queue is full
+ */
+esp_err_t node_control_set(uint8_t device, const imu_settings_t *wanted);
+
+/**
+ * @brief What the job knows about a device; never blocks
+ */
+void node_control_get(uint8_t device, imu_node_state_t *out);
+
+/**
+ * @brief Rescale a device's sample to the power-on ranges; cheap enough
+ *        for every sample
+ */
+void node_control_normalize(int device, IMU_DATA *sample);
+
+#endif // NODE_CONTROL_H
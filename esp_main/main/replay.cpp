@@ -0,0 +1,454 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "replay.h"
+#include "tasks.h"
+#include "telemetry.h"
+
+#define REPLAY_MAGIC "MHRP"
+#define REPLAY_VERSION 3
+#define REPLAY_END_MARKER 0xFF
+#define REPLAY_GAP_MARKER 0xFE
+#define REPLAY_GAP_BYTES 5
+#define REPLAY_BACKLOG_MARKER 0xFD
+#define REPLAY_BACKLOG_HEADER_BYTES 11  // marker, device, count, base_us
+#define REPLAY_GESTURE_FLAG 0x10
+
+#define RECORD_BLOCK_SIZE 4096
+// Worst case for one tick: flags + 2 varints per device + gestures + hash
+#define RECORD_MAX_TICK_BYTES (1 + N_CURSORS * 2 * 5 + 1 + GAME_MAX_GESTURES * 2 + 2)
+// Recovered node samples waiting for the game task to record them
+#define RECORD_BACKLOG_QUEUE_SIZE 4
+
+static const char *TAG = "replay";
+
+typedef struct {
+    int block;  // index into record_blocks, -1 means "close the file"
+    size_t len;
+} record_block_t;
+
+// Recorder state. The game task fills one block while the writer task drains
+// the other. Blocks travel game -> writer on the full queue and come back on
+// the free queue, so neither side ever touches a block the other owns.
+static FILE *record_file = NULL;
+static uint8_t record_blocks[2][RECORD_BLOCK_SIZE];
+static int record_active_block = 0;
+static size_t record_fill = 0;
+static int32_t record_prev_y[N_CURSORS];
+static int32_t record_prev_z[N_CURSORS];
+static QueueHandle_t record_full_queue = NULL;
+static QueueHandle_t record_free_queue = NULL;
+static StaticQueue_t record_backlog_storage;
+static uint8_t record_backlog_buffer[RECORD_BACKLOG_QUEUE_SIZE * sizeof(imu_backlog_msg_t)];
+static QueueHandle_t record_backlog_queue = NULL;
+static imu_backlog_msg_t record_backlog_msg;   // game task only
+static TaskHandle_t record_writer = NULL;
+static SemaphoreHandle_t record_closed = NULL;  // given once the file is closed
+static volatile bool recording = false;
+static bool record_header_pending = false;  // block 0 still holds the header
+static uint32_t record_block_ticks = 0;     // ticks in the active block
+static uint32_t record_gap_ticks = 0;       // ticks lost since the last block that went out
+static replay_record_stats_t record_stats = {};
+
+static uint16_t fold_hash(uint32_t h)
+{
+    return (uint16_t)(h ^ (h >> 16));
+}
+
+static size_t put_varint(uint8_t *out, int32_t value)
+{
+    uint32_t v = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31); // zigzag
+    size_t n = 0;
+    while (v >= 0x80) {
+        out[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    out[n++] = (uint8_t)v;
+    return n;
+}
+
+static bool get_varint(FILE *fh, int32_t *value)
+{
+    uint32_t v = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        int c = fgetc(fh);
+        if (c == EOF) {
+            return false;
+        }
+        v |= (uint32_t)(c & 0x7F) << shift;
+        if (!(c & 0x80)) {
+            *value = (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void record_writer_task(void *pvParameters)
+{
+    record_block_t block;
+    while (xQueueReceive(record_full_queue, &block, portMAX_DELAY) == pdTRUE) {
+        if (block.block < 0) {
+            break;
+        }
+        int64_t write_start = esp_timer_get_time();
+        if (fwrite(record_blocks[block.block], 1, block.len, record_file) != block.len) {
+            ESP_LOGE(TAG, "Short write to session file");
+        }
+        telemetry_sd_write(block.len, esp_timer_get_time() - write_start);
+        xQueueSend(record_free_queue, &block.block, portMAX_DELAY);
+    }
+
+    fclose(record_file);
+    record_file = NULL;
+    record_writer = NULL;
+    xSemaphoreGive(record_closed);
+    vTaskDelete(NULL);
+}
+
+static void record_submit_block(void)
+{
+    // Never wait on the writer from the game task. No free block means the
+    // SD card is a whole block behind, so this block is dropped and reused,
+    // starting with a gap record for everything lost since the last block
+    // that went out. The header block is the exception: without it the file
+    // is no recording at all. It is the first one submitted and the spare
+    // block is free by then, so the wait never actually blocks.
+    int next;
+    TickType_t wait = record_header_pending ? portMAX_DELAY : 0;
+    if (xQueueReceive(record_free_queue, &next, wait) != pdTRUE) {
+        record_stats.dropped_blocks++;
+        record_gap_ticks += record_block_ticks;
+        uint8_t *out = record_blocks[record_active_block];
+        out[0] = REPLAY_GAP_MARKER;
+        memcpy(out + 1, &record_gap_ticks, sizeof(record_gap_ticks));
+        record_fill = REPLAY_GAP_BYTES;
+        record_block_ticks = 0;
+        return;
+    }
+    record_block_t block = {record_active_block, record_fill};
+    xQueueSend(record_full_queue, &block, 0);
+    record_active_block = next;
+    record_fill = 0;
+    record_block_ticks = 0;
+    record_gap_ticks = 0;
+    record_header_pending = false;
+}
+
+esp_err_t replay_record_start(const char *path, uint32_t seed)
+{
+    if (recording) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    record_file = fopen(path, "wb");
+    if (record_file == NULL) {
+        ESP_LOGE(TAG, "Failed to open %s for recording", path);
+        return ESP_FAIL;
+    }
+
+    if (record_full_queue == NULL) {
+        // Room for both blocks plus the close marker
+        record_full_queue = xQueueCreate(3, sizeof(record_block_t));
+        record_free_queue = xQueueCreate(2, sizeof(int));
+        record_closed = xSemaphoreCreateBinary();
+        record_backlog_queue = xQueueCreateStatic(RECORD_BACKLOG_QUEUE_SIZE, sizeof(imu_backlog_msg_t),
+                                                  record_backlog_buffer, &record_backlog_storage);
+        if (record_full_queue == NULL || record_free_queue == NULL || record_closed == NULL) {
+            fclose(record_file);
+            record_file = NULL;
+            return ESP_ERR_NO_MEM;
+        }
+        telemetry_watch_queue("rec_blocks", record_full_queue);
+    }
+    xQueueReset(record_full_queue);
+    xQueueReset(record_free_queue);
+    xQueueReset(record_backlog_queue);
+    int spare = 1;
+    xQueueSend(record_free_queue, &spare, 0);
+
+    uint8_t *header = record_blocks[0];
+    uint16_t tick_hz = GAME_TICK_HZ;
+    memcpy(header, REPLAY_MAGIC, 4);
+    header[4] = REPLAY_VERSION;
+    header[5] = N_CURSORS;
+    memcpy(header + 6, &tick_hz, sizeof(tick_hz));
+    memcpy(header + 8, &seed, sizeof(seed));
+
+    record_active_block = 0;
+    record_fill = 12;
+    record_header_pending = true;
+    record_block_ticks = 0;
+    record_gap_ticks = 0;
+    memset(record_prev_y, 0, sizeof(record_prev_y));
+    memset(record_prev_z, 0, sizeof(record_prev_z));
+    memset(&record_stats, 0, sizeof(record_stats));
+
+    if (task_start(TASK_REC_WRITER, record_writer_task, NULL, &record_writer) != pdPASS) {
+        fclose(record_file);
+        record_file = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+
+    recording = true;
+    ESP_LOGI(TAG, "Recording session to %s (seed %" PRIu32 ")", path, seed);
+    return ESP_OK;
+}
+
+static void record_write_backlog(const imu_backlog_msg_t *msg)
+{
+    size_t records = msg->count * sizeof(imu_backlog_record_t);
+    size_t n = REPLAY_BACKLOG_HEADER_BYTES + records;
+    // Leave room for the tick that follows
+    if (record_fill + n + RECORD_MAX_TICK_BYTES > RECORD_BLOCK_SIZE) {
+        record_submit_block();
+    }
+    uint8_t *out = record_blocks[record_active_block] + record_fill;
+    out[0] = REPLAY_BACKLOG_MARKER;
+    out[1] = msg->device;
+    out[2] = msg->count;
+    memcpy(out + 3, &msg->base_us, sizeof(msg->base_us));
+    memcpy(out + REPLAY_BACKLOG_HEADER_BYTES, msg->records, records);
+    record_fill += n;
+    record_stats.bytes += n;
+    record_stats.backlog_records += msg->count;
+}
+
+void replay_record_backlog(const imu_backlog_msg_t *msg)
+{
+    if (!recording) {
+        return;
+    }
+    if (xQueueSend(record_backlog_queue, msg, 0) != pdTRUE) {
+        record_stats.backlog_dropped++;
+    }
+}
+
+void replay_record_tick(const GameInput *in, uint32_t world_hash)
+{
+    if (!recording) {
+        return;
+    }
+
+    // At most one recovered batch per tick, ahead of the tick's own record
+    if (xQueueReceive(record_backlog_queue, &record_backlog_msg, 0) == pdTRUE) {
+        record_write_backlog(&record_backlog_msg);
+    }
+
+    uint8_t *out = record_blocks[record_active_block] + record_fill;
+    size_t n = 0;
+
+    uint8_t flags = (uint8_t)(in->new_sample_mask & 0x0F);
+    if (in->n_gestures > 0) {
+        flags |= REPLAY_GESTURE_FLAG;
+    }
+    out[n++] = flags;
+
+    for (int c = 0; c < N_CURSORS; c++) {
+        if (!(in->new_sample_mask & (1u << c))) {
+            continue;
+        }
+        n += put_varint(out + n, in->gyro_y[c] - record_prev_y[c]);
+        n += put_varint(out + n, in->gyro_z[c] - record_prev_z[c]);
+        record_prev_y[c] = in->gyro_y[c];
+        record_prev_z[c] = in->gyro_z[c];
+    }
+
+    if (in->n_gestures > 0) {
+        out[n++] = in->n_gestures;
+        for (int i = 0; i < in->n_gestures; i++) {
+            out[n++] = in->gestures[i].device;
+            out[n++] = in->gestures[i].kind;
+        }
+    }
+
+    uint16_t hash = fold_hash(world_hash);
+    memcpy(out + n, &hash, sizeof(hash));
+    n += sizeof(hash);
+
+    record_fill += n;
+    record_block_ticks++;
+    record_stats.ticks++;
+    record_stats.bytes += n;
+
+    if (record_fill + RECORD_MAX_TICK_BYTES > RECORD_BLOCK_SIZE) {
+        record_submit_block();
+    }
+}
+
+void replay_record_stop(void)
+{
+    if (!recording) {
+        return;
+    }
+    recording = false;
+
+    record_blocks[record_active_block][record_fill++] = REPLAY_END_MARKER;
+    record_block_t block = {record_active_block, record_fill};
+    xQueueSend(record_full_queue, &block, portMAX_DELAY);
+    block.block = -1;
+    xQueueSend(record_full_queue, &block, portMAX_DELAY);
+    record_fill = 0;
+    // Wait for the writer so the file is complete once this returns
+    xSemaphoreTake(record_closed, portMAX_DELAY);
+
+    ESP_LOGI(TAG, "Recording stopped: %" PRIu32 " ticks, %" PRIu32 " bytes, %" PRIu32 " blocks dropped, "
+             "%" PRIu32 " recovered samples",
+             record_stats.ticks, record_stats.bytes, record_stats.dropped_blocks, record_stats.backlog_records);
+}
+
+void replay_get_record_stats(replay_record_stats_t *out)
+{
+    *out = record_stats;
+}
+
+esp_err_t replay_run(const char *path, replay_result_t *result)
+{
+    memset(result, 0, sizeof(*result));
+    result->first_divergence = -1;
+    result->gap_at = -1;
+
+    FILE *fh = fopen(path, "rb");
+    if (fh == NULL) {
+        ESP_LOGE(TAG, "Failed to open %s", path);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    uint8_t header[12];
+    if (fread(header, 1, sizeof(header), fh) != sizeof(header) ||
+        memcmp(header, REPLAY_MAGIC, 4) != 0 || header[4] != REPLAY_VERSION) {
+        ESP_LOGE(TAG, "%s is not a session recording", path);
+        fclose(fh);
+        return ESP_ERR_INVALID_ARG;
+    }
+    uint16_t tick_hz;
+    uint32_t seed;
+    memcpy(&tick_hz, header + 6, sizeof(tick_hz));
+    memcpy(&seed, header + 8, sizeof(seed));
+    if (header[5] != N_CURSORS || tick_hz != GAME_TICK_HZ) {
+        ESP_LOGE(TAG, "Recording made with %d devices at %d Hz, expected %d at %d Hz",
+                 header[5], tick_hz, N_CURSORS, GAME_TICK_HZ);
+        fclose(fh);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    // Bigger stdio buffer: replay is bound by how fast records can be parsed
+    static char read_buffer[RECORD_BLOCK_SIZE];
+    setvbuf(fh, read_buffer, _IOFBF, sizeof(read_buffer));
+
+    game_init(seed);
+    game_set_silent(true);
+
+    GameInput input = {};
+    esp_err_t ret = ESP_OK;
+    int64_t start = esp_timer_get_time();
+
+    while (1) {
+        int flags = fgetc(fh);
+        if (flags == EOF || flags == REPLAY_END_MARKER) {
+            break;
+        }
+        if (flags == REPLAY_GAP_MARKER) {
+            // The recorder fell behind and lost these ticks. Nothing after
+            // them can be replayed: the world and the sample deltas both
+            // depend on what was lost.
+            if (fread(&result->gap_ticks, sizeof(result->gap_ticks), 1, fh) != 1) {
+                ret = ESP_ERR_INVALID_SIZE;
+            }
+            result->gap_at = result->ticks;
+            break;
+        }
+        if (flags == REPLAY_BACKLOG_MARKER) {
+            // Samples a node caught up on after an outage. The game never
+            // saw them, so there is nothing to replay.
+            uint8_t side[REPLAY_BACKLOG_HEADER_BYTES - 1];
+            if (fread(side, sizeof(side), 1, fh) != 1 || side[1] > IMU_BACKLOG_BATCH ||
+                fseek(fh, side[1] * sizeof(imu_backlog_record_t), SEEK_CUR) != 0) {
+                ESP_LOGE(TAG, "Truncated side record at tick %" PRIu32, result->ticks);
+                ret = ESP_ERR_INVALID_SIZE;
+                break;
+            }
+            continue;
+        }
+
+        input.new_sample_mask = flags & 0x0F;
+        input.time_us = (int64_t)result->ticks * GAME_TICK_US;
+        bool ok = true;
+        for (int c = 0; c < N_CURSORS && ok; c++) {
+            if (!(input.new_sample_mask & (1u << c))) {
+                continue;
+            }
+            int32_t dy, dz;
+            ok = get_varint(fh, &dy) && get_varint(fh, &dz);
+            input.gyro_y[c] += dy;
+            input.gyro_z[c] += dz;
+        }
+
+        input.n_gestures = 0;
+        if (ok && (flags & REPLAY_GESTURE_FLAG)) {
+            int count = fgetc(fh);
+            ok = count != EOF && count <= GAME_MAX_GESTURES;
+            for (int i = 0; ok && i < count; i++) {
+                int device = fgetc(fh);
+                int kind = fgetc(fh);
+                ok = device != EOF && kind != EOF;
+                input.gestures[i].device = (uint8_t)device;
+                input.gestures[i].kind = (uint8_t)kind;
+            }
+            input.n_gestures = ok ? (uint8_t)count : 0;
+        }
+
+        uint16_t expected;
+        if (!ok || fread(&expected, sizeof(expected), 1, fh) != 1) {
+            ESP_LOGE(TAG, "Truncated record at tick %" PRIu32, result->ticks);
+            ret = ESP_ERR_INVALID_SIZE;
+            break;
+        }
+
+        game_tick(&input);
+
+        if (fold_hash(game_world_hash()) != expected) {
+            if (result->first_divergence < 0) {
+                result->first_divergence = result->ticks;
+            }
+            result->diverged_ticks++;
+        }
+        result->ticks++;
+    }
+
+    result->elapsed_us = esp_timer_get_time() - start;
+    if (result->elapsed_us > 0) {
+        result->speedup = (float)((int64_t)result->ticks * GAME_TICK_US) / result->elapsed_us;
+    }
+
+    game_set_silent(false);
+    fclose(fh);
+
+    ESP_LOGI(TAG, "Replayed %" PRIu32 " ticks in %" PRId64 " us (%.1fx real time), %" PRIu32 " diverged (first at %" PRId64 ")",
+             result->ticks, result->elapsed_us, result->speedup,
+             result->diverged_ticks, result->first_divergence);
+    return ret;
+}
+
+void replay_print_result(const char *path, esp_err_t err, const replay_result_t *result)
+{
+    printf("replay %s: %s\n", path, esp_err_to_name(err));
+    printf("  ticks     %" PRIu32 " in %" PRId64 " us (%.1fx real time)\n",
+           result->ticks, result->elapsed_us, result->speedup);
+    if (result->diverged_ticks > 0) {
+        printf("  diverged  %" PRIu32 " ticks, first at tick %" PRId64 "\n",
+               result->diverged_ticks, result->first_divergence);
+    } else {
+        printf("  diverged  none\n");
+    }
+    if (result->gap_at >= 0) {
+        printf("  stopped   at tick %" PRId64 ": the recorder lost the next %" PRIu32 " ticks\n",
+               result->gap_at, result->gap_ticks);
+    }
+}
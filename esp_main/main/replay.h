@@ -0,0 +1,103 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "game.h"
+#include "hal.h"
+#include "imu_control.h"
+
+#define SESSION_FILE HAL_STORAGE_ROOT "/session.rec"
+
+/*
+ * Session stream format (little-endian)
+ * -------------------------------------
+ * Header, 12 bytes:
+ *   "MHRP", u8 version, u8 device count, u16 tick rate (Hz), u32 RNG seed
+ *
+ * One record per simulation tick (the tick index is the timestamp):
+ *   u8 flags     bits 0-3: devices with a new IMU sample this tick
+ *                bit 4:    gesture list follows
+ *   per flagged device: zigzag varint delta of gyro_y, then of gyro_z,
+ *                       against that device's previous recorded sample
+ *   if bit 4:    u8 count, then count x (u8 device, u8 kind)
+ *   u16          world hash after the tick (32-bit hash folded to 16)
+ *
+ * A flags byte of 0xFD is a side record of samples a node held through a
+ * link outage and uploaded afterwards (see imu_backlog.h): u8 device, u8
+ * count, i64 base_us on the node's clock, then count x imu_backlog_record_t.
+ * The game never saw them, so a replay skips them.
+ *
+ * A flags byte of 0xFE is a gap: a u32 count of ticks the recorder dropped
+ * because the SD card fell behind follows, and everything after it can only
+ * be read, not replayed. A flags byte of 0xFF ends the stream. An idle tick
+ * costs 3 bytes.
+ */
+
+typedef struct {
+    uint32_t ticks;           // ticks replayed
+    uint32_t diverged_ticks;  // ticks whose world hash did not match the recording
+    int64_t first_divergence; // first diverging tick, -1 if none
+    int64_t elapsed_us;       // wall time spent replaying
+    float speedup;            // simulated time / wall time
+    int64_t gap_at;           // tick the replay stopped at a recording gap, -1 if none
+    uint32_t gap_ticks;       // ticks lost in that gap
+} replay_result_t;
+
+typedef struct {
+    uint32_t ticks;
+    uint32_t bytes;
+    uint32_t dropped_blocks;  // blocks lost because the writer fell behind; each
+                              // leaves a gap record, and replay stops at the first
+    uint32_t backlog_records; // recovered node samples written as side records
+    uint32_t backlog_dropped; // batches of them that found the queue full
+} replay_record_stats_t;
+
+/**
+ * @brief Start recording every simulation input to a file
+ *
+ * Must be called before the game task starts or while it is parked, with
+ * the seed it will (re)start the world with (see game_session_start()).
+ * Records are built in RAM by the game task and written out in blocks by a
+ * low-priority writer task, so SD latency never stalls a tick.
+ */
+esp_err_t replay_record_start(const char *path, uint32_t seed);
+
+/**
+ * @brief Append one tick to the recording (no-op when not recording)
+ */
+void replay_record_tick(const GameInput *in, uint32_t world_hash);
+
+/**
+ * @brief Add samples a node held through an outage to the recording
+ *
+ * Safe to call from any task: the batch is queued, and the game task writes
+ * it out as a side record with its next tick. No-op when not recording.
+ */
+void replay_record_backlog(const imu_backlog_msg_t *msg);
+
+/**
+ * @brief Flush and close the recording
+ *
+ * Returns once the file is complete. Must not race replay_record_tick(), so
+ * the game task has to be parked first (see game_session_end()).
+ */
+void replay_record_stop(void);
+
+void replay_get_record_stats(replay_record_stats_t *out);
+
+/**
+ * @brief Re-run a recorded session as fast as possible and check every
+ *        tick's world hash against the recording
+ *
+ * Drives the game state directly, so it must not run alongside game_task.
+ * Hit SFX are muted for the duration.
+ */
+esp_err_t replay_run(const char *path, replay_result_t *result);
+
+/**
+ * @brief Print a replay_run() result to stdout
+ */
+void replay_print_result(const char *path, esp_err_t err, const replay_result_t *result);
+
+#endif // REPLAY_H
@@ -0,0 +1,127 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "deadline.h"
+#include "game.h"
+#include "replay.h"
+#include "scenario.h"
+#include "telemetry.h"
+
+static const char *TAG = "scenario";
+
+static int env_int(const char *name, int fallback)
+{
+    const char *value = getenv(name);
+    return value ? atoi(value) : fallback;
+}
+
+static uint32_t bus_lost(const telemetry_snapshot_t *snap)
+{
+    uint32_t lost = 0;
+    for (size_t i = 0; i < snap->n_topics; i++) {
+        for (size_t j = 0; j < snap->topics[i].n_subscribers; j++) {
+            lost += snap->topics[i].subscribers[j].lost;
+        }
+    }
+    return lost;
+}
+
+// Flat name -> number object; tools/perf_scenarios.py knows which way is better
+static void write_results(FILE *f, const telemetry_snapshot_t *start, const telemetry_snapshot_t *end)
+{
+    double window_s = (end->time_us - end->since_us) / 1e6;
+    if (window_s <= 0) {
+        window_s = 1.0;
+    }
+
+    uint32_t imu_samples = 0;
+    for (int i = 0; i < HAL_MAX_IMU_DEVICES; i++) {
+        imu_samples += end->imu_samples[i];
+    }
+
+    replay_record_stats_t record;
+    replay_get_record_stats(&record);
+
+    uint32_t alloc_violations = 0;
+    for (int i = 0; i < ALLOC_REGION_COUNT; i++) {
+        alloc_violations += end->allocs[i].violations;
+    }
+
+    uint32_t deadline_misses = 0;
+    for (int i = 0; i < DEADLINE_COUNT; i++) {
+        deadline_stats_t st;
+        deadline_get_stats((deadline_id_t)i, &st);
+        deadline_misses += st.late + st.overruns;
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    fprintf(f, "{\n  \"window_s\": %.1f,\n  \"metrics\": {\n", window_s);
+    fprintf(f, "    \"frames_per_s\": %.1f,\n", end->frames / window_s);
+    fprintf(f, "    \"frame_p50_us\": %" PRIu32 ",\n", telemetry_frame_percentile_us(end, NULL, 50));
+    fprintf(f, "    \"frame_p95_us\": %" PRIu32 ",\n", telemetry_frame_percentile_us(end, NULL, 95));
+    fprintf(f, "    \"frame_p99_us\": %" PRIu32 ",\n", telemetry_frame_percentile_us(end, NULL, 99));
+    fprintf(f, "    \"frame_max_us\": %" PRIu32 ",\n", end->frame_max_us);
+    fprintf(f, "    \"audio_underruns\": %" PRIu32 ",\n", end->audio_underruns);
+    fprintf(f, "    \"sfx_max_us\": %" PRId64 ",\n", end->sfx.count > 0 ? end->sfx.max_us : (int64_t)0);
+    fprintf(f, "    \"imu_samples_per_s\": %.1f,\n", imu_samples / window_s);
+    fprintf(f, "    \"imu_lost\": %" PRIu32 ",\n", end->imu_lost);
+    fprintf(f, "    \"imu_latency_p50_us\": %" PRIu32 ",\n", telemetry_imu_latency_percentile_us(end, NULL, 50));
+    fprintf(f, "    \"imu_latency_p95_us\": %" PRIu32 ",\n", telemetry_imu_latency_percentile_us(end, NULL, 95));
+    fprintf(f, "    \"imu_latency_max_us\": %" PRIu32 ",\n", end->imu_latency_max_us);
+    fprintf(f, "    \"bus_lost\": %" PRIu32 ",\n", bus_lost(end) - bus_lost(start));
+    fprintf(f, "    \"record_dropped_blocks\": %" PRIu32 ",\n", record.dropped_blocks);
+    fprintf(f, "    \"alloc_violations\": %" PRIu32 ",\n", alloc_violations);
+    fprintf(f, "    \"deadline_misses\": %" PRIu32 ",\n", deadline_misses);
+    for (size_t i = 0; i < end->n_regions; i++) {
+        fprintf(f, "    \"peak_%s_bytes\": %u,\n", end->regions[i].name, (unsigned)end->regions[i].peak);
+    }
+    fprintf(f, "    \"rss_peak_kb\": %ld\n", usage.ru_maxrss);
+    fprintf(f, "  }\n}\n");
+}
+
+bool scenario_requested(void)
+{
+    return getenv("MCHACKS_SCENARIO_SECONDS") != NULL;
+}
+
+void scenario_run(void)
+{
+    int seconds = env_int("MCHACKS_SCENARIO_SECONDS", 60);
+    int warmup_s = env_int("MCHACKS_SCENARIO_WARMUP_S", 2);
+    const char *out_path = getenv("MCHACKS_SCENARIO_OUT") ? getenv("MCHACKS_SCENARIO_OUT") : "scenario.json";
+    if (getenv("MCHACKS_LOG_LEVEL")) {
+        esp_log_level_set("*", (esp_log_level_t)env_int("MCHACKS_LOG_LEVEL", ESP_LOG_INFO));
+    }
+
+    // Let lazy buffers, file opens and the first IMU packets settle first
+    vTaskDelay(pdMS_TO_TICKS(warmup_s * 1000));
+
+    static telemetry_snapshot_t start;
+    static telemetry_snapshot_t end;
+    telemetry_reset();
+    deadline_clear();
+    telemetry_capture(&start);
+    ESP_LOGI(TAG, "Measuring for %d s", seconds);
+    vTaskDelay(pdMS_TO_TICKS(seconds * 1000));
+    telemetry_capture(&end);
+    // End the session so its recording is complete before exit()
+    game_session_end();
+
+    telemetry_print(&end, NULL);
+
+    FILE *f = fopen(out_path, "w");
+    if (f == NULL) {
+        ESP_LOGE(TAG, "Failed to open %s", out_path);
+        exit(1);
+    }
+    write_results(f, &start, &end);
+    fclose(f);
+    ESP_LOGI(TAG, "Results in %s", out_path);
+    exit(0);
+}
@@ -0,0 +1,37 @@
+#ifndef SCENARIO_H
+#define SCENARIO_H
+
+#include <stdbool.h>
+
+/*
+ * Scenario runs (Linux target only)
+ * ---------------------------------
+ * tools/perf_scenarios.py boots the whole firmware on the host together
+ * with a set of host IMU nodes, lets it run a fixed window and compares what
+ * came out against tools/perf_baselines.json (the firmware's budgets until
+ * measured on the reference host). The firmware side is driven by the
+ * environment:
+ *
+ *   MCHACKS_SCENARIO_SECONDS   length of the measured window; unset = normal run
+ *   MCHACKS_SCENARIO_WARMUP_S  time after boot before the window opens (default 2)
+ *   MCHACKS_SCENARIO_OUT       where the results go (default scenario.json)
+ *   MCHACKS_LOG_LEVEL          esp_log level for every tag (0-5, default unchanged)
+ *
+ * The window is a telemetry_reset() .. telemetry_capture() pair, so the
+ * results are the same counters the console shows on the board, plus the
+ * process's peak RSS standing in for the heap figures the host can't give.
+ */
+
+/**
+ * @brief Whether this run was started as a scenario
+ */
+bool scenario_requested(void);
+
+/**
+ * @brief Measure the scenario window, write the results and exit the process
+ *
+ * Call once boot is done. Never returns.
+ */
+void scenario_run(void);
+
+#endif // SCENARIO_H
@@ -19,15 +19,15 @@
 #include "sd_test_io.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "jobs.h"
 #if SOC_SDMMC_IO_POWER_EXTERNAL
 #include "sd_pwr_ctrl_by_on_chip_ldo.h"
 #endif
 
 #define EXAMPLE_MAX_CHAR_SIZE    64
-#define BYTE_QUEUE_SIZE          100
-#define READ_TASK_STACK_SIZE     4096
-#define PROCESS_TASK_STACK_SIZE  4096
+#define BYTE_QUEUE_SIZE          128  // power of two for CoChannel
+#define READ_TIMEOUT_MS          5000
 #define MOUNT_POINT              "/sdcard"
 
 static const char *TAG = "example";
@@ -38,8 +38,14 @@ static sdmmc_host_t host;
 static const char mount_point[] = MOUNT_POINT;
 bool sd_card_mounted = false;
 
-// FreeRTOS queue for byte-by-byte processing
-static QueueHandle_t byte_queue = NULL;
+// Channels between the caller and the byte-by-byte jobs
+static CoChannel<uint8_t, BYTE_QUEUE_SIZE> byte_channel;
+static CoChannel<const char *, 2> path_channel;
+static SemaphoreHandle_t read_done = NULL;
+// Set once both jobs are up; a reader that started without its processor
+// isn't spawned a second time on the retry
+static bool byte_workers_started = false;
+static bool file_reader_started = false;
 
 // Special marker to indicate end of file
 #define EOF_MARKER 0xFF
@@ -68,52 +74,58 @@ static esp_err_t s_example_write_file(const char *path, uint8_t *data, size_t da
     return (written == data_len) ? ESP_OK : ESP_FAIL;
 }
 
-static void file_reader_task(void *pvParameters)
+// The reader and processor are jobs on the shared executor (see jobs.h),
+// spawned on first use, that wait for the next file instead of ending. Their
+// frames come from job_frames, so repeated reads never touch the heap.
+static CoJob file_reader_job(void)
 {
-    const char *file_path = (const char *)pvParameters;
-    FILE *f = fopen(file_path, "rb");
-    if (!f) {
-        ESP_LOGE(TAG, "Reader: Failed to open %s", file_path);
-        vTaskDelete(NULL);
-        return;
-    }
+    while (1) {
+        const char *file_path;
+        co_await path_channel.pop(&file_path);
 
-    ESP_LOGI(TAG, "Reader: Reading %s byte-by-byte", file_path);
-    int byte_count = 0, ch;
+        FILE *f = fopen(file_path, "rb");
+        if (!f) {
+            ESP_LOGE(TAG, "Reader: Failed to open %s", file_path);
+        } else {
+            ESP_LOGI(TAG, "Reader: Reading %s byte-by-byte", file_path);
+            int byte_count = 0, ch;
+
+            while ((ch = fgetc(f)) != EOF) {
+                uint8_t byte = (uint8_t)ch;
+                co_await byte_channel.push(byte);
+                ESP_LOGI(TAG, "Reader: Byte #%d: 0x%02X", ++byte_count, byte);
+                co_await jobs.sleep_ms(10);
+            }
 
-    while ((ch = fgetc(f)) != EOF) {
-        uint8_t byte = (uint8_t)ch;
-        if (xQueueSend(byte_queue, &byte, portMAX_DELAY) != pdTRUE) {
-            ESP_LOGE(TAG, "Reader: Queue send failed");
-            break;
+            fclose(f);
+            ESP_LOGI(TAG, "Reader: Finished %d bytes", byte_count);
         }
-        ESP_LOGI(TAG, "Reader: Byte #%d: 0x%02X", ++byte_count, byte);
-        vTaskDelay(pdMS_TO_TICKS(10));
-    }
 
-    fclose(f);
-    ESP_LOGI(TAG, "Reader: Finished %d bytes", byte_count);
-
-    uint8_t eof_marker = EOF_MARKER;
-    xQueueSend(byte_queue, &eof_marker, portMAX_DELAY);
-    vTaskDelete(NULL);
+        co_await byte_channel.push(EOF_MARKER);
+    }
 }
 
-static void byte_processor_task(void *pvParameters)
+static CoJob byte_processor_job(void)
 {
     uint8_t byte, buffer[EXAMPLE_MAX_CHAR_SIZE + 1] = {0};
     int processed_count = 0, buffer_idx = 0;
 
     ESP_LOGI(TAG, "Processor: Started, waiting for bytes...");
 
-    while (xQueueReceive(byte_queue, &byte, portMAX_DELAY) == pdTRUE) {
+    while (1) {
+        co_await byte_channel.pop(&byte);
         if (byte == EOF_MARKER) {
             ESP_LOGI(TAG, "Processor: EOF marker received");
             if (buffer_idx > 0) {
                 ESP_LOGI(TAG, "Processor: Final buffer (%d bytes):", buffer_idx);
                 ESP_LOG_BUFFER_HEX(TAG, buffer, buffer_idx);
             }
-            break;
+            ESP_LOGI(TAG, "Processor: Finished %d bytes", processed_count);
+            processed_count = 0;
+            buffer_idx = 0;
+            memset(buffer, 0, sizeof(buffer));
+            xSemaphoreGive(read_done);
+            continue;
         }
 
         ESP_LOGI(TAG, "Processor: Byte #%d: 0x%02X", ++processed_count, byte);
@@ -127,38 +139,53 @@ static void byte_processor_task(void *pvParameters)
             memset(buffer, 0, sizeof(buffer));
         }
     }
+}
 
-    ESP_LOGI(TAG, "Processor: Finished %d bytes", processed_count);
-    vTaskDelete(NULL);
+static esp_err_t start_byte_workers(void)
+{
+    if (read_done == NULL) {
+        static StaticSemaphore_t read_done_storage;
+        read_done = xSemaphoreCreateBinaryStatic(&read_done_storage);
+    }
+
+    esp_err_t ret;
+    if (!file_reader_started) {
+        if ((ret = jobs.spawn(file_reader_job())) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to start the reader job: %s", esp_err_to_name(ret));
+            return ret;
+        }
+        file_reader_started = true;
+    }
+    if ((ret = jobs.spawn(byte_processor_job())) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start the processor job: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    byte_workers_started = true;
+    ESP_LOGI(TAG, "Reader and processor jobs started (byte channel: %d)", BYTE_QUEUE_SIZE);
+    return ESP_OK;
 }
 
 static esp_err_t s_example_read_file_byte_by_byte(const char *path)
 {
-    ESP_LOGI(TAG, "Starting byte-by-byte reading with FreeRTOS queue");
+    ESP_LOGI(TAG, "Starting byte-by-byte reading through a job channel");
 
-    if (!byte_queue) {
-        byte_queue = xQueueCreate(BYTE_QUEUE_SIZE, sizeof(uint8_t));
-        if (!byte_queue) {
-            ESP_LOGE(TAG, "Failed to create byte queue");
-            return ESP_FAIL;
+    if (!byte_workers_started) {
+        esp_err_t ret = start_byte_workers();
+        if (ret != ESP_OK) {
+            return ret;
         }
-        ESP_LOGI(TAG, "Created byte queue (size: %d)", BYTE_QUEUE_SIZE);
     }
 
-    if (xTaskCreate(file_reader_task, "file_reader", READ_TASK_STACK_SIZE,
-                    (void *)path, 5, NULL) != pdPASS) {
-        ESP_LOGE(TAG, "Failed to create reader task");
-        return ESP_FAIL;
+    // path must stay valid until the processor reports the file done. A
+    // read that timed out may still hold the channel.
+    if (!path_channel.try_push(path)) {
+        ESP_LOGE(TAG, "Reader busy, %s not read", path);
+        return ESP_ERR_INVALID_STATE;
     }
-
-    if (xTaskCreate(byte_processor_task, "byte_processor", PROCESS_TASK_STACK_SIZE,
-                    NULL, 5, NULL) != pdPASS) {
-        ESP_LOGE(TAG, "Failed to create processor task");
-        return ESP_FAIL;
+    if (xSemaphoreTake(read_done, pdMS_TO_TICKS(READ_TIMEOUT_MS)) != pdTRUE) {
+        ESP_LOGE(TAG, "Timed out reading %s", path);
+        return ESP_ERR_TIMEOUT;
     }
-
-    ESP_LOGI(TAG, "Reader and processor tasks created");
-    vTaskDelay(pdMS_TO_TICKS(5000));
     return ESP_OK;
 }
 
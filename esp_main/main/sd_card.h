@@ -7,6 +7,8 @@
 
 #include "esp_err.h"
 
+extern bool sd_card_mounted;
+
 void spi_main();
 esp_err_t sd_card_init(void);
 void sd_card_deinit(void);
@@ -18,54 +18,45 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
 
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
 #include <dirent.h> // Added for directory listing
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <atomic>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "esp_log.h"
 #include "esp_err.h"
-#include "driver/i2s_pdm.h"
-#include "driver/gpio.h"
-#include "sd_card.h" // Shared SD card initialization
-
-// Setup Pins
-#define I2S_CLK_PIN GPIO_NUM_1  // PDM CLK (Bit Clock) - NOT CONNECTED to Amp
-#define I2S_DATA_PIN GPIO_NUM_2 // PDM DATA (DOUT) -> Connect to Amp Input with RC Filter
-
-/* WIRING GUIDE: PAM8403 (Analog Amp) + ESP32 (PDM Digital Out)
- * -------------------------------------------------------------
- * Since the ESP32-S3 doesn't have an internal DAC, we use PDM mode.
- * The PAM8403 expects an ANALOG signal.
- *
- * To make this work, you need a simple RC Low-Pass Filter on the Data Pin.
- *
- * [ESP32 Side]                    [PAM8403 Amp Input Side]
- * 5V / VBUS   ------------------>  5V +
- * GND         ------------------>  5V -
- * GND         ------------------>  ⊥ (Upside down T / Audio Ground)
- *
- * GPIO 2 (Data) -> [Resistor] -> + -> L (Left Input)
- *                    (1k-4.7k)   |
- *                                = [Capacitor] (10nF-100nF)
- *                                |
- *                               GND
- *
- * Note: If you don't have a resistor/capacitor, you can connect GPIO 2
- * directly to "L", but the sound might be harsh/noisy.
- *
- * [Speaker Side]
- * Connect your speaker wires to L+ and L- on the PAM8403.
- * DO NOT CONNECT L- or R- to GROUND! The PAM8403 outputs are "Bridged" (BTL).
- */
+#include "esp_timer.h"
+#include "alloc_track.h"
+#include "arenas.h"
+#include "audio_dsp.h"
+#include "audio_pipeline.h"
+#include "hal.h"
+#include "bus.h"
+#include "deadline.h"
+#include "lf_queue.h"
+#include "speaker.h"
+#include "tasks.h"
+#include "telemetry.h"
+#include "trace.h"
 
 // defines
 #define REBOOT_WAIT 5000            // reboot after 5 seconds
 #define AUDIO_BUFFER 2048           // buffer size for reading the wav file and sending to i2s
-#define WAV_FILE "/sdcard/test.wav" // wav file to play
+#define WAV_HEADER_SIZE 44          // canonical header; the samples follow it
+#define SFX_MAX_SAMPLES 16000       // ~0.36s at 44.1kHz, mono
+#define SFX_LOAD_CHUNK_FRAMES 256   // read per audio loop pass while an SFX loads, at most 1 KB
+
+#define AUDIO_CMD_QUEUE_SIZE 16
+
+// Network source: how often to look for the first packet, and how long a
+// stream may go without packets before it counts as finished
+#define NET_POLL_MS 10
+#define NET_TIMEOUT_US 3000000
 
 // I2S PDM sample rate limits for ESP32-S3
 #define I2S_PDM_MIN_RATE 8000       // Minimum supported sample rate
@@ -74,47 +65,289 @@
 // constants
 static const char *TAG = "speaker_pdm";
 
-// handles
-static i2s_chan_handle_t tx_handle = NULL;
+typedef enum {
+    AUDIO_CMD_PLAY,
+    AUDIO_CMD_PLAY_NET,
+    AUDIO_CMD_STOP,
+    AUDIO_CMD_PAUSE,
+    AUDIO_CMD_RESUME,
+    AUDIO_CMD_SEEK,
+    AUDIO_CMD_SPEED,
+    AUDIO_CMD_VOLUME,
+    AUDIO_CMD_SFX_LOAD,
+} audio_cmd_kind_t;
+
+typedef struct {
+    audio_cmd_kind_t kind;
+    uint32_t id;
+    int64_t issued_us;
+    uint32_t position_ms;       // SEEK
+    float speed;                // SPEED, already clamped
+    uint8_t volume;             // VOLUME
+    char path[AUDIO_PATH_MAX];  // PLAY, SFX_LOAD
+} audio_cmd_t;
 
+// Posted by any task, drained by the audio task only
+static LfQueue<audio_cmd_t, AUDIO_CMD_QUEUE_SIZE> commands;
+static std::atomic<uint32_t> next_cmd_id(1);
+static TaskHandle_t audio_task_handle = NULL;
+
+// Service state, only touched by the audio task. Other tasks read the
+// status through the seqlock in audio_get_status().
+static audio_state_t state = AUDIO_IDLE;
 // Playback speed control (1.0 = normal, 2.0 = 2x speed, 0.5 = half speed)
 static float playback_speed = 1.0f;
+static uint8_t volume = AUDIO_VOLUME_MAX;
+static uint32_t commands_done = 0;
+// Issue time of the command whose first sample is still to be written, 0 if none
+static int64_t pending_start_us = 0;
+static uint32_t pending_start_id = 0;
+static audio_status_t status = {};
+static std::atomic<uint32_t> status_seq(0);
+
+// Preloaded SFX voice (mono, 16-bit) and the trigger handed over by the game.
+// sfx_pending holds the origin time of the hit, 0 when nothing is pending.
+// The samples are loaded by the audio task itself (AUDIO_CMD_SFX_LOAD) into
+// whichever of the two banks the voice isn't playing from, so they never
+// change under the mixer.
+static int16_t *sfx_banks[2] = {};
+static int16_t *sfx_samples = NULL;     // the bank in use, NULL until the first load
+static size_t sfx_length = 0;
+static uint32_t sfx_rate = 0;
+static std::atomic<int64_t> sfx_pending(0);
+// Hits published by the game; read by the audio task only
+static BusSubscriber hit_sub;
+// Staging for bus_pcm, kept off the audio task's stack
+static bus_pcm_t pcm_block;
+
+// Voice state, only touched by the playback loop
+static size_t sfx_position = 0;
+static bool sfx_active = false;
+static int64_t sfx_origin_us = 0;
+
+// An SFX load in progress, read SFX_LOAD_CHUNK_FRAMES at a time between mix
+// blocks so the card never holds up the output. Only touched by the audio task.
+typedef struct {
+    FILE *fh;                   // NULL when no load is running
+    uint32_t cmd_id;
+    uint16_t channels;
+    uint32_t sample_rate;
+    int16_t *samples;           // the bank being filled
+    size_t length;
+} sfx_loader_t;
+
+static sfx_loader_t sfx_loader = {};
+static int16_t sfx_load_chunk[SFX_LOAD_CHUNK_FRAMES * 2];
+
+// The voice on its own while no stream holds the output (sfx_solo_step)
+static uint32_t sfx_solo_rate = 0;      // output opened for it, 0 if none
+static uint32_t sfx_solo_tail = 0;      // silent blocks still to push it out
+static int16_t sfx_solo_block[MIX_BLOCK_FRAMES];
+
+// Chunk buffer, taken from the audio arena on the first play and kept
+static int16_t *audio_buf = NULL;
+
+// Network source: the jitter buffer's storage comes from the audio arena on
+// the first network play and is kept; one net_pool buffer receives datagrams
+// while the stream lasts
+static NetAudioRx net_rx;
+static int16_t *net_storage = NULL;
+static uint8_t *net_packet = NULL;
+
+static sfx_latency_stats_t sfx_stats = {};
+// Set by other tasks; the playback loop owns sfx_stats and clears it
+static std::atomic<bool> sfx_stats_reset(false);
+// What sfx_get_latency_stats() reads, through the same seqlock as the status
+static sfx_latency_stats_t sfx_stats_pub = {};
+static std::atomic<uint32_t> sfx_stats_seq(0);
+
+static esp_err_t read_wav_header(FILE *fh, uint16_t *channels, uint32_t *sample_rate, uint16_t *bits_per_sample)
+{
+    // Read WAV header (44 bytes)
+    uint8_t header[44];
+    if (fread(header, 1, 44, fh) != 44) {
+        ESP_LOGE(TAG, "Failed to read WAV header");
+        return ESP_FAIL;
+    }
 
-static esp_err_t i2s_setup(uint32_t sample_rate, i2s_slot_mode_t slot_mode)
+    // Parse WAV Header
+    // Offset 22: Num Channels (2 bytes)
+    *channels = header[22] | (header[23] << 8);
+    // Offset 24: Sample Rate (4 bytes)
+    *sample_rate = header[24] | (header[25] << 8) | (header[26] << 16) | (header[27] << 24);
+    // Offset 34: Bits Per Sample (2 bytes)
+    *bits_per_sample = header[34] | (header[35] << 8);
+    return ESP_OK;
+}
+
+static void publish_sfx_stats(void)
 {
-    ESP_LOGI(TAG, "Initializing I2S PDM TX channel with Rate: %ld, Mode: %s", 
-             sample_rate, slot_mode == I2S_SLOT_MODE_STEREO ? "Stereo" : "Mono");
+    uint32_t seq = sfx_stats_seq.load(std::memory_order_relaxed);
+    sfx_stats_seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    sfx_stats_pub = sfx_stats;
+    sfx_stats_seq.store(seq + 2, std::memory_order_release);
+}
 
-    // Channel should always be NULL here (cleaned up after each playback)
-    if (tx_handle != NULL) {
-        ESP_LOGW(TAG, "I2S channel handle is not NULL, this shouldn't happen!");
-        tx_handle = NULL;
+// Start the voice if the game has triggered a hit since the last block
+static void sfx_poll(void)
+{
+    bool changed = false;
+    if (sfx_stats_reset.exchange(false, std::memory_order_relaxed)) {
+        sfx_stats = {};
+        changed = true;
     }
 
-    // Create new I2S channel
-    i2s_chan_config_t chan_cfg = I2S_CHANNEL_DEFAULT_CONFIG(I2S_NUM_AUTO, I2S_ROLE_MASTER);
-    ESP_ERROR_CHECK(i2s_new_channel(&chan_cfg, &tx_handle, NULL));
+    int64_t origin = sfx_pending.exchange(0, std::memory_order_acquire);
+    HitEvent hit;
+    while (bus_hit.poll(&hit_sub, &hit)) {
+        if (origin != 0) {
+            sfx_stats.retriggers++;
+            changed = true;
+        }
+        origin = hit.sample_time_us != 0 ? hit.sample_time_us : 1;
+    }
+    if (origin != 0 && sfx_length > 0) {
+        if (sfx_active) {
+            // Retriggered before the previous hit finished: restart the voice
+            sfx_stats.retriggers++;
+            changed = true;
+        }
+        sfx_active = true;
+        sfx_position = 0;
+        sfx_origin_us = origin;
+    }
+    if (changed) {
+        publish_sfx_stats();
+    }
+}
 
-    // Setup PDM TX configuration
-    i2s_pdm_tx_config_t pdm_tx_cfg = {
-        .clk_cfg = I2S_PDM_TX_CLK_DEFAULT_CONFIG(sample_rate),
-        .slot_cfg = I2S_PDM_TX_SLOT_DEFAULT_CONFIG(I2S_DATA_BIT_WIDTH_16BIT, slot_mode),
-        .gpio_cfg = {
-            .clk = I2S_CLK_PIN,
-            .dout = I2S_DATA_PIN,
-            .invert_flags = {
-                .clk_inv = false,
-            },
-        },
-    };
+// Mix the playing voice into one block of interleaved samples
+static void sfx_mix_voice(int16_t *block, size_t frames, uint16_t channels)
+{
+    if (!sfx_active) {
+        return;
+    }
 
-    return i2s_channel_init_pdm_tx_mode(tx_handle, &pdm_tx_cfg);
+    for (size_t f = 0; f < frames && sfx_position < sfx_length; f++, sfx_position++) {
+        int32_t s = sfx_samples[sfx_position];
+        for (uint16_t c = 0; c < channels; c++) {
+            int32_t mixed = block[f * channels + c] + s;
+            if (mixed > INT16_MAX) mixed = INT16_MAX;
+            if (mixed < INT16_MIN) mixed = INT16_MIN;
+            block[f * channels + c] = (int16_t)mixed;
+        }
+    }
+    if (sfx_position >= sfx_length) {
+        sfx_active = false;
+    }
+}
+
+// Mix the SFX voice into one block of interleaved samples, starting it first if
+// the game has triggered a hit since the last block
+static void sfx_mix_block(int16_t *block, size_t frames, uint16_t channels)
+{
+    sfx_poll();
+    sfx_mix_voice(block, frames, channels);
+}
+
+// Called right after the block carrying the start of a voice has been queued.
+// Everything still ahead of it in the DMA queue has to play out first.
+static void sfx_record_latency(uint32_t output_rate)
+{
+    int64_t queued_us = (int64_t)hal_audio_sink()->queued_frames() * 1000000 / output_rate;
+    int64_t latency = esp_timer_get_time() - sfx_origin_us + queued_us;
+    sfx_origin_us = 0;
+
+    if (sfx_stats.count == 0 || latency < sfx_stats.min_us) sfx_stats.min_us = latency;
+    if (latency > sfx_stats.max_us) sfx_stats.max_us = latency;
+    sfx_stats.total_us += latency;
+    sfx_stats.last_us = latency;
+    sfx_stats.count++;
+    if (latency > HIT_SFX_BUDGET_US) sfx_stats.over_budget++;
+    publish_sfx_stats();
+}
+
+static void sfx_solo_close(void)
+{
+    if (sfx_solo_rate != 0) {
+        hal_audio_sink()->close();
+        telemetry_audio_stream(0);
+        sfx_solo_rate = 0;
+    }
+    sfx_solo_tail = 0;
 }
 
-static esp_err_t play_wav(const char *fp)
+// With no stream holding the output, a hit opens it at the effect's own rate
+// and the voice plays alone, followed by enough silence to push it through
+// the output queue before the output closes again. A stream opening its
+// output takes over (stream_open_output()) and the voice carries on in its mix.
+//
+// @return false once there is nothing left to play
+static bool sfx_solo_step(void)
+{
+    AudioSink *sink = hal_audio_sink();
+    sfx_poll();
+    if (sfx_active) {
+        sfx_solo_tail = sink->queued_frames() / MIX_BLOCK_FRAMES + 1;
+    } else if (sfx_solo_tail == 0) {
+        sfx_solo_close();
+        return false;
+    } else {
+        sfx_solo_tail--;
+    }
+
+    if (sfx_solo_rate == 0) {
+        esp_err_t ret = sink->open(sfx_rate, 1);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to open audio output for the SFX: %s", esp_err_to_name(ret));
+            sfx_active = false;
+            sfx_origin_us = 0;
+            sfx_solo_tail = 0;
+            return false;
+        }
+        sfx_solo_rate = sfx_rate;
+        telemetry_audio_stream(sfx_rate);
+    }
+
+    memset(sfx_solo_block, 0, sizeof(sfx_solo_block));
+    sfx_mix_voice(sfx_solo_block, MIX_BLOCK_FRAMES, 1);
+    if (sink->write(sfx_solo_block, MIX_BLOCK_FRAMES) != ESP_OK) {
+        ESP_LOGE(TAG, "Audio write failed");
+        sfx_active = false;
+        sfx_origin_us = 0;
+        sfx_solo_close();
+        return false;
+    }
+    if (sfx_origin_us != 0) {
+        sfx_record_latency(sfx_solo_rate);
+    }
+    return true;
+}
+
+// Stream state, only touched by the audio task
+typedef struct {
+    FILE *fh;
+    bool net;                   // the network source instead of a file
+    uint16_t channels;
+    audio_format_t format;
+    uint32_t sample_rate;
+    uint32_t total_frames;      // frames in the file, 0 for the network source
+    uint32_t frames_read;       // file frames consumed so far (played, for the network source)
+    uint32_t output_rate;       // 0 while the output is closed
+    audio_pipeline_t pipeline;  // decode and frame skipping, picked for the format and speed
+    size_t len;                 // samples decoded into audio_buf
+    size_t pos;                 // next sample of audio_buf to write
+    size_t samples_played;
+    size_t samples_skipped;
+} stream_t;
+
+static stream_t stream = {};
+
+static esp_err_t stream_open(const char *fp)
 {
     // Ensure SD card is mounted
-    if (sd_card_init() != ESP_OK) {
+    if (hal_storage()->mount() != ESP_OK) {
         ESP_LOGE(TAG, "SD Card not initialized");
         return ESP_FAIL;
     }
@@ -123,36 +356,65 @@ static esp_err_t play_wav(const char *fp)
     FILE *fh = fopen(fp, "rb");
     if (fh == NULL) {
         ESP_LOGE(TAG, "Failed to open file");
-        return ESP_ERR_INVALID_ARG;
+        return ESP_ERR_NOT_FOUND;
     }
 
-    // Read WAV header (44 bytes)
-    uint8_t header[44];
-    if (fread(header, 1, 44, fh) != 44) {
-        ESP_LOGE(TAG, "Failed to read WAV header");
+    uint16_t channels;
+    uint32_t sample_rate;
+    uint16_t bits_per_sample;
+    if (read_wav_header(fh, &channels, &sample_rate, &bits_per_sample) != ESP_OK) {
         fclose(fh);
         return ESP_FAIL;
     }
 
-    // Parse WAV Header
-    // Offset 22: Num Channels (2 bytes)
-    uint16_t channels = header[22] | (header[23] << 8);
-    // Offset 24: Sample Rate (4 bytes)
-    uint32_t sample_rate = header[24] | (header[25] << 8) | (header[26] << 16) | (header[27] << 24);
-    // Offset 34: Bits Per Sample (2 bytes)
-    uint16_t bits_per_sample = header[34] | (header[35] << 8);
-
-    ESP_LOGI(TAG, "WAV Info - Rate: %ld Hz, Channels: %d, Bits: %d", sample_rate, channels, bits_per_sample);
+    ESP_LOGI(TAG, "WAV Info - Rate: %" PRIu32 " Hz, Channels: %d, Bits: %d", sample_rate, channels, bits_per_sample);
 
-    if (bits_per_sample != 16) {
-        ESP_LOGE(TAG, "Only 16-bit WAV files are supported");
+    if ((bits_per_sample != 16 && bits_per_sample != 8) || channels == 0 || sample_rate == 0) {
+        ESP_LOGE(TAG, "Only 8-bit and 16-bit PCM WAV files are supported");
         fclose(fh);
         return ESP_ERR_NOT_SUPPORTED;
     }
 
+    // create a writer buffer
+    if (audio_buf == NULL) {
+        audio_buf = audio_arena.alloc_array<int16_t>(AUDIO_BUFFER);
+        if (audio_buf == NULL) {
+            ESP_LOGE(TAG, "Failed to allocate buffer");
+            fclose(fh);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    // Everything after the canonical 44-byte header is sample data
+    fseek(fh, 0, SEEK_END);
+    long size = ftell(fh);
+    fseek(fh, WAV_HEADER_SIZE, SEEK_SET);
+
+    stream = {};
+    stream.fh = fh;
+    stream.channels = channels;
+    stream.format = bits_per_sample == 8 ? AUDIO_FORMAT_PCM8 : AUDIO_FORMAT_PCM16;
+    stream.sample_rate = sample_rate;
+    stream.total_frames = size > WAV_HEADER_SIZE
+                              ? (size - WAV_HEADER_SIZE) / (channels * audio_format_bytes(stream.format))
+                              : 0;
+    audio_pipeline_init(&stream.pipeline, stream.format, channels, 1.0f);
+    return ESP_OK;
+}
+
+// Configure the output for the file at the current playback speed
+static esp_err_t stream_open_output(void)
+{
+    // A voice playing on its own hands the output over and goes on in the mix
+    sfx_solo_close();
+
+    uint32_t sample_rate = stream.sample_rate;
+    // A live stream plays at the rate it arrives
+    float speed = stream.net ? 1.0f : playback_speed;
+
     // Apply playback speed adjustment with frame skipping for speeds above hardware limit
-    uint32_t adjusted_sample_rate = (uint32_t)(sample_rate * playback_speed);
-    float frame_skip_ratio = 1.0f;  // 1.0 = play all frames, 2.0 = skip every other frame
+    uint32_t adjusted_sample_rate = (uint32_t)(sample_rate * speed);
+    float frame_skip_ratio = 1.0f;
 
     // Check if we exceed hardware limits
     if (adjusted_sample_rate > I2S_PDM_MAX_RATE) {
@@ -160,108 +422,217 @@ static esp_err_t play_wav(const char *fp)
         frame_skip_ratio = (float)adjusted_sample_rate / I2S_PDM_MAX_RATE;
         adjusted_sample_rate = I2S_PDM_MAX_RATE;
 
-        ESP_LOGI(TAG, "Speed %.2fx exceeds hardware limit (max %.2fx for %ld Hz)",
-                 playback_speed, (float)I2S_PDM_MAX_RATE / sample_rate, sample_rate);
+        ESP_LOGI(TAG, "Speed %.2fx exceeds hardware limit (max %.2fx for %" PRIu32 " Hz)",
+                 speed, (float)I2S_PDM_MAX_RATE / sample_rate, sample_rate);
         ESP_LOGI(TAG, "Using frame skipping: playing at %d Hz, skipping %.1f%% of samples",
                  I2S_PDM_MAX_RATE, (frame_skip_ratio - 1.0f) * 100.0f / frame_skip_ratio);
-        ESP_LOGI(TAG, "Effective speed: %.2fx (hardware %.2fx + frame skip %.2fx)",
-                 playback_speed, (float)I2S_PDM_MAX_RATE / sample_rate, frame_skip_ratio);
     } else if (adjusted_sample_rate < I2S_PDM_MIN_RATE) {
-        ESP_LOGW(TAG, "Adjusted sample rate %ld Hz is below PDM minimum, clamping to %d Hz",
+        ESP_LOGW(TAG, "Adjusted sample rate %" PRIu32 " Hz is below PDM minimum, clamping to %d Hz",
                  adjusted_sample_rate, I2S_PDM_MIN_RATE);
         adjusted_sample_rate = I2S_PDM_MIN_RATE;
     }
-    
-    ESP_LOGI(TAG, "Playback speed: %.2fx (Original: %ld Hz -> Adjusted: %ld Hz)",
-             playback_speed, sample_rate, adjusted_sample_rate);
 
-    // Configure I2S based on file properties
-    i2s_slot_mode_t mode = (channels == 2) ? I2S_SLOT_MODE_STEREO : I2S_SLOT_MODE_MONO;
-    ESP_ERROR_CHECK(i2s_setup(adjusted_sample_rate, mode));
+    ESP_LOGI(TAG, "Playback speed: %.2fx (Original: %" PRIu32 " Hz -> Adjusted: %" PRIu32 " Hz)",
+             speed, sample_rate, adjusted_sample_rate);
 
-    // create a writer buffer
-    int16_t *buf = (int16_t *)calloc(AUDIO_BUFFER, sizeof(int16_t));
-    if (buf == NULL) {
-        ESP_LOGE(TAG, "Failed to allocate buffer");
-        fclose(fh);
-        return ESP_ERR_NO_MEM;
+    if (hal_audio_sink()->open(adjusted_sample_rate, stream.channels) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to open audio output");
+        return ESP_FAIL;
+    }
+    stream.output_rate = adjusted_sample_rate;
+    // A pass that starts later than the output queue plus a few blocks lasts
+    // lets the output run dry; one pass, chunk refill included, gets half that
+    uint32_t queue_us = (uint32_t)((uint64_t)hal_audio_sink()->queued_frames() * 1000000 / adjusted_sample_rate);
+    uint32_t period_us = queue_us + (uint32_t)((uint64_t)4 * MIX_BLOCK_FRAMES * 1000000 / adjusted_sample_rate);
+    deadline_declare(DEADLINE_AUDIO, period_us, period_us / 2);
+    audio_pipeline_init(&stream.pipeline, stream.format, stream.channels, frame_skip_ratio);
+    if (!stream.pipeline.specialized) {
+        ESP_LOGI(TAG, "No specialized pipeline for %d channels, using the generic one", stream.channels);
+    }
+    telemetry_audio_stream(adjusted_sample_rate);
+    return ESP_OK;
+}
+
+// Closing releases the output while nothing is playing to free resources
+static void stream_close_output(void)
+{
+    if (stream.output_rate != 0) {
+        hal_audio_sink()->close();
+        telemetry_audio_stream(0);
+        stream.output_rate = 0;
     }
+}
 
-    size_t bytes_read = 0;
-    size_t bytes_written = 0;
+static void net_close(void);
 
-    // Frame skipping state
-    float frame_position = 0.0f;
-    size_t samples_skipped = 0;
-    size_t samples_played = 0;
+static void stream_close(void)
+{
+    stream_close_output();
+    if (stream.net) {
+        net_close();
+        return;
+    }
+    if (stream.fh == NULL) {
+        return;
+    }
 
-    // Read first chunk
-    bytes_read = fread(buf, sizeof(int16_t), AUDIO_BUFFER, fh);
+    // Log frame skipping statistics if used
+    if (stream.samples_skipped > 0) {
+        ESP_LOGI(TAG, "Frame skipping stats: Played %zu samples, Skipped %zu samples (%.1f%%)",
+                 stream.samples_played, stream.samples_skipped,
+                 (float)stream.samples_skipped * 100.0f / (stream.samples_played + stream.samples_skipped));
+    }
 
-    ESP_ERROR_CHECK(i2s_channel_enable(tx_handle));
+    if (sfx_stats.count > 0) {
+        ESP_LOGI(TAG, "Hit SFX latency: %" PRIu32 " hits, min %" PRId64 " us, avg %" PRId64 " us, "
+                 "max %" PRId64 " us, %" PRIu32 " over %d us budget",
+                 sfx_stats.count, sfx_stats.min_us, sfx_stats.total_us / sfx_stats.count,
+                 sfx_stats.max_us, sfx_stats.over_budget, HIT_SFX_BUDGET_US);
+    }
 
-    int chunk_count = 0;
-    while (bytes_read > 0) {
-        // Apply frame skipping if needed
-        if (frame_skip_ratio > 1.0f) {
-            // Use fractional frame position for accurate skipping
-            size_t samples_to_process = bytes_read;
-            size_t samples_to_write = 0;
+    fclose(stream.fh);
+    stream.fh = NULL;
+}
 
-            // Reset frame position for each chunk
-            frame_position = 0.0f;
+static void stream_seek(uint32_t position_ms)
+{
+    uint32_t frame = (uint32_t)((uint64_t)position_ms * stream.sample_rate / 1000);
+    if (frame > stream.total_frames) {
+        frame = stream.total_frames;
+    }
+    fseek(stream.fh, WAV_HEADER_SIZE + (long)frame * stream.channels * audio_format_bytes(stream.format), SEEK_SET);
+    stream.frames_read = frame;
+    stream.len = 0;
+    stream.pos = 0;
+}
 
-            // Fractional decimation: works for any ratio (2.0x, 2.5x, etc.)
-            while (frame_position < samples_to_process) {
-                size_t input_index = (size_t)frame_position;
-                if (input_index < samples_to_process) {
-                    buf[samples_to_write] = buf[input_index];
-                    samples_to_write++;
-                }
-                frame_position += frame_skip_ratio;
-            }
+// Read, decode and decimate the next chunk; false at the end of the file
+static bool stream_fill(void)
+{
+    int16_t *buf = audio_buf;
 
-            samples_skipped += (samples_to_process - samples_to_write);
-            samples_played += samples_to_write;
-            bytes_read = samples_to_write;
-        }
+    // The raw chunk is read into the back of the buffer and converted in
+    // place towards the front (see audio_pipeline.h)
+    size_t frame_bytes = stream.channels * audio_format_bytes(stream.format);
+    size_t max_frames = AUDIO_BUFFER / stream.channels;
+    uint8_t *raw = (uint8_t *)buf + audio_pipeline_input_offset(&stream.pipeline, max_frames, AUDIO_BUFFER);
 
-        // write the buffer to the i2s
-        if (i2s_channel_write(tx_handle, buf, bytes_read * sizeof(int16_t), &bytes_written, portMAX_DELAY) != ESP_OK) {
-            ESP_LOGE(TAG, "I2S write failed");
-            break;
-        }
-        bytes_read = fread(buf, sizeof(int16_t), AUDIO_BUFFER, fh);
+    TRACE_BEGIN(TRACE_SD_READ);
+    int64_t read_start = esp_timer_get_time();
+    // Whole frames only; a torn last frame is dropped
+    size_t frames_read = fread(raw, frame_bytes, max_frames, stream.fh);
+    telemetry_sd_read(frames_read * frame_bytes, esp_timer_get_time() - read_start);
+    TRACE_END(TRACE_SD_READ, frames_read * frame_bytes);
 
-        // Visual feedback for playback
-        if (++chunk_count % 10 == 0) {
-            printf(".");
-            fflush(stdout);
-        }
+    stream.frames_read += frames_read;
+    if (frames_read == 0) {
+        return false;
     }
-    printf("\n");
 
-    ESP_ERROR_CHECK(i2s_channel_disable(tx_handle));
+    TRACE_BEGIN(TRACE_AUDIO_CHUNK);
+    size_t samples = audio_pipeline_run(&stream.pipeline, raw, frames_read, buf);
+    stream.samples_skipped += frames_read * stream.channels - samples;
+    stream.samples_played += samples;
+    TRACE_END(TRACE_AUDIO_CHUNK, samples);
 
-    // Log frame skipping statistics if used
-    if (frame_skip_ratio > 1.0f && samples_skipped > 0) {
-        ESP_LOGI(TAG, "Frame skipping stats: Played %zu samples, Skipped %zu samples (%.1f%%)",
-                 samples_played, samples_skipped,
-                 (float)samples_skipped * 100.0f / (samples_played + samples_skipped));
+    stream.len = samples;
+    stream.pos = 0;
+    return true;
+}
+
+static esp_err_t net_open(void)
+{
+    if (audio_buf == NULL) {
+        audio_buf = audio_arena.alloc_array<int16_t>(AUDIO_BUFFER);
+    }
+    if (net_storage == NULL) {
+        net_storage = audio_arena.alloc_array<int16_t>(NET_AUDIO_STORAGE_SAMPLES);
+    }
+    if (audio_buf == NULL || net_storage == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate network audio buffers");
+        return ESP_ERR_NO_MEM;
+    }
+    net_packet = (uint8_t *)net_pool.alloc();
+    if (net_packet == NULL) {
+        ESP_LOGE(TAG, "No network buffer for the audio stream");
+        return ESP_ERR_NO_MEM;
     }
 
-    // Delete the channel after playback to free resources
-    ESP_LOGI(TAG, "Cleaning up I2S channel");
-    esp_err_t ret = i2s_del_channel(tx_handle);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to delete I2S channel: %s", esp_err_to_name(ret));
+    net_rx.init(net_storage);
+    stream = {};
+    stream.net = true;
+    ESP_LOGI(TAG, "Waiting for network audio on port %d", NET_AUDIO_PORT);
+    return ESP_OK;
+}
+
+static void net_close(void)
+{
+    net_audio_stats_t st;
+    net_rx.stats(&st);
+    if (st.packets > 0) {
+        ESP_LOGI(TAG, "Network audio: %" PRIu32 " packets, %" PRIu32 " late, %" PRIu32 " concealed, "
+                 "%" PRIu32 " underruns, depth max %" PRIu32 " frames, jitter %" PRIu32 " us, drift %" PRId32 " ppm",
+                 st.packets, st.late, st.concealed, st.underruns,
+                 st.max_depth_frames, st.jitter_us, st.drift_ppm);
     }
-    tx_handle = NULL;  // Important: Set to NULL after deletion
+    net_pool.free(net_packet);
+    net_packet = NULL;
+    stream.net = false;
+}
 
-    free(buf);
-    fclose(fh);
+// Take in every datagram that has arrived and keep the output on the
+// sender's format. ESP_ERR_TIMEOUT while no packet has arrived yet.
+static esp_err_t net_service(void)
+{
+    NetTransport *net = hal_net();
+    size_t len;
+    int64_t arrival_us;
+    while (net->receive_audio(net_packet, NET_BUFFER_SIZE, &len, &arrival_us)) {
+        net_rx.push(net_packet, len, arrival_us);
+    }
+    if (!net_rx.has_format()) {
+        return ESP_ERR_TIMEOUT;
+    }
 
-    return ESP_OK;
+    if (stream.output_rate != 0 &&
+        (net_rx.sample_rate() == stream.sample_rate && net_rx.channels() == stream.channels)) {
+        return ESP_OK;
+    }
+    uint32_t rate = net_rx.sample_rate();
+    if (rate < I2S_PDM_MIN_RATE || rate > I2S_PDM_MAX_RATE) {
+        ESP_LOGE(TAG, "Network audio at %" PRIu32 " Hz is outside what the output can play", rate);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    ESP_LOGI(TAG, "Network audio: %" PRIu32 " Hz, %d channels", rate, net_rx.channels());
+    stream_close_output();
+    stream.sample_rate = rate;
+    stream.channels = net_rx.channels();
+    stream.len = 0;
+    stream.pos = 0;
+    return stream_open_output();
+}
+
+// Pull the next mix block out of the jitter buffer; false once the sender
+// has finished or gone quiet
+static bool net_fill(void)
+{
+    if (net_rx.ended() || esp_timer_get_time() - net_rx.last_arrival_us() > NET_TIMEOUT_US) {
+        return false;
+    }
+
+    TRACE_BEGIN(TRACE_AUDIO_CHUNK);
+    uint32_t concealed = net_rx.concealed();
+    size_t samples = net_rx.pull(audio_buf, MIX_BLOCK_FRAMES);
+    if (net_rx.concealed() != concealed) {
+        TRACE_INSTANT(TRACE_AUDIO_CONCEAL, net_rx.concealed() - concealed);
+    }
+    TRACE_END(TRACE_AUDIO_CHUNK, samples);
+
+    stream.frames_read += MIX_BLOCK_FRAMES;
+    stream.samples_played += samples;
+    stream.len = samples;
+    stream.pos = 0;
+    return true;
 }
 
 static void list_sd_files(const char *path)
@@ -284,56 +655,556 @@ static void list_sd_files(const char *path)
     closedir(dir);
 }
 
-#ifdef __cplusplus
-extern "C" {
-#endif
-
-// Set playback speed (1.0 = normal, 2.0 = 2x speed, 0.5 = half speed)
-void set_playback_speed(float speed)
+static float clamp_speed(float speed)
 {
     if (speed <= 0.0f) {
         ESP_LOGW(TAG, "Invalid playback speed %.2f, must be > 0. Using 1.0", speed);
-        playback_speed = 1.0f;
+        return 1.0f;
     } else if (speed > 4.0f) {
         ESP_LOGW(TAG, "Playback speed %.2f is very high, clamping to 4.0x", speed);
-        playback_speed = 4.0f;
+        return 4.0f;
     } else if (speed < 0.25f) {
         ESP_LOGW(TAG, "Playback speed %.2f is very low, clamping to 0.25x", speed);
-        playback_speed = 0.25f;
-    } else {
-        playback_speed = speed;
+        return 0.25f;
     }
-    ESP_LOGI(TAG, "Playback speed set to %.2fx", playback_speed);
+    return speed;
 }
 
-// Get current playback speed
-float get_playback_speed(void)
+static void post_event(audio_event_kind_t kind, uint32_t cmd_id, esp_err_t err, int64_t latency_us)
 {
-    return playback_speed;
+    audio_event_t event = {kind, cmd_id, err, latency_us};
+    bus_audio.publish(event);
 }
 
-// Renamed from app_main to avoid conflict with McHacks.cpp
-void speaker_main(void)
+static void publish_status(void)
 {
-    // Ensure SD is initialized first
-    sd_card_init();
+    uint32_t seq = status_seq.load(std::memory_order_relaxed);
+    status_seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
 
-    // List files to help debug
-    list_sd_files("/sdcard");
+    status.state = state;
+    status.position_ms = stream.sample_rate != 0
+                             ? (uint32_t)((uint64_t)stream.frames_read * 1000 / stream.sample_rate) : 0;
+    status.duration_ms = stream.sample_rate != 0
+                             ? (uint32_t)((uint64_t)stream.total_frames * 1000 / stream.sample_rate) : 0;
+    status.speed = playback_speed;
+    status.volume = volume;
+    status.output_rate = stream.output_rate;
+    status.commands = commands_done;
+    status.net = stream.net;
+    if (stream.net) {
+        net_rx.stats(&status.net_stats);
+    }
+
+    status_seq.store(seq + 2, std::memory_order_release);
+}
 
-    // play the wav file
-    ESP_LOGI(TAG, "Playing wav file");
-    if (play_wav(WAV_FILE) != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to play WAV file");
+// Start (or restart) the output and arm the command-to-first-sample timer
+static esp_err_t start_output(const audio_cmd_t *cmd)
+{
+    if (stream.output_rate == 0) {
+        esp_err_t ret = stream_open_output();
+        if (ret != ESP_OK) {
+            return ret;
+        }
     }
+    pending_start_us = cmd->issued_us;
+    pending_start_id = cmd->id;
+    state = AUDIO_PLAYING;
+    return ESP_OK;
+}
 
-    // Channel is already cleaned up in play_wav()
-    // We don't deinit SD card here just in case other tasks need it
+static void stop_stream(audio_event_kind_t kind)
+{
+    if (state != AUDIO_IDLE) {
+        stream_close();
+        state = AUDIO_IDLE;
+        pending_start_us = 0;
+        post_event(kind, status.cmd_id, ESP_OK, 0);
+    }
+}
 
-    ESP_LOGI(TAG, "Speaker test complete");
+static void sfx_load_abort(void)
+{
+    if (sfx_loader.fh != NULL) {
+        fclose(sfx_loader.fh);
+        sfx_loader.fh = NULL;
+    }
 }
 
-#ifdef __cplusplus
+// Runs on the audio task: opens the file and picks the bank to fill. The
+// samples follow a chunk at a time from sfx_load_step(); the effect in use
+// keeps playing until they are all in.
+static esp_err_t sfx_load_begin(const audio_cmd_t *cmd)
+{
+    if (sfx_loader.fh != NULL) {
+        // Superseded by the newer load
+        ESP_LOGW(TAG, "SFX load %" PRIu32 " abandoned", sfx_loader.cmd_id);
+        post_event(AUDIO_EVENT_ERROR, sfx_loader.cmd_id, ESP_ERR_INVALID_STATE, 0);
+        sfx_load_abort();
+    }
+
+    FILE *fh = fopen(cmd->path, "rb");
+    if (fh == NULL) {
+        ESP_LOGE(TAG, "Failed to open SFX file %s", cmd->path);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    uint16_t channels;
+    uint32_t sample_rate;
+    uint16_t bits_per_sample;
+    if (read_wav_header(fh, &channels, &sample_rate, &bits_per_sample) != ESP_OK) {
+        fclose(fh);
+        return ESP_FAIL;
+    }
+    if (bits_per_sample != 16 || channels == 0 || channels > 2) {
+        ESP_LOGE(TAG, "SFX must be 16-bit mono or stereo");
+        fclose(fh);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    // The second bank is only taken from the arena once an effect is replaced
+    int bank = (sfx_samples == sfx_banks[0] && sfx_samples != NULL) ? 1 : 0;
+    if (sfx_banks[bank] == NULL) {
+        sfx_banks[bank] = audio_arena.alloc_array<int16_t>(SFX_MAX_SAMPLES);
+        if (sfx_banks[bank] == NULL) {
+            ESP_LOGE(TAG, "Failed to allocate SFX buffer");
+            fclose(fh);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    sfx_loader.fh = fh;
+    sfx_loader.cmd_id = cmd->id;
+    sfx_loader.channels = channels;
+    sfx_loader.sample_rate = sample_rate;
+    sfx_loader.samples = sfx_banks[bank];
+    sfx_loader.length = 0;
+    return ESP_OK;
+}
+
+// Read the next chunk of a load in progress; once the file is in, the voice
+// switches over to the new bank
+static void sfx_load_step(void)
+{
+    if (sfx_loader.fh == NULL) {
+        return;
+    }
+
+    size_t frames = SFX_MAX_SAMPLES - sfx_loader.length;
+    if (frames > SFX_LOAD_CHUNK_FRAMES) {
+        frames = SFX_LOAD_CHUNK_FRAMES;
+    }
+    size_t got = fread(sfx_load_chunk, sizeof(int16_t) * sfx_loader.channels, frames, sfx_loader.fh);
+    // Stored as mono; stereo effects are downmixed once here rather than per hit
+    for (size_t f = 0; f < got; f++) {
+        sfx_loader.samples[sfx_loader.length++] = (sfx_loader.channels == 2)
+            ? (int16_t)((sfx_load_chunk[2 * f] + sfx_load_chunk[2 * f + 1]) / 2)
+            : sfx_load_chunk[f];
+    }
+    if (got == frames && sfx_loader.length < SFX_MAX_SAMPLES) {
+        return;
+    }
+    sfx_load_abort();
+
+    // A voice still playing the old effect would run on into the new one
+    sfx_active = false;
+    sfx_origin_us = 0;
+    sfx_samples = sfx_loader.samples;
+    sfx_length = sfx_loader.length;
+    sfx_rate = sfx_loader.sample_rate < I2S_PDM_MIN_RATE ? I2S_PDM_MIN_RATE
+               : sfx_loader.sample_rate > I2S_PDM_MAX_RATE ? I2S_PDM_MAX_RATE : sfx_loader.sample_rate;
+    ESP_LOGI(TAG, "Loaded SFX: %zu samples at %" PRIu32 " Hz", sfx_length, sfx_loader.sample_rate);
 }
+
+static void handle_command(const audio_cmd_t *cmd)
+{
+    esp_err_t err = ESP_OK;
+    switch (cmd->kind) {
+    case AUDIO_CMD_PLAY:
+        stop_stream(AUDIO_EVENT_STOPPED);
+        err = stream_open(cmd->path);
+        if (err == ESP_OK) {
+            status.cmd_id = cmd->id;
+            memcpy(status.path, cmd->path, sizeof(status.path));
+            err = start_output(cmd);
+            if (err != ESP_OK) {
+                stream_close();
+            }
+        }
+        break;
+    case AUDIO_CMD_PLAY_NET:
+        stop_stream(AUDIO_EVENT_STOPPED);
+        err = net_open();
+        if (err == ESP_OK) {
+            status.cmd_id = cmd->id;
+            strcpy(status.path, "net");
+            // The output opens with the first packet (net_service)
+            pending_start_us = cmd->issued_us;
+            pending_start_id = cmd->id;
+            state = AUDIO_PLAYING;
+        }
+        break;
+    case AUDIO_CMD_STOP:
+        stop_stream(AUDIO_EVENT_STOPPED);
+        break;
+    case AUDIO_CMD_PAUSE:
+        if (stream.net) {
+            err = ESP_ERR_NOT_SUPPORTED;
+            break;
+        }
+        if (state != AUDIO_PLAYING) {
+            err = ESP_ERR_INVALID_STATE;
+            break;
+        }
+        stream_close_output();
+        state = AUDIO_PAUSED;
+        pending_start_us = 0;
+        post_event(AUDIO_EVENT_PAUSED, cmd->id, ESP_OK, 0);
+        break;
+    case AUDIO_CMD_RESUME:
+        if (state != AUDIO_PAUSED) {
+            err = ESP_ERR_INVALID_STATE;
+            break;
+        }
+        err = start_output(cmd);
+        break;
+    case AUDIO_CMD_SEEK:
+        if (state == AUDIO_IDLE) {
+            err = ESP_ERR_INVALID_STATE;
+            break;
+        }
+        if (stream.net) {
+            err = ESP_ERR_NOT_SUPPORTED;
+            break;
+        }
+        stream_seek(cmd->position_ms);
+        if (state == AUDIO_PLAYING) {
+            pending_start_us = cmd->issued_us;
+            pending_start_id = cmd->id;
+        }
+        break;
+    case AUDIO_CMD_SPEED:
+        playback_speed = cmd->speed;
+        // The output rate follows the speed, so a playing file reopens it
+        if (state == AUDIO_PLAYING && !stream.net) {
+            stream_close_output();
+            err = stream_open_output();
+            if (err != ESP_OK) {
+                stream_close();
+                state = AUDIO_IDLE;
+            }
+        }
+        break;
+    case AUDIO_CMD_VOLUME:
+        volume = cmd->volume;
+        break;
+    case AUDIO_CMD_SFX_LOAD:
+        err = sfx_load_begin(cmd);
+        break;
+    }
+
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Audio command %" PRIu32 " failed: %s", cmd->id, esp_err_to_name(err));
+        post_event(AUDIO_EVENT_ERROR, cmd->id, err, 0);
+    }
+    commands_done++;
+    publish_status();
+}
+
+// Hand a copy of the block just queued to the analyzer (see analyzer.h). A
+// mono downmix and a copy into the topic's ring; nothing here can wait.
+static void publish_pcm(const int16_t *block, size_t frames, uint32_t queued_frames)
+{
+    uint32_t ahead = queued_frames > frames ? queued_frames - (uint32_t)frames : 0;
+    pcm_block.play_us = esp_timer_get_time() + (int64_t)ahead * 1000000 / stream.output_rate;
+    pcm_block.sample_rate = stream.output_rate;
+    pcm_block.frames = (uint16_t)frames;
+    audio_downmix_mono(block, frames, stream.channels, pcm_block.samples);
+    bus_pcm.publish(pcm_block);
+}
+
+// Write the next mix block; false once the file has run out
+static bool stream_step(void)
+{
+    AudioSink *sink = hal_audio_sink();
+
+    deadline_begin(DEADLINE_AUDIO);
+    ALLOC_REGION_BEGIN(ALLOC_REGION_AUDIO);
+    if (stream.pos >= stream.len && !(stream.net ? net_fill() : stream_fill())) {
+        ALLOC_REGION_END(ALLOC_REGION_AUDIO);
+        deadline_idle(DEADLINE_AUDIO);
+        return false;
+    }
+
+    int16_t *block = audio_buf + stream.pos;
+    size_t block_samples = stream.len - stream.pos;
+    if (block_samples > MIX_BLOCK_FRAMES * stream.channels) {
+        block_samples = MIX_BLOCK_FRAMES * stream.channels;
+    }
+    stream.pos += block_samples;
+
+    audio_apply_gain(block, block_samples, (int32_t)volume * 256 / AUDIO_VOLUME_MAX);
+    sfx_mix_block(block, block_samples / stream.channels, stream.channels);
+    // The write blocks while the output queue is full; that is waiting, not work
+    deadline_end(DEADLINE_AUDIO);
+
+    TRACE_BEGIN(TRACE_AUDIO_WRITE);
+    esp_err_t write_ret = sink->write(block, block_samples);
+    TRACE_END(TRACE_AUDIO_WRITE, block_samples);
+    ALLOC_REGION_END(ALLOC_REGION_AUDIO);
+    if (write_ret != ESP_OK) {
+        ESP_LOGE(TAG, "Audio write failed");
+        post_event(AUDIO_EVENT_ERROR, status.cmd_id, write_ret, 0);
+        return false;
+    }
+
+    publish_pcm(block, block_samples / stream.channels, sink->queued_frames());
+
+    if (sfx_origin_us != 0) {
+        sfx_record_latency(stream.output_rate);
+    }
+    if (pending_start_us != 0) {
+        // Same accounting as the SFX: the block plays after everything queued ahead of it
+        int64_t queued_us = (int64_t)sink->queued_frames() * 1000000 / stream.output_rate;
+        int64_t latency = esp_timer_get_time() - pending_start_us + queued_us;
+        pending_start_us = 0;
+        status.last_latency_us = latency;
+        if (latency > status.max_latency_us) {
+            status.max_latency_us = latency;
+        }
+        ESP_LOGI(TAG, "Command %" PRIu32 " to first sample: %" PRId64 " us", pending_start_id, latency);
+        post_event(AUDIO_EVENT_STARTED, pending_start_id, ESP_OK, latency);
+        publish_status();
+    } else if (stream.pos >= stream.len) {
+        // Position updates once per chunk are plenty for a progress display
+        publish_status();
+    }
+    return true;
+}
+
+static void audio_task(void *pvParameters)
+{
+    list_sd_files(HAL_STORAGE_ROOT);
+    publish_status();
+    // Hits wake the task too, so a hit while idle plays straight away
+    bus_hit.subscribe(&hit_sub, "audio", true);
+
+    while (1) {
+        audio_cmd_t cmd;
+        while (commands.pop(&cmd)) {
+            handle_command(&cmd);
+        }
+        sfx_load_step();
+
+        if (state != AUDIO_PLAYING) {
+            // No stream to feed: a hit sound plays alone, paced by the
+            // output; otherwise sleep until the next post or hit, unless
+            // an SFX is still loading
+            deadline_idle(DEADLINE_AUDIO);
+            if (!sfx_solo_step() && sfx_loader.fh == NULL) {
+                ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            }
+            continue;
+        }
+
+        if (stream.net) {
+            esp_err_t ret = net_service();
+            if (ret == ESP_ERR_TIMEOUT) {
+                // No sender yet; look again shortly, or at the next command.
+                // Until the first packet opens the output, hits play alone.
+                deadline_idle(DEADLINE_AUDIO);
+                if (stream.output_rate == 0 && sfx_solo_step()) {
+                    continue;
+                }
+                HitEvent hit;
+                while (bus_hit.poll(&hit_sub, &hit)) {
+                }
+                ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(NET_POLL_MS));
+                continue;
+            }
+            if (ret != ESP_OK) {
+                post_event(AUDIO_EVENT_ERROR, status.cmd_id, ret, 0);
+                stop_stream(AUDIO_EVENT_STOPPED);
+                publish_status();
+                continue;
+            }
+        }
+
+        if (!stream_step()) {
+            uint32_t id = status.cmd_id;
+            stream_close();
+            state = AUDIO_IDLE;
+            pending_start_us = 0;
+            post_event(AUDIO_EVENT_FINISHED, id, ESP_OK, 0);
+            publish_status();
+        }
+    }
+}
+
+static uint32_t post_command(audio_cmd_t *cmd)
+{
+    cmd->id = next_cmd_id.fetch_add(1, std::memory_order_relaxed);
+    if (cmd->id == 0) {
+        // 0 means "not posted"; skip it on wrap-around
+        cmd->id = next_cmd_id.fetch_add(1, std::memory_order_relaxed);
+    }
+    cmd->issued_us = esp_timer_get_time();
+    if (!commands.push(*cmd)) {
+        ESP_LOGW(TAG, "Audio command queue full");
+        return 0;
+    }
+    TaskHandle_t task = audio_task_handle;
+    if (task != NULL) {
+        xTaskNotifyGive(task);
+    }
+    return cmd->id;
+}
+
+#ifdef __cplusplus
+extern "C" {
 #endif
 
+esp_err_t audio_start(void)
+{
+    if (audio_task_handle != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    // Commands posted before this point are already queued and run first
+    return task_start(TASK_AUDIO, audio_task, NULL, &audio_task_handle) == pdPASS ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+uint32_t audio_play(const char *path)
+{
+    audio_cmd_t cmd = {};
+    cmd.kind = AUDIO_CMD_PLAY;
+    size_t len = strlen(path);
+    if (len >= sizeof(cmd.path)) {
+        ESP_LOGE(TAG, "Path too long: %s", path);
+        return 0;
+    }
+    memcpy(cmd.path, path, len + 1);
+    return post_command(&cmd);
+}
+
+uint32_t audio_play_net(void)
+{
+    audio_cmd_t cmd = {};
+    cmd.kind = AUDIO_CMD_PLAY_NET;
+    return post_command(&cmd);
+}
+
+uint32_t audio_stop(void)
+{
+    audio_cmd_t cmd = {};
+    cmd.kind = AUDIO_CMD_STOP;
+    return post_command(&cmd);
+}
+
+uint32_t audio_pause(void)
+{
+    audio_cmd_t cmd = {};
+    cmd.kind = AUDIO_CMD_PAUSE;
+    return post_command(&cmd);
+}
+
+uint32_t audio_resume(void)
+{
+    audio_cmd_t cmd = {};
+    cmd.kind = AUDIO_CMD_RESUME;
+    return post_command(&cmd);
+}
+
+uint32_t audio_seek(uint32_t position_ms)
+{
+    audio_cmd_t cmd = {};
+    cmd.kind = AUDIO_CMD_SEEK;
+    cmd.position_ms = position_ms;
+    return post_command(&cmd);
+}
+
+uint32_t audio_set_speed(float speed)
+{
+    audio_cmd_t cmd = {};
+    cmd.kind = AUDIO_CMD_SPEED;
+    cmd.speed = clamp_speed(speed);
+    return post_command(&cmd);
+}
+
+uint32_t audio_set_volume(uint8_t level)
+{
+    audio_cmd_t cmd = {};
+    cmd.kind = AUDIO_CMD_VOLUME;
+    cmd.volume = level > AUDIO_VOLUME_MAX ? AUDIO_VOLUME_MAX : level;
+    return post_command(&cmd);
+}
+
+void audio_get_status(audio_status_t *out)
+{
+    while (1) {
+        uint32_t before = status_seq.load(std::memory_order_acquire);
+        if (before & 1) {
+            continue;
+        }
+        memcpy(out, &status, sizeof(*out));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (status_seq.load(std::memory_order_relaxed) == before) {
+            break;
+        }
+    }
+    out->dropped_commands = commands.dropped();
+}
+
+uint32_t sfx_load(const char *path)
+{
+    audio_cmd_t cmd = {};
+    cmd.kind = AUDIO_CMD_SFX_LOAD;
+    size_t len = strlen(path);
+    if (len >= sizeof(cmd.path)) {
+        ESP_LOGE(TAG, "Path too long: %s", path);
+        return 0;
+    }
+    memcpy(cmd.path, path, len + 1);
+    return post_command(&cmd);
+}
+
+void sfx_trigger(int64_t origin_us)
+{
+    // 0 is the "nothing pending" marker
+    sfx_pending.store(origin_us != 0 ? origin_us : 1, std::memory_order_release);
+    // An idle audio task is asleep until notified; a playing one picks it up
+    // at the next block either way
+    TaskHandle_t task = audio_task_handle;
+    if (task != NULL) {
+        xTaskNotifyGive(task);
+    }
+}
+
+void sfx_get_latency_stats(sfx_latency_stats_t *out)
+{
+    while (1) {
+        uint32_t before = sfx_stats_seq.load(std::memory_order_acquire);
+        if (before & 1) {
+            continue;
+        }
+        memcpy(out, &sfx_stats_pub, sizeof(*out));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (sfx_stats_seq.load(std::memory_order_relaxed) == before) {
+            return;
+        }
+    }
+}
+
+void sfx_reset_latency_stats(void)
+{
+    sfx_stats_reset.store(true, std::memory_order_relaxed);
+    // An idle audio task would otherwise only clear them at the next hit
+    TaskHandle_t task = audio_task_handle;
+    if (task != NULL) {
+        xTaskNotifyGive(task);
+    }
+}
+
+#ifdef __cplusplus
+}
+#endif
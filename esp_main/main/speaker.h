@@ -1,35 +1,178 @@
 #ifndef SPEAKER_H
 #define SPEAKER_H
 
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "net_audio.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// Hit-to-sound budget checked by the SFX latency stats
+#define HIT_SFX_BUDGET_US 30000
+
+typedef struct {
+    uint32_t count;       // hits that reached the I2S queue
+    uint32_t over_budget; // hits slower than HIT_SFX_BUDGET_US
+    uint32_t retriggers;  // hits that cut off a still-playing SFX
+    int64_t min_us;
+    int64_t max_us;
+    int64_t last_us;
+    int64_t total_us;
+} sfx_latency_stats_t;
+
+/*
+ * Audio service
+ * -------------
+ * Playback runs on its own task (TASK_AUDIO). Callers post commands through
+ * a lock-free queue and return at once; each command gets an id that shows
+ * up again in the events and status it causes. The service checks for
+ * commands between mix blocks, so one takes effect within a block
+ * (MIX_BLOCK_FRAMES, ~3 ms at 44.1 kHz) of being posted.
+ *
+ * Events go out on the bus_audio topic (see bus.h). The time from a play,
+ * resume or seek command to its first sample leaving the speaker is
+ * measured the same way as the hit SFX latency and reported in the STARTED
+ * event and the status.
+ *
+ * Besides WAV files the service plays the network audio source (see
+ * net_audio.h) through the same output, mixer and SFX path.
+ */
+
+// Playback hands I2S blocks this many frames long, so a triggered SFX can
+// start mid-chunk instead of waiting for the next fread
+#define MIX_BLOCK_FRAMES 128
+
+#define AUDIO_PATH_MAX 64
+#define AUDIO_VOLUME_MAX 100
+
+typedef enum {
+    AUDIO_IDLE,
+    AUDIO_PLAYING,
+    AUDIO_PAUSED,
+} audio_state_t;
+
+typedef enum {
+    AUDIO_EVENT_STARTED,     // first sample after a play, resume or seek is queued
+    AUDIO_EVENT_PAUSED,
+    AUDIO_EVENT_FINISHED,    // reached the end of the file, or the network stream ended or went quiet
+    AUDIO_EVENT_STOPPED,     // stopped, or replaced by another play
+    AUDIO_EVENT_ERROR,       // the command could not be carried out, see err
+} audio_event_kind_t;
+
+typedef struct {
+    audio_event_kind_t kind;
+    uint32_t cmd_id;
+    esp_err_t err;
+    int64_t latency_us;      // STARTED only: command to first sample
+} audio_event_t;
+
+typedef struct {
+    audio_state_t state;
+    uint32_t cmd_id;         // id of the command that started the current file
+    char path[AUDIO_PATH_MAX];
+    uint32_t position_ms;
+    uint32_t duration_ms;
+    float speed;
+    uint8_t volume;          // 0 to AUDIO_VOLUME_MAX
+    uint32_t output_rate;    // 0 unless playing
+    int64_t last_latency_us; // command to first sample, last play/resume/seek
+    int64_t max_latency_us;
+    uint32_t commands;       // commands carried out
+    uint32_t dropped_commands; // posts refused because the queue was full
+    bool net;                // playing the network source; path is "net"
+    net_audio_stats_t net_stats; // jitter buffer of the latest network stream
+} audio_status_t;
+
+/**
+ * @brief Start the audio service task
+ */
+esp_err_t audio_start(void);
+
+/**
+ * @brief Play a 16-bit WAV file, replacing whatever is playing
+ *
+ * These post a command and return at once; safe to call from any task.
+ *
+ * @return Command id, 0 if the command queue was full
+ */
+uint32_t audio_play(const char *path);
+uint32_t audio_stop(void);
+uint32_t audio_pause(void);
+uint32_t audio_resume(void);
+uint32_t audio_seek(uint32_t position_ms);
+
 /**
- * @brief Initialize and run speaker test/playback
- * This function initializes the SD card, lists files, and plays the configured WAV file
+ * @brief Play whatever a sender streams to NET_AUDIO_PORT, replacing
+ *        whatever is playing
+ *
+ * The output opens at the sender's rate once its first packet arrives and
+ * follows it if the format changes. The stream finishes when the sender
+ * marks its last packet or goes quiet for a few seconds. Seek, pause and
+ * speed don't apply to a live stream.
  */
-void speaker_main(void);
+uint32_t audio_play_net(void);
 
 /**
- * @brief Set the playback speed multiplier
- * 
+ * @brief Change the playback speed, live if something is playing
+ *
  * @param speed Playback speed multiplier (1.0 = normal, 2.0 = 2x speed, 0.5 = half speed)
  *              Valid range: 0.25x to 4.0x (values outside this range will be clamped)
- * 
+ *
  * @note This affects the pitch of the audio (faster = higher pitch, slower = lower pitch)
- * @note Speed must be set BEFORE calling play functions
- * @note The final sample rate is clamped to hardware limits (8000-48000 Hz for PDM)
- *       For a 44100 Hz WAV file: max speed ~1.08x, min speed ~0.18x
+ * @note The final sample rate is clamped to hardware limits (8000-48000 Hz for PDM);
+ *       faster speeds than that skip frames
+ */
+uint32_t audio_set_speed(float speed);
+
+/**
+ * @brief Change the music volume (0 to AUDIO_VOLUME_MAX); the SFX stay at full level
  */
-void set_playback_speed(float speed);
+uint32_t audio_set_volume(uint8_t volume);
 
 /**
- * @brief Get the current playback speed multiplier
+ * @brief Copy out the current playback status
+ */
+void audio_get_status(audio_status_t *out);
+
+/**
+ * @brief Preload a short 16-bit WAV file into RAM as the hit sound effect
  *
- * @return Current playback speed (1.0 = normal speed)
+ * Read by the audio task a small chunk at a time between mix blocks into a
+ * second buffer, so the card never holds up the output. The current effect
+ * keeps playing until the new one is complete; the mixer never sees a
+ * half-loaded effect. A file that can't be loaded, or a load overtaken by
+ * a newer one, shows up as an AUDIO_EVENT_ERROR with the returned id.
+ *
+ * @param path Path of the WAV file (e.g. "/sdcard/hit.wav")
+ * @note Stereo files are downmixed to mono; anything longer than the SFX buffer is truncated
+ * @return Command id, 0 if the queue was full or the path too long
+ */
+uint32_t sfx_load(const char *path);
+
+/**
+ * @brief Start the preloaded sound effect on top of the current playback
+ *
+ * Every hit published on bus_hit does this too. Safe to call from any task. The voice is mixed into the next I2S block
+ * (a few milliseconds away) rather than the next file chunk. With nothing
+ * playing, the output opens at the effect's own rate for the voice alone
+ * and closes again once it has played out.
+ *
+ * @param origin_us esp_timer time of the input that caused the hit, used for latency stats
+ */
+void sfx_trigger(int64_t origin_us);
+
+/**
+ * @brief Copy out the motion-to-sound latency statistics of all hits so far
+ */
+void sfx_get_latency_stats(sfx_latency_stats_t *out);
+
+/**
+ * @brief Clear the latency statistics; takes effect at the next mixed block
  */
-float get_playback_speed(void);
+void sfx_reset_latency_stats(void);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,491 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_console.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "analyzer.h"
+#include "boot.h"
+#include "calibration.h"
+#include "deadline.h"
+#include "console_repl.h"
+#include "game.h"
+#include "hal.h"
+#include "jobs.h"
+#include "node_control.h"
+#include "replay.h"
+#include "speaker.h"
+#include "stats_console.h"
+#include "tasks.h"
+#include "telemetry.h"
+#include "trace.h"
+
+#define TOP_DEFAULT_COUNT 10
+#define TOP_DEFAULT_INTERVAL_MS 1000
+#define TRACE_FILE HAL_STORAGE_ROOT "/trace.bin"
+#define DEADLINE_FILE HAL_STORAGE_ROOT "/deadline.txt"
+
+// Only the REPL task touches these, so they don't need to live on its stack
+static telemetry_snapshot_t captures[2];
+static task_cpu_stat_t task_stats[TASK_STATS_MAX];
+// 'stats' shows CPU since boot or 'stats reset'; 'top' since its last refresh
+static task_stats_window_t stats_window;
+static task_stats_window_t top_window;
+
+static void print_tasks(task_stats_window_t *window)
+{
+    size_t n = task_stats_sample(window, task_stats, TASK_STATS_MAX);
+    printf("%-16s %4s %4s %7s %6s\n", "task", "core", "prio", "cpu", "stack");
+    for (size_t i = 0; i < n; i++) {
+        char core[4] = "-";
+        if (task_stats[i].core != tskNO_AFFINITY) {
+            snprintf(core, sizeof(core), "%d", (int)task_stats[i].core);
+        }
+        printf("%-16s %4s %4u %3lu.%lu%% %6lu\n", task_stats[i].name, core,
+               (unsigned)task_stats[i].priority, task_stats[i].cpu_permille / 10,
+               task_stats[i].cpu_permille % 10, task_stats[i].stack_free);
+    }
+}
+
+static int cmd_stats(int argc, char **argv)
+{
+    if (argc > 1) {
+        if (strcmp(argv[1], "reset") != 0) {
+            printf("usage: stats [reset]\n");
+            return 1;
+        }
+        telemetry_reset();
+        // Also restarts the CPU accounting window
+        task_stats_sample(&stats_window, task_stats, TASK_STATS_MAX);
+        printf("counters reset\n");
+        return 0;
+    }
+
+    telemetry_capture(&captures[0]);
+    telemetry_print(&captures[0], NULL);
+    printf("\n");
+    print_tasks(&stats_window);
+    return 0;
+}
+
+static int cmd_top(int argc, char **argv)
+{
+    int count = argc > 1 ? atoi(argv[1]) : TOP_DEFAULT_COUNT;
+    int interval_ms = argc > 2 ? atoi(argv[2]) : TOP_DEFAULT_INTERVAL_MS;
+    if (count <= 0 || interval_ms <= 0) {
+        printf("usage: top [count] [interval_ms]\n");
+        return 1;
+    }
+
+    int cur = 0;
+    telemetry_capture(&captures[cur]);
+    task_stats_sample(&top_window, task_stats, TASK_STATS_MAX);
+    for (int i = 0; i < count; i++) {
+        vTaskDelay(pdMS_TO_TICKS(interval_ms));
+        telemetry_capture(&captures[1 - cur]);
+        cur = 1 - cur;
+
+        // Clear the screen and home the cursor
+        printf("\033[2J\033[H");
+        telemetry_print(&captures[cur], &captures[1 - cur]);
+        printf("\n");
+        print_tasks(&top_window);
+        fflush(stdout);
+    }
+    return 0;
+}
+
+static int cmd_boot(int argc, char **argv)
+{
+    boot_print_timeline();
+    return 0;
+}
+
+static int cmd_cal(int argc, char **argv)
+{
+    if (argc == 4) {
+        imu_bias_t bias = {(int16_t)atoi(argv[2]), (int16_t)atoi(argv[3])};
+        esp_err_t ret = calibration_set(atoi(argv[1]), bias);
+        if (ret != ESP_OK) {
+            printf("cal: %s\n", esp_err_to_name(ret));
+            return 1;
+        }
+    } else if (argc != 1) {
+        printf("usage: cal [device gyro_y gyro_z]\n");
+        return 1;
+    }
+
+    for (int i = 0; i < N_CURSORS; i++) {
+        imu_bias_t bias = calibration_bias(i);
+        printf("device %d: gyro_y %d gyro_z %d\n", i, bias.gyro_y, bias.gyro_z);
+    }
+    return 0;
+}
+
+static int cmd_jobs(int argc, char **argv)
+{
+    co_stats_t st;
+    jobs.stats(&st);
+    printf("workers %u, jobs alive %lu, started %lu, rejected %lu\n", (unsigned)st.workers,
+           st.jobs_alive, st.jobs_started, st.rejected);
+    printf("resumes %lu\n", st.resumes);
+    printf("frames %lu bytes, peak %lu, failed allocations %lu\n", st.frame_bytes, st.frame_peak,
+           st.frame_failures);
+    return 0;
+}
+
+static int cmd_deadline(int argc, char **argv)
+{
+    if (argc == 1) {
+        deadline_print(stdout, -1);
+    } else if (argc == 2 && strcmp(argv[1], "clear") == 0) {
+        deadline_clear();
+    } else if ((argc == 2 || argc == 3) && strcmp(argv[1], "save") == 0) {
+        esp_err_t ret = hal_storage()->mount();
+        if (ret == ESP_OK) {
+            ret = deadline_save(argc == 3 ? argv[2] : DEADLINE_FILE);
+        }
+        if (ret != ESP_OK) {
+            printf("deadline: %s\n", esp_err_to_name(ret));
+            return 1;
+        }
+    } else if (argc == 2 && argv[1][0] >= '0' && argv[1][0] <= '9') {
+        deadline_print(stdout, atoi(argv[1]));
+    } else {
+        printf("usage: deadline [<snapshot>|save [path]|clear]\n");
+        return 1;
+    }
+    return 0;
+}
+
+static const char *const AUDIO_STATE_NAMES[] = {"idle", "playing", "paused"};
+
+static int cmd_audio(int argc, char **argv)
+{
+    uint32_t id = 0;
+    if (argc == 3 && strcmp(argv[1], "play") == 0) {
+        id = audio_play(argv[2]);
+    } else if (argc == 2 && strcmp(argv[1], "net") == 0) {
+        id = audio_play_net();
+    } else if (argc == 2 && strcmp(argv[1], "stop") == 0) {
+        id = audio_stop();
+    } else if (argc == 2 && strcmp(argv[1], "pause") == 0) {
+        id = audio_pause();
+    } else if (argc == 2 && strcmp(argv[1], "resume") == 0) {
+        id = audio_resume();
+    } else if (argc == 3 && strcmp(argv[1], "seek") == 0) {
+        id = audio_seek((uint32_t)atoi(argv[2]));
+    } else if (argc == 3 && strcmp(argv[1], "speed") == 0) {
+        id = audio_set_speed(strtof(argv[2], NULL));
+    } else if (argc == 3 && strcmp(argv[1], "volume") == 0) {
+        id = audio_set_volume((uint8_t)atoi(argv[2]));
+    } else if (argc != 1) {
+        printf("usage: audio [play <path>|net|stop|pause|resume|seek <ms>|speed <x>|volume <0-100>]\n");
+        return 1;
+    }
+    if (argc > 1) {
+        if (id == 0) {
+            printf("audio: command queue full\n");
+            return 1;
+        }
+        printf("command %lu posted\n", id);
+        return 0;
+    }
+
+    audio_status_t st;
+    audio_get_status(&st);
+    printf("%s %s  %lu.%03lu / %lu.%03lu s  speed %.2fx  volume %u  rate %lu Hz\n",
+           AUDIO_STATE_NAMES[st.state], st.state != AUDIO_IDLE ? st.path : "-",
+           st.position_ms / 1000, st.position_ms % 1000, st.duration_ms / 1000, st.duration_ms % 1000,
+           st.speed, st.volume, st.output_rate);
+    printf("command to first sample: last %lld us, max %lld us\n", st.last_latency_us, st.max_latency_us);
+    printf("commands %lu, dropped %lu\n", st.commands, st.dropped_commands);
+    if (st.net) {
+        const net_audio_stats_t *n = &st.net_stats;
+        printf("net %s  %lu Hz x%u  depth %lu / target %lu frames (max %lu)  jitter %lu us  drift %ld ppm\n",
+               n->playing ? "playing" : "buffering", n->sample_rate, n->channels,
+               n->depth_frames, n->target_frames, n->max_depth_frames, n->jitter_us, n->drift_ppm);
+        printf("net packets %lu, late %lu, concealed %lu, underruns %lu, duplicates %lu, overflows %lu, "
+               "malformed %lu, resets %lu\n",
+               n->packets, n->late, n->concealed, n->underruns, n->duplicates, n->overflows,
+               n->malformed, n->resets);
+    }
+    return 0;
+}
+
+static int cmd_spectrum(int argc, char **argv)
+{
+    analyzer_stats_t st;
+    analyzer_get_stats(&st);
+    analyzer_snapshot_t s;
+    analyzer_get(&s);
+    printf("analyses %lu, blocks %lu, last %lu us, max %lu us, rate %lu Hz\n", st.analyses, st.blocks,
+           st.last_us, st.max_us, s.sample_rate);
+    printf("tempo %.1f bpm, beats %lu (confidence %.2f), tracker max %lu us\n", s.bpm, s.beats,
+           s.beat.confidence, st.track_max_us);
+    printf("hits on the beat %lu/%lu, mean offset %ld ms\n", st.on_beat, st.hits, st.mean_offset_us / 1000);
+    for (size_t b = 0; b < SPECTRUM_BANDS; b++) {
+        char bar[33];
+        size_t n = s.bands[b] / 8;
+        memset(bar, '#', n);
+        bar[n] = '\0';
+        printf("%2u %3u %s\n", (unsigned)b, s.bands[b], bar);
+    }
+    return 0;
+}
+
+static const char *const uplinks[] = {"samples", "events", "both"};
+
+static void print_settings(const char *label, const imu_settings_t *s)
+{
+    printf("  %-9s %u Hz, batch %u, dead band %u, range %dg %d dps, %s\n", label, s->rate_hz, s->batch,
+           s->dead_band, 2 << s->accel_range, 250 << s->gyro_range,
+           s->uplink <= IMU_UPLINK_BOTH ? uplinks[s->uplink] : "?");
+}
+
+// Range index of a full scale given in g or degrees/s, -1 if none matches
+static int range_index(int value, int base)
+{
+    for (int i = 0; i < 4; i++) {
+        if (value == base << i) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int cmd_node(int argc, char **argv)
+{
+    if (argc == 1) {
+        int64_t now = esp_timer_get_time();
+        bool any = false;
+        for (uint8_t d = 0; d < HAL_MAX_IMU_DEVICES; d++) {
+            imu_node_state_t n;
+            node_control_get(d, &n);
+            if (!n.seen) {
+                continue;
+            }
+            any = true;
+            struct in_addr addr = {.s_addr = n.peer.addr};
+            printf("device %u at %s:%u, heard %lld ms ago, %lu acks, %lu resends%s%s%s\n", d,
+                   inet_ntoa(addr), ntohs(n.peer.port), (now - n.heard_us) / 1000, n.acks, n.resends,
+                   n.pending ? ", SET pending" : "", n.failed ? ", SET unanswered" : "",
+                   n.adjusted ? ", adjusted" : "");
+            if (n.events > 0) {
+                printf("  events    %lu, %lu lost\n", n.events, n.events_lost);
+            }
+            if (n.backlog_msgs > 0) {
+                printf("  backlog   %lu samples in %lu messages, %lu messages lost, %lu repeated, "
+                       "%lu dropped by the node, %lu still queued\n",
+                       n.backlog_samples, n.backlog_msgs, n.backlog_msgs_lost, n.backlog_repeats,
+                       n.backlog_dropped, n.backlog_remaining);
+            }
+            print_settings("effective", &n.effective);
+            if (n.has_wanted) {
+                print_settings("wanted", &n.wanted);
+            }
+        }
+        if (!any) {
+            printf("no nodes heard from\n");
+        }
+        return 0;
+    }
+
+    // Change one thing, keeping the rest as last asked for (or as running)
+    imu_node_state_t n;
+    uint8_t device = (uint8_t)atoi(argv[1]);
+    node_control_get(device, &n);
+    imu_settings_t s = n.has_wanted ? n.wanted : n.effective;
+    if (!n.has_wanted && !n.seen) {
+        imu_settings_default(&s);
+    }
+    bool ok = true;
+    if (argc == 4 && strcmp(argv[2], "rate") == 0) {
+        s.rate_hz = (uint16_t)atoi(argv[3]);
+    } else if (argc == 4 && strcmp(argv[2], "batch") == 0) {
+        s.batch = (uint8_t)atoi(argv[3]);
+    } else if (argc == 4 && strcmp(argv[2], "deadband") == 0) {
+        s.dead_band = (uint16_t)atoi(argv[3]);
+    } else if (argc == 5 && strcmp(argv[2], "range") == 0) {
+        int accel = range_index(atoi(argv[3]), 2);
+        int gyro = range_index(atoi(argv[4]), 250);
+        ok = accel >= 0 && gyro >= 0;
+        s.accel_range = (uint8_t)accel;
+        s.gyro_range = (uint8_t)gyro;
+    } else if (argc == 4 && strcmp(argv[2], "uplink") == 0) {
+        ok = false;
+        for (uint8_t u = 0; u <= IMU_UPLINK_BOTH; u++) {
+            if (strcmp(argv[3], uplinks[u]) == 0) {
+                s.uplink = u;
+                ok = true;
+            }
+        }
+    } else {
+        ok = false;
+    }
+    if (!ok) {
+        printf("usage: node [<device> rate <hz>|batch <n>|deadband <counts>|range <2-16 g> <250-2000 dps>|\n"
+               "            uplink samples|events|both]\n");
+        return 1;
+    }
+    esp_err_t ret = node_control_set(device, &s);
+    if (ret != ESP_OK) {
+        printf("node: %s\n", esp_err_to_name(ret));
+        return 1;
+    }
+    print_settings("requested", &s);
+    return 0;
+}
+
+static int cmd_replay(int argc, char **argv)
+{
+    if (argc > 2) {
+        printf("usage: replay [path]\n");
+        return 1;
+    }
+    const char *path = argc == 2 ? argv[1] : SESSION_FILE;
+
+    // The replay drives the world itself: end the live session first, which
+    // also completes its recording in case that is what is being replayed
+    esp_err_t ret = game_session_end();
+    if (ret != ESP_OK) {
+        printf("replay: no session to end (%s)\n", esp_err_to_name(ret));
+        return 1;
+    }
+    replay_result_t result;
+    ret = replay_run(path, &result);
+    replay_print_result(path, ret, &result);
+
+    // Then play on in a new session, recorded over the last one
+    bool record = hal_storage()->mount() == ESP_OK;
+    game_session_start(esp_random(), record ? SESSION_FILE : NULL);
+    return ret == ESP_OK ? 0 : 1;
+}
+
+#if CONFIG_MCHACKS_TRACE
+static int cmd_trace(int argc, char **argv)
+{
+    esp_err_t ret = ESP_ERR_INVALID_ARG;
+    if (argc == 2 && strcmp(argv[1], "on") == 0) {
+        trace_set_enabled(true);
+        ret = ESP_OK;
+    } else if (argc == 2 && strcmp(argv[1], "off") == 0) {
+        trace_set_enabled(false);
+        ret = ESP_OK;
+    } else if ((argc == 2 || argc == 3) && strcmp(argv[1], "dump") == 0) {
+        ret = hal_storage()->mount();
+        if (ret == ESP_OK) {
+            ret = trace_dump_file(argc == 3 ? argv[2] : TRACE_FILE);
+        }
+    } else if (argc == 4 && strcmp(argv[1], "send") == 0) {
+        ret = trace_dump_tcp(argv[2], (uint16_t)atoi(argv[3]));
+    } else {
+        printf("usage: trace on|off|dump [path]|send <ip> <port>\n");
+        return 1;
+    }
+    if (ret != ESP_OK) {
+        printf("trace: %s\n", esp_err_to_name(ret));
+        return 1;
+    }
+    return 0;
+}
+#endif
+
+esp_err_t stats_console_start(void)
+{
+    const esp_console_cmd_t stats_cmd = {
+        .command = "stats",
+        .help = "Performance counters since boot or the last 'stats reset'",
+        .hint = "[reset]",
+        .func = &cmd_stats,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&stats_cmd));
+
+    const esp_console_cmd_t top_cmd = {
+        .command = "top",
+        .help = "Live rates and per-task CPU, refreshed count times every interval_ms",
+        .hint = "[count] [interval_ms]",
+        .func = &cmd_top,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&top_cmd));
+
+    const esp_console_cmd_t audio_cmd = {
+        .command = "audio",
+        .help = "Playback status, or post a command to the audio service",
+        .hint = "[play <path>|net|stop|pause|resume|seek <ms>|speed <x>|volume <0-100>]",
+        .func = &cmd_audio,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&audio_cmd));
+
+    const esp_console_cmd_t boot_cmd = {
+        .command = "boot",
+        .help = "Boot step timeline, first frame and first IMU sample",
+        .hint = NULL,
+        .func = &cmd_boot,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&boot_cmd));
+
+    const esp_console_cmd_t cal_cmd = {
+        .command = "cal",
+        .help = "Show the IMU gyro bias, or set and store one device's",
+        .hint = "[device gyro_y gyro_z]",
+        .func = &cmd_cal,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&cal_cmd));
+
+    const esp_console_cmd_t deadline_cmd = {
+        .command = "deadline",
+        .help = "Deadline misses of the audio, render and IMU loops, with their post-mortem snapshots",
+        .hint = "[<snapshot>|save [path]|clear]",
+        .func = &cmd_deadline,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&deadline_cmd));
+
+    const esp_console_cmd_t jobs_cmd = {
+        .command = "jobs",
+        .help = "Background job executor: workers, live jobs, coroutine frame memory",
+        .hint = NULL,
+        .func = &cmd_jobs,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&jobs_cmd));
+
+    const esp_console_cmd_t spectrum_cmd = {
+        .command = "spectrum",
+        .help = "Band levels, tempo and hit timing from the audio analyzer, and what they cost",
+        .hint = NULL,
+        .func = &cmd_spectrum,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&spectrum_cmd));
+
+    const esp_console_cmd_t node_cmd = {
+        .command = "node",
+        .help = "IMU nodes and their settings, or change one node's",
+        .hint = "[<device> rate <hz>|batch <n>|deadband <counts>|range <g> <dps>|uplink <what>]",
+        .func = &cmd_node,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&node_cmd));
+
+    const esp_console_cmd_t replay_cmd = {
+        .command = "replay",
+        .help = "End the session and replay a recording, checking every tick's world hash",
+        .hint = "[path]",
+        .func = &cmd_replay,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&replay_cmd));
+
+#if CONFIG_MCHACKS_TRACE
+    const esp_console_cmd_t trace_cmd = {
+        .command = "trace",
+        .help = "Pause/resume the event tracer, or dump it to the SD card or a TCP listener",
+        .hint = "on|off|dump [path]|send <ip> <port>",
+        .func = &cmd_trace,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&trace_cmd));
+#endif
+
+    const task_config_t *cfg = &TASK_CONFIG[TASK_CONSOLE];
+    return console_repl_start("mchacks>", cfg->priority, cfg->stack, cfg->core);
+}
@@ -0,0 +1,16 @@
+#ifndef STATS_CONSOLE_H
+#define STATS_CONSOLE_H
+
+#include "esp_err.h"
+
+/**
+ * @brief Register the performance console commands and start the REPL
+ *
+ *   stats          counters since boot or the last reset, plus per-task CPU
+ *   stats reset    zero every counter and start a new window
+ *   top [n] [ms]   refresh a rate view n times (default 10), every ms (default 1000)
+ *   trace ...      event tracer control and dump (CONFIG_MCHACKS_TRACE only)
+ */
+esp_err_t stats_console_start(void);
+
+#endif // STATS_CONSOLE_H
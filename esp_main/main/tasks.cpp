@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "tasks.h"
+
+static const char *TAG = "tasks";
+
+const task_config_t TASK_CONFIG[TASK_COUNT] = {
+    // In task_id_t order
+    // name          core            prio  stack
+    {"audio",        0,              21,   4096},  // TASK_AUDIO
+    {"game",         1,              12,   4096},  // TASK_GAME
+    {"graphics",     1,              10,   4096},  // TASK_GRAPHICS
+    {"rec_writer",   0,              3,    3072},  // TASK_REC_WRITER
+    {"console",      0,              2,    4096},  // TASK_CONSOLE (created by esp_console)
+    {"jobs0",        0,              5,    4096},  // TASK_JOBS0
+    {"jobs1",        1,              5,    4096},  // TASK_JOBS1
+    {"boot",         tskNO_AFFINITY, 8,    6144},  // TASK_BOOT (WiFi bring-up needs the stack)
+    {"http",         0,              2,    4096},  // TASK_HTTP
+};
+
+BaseType_t task_start(task_id_t id, TaskFunction_t fn, void *arg, TaskHandle_t *handle)
+{
+    const task_config_t *cfg = &TASK_CONFIG[id];
+    BaseType_t ret = xTaskCreatePinnedToCore(fn, cfg->name, cfg->stack, arg,
+                                             cfg->priority, handle, cfg->core);
+    if (ret != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start task %s", cfg->name);
+    }
+    return ret;
+}
+
+BaseType_t task_start_in(task_id_t id, TaskFunction_t fn, void *arg, MemArena *arena, TaskHandle_t *handle)
+{
+    const task_config_t *cfg = &TASK_CONFIG[id];
+    StackType_t *stack = (StackType_t *)arena->alloc(cfg->stack, 16);
+    StaticTask_t *tcb = arena->alloc_array<StaticTask_t>(1);
+    if (stack == NULL || tcb == NULL) {
+        ESP_LOGE(TAG, "No arena room for task %s", cfg->name);
+        return pdFAIL;
+    }
+
+    TaskHandle_t task = xTaskCreateStaticPinnedToCore(fn, cfg->name, cfg->stack, arg,
+                                                      cfg->priority, stack, tcb, cfg->core);
+    if (handle != NULL) {
+        *handle = task;
+    }
+    return task != NULL ? pdPASS : pdFAIL;
+}
+
+size_t task_stats_sample(task_stats_window_t *window, task_cpu_stat_t *out, size_t max)
+{
+    uint32_t total = 0;
+    UBaseType_t count = uxTaskGetSystemState(window->status, TASK_STATS_MAX, &total);
+    if (count == 0) {
+        // Only happens when the table is too small for every task
+        ESP_LOGW(TAG, "%u tasks, task stats only have room for %d",
+                 (unsigned)uxTaskGetNumberOfTasks(), TASK_STATS_MAX);
+        return 0;
+    }
+    uint32_t elapsed = total - window->prev_total;
+
+    size_t n = 0;
+    for (UBaseType_t i = 0; i < count && n < max; i++) {
+        const TaskStatus_t *status = &window->status[i];
+        uint32_t previous = 0;
+        for (size_t j = 0; j < window->prev_count; j++) {
+            if (window->prev_number[j] == status->xTaskNumber) {
+                previous = window->prev_runtime[j];
+                break;
+            }
+        }
+
+        task_cpu_stat_t *stat = &out[n++];
+        strncpy(stat->name, status->pcTaskName, sizeof(stat->name) - 1);
+        stat->name[sizeof(stat->name) - 1] = '\0';
+        stat->core = xTaskGetCoreID(status->xHandle);
+        stat->priority = status->uxCurrentPriority;
+        stat->stack_free = status->usStackHighWaterMark;
+        stat->cpu_permille = elapsed > 0
+            ? (uint32_t)((uint64_t)(status->ulRunTimeCounter - previous) * 1000 / elapsed)
+            : 0;
+    }
+
+    for (UBaseType_t i = 0; i < count; i++) {
+        window->prev_number[i] = window->status[i].xTaskNumber;
+        window->prev_runtime[i] = window->status[i].ulRunTimeCounter;
+    }
+    window->prev_count = count;
+    window->prev_total = total;
+    return n;
+}
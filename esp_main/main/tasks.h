@@ -0,0 +1,102 @@
+#ifndef TASKS_H
+#define TASKS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "mem_pool.h"
+
+/*
+ * Core and priority plan for the main board
+ * -----------------------------------------
+ * Core 0: WiFi/lwIP (pinned there through sdkconfig.defaults), audio and
+ *         background I/O. Audio outranks everything of ours so the I2S
+ *         queue is refilled first; only the WiFi driver and esp_timer sit
+ *         above it.
+ * Core 1: the game simulation and the renderer, which get the whole core
+ *         to themselves instead of fighting the network stack for it.
+ *
+ * Jobs:   waiting-heavy background work runs as coroutines (see jobs.h) on
+ *         one low-priority worker per core rather than a task each.
+ *
+ * Boot:   the init step workers (see boot.h) float between the cores and
+ *         are gone once the firmware is up.
+ *
+ * HTTP:   the telemetry server (see telemetry_http.h) sits with the network
+ *         stack on core 0, at the console's priority, below all the rest.
+ *
+ * Every task the firmware creates is started through task_start() with an
+ * entry from this table, so the plan lives in one place.
+ */
+
+typedef enum {
+    TASK_AUDIO,
+    TASK_GAME,
+    TASK_GRAPHICS,
+    TASK_REC_WRITER,
+    TASK_CONSOLE,
+    TASK_JOBS0,
+    TASK_JOBS1,
+    TASK_BOOT,
+    TASK_HTTP,
+    TASK_COUNT,
+} task_id_t;
+
+typedef struct {
+    const char *name;
+    BaseType_t core;
+    UBaseType_t priority;
+    uint32_t stack;
+} task_config_t;
+
+extern const task_config_t TASK_CONFIG[TASK_COUNT];
+
+/**
+ * @brief Create a task with the core, priority and stack from TASK_CONFIG
+ */
+BaseType_t task_start(task_id_t id, TaskFunction_t fn, void *arg, TaskHandle_t *handle);
+
+/**
+ * @brief Like task_start(), with the stack and TCB taken from an arena
+ *
+ * For tasks created after boot, so they never touch the heap. The memory is
+ * not returned when the task ends; create such tasks once and keep them.
+ */
+BaseType_t task_start_in(task_id_t id, TaskFunction_t fn, void *arg, MemArena *arena, TaskHandle_t *handle);
+
+#define TASK_STATS_MAX 32
+
+typedef struct {
+    char name[configMAX_TASK_NAME_LEN];
+    BaseType_t core;              // tskNO_AFFINITY if unpinned
+    UBaseType_t priority;
+    uint32_t cpu_permille;        // share of one core since the previous sample
+    uint32_t stack_free;          // stack high water mark, bytes
+} task_cpu_stat_t;
+
+// One caller's CPU accounting window: the run-time counters from its previous
+// sample, matched up by task number. Each caller keeps its own, so sampling
+// from one place never shortens another's window.
+typedef struct {
+    TaskStatus_t status[TASK_STATS_MAX];
+    UBaseType_t prev_number[TASK_STATS_MAX];
+    uint32_t prev_runtime[TASK_STATS_MAX];
+    size_t prev_count;
+    uint32_t prev_total;
+} task_stats_window_t;
+
+/**
+ * @brief Per-task CPU usage since the previous call with the same window
+ *
+ * Built on the FreeRTOS run-time counters (CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS).
+ * Each core contributes 1000 permille, so a dual-core total is 2000. Logs a
+ * warning and returns nothing when there are more than TASK_STATS_MAX tasks.
+ *
+ * @param window Zero-initialised before the first call; the first sample
+ *               covers the time since boot
+ * @return Number of entries written to out
+ */
+size_t task_stats_sample(task_stats_window_t *window, task_cpu_stat_t *out, size_t max);
+
+#endif // TASKS_H
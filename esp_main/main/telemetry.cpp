@@ -0,0 +1,486 @@
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include "esp_timer.h"
+#include "hal.h"
+#include "telemetry.h"
+#if !CONFIG_IDF_TARGET_LINUX
+#include "esp_heap_caps.h"
+#endif
+
+// Writers are the tasks that own each path; readers only ever copy
+static std::atomic<uint32_t> frames(0);
+static std::atomic<uint32_t> frame_max_us(0);
+static std::atomic<uint32_t> frame_hist[TELEMETRY_FRAME_BUCKETS];
+
+static std::atomic<uint32_t> audio_rate(0);
+
+static std::atomic<uint64_t> sd_read_bytes(0);
+static std::atomic<uint64_t> sd_read_us(0);
+static std::atomic<uint64_t> sd_write_bytes(0);
+static std::atomic<uint64_t> sd_write_us(0);
+
+static std::atomic<uint32_t> imu_samples[HAL_MAX_IMU_DEVICES];
+static std::atomic<uint32_t> imu_latency_max_us(0);
+static std::atomic<uint32_t> imu_latency_hist[TELEMETRY_IMU_LATENCY_BUCKETS];
+
+// Driver-side counters are cumulative from boot; a reset just moves the baseline
+static uint32_t underrun_base = 0;
+static uint32_t imu_received_base[HAL_MAX_IMU_DEVICES];
+static uint32_t imu_lost_base = 0;
+static uint32_t published_base[BUS_MAX_TOPICS];
+
+static int64_t window_start_us = 0;
+
+static telemetry_queue_t watched_queues[TELEMETRY_MAX_QUEUES];
+static QueueHandle_t watched_handles[TELEMETRY_MAX_QUEUES];
+static std::atomic<size_t> n_watched(0);
+
+void telemetry_frame(uint32_t interval_us)
+{
+    uint32_t bucket = interval_us / TELEMETRY_FRAME_BUCKET_US;
+    if (bucket >= TELEMETRY_FRAME_BUCKETS) {
+        bucket = TELEMETRY_FRAME_BUCKETS - 1;
+    }
+    frame_hist[bucket].fetch_add(1, std::memory_order_relaxed);
+    frames.fetch_add(1, std::memory_order_relaxed);
+    if (interval_us > frame_max_us.load(std::memory_order_relaxed)) {
+        frame_max_us.store(interval_us, std::memory_order_relaxed);
+    }
+}
+
+void telemetry_audio_stream(uint32_t sample_rate)
+{
+    audio_rate.store(sample_rate, std::memory_order_relaxed);
+}
+
+void telemetry_sd_read(size_t bytes, int64_t elapsed_us)
+{
+    sd_read_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    sd_read_us.fetch_add(elapsed_us, std::memory_order_relaxed);
+}
+
+void telemetry_sd_write(size_t bytes, int64_t elapsed_us)
+{
+    sd_write_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    sd_write_us.fetch_add(elapsed_us, std::memory_order_relaxed);
+}
+
+void telemetry_imu_sample(int device)
+{
+    if (device >= 0 && device < HAL_MAX_IMU_DEVICES) {
+        imu_samples[device].fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void telemetry_imu_latency(uint32_t latency_us)
+{
+    uint32_t bucket = latency_us / TELEMETRY_IMU_LATENCY_BUCKET_US;
+    if (bucket >= TELEMETRY_IMU_LATENCY_BUCKETS) {
+        bucket = TELEMETRY_IMU_LATENCY_BUCKETS - 1;
+    }
+    imu_latency_hist[bucket].fetch_add(1, std::memory_order_relaxed);
+    if (latency_us > imu_latency_max_us.load(std::memory_order_relaxed)) {
+        imu_latency_max_us.store(latency_us, std::memory_order_relaxed);
+    }
+}
+
+void telemetry_watch_queue(const char *name, QueueHandle_t queue)
+{
+    size_t n = n_watched.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < n; i++) {
+        if (watched_handles[i] == queue) {
+            return;
+        }
+    }
+    if (n >= TELEMETRY_MAX_QUEUES) {
+        return;
+    }
+    watched_queues[n].name = name;
+    watched_handles[n] = queue;
+    n_watched.store(n + 1, std::memory_order_release);
+}
+
+size_t telemetry_queue_depths(telemetry_queue_t *out, size_t max)
+{
+    size_t n = n_watched.load(std::memory_order_acquire);
+    if (n > max) {
+        n = max;
+    }
+    for (size_t i = 0; i < n; i++) {
+        out[i].name = watched_queues[i].name;
+        out[i].waiting = uxQueueMessagesWaiting(watched_handles[i]);
+        out[i].capacity = out[i].waiting + uxQueueSpacesAvailable(watched_handles[i]);
+    }
+    return n;
+}
+
+void telemetry_heap(telemetry_heap_t *out)
+{
+    memset(out, 0, sizeof(*out));
+#if !CONFIG_IDF_TARGET_LINUX
+    out->free = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    out->min_free = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL);
+    out->largest_block = heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL);
+#endif
+}
+
+void telemetry_capture(telemetry_snapshot_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    out->time_us = esp_timer_get_time();
+    out->since_us = window_start_us;
+
+    out->frames = frames.load(std::memory_order_relaxed);
+    out->frame_max_us = frame_max_us.load(std::memory_order_relaxed);
+    for (int i = 0; i < TELEMETRY_FRAME_BUCKETS; i++) {
+        out->frame_hist[i] = frame_hist[i].load(std::memory_order_relaxed);
+    }
+
+    AudioSink *sink = hal_audio_sink();
+    out->audio_rate = audio_rate.load(std::memory_order_relaxed);
+    if (out->audio_rate > 0) {
+        out->audio_latency_us = (uint32_t)((uint64_t)sink->queued_frames() * 1000000 / out->audio_rate);
+    }
+    out->audio_underruns = sink->underruns() - underrun_base;
+    sfx_get_latency_stats(&out->sfx);
+
+    out->sd_read_bytes = sd_read_bytes.load(std::memory_order_relaxed);
+    out->sd_read_us = sd_read_us.load(std::memory_order_relaxed);
+    out->sd_write_bytes = sd_write_bytes.load(std::memory_order_relaxed);
+    out->sd_write_us = sd_write_us.load(std::memory_order_relaxed);
+
+    NetTransport *net = hal_net();
+    for (int i = 0; i < HAL_MAX_IMU_DEVICES; i++) {
+        out->imu_samples[i] = imu_samples[i].load(std::memory_order_relaxed);
+        uint32_t received = net->received(i);
+        out->imu_received[i] = received > 0 ? received - imu_received_base[i] : 0;
+    }
+    out->imu_lost = net->lost() - imu_lost_base;
+    out->imu_latency_max_us = imu_latency_max_us.load(std::memory_order_relaxed);
+    for (int i = 0; i < TELEMETRY_IMU_LATENCY_BUCKETS; i++) {
+        out->imu_latency_hist[i] = imu_latency_hist[i].load(std::memory_order_relaxed);
+    }
+
+    out->n_queues = telemetry_queue_depths(out->queues, TELEMETRY_MAX_QUEUES);
+
+    out->n_topics = bus_topic_stats(out->topics, BUS_MAX_TOPICS);
+    for (size_t i = 0; i < out->n_topics; i++) {
+        out->topics[i].published -= published_base[i];
+    }
+
+    telemetry_heap_t heap;
+    telemetry_heap(&heap);
+    out->heap_free = heap.free;
+    out->heap_min_free = heap.min_free;
+    out->heap_largest_block = heap.largest_block;
+#if !CONFIG_IDF_TARGET_LINUX
+    out->psram_free = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+    out->psram_total = heap_caps_get_total_size(MALLOC_CAP_SPIRAM);
+#endif
+    // On the host the heap is the process heap; the fields stay 0
+
+    out->n_regions = mem_region_stats(out->regions, MEM_MAX_REGIONS);
+    alloc_track_stats(out->allocs);
+}
+
+void telemetry_reset(void)
+{
+    frames.store(0, std::memory_order_relaxed);
+    frame_max_us.store(0, std::memory_order_relaxed);
+    for (int i = 0; i < TELEMETRY_FRAME_BUCKETS; i++) {
+        frame_hist[i].store(0, std::memory_order_relaxed);
+    }
+    sd_read_bytes.store(0, std::memory_order_relaxed);
+    sd_read_us.store(0, std::memory_order_relaxed);
+    sd_write_bytes.store(0, std::memory_order_relaxed);
+    sd_write_us.store(0, std::memory_order_relaxed);
+
+    underrun_base = hal_audio_sink()->underruns();
+    NetTransport *net = hal_net();
+    for (int i = 0; i < HAL_MAX_IMU_DEVICES; i++) {
+        imu_samples[i].store(0, std::memory_order_relaxed);
+        imu_received_base[i] = net->received(i);
+    }
+    imu_lost_base = net->lost();
+    imu_latency_max_us.store(0, std::memory_order_relaxed);
+    for (int i = 0; i < TELEMETRY_IMU_LATENCY_BUCKETS; i++) {
+        imu_latency_hist[i].store(0, std::memory_order_relaxed);
+    }
+    sfx_reset_latency_stats();
+    mem_reset_peaks();
+
+    bus_topic_stats_t topics[BUS_MAX_TOPICS];
+    size_t n_topics = bus_topic_stats(topics, BUS_MAX_TOPICS);
+    for (size_t i = 0; i < n_topics; i++) {
+        published_base[i] = topics[i].published;
+    }
+
+    window_start_us = esp_timer_get_time();
+}
+
+// Upper edge of the bucket holding the percentile of now - prev
+static uint32_t hist_percentile(const uint32_t *now, const uint32_t *prev, int buckets,
+                                uint32_t bucket_us, uint32_t percentile)
+{
+    uint32_t total = 0;
+    for (int i = 0; i < buckets; i++) {
+        total += now[i] - (prev ? prev[i] : 0);
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    uint32_t rank = (uint32_t)(((uint64_t)total * percentile + 99) / 100);
+    uint32_t seen = 0;
+    for (int i = 0; i < buckets; i++) {
+        seen += now[i] - (prev ? prev[i] : 0);
+        if (seen >= rank) {
+            return (i + 1) * bucket_us;
+        }
+    }
+    return buckets * bucket_us;
+}
+
+uint32_t telemetry_frame_percentile_us(const telemetry_snapshot_t *now,
+                                       const telemetry_snapshot_t *prev, uint32_t percentile)
+{
+    return hist_percentile(now->frame_hist, prev ? prev->frame_hist : NULL,
+                           TELEMETRY_FRAME_BUCKETS, TELEMETRY_FRAME_BUCKET_US, percentile);
+}
+
+uint32_t telemetry_imu_latency_percentile_us(const telemetry_snapshot_t *now,
+                                             const telemetry_snapshot_t *prev, uint32_t percentile)
+{
+    return hist_percentile(now->imu_latency_hist, prev ? prev->imu_latency_hist : NULL,
+                           TELEMETRY_IMU_LATENCY_BUCKETS, TELEMETRY_IMU_LATENCY_BUCKET_US, percentile);
+}
+
+static double mb_per_s(uint64_t bytes, uint64_t us)
+{
+    return us > 0 ? (double)bytes / us : 0.0;
+}
+
+void telemetry_print(const telemetry_snapshot_t *now, const telemetry_snapshot_t *prev)
+{
+    // A reset in between makes the earlier capture meaningless as a baseline
+    if (prev != NULL && prev->since_us != now->since_us) {
+        prev = NULL;
+    }
+    int64_t window_us = now->time_us - (prev ? prev->time_us : now->since_us);
+    double window_s = window_us > 0 ? window_us / 1e6 : 1.0;
+
+    uint32_t frames = now->frames - (prev ? prev->frames : 0);
+    printf("window      %.1f s\n", window_s);
+    printf("render      %.1f fps, frame p50 %" PRIu32 " us, p95 %" PRIu32 " us, p99 %" PRIu32 " us, max %" PRIu32 " us\n",
+           frames / window_s,
+           telemetry_frame_percentile_us(now, prev, 50),
+           telemetry_frame_percentile_us(now, prev, 95),
+           telemetry_frame_percentile_us(now, prev, 99),
+           now->frame_max_us);
+
+    printf("audio       %" PRIu32 " Hz, output latency %" PRIu32 " us, %" PRIu32 " underruns\n",
+           now->audio_rate, now->audio_latency_us,
+           now->audio_underruns - (prev ? prev->audio_underruns : 0));
+    if (now->sfx.count > 0) {
+        printf("hit sfx     %" PRIu32 " hits, min %" PRId64 " us, avg %" PRId64 " us, max %" PRId64 " us, "
+               "%" PRIu32 " over budget, %" PRIu32 " retriggers\n",
+               now->sfx.count, now->sfx.min_us, now->sfx.total_us / now->sfx.count,
+               now->sfx.max_us, now->sfx.over_budget, now->sfx.retriggers);
+    }
+
+    uint64_t read_bytes = now->sd_read_bytes - (prev ? prev->sd_read_bytes : 0);
+    uint64_t read_us = now->sd_read_us - (prev ? prev->sd_read_us : 0);
+    uint64_t write_bytes = now->sd_write_bytes - (prev ? prev->sd_write_bytes : 0);
+    uint64_t write_us = now->sd_write_us - (prev ? prev->sd_write_us : 0);
+    printf("sd read     %llu KB, %.2f MB/s while busy, %.1f%% busy\n",
+           (unsigned long long)(read_bytes / 1024), mb_per_s(read_bytes, read_us),
+           read_us * 100.0 / (window_s * 1e6));
+    printf("sd write    %llu KB, %.2f MB/s while busy, %.1f%% busy\n",
+           (unsigned long long)(write_bytes / 1024), mb_per_s(write_bytes, write_us),
+           write_us * 100.0 / (window_s * 1e6));
+
+    // Devices that never sent anything are left out
+    for (int i = 0; i < HAL_MAX_IMU_DEVICES; i++) {
+        if (now->imu_samples[i] == 0 && now->imu_received[i] == 0) {
+            continue;
+        }
+        uint32_t samples = now->imu_samples[i] - (prev ? prev->imu_samples[i] : 0);
+        uint32_t received = now->imu_received[i] - (prev ? prev->imu_received[i] : 0);
+        if (now->imu_received[i] > 0) {
+            printf("imu %-2d      %.1f samples/s, %" PRIu32 " received\n", i, samples / window_s, received);
+        } else {
+            printf("imu %-2d      %.1f samples/s\n", i, samples / window_s);
+        }
+    }
+    if (now->imu_lost > 0) {
+        printf("imu lost    %" PRIu32 " datagrams\n", now->imu_lost - (prev ? prev->imu_lost : 0));
+    }
+    if (telemetry_imu_latency_percentile_us(now, prev, 100) > 0) {
+        printf("imu ingest  p50 %" PRIu32 " us, p95 %" PRIu32 " us, max %" PRIu32 " us\n",
+               telemetry_imu_latency_percentile_us(now, prev, 50),
+               telemetry_imu_latency_percentile_us(now, prev, 95),
+               now->imu_latency_max_us);
+    }
+
+    for (size_t i = 0; i < now->n_queues; i++) {
+        printf("queue       %-12s %" PRIu32 "/%" PRIu32 "\n", now->queues[i].name,
+               now->queues[i].waiting, now->queues[i].capacity);
+    }
+
+    for (size_t i = 0; i < now->n_topics; i++) {
+        const bus_topic_stats_t *t = &now->topics[i];
+        uint32_t published = t->published - (prev && i < prev->n_topics ? prev->topics[i].published : 0);
+        printf("topic       %-8s %.1f msg/s", t->name, published / window_s);
+        for (size_t j = 0; j < t->n_subscribers; j++) {
+            const bus_subscriber_stats_t *sub = &t->subscribers[j];
+            printf(", %s lag %" PRIu32 "/%" PRIu32 " lost %" PRIu32, sub->name, sub->lag, t->capacity, sub->lost);
+        }
+        printf("\n");
+    }
+
+    if (now->heap_free > 0) {
+        // Share of free memory that is not in the largest block
+        unsigned fragmentation = 100 - (unsigned)((uint64_t)now->heap_largest_block * 100 / now->heap_free);
+        printf("heap        %u free, %u min free, %u largest block, %u%% fragmented\n",
+               (unsigned)now->heap_free, (unsigned)now->heap_min_free,
+               (unsigned)now->heap_largest_block, fragmentation);
+    }
+    if (now->psram_total > 0) {
+        printf("psram       %u / %u free\n", (unsigned)now->psram_free, (unsigned)now->psram_total);
+    }
+    for (size_t i = 0; i < now->n_regions; i++) {
+        const mem_region_stats_t *r = &now->regions[i];
+        printf("%-11s %-7s %u / %u used, peak %u, %" PRIu32 " failed\n", r->name,
+               r->pool ? "pool" : "arena", (unsigned)r->used, (unsigned)r->capacity,
+               (unsigned)r->peak, r->failures);
+    }
+#if CONFIG_MCHACKS_ALLOC_TRACK
+    for (int i = 0; i < ALLOC_REGION_COUNT; i++) {
+        const alloc_region_stats_t *a = &now->allocs[i];
+        printf("allocs      %-7s %" PRIu32 " in %" PRIu32 " iterations, %" PRIu32 " after warm-up\n",
+               alloc_region_name((alloc_region_t)i), a->allocations, a->iterations, a->violations);
+    }
+#endif
+}
+
+// snprintf() onto the end of a buffer; once it's full only the length grows
+typedef struct {
+    char *buf;
+    size_t size;
+    size_t len;
+} json_out_t;
+
+static void __attribute__((format(printf, 2, 3))) json_printf(json_out_t *out, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    size_t room = out->len < out->size ? out->size - out->len : 0;
+    int n = vsnprintf(room > 0 ? out->buf + out->len : NULL, room, fmt, args);
+    va_end(args);
+    if (n > 0) {
+        out->len += n;
+    }
+}
+
+size_t telemetry_format_json(const telemetry_snapshot_t *now, const telemetry_snapshot_t *prev,
+                             char *buf, size_t size)
+{
+    if (prev != NULL && prev->since_us != now->since_us) {
+        prev = NULL;
+    }
+    int64_t window_us = now->time_us - (prev ? prev->time_us : now->since_us);
+    double window_s = window_us > 0 ? window_us / 1e6 : 1.0;
+    json_out_t out = {buf, size, 0};
+
+    json_printf(&out, "{\"time_us\":%" PRId64 ",\"window_us\":%" PRId64, now->time_us, window_us);
+    json_printf(&out, ",\"render\":{\"fps\":%.1f,\"p50_us\":%" PRIu32 ",\"p95_us\":%" PRIu32 ","
+                "\"p99_us\":%" PRIu32 ",\"max_us\":%" PRIu32 "}",
+                (now->frames - (prev ? prev->frames : 0)) / window_s,
+                telemetry_frame_percentile_us(now, prev, 50),
+                telemetry_frame_percentile_us(now, prev, 95),
+                telemetry_frame_percentile_us(now, prev, 99),
+                now->frame_max_us);
+
+    json_printf(&out, ",\"audio\":{\"rate\":%" PRIu32 ",\"latency_us\":%" PRIu32 ",\"underruns\":%" PRIu32,
+                now->audio_rate, now->audio_latency_us,
+                now->audio_underruns - (prev ? prev->audio_underruns : 0));
+    json_printf(&out, ",\"sfx\":{\"hits\":%" PRIu32 ",\"min_us\":%" PRId64 ",\"avg_us\":%" PRId64 ",\"max_us\":%" PRId64 ","
+                "\"over_budget\":%" PRIu32 ",\"retriggers\":%" PRIu32 "}}",
+                now->sfx.count, now->sfx.count > 0 ? now->sfx.min_us : (int64_t)0,
+                now->sfx.count > 0 ? now->sfx.total_us / now->sfx.count : (int64_t)0,
+                now->sfx.count > 0 ? now->sfx.max_us : (int64_t)0, now->sfx.over_budget, now->sfx.retriggers);
+
+    json_printf(&out, ",\"sd\":{\"read_bytes\":%llu,\"read_us\":%llu,\"write_bytes\":%llu,\"write_us\":%llu}",
+                (unsigned long long)(now->sd_read_bytes - (prev ? prev->sd_read_bytes : 0)),
+                (unsigned long long)(now->sd_read_us - (prev ? prev->sd_read_us : 0)),
+                (unsigned long long)(now->sd_write_bytes - (prev ? prev->sd_write_bytes : 0)),
+                (unsigned long long)(now->sd_write_us - (prev ? prev->sd_write_us : 0)));
+
+    json_printf(&out, ",\"imu\":[");
+    bool first = true;
+    for (int i = 0; i < HAL_MAX_IMU_DEVICES; i++) {
+        if (now->imu_samples[i] == 0 && now->imu_received[i] == 0) {
+            continue;
+        }
+        uint32_t samples = now->imu_samples[i] - (prev ? prev->imu_samples[i] : 0);
+        uint32_t received = now->imu_received[i] - (prev ? prev->imu_received[i] : 0);
+        json_printf(&out, "%s{\"device\":%d,\"samples_per_s\":%.1f,\"received\":%" PRIu32 "}", first ? "" : ",",
+                    i, samples / window_s, received);
+        first = false;
+    }
+    json_printf(&out, "],\"imu_lost\":%" PRIu32, now->imu_lost - (prev ? prev->imu_lost : 0));
+    json_printf(&out, ",\"imu_latency\":{\"p50_us\":%" PRIu32 ",\"p95_us\":%" PRIu32 ",\"max_us\":%" PRIu32 "}",
+                telemetry_imu_latency_percentile_us(now, prev, 50),
+                telemetry_imu_latency_percentile_us(now, prev, 95),
+                now->imu_latency_max_us);
+
+    json_printf(&out, ",\"queues\":[");
+    for (size_t i = 0; i < now->n_queues; i++) {
+        json_printf(&out, "%s{\"name\":\"%s\",\"waiting\":%" PRIu32 ",\"capacity\":%" PRIu32 "}", i > 0 ? "," : "",
+                    now->queues[i].name, now->queues[i].waiting, now->queues[i].capacity);
+    }
+
+    json_printf(&out, "],\"topics\":[");
+    for (size_t i = 0; i < now->n_topics; i++) {
+        const bus_topic_stats_t *t = &now->topics[i];
+        uint32_t published = t->published - (prev && i < prev->n_topics ? prev->topics[i].published : 0);
+        json_printf(&out, "%s{\"name\":\"%s\",\"per_s\":%.1f,\"capacity\":%" PRIu32 ",\"subscribers\":[",
+                    i > 0 ? "," : "", t->name, published / window_s, t->capacity);
+        for (size_t j = 0; j < t->n_subscribers; j++) {
+            const bus_subscriber_stats_t *sub = &t->subscribers[j];
+            json_printf(&out, "%s{\"name\":\"%s\",\"lag\":%" PRIu32 ",\"lost\":%" PRIu32 "}", j > 0 ? "," : "",
+                        sub->name, sub->lag, sub->lost);
+        }
+        json_printf(&out, "]}");
+    }
+
+    json_printf(&out, "],\"heap\":{\"free\":%u,\"min_free\":%u,\"largest_block\":%u,\"psram_free\":%u,"
+                "\"psram_total\":%u}",
+                (unsigned)now->heap_free, (unsigned)now->heap_min_free, (unsigned)now->heap_largest_block,
+                (unsigned)now->psram_free, (unsigned)now->psram_total);
+
+    json_printf(&out, ",\"regions\":[");
+    for (size_t i = 0; i < now->n_regions; i++) {
+        const mem_region_stats_t *r = &now->regions[i];
+        json_printf(&out, "%s{\"name\":\"%s\",\"pool\":%s,\"used\":%u,\"capacity\":%u,\"peak\":%u,"
+                    "\"failed\":%" PRIu32 "}",
+                    i > 0 ? "," : "", r->name, r->pool ? "true" : "false", (unsigned)r->used,
+                    (unsigned)r->capacity, (unsigned)r->peak, r->failures);
+    }
+    json_printf(&out, "]");
+#if CONFIG_MCHACKS_ALLOC_TRACK
+    json_printf(&out, ",\"allocs\":[");
+    for (int i = 0; i < ALLOC_REGION_COUNT; i++) {
+        const alloc_region_stats_t *a = &now->allocs[i];
+        json_printf(&out, "%s{\"name\":\"%s\",\"allocations\":%" PRIu32 ",\"iterations\":%" PRIu32 ",\"violations\":%" PRIu32 "}",
+                    i > 0 ? "," : "", alloc_region_name((alloc_region_t)i), a->allocations, a->iterations,
+                    a->violations);
+    }
+    json_printf(&out, "]");
+#endif
+    json_printf(&out, "}");
+    return out.len;
+}
@@ -0,0 +1,188 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "alloc_track.h"
+#include "event_bus.h"
+#include "game.h"
+#include "hal.h"
+#include "mem_pool.h"
+#include "speaker.h"
+
+/*
+ * Live performance counters
+ * -------------------------
+ * The hot paths only bump relaxed atomics (a handful of cycles each), so the
+ * counters stay on in production. Everything else (percentiles, rates,
+ * queue and heap queries) is done by telemetry_capture() when someone asks.
+ *
+ * Counters run from boot or from the last telemetry_reset(). Rates over a
+ * shorter window come from diffing two captures (see telemetry_print()).
+ */
+
+#define TELEMETRY_FRAME_BUCKET_US 1000
+#define TELEMETRY_FRAME_BUCKETS 64   // the last bucket also holds every slower frame
+#define TELEMETRY_IMU_LATENCY_BUCKET_US 250
+#define TELEMETRY_IMU_LATENCY_BUCKETS 64  // the last bucket also holds every later pickup
+#define TELEMETRY_MAX_QUEUES 8
+
+typedef struct {
+    const char *name;
+    uint32_t waiting;
+    uint32_t capacity;
+} telemetry_queue_t;
+
+typedef struct {
+    size_t free;
+    size_t min_free;
+    size_t largest_block;
+} telemetry_heap_t;
+
+typedef struct {
+    int64_t time_us;                 // when the capture was taken
+    int64_t since_us;                // start of the counting window
+
+    // Renderer: histogram of frame-to-frame intervals
+    uint32_t frames;
+    uint32_t frame_max_us;
+    uint32_t frame_hist[TELEMETRY_FRAME_BUCKETS];
+
+    // Audio
+    uint32_t audio_rate;             // output rate of the current stream, 0 if idle
+    uint32_t audio_latency_us;       // fixed output queue latency at that rate
+    uint32_t audio_underruns;
+    sfx_latency_stats_t sfx;
+
+    // Storage
+    uint64_t sd_read_bytes;
+    uint64_t sd_read_us;             // time spent inside reads
+    uint64_t sd_write_bytes;
+    uint64_t sd_write_us;
+
+    // IMU ingest per device. The game picks up at most one sample per device
+    // a tick, so received running ahead of samples is coalescing, not loss.
+    uint32_t imu_samples[HAL_MAX_IMU_DEVICES];  // new samples picked up by the game
+    uint32_t imu_received[HAL_MAX_IMU_DEVICES]; // samples the transport took in, 0 if it can't count
+    uint32_t imu_lost;               // sample datagrams the transport dropped, all devices
+    // Time from a sample reaching the link to the game tick that used it, all
+    // devices; empty when the transport can't timestamp arrivals
+    uint32_t imu_latency_max_us;
+    uint32_t imu_latency_hist[TELEMETRY_IMU_LATENCY_BUCKETS];
+
+    // Queues registered with telemetry_watch_queue()
+    size_t n_queues;
+    telemetry_queue_t queues[TELEMETRY_MAX_QUEUES];
+
+    // Event bus topics; published counts run from the window start, subscriber
+    // counts from when each subscribed
+    size_t n_topics;
+    bus_topic_stats_t topics[BUS_MAX_TOPICS];
+
+    // Heap, bytes
+    size_t heap_free;
+    size_t heap_min_free;
+    size_t heap_largest_block;
+    size_t psram_free;
+    size_t psram_total;
+
+    // Boot-time arenas and pools (see arenas.h)
+    size_t n_regions;
+    mem_region_stats_t regions[MEM_MAX_REGIONS];
+
+    // Hot-path allocations (CONFIG_MCHACKS_ALLOC_TRACK only)
+    alloc_region_stats_t allocs[ALLOC_REGION_COUNT];
+} telemetry_snapshot_t;
+
+/**
+ * @brief Count one rendered frame, interval_us since the previous one
+ */
+void telemetry_frame(uint32_t interval_us);
+
+/**
+ * @brief Note the output rate of the audio stream that just started (0 when it stops)
+ */
+void telemetry_audio_stream(uint32_t sample_rate);
+
+void telemetry_sd_read(size_t bytes, int64_t elapsed_us);
+void telemetry_sd_write(size_t bytes, int64_t elapsed_us);
+
+/**
+ * @brief Count a new IMU sample picked up from device
+ */
+void telemetry_imu_sample(int device);
+
+/**
+ * @brief Count the ingest latency of a sample the game just picked up
+ */
+void telemetry_imu_latency(uint32_t latency_us);
+
+/**
+ * @brief Report the depth of a queue in every capture
+ *
+ * @param name Must outlive the program (a string literal)
+ */
+void telemetry_watch_queue(const char *name, QueueHandle_t queue);
+
+/**
+ * @brief Current depth of every queue registered with telemetry_watch_queue()
+ *
+ * @return Number of entries written to out
+ */
+size_t telemetry_queue_depths(telemetry_queue_t *out, size_t max);
+
+/**
+ * @brief Internal heap state; zero on the host, where the heap is the process's
+ */
+void telemetry_heap(telemetry_heap_t *out);
+
+/**
+ * @brief Copy out every counter plus the current queue depths and heap state
+ */
+void telemetry_capture(telemetry_snapshot_t *out);
+
+/**
+ * @brief Zero every counter and start a new counting window
+ */
+void telemetry_reset(void);
+
+/**
+ * @brief Frame interval at the given percentile (0-100) over a window
+ *
+ * @param prev Start of the window, or NULL for the whole counting window
+ * @return Upper edge of the percentile's histogram bucket, 0 if no frames
+ */
+uint32_t telemetry_frame_percentile_us(const telemetry_snapshot_t *now,
+                                       const telemetry_snapshot_t *prev, uint32_t percentile);
+
+/**
+ * @brief IMU ingest latency at the given percentile (0-100) over a window
+ *
+ * @param prev Start of the window, or NULL for the whole counting window
+ * @return Upper edge of the percentile's histogram bucket, 0 if no samples
+ */
+uint32_t telemetry_imu_latency_percentile_us(const telemetry_snapshot_t *now,
+                                             const telemetry_snapshot_t *prev, uint32_t percentile);
+
+/**
+ * @brief Print a capture as a human-readable report
+ *
+ * @param prev Earlier capture to compute rates against, or NULL to use the
+ *             whole counting window
+ */
+void telemetry_print(const telemetry_snapshot_t *now, const telemetry_snapshot_t *prev);
+
+/**
+ * @brief Write a capture as a JSON object on one line, with the same
+ *        figures as telemetry_print()
+ *
+ * @param prev As for telemetry_print()
+ * @return Length of the whole text, like snprintf(); the buffer holds all
+ *         of it only if that is below size
+ */
+size_t telemetry_format_json(const telemetry_snapshot_t *now, const telemetry_snapshot_t *prev,
+                             char *buf, size_t size);
+
+#endif // TELEMETRY_H
@@ -0,0 +1,558 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "telemetry_http.h"
+
+#if CONFIG_MCHACKS_HTTP_TELEMETRY
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "analyzer.h"
+#include "deadline.h"
+#include "speaker.h"
+#include "tasks.h"
+#include "telemetry.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0                  // lwIP has no SIGPIPE to suppress
+#endif
+
+#define LISTEN_BACKLOG 2
+#define REQUEST_MAX 512                 // request line and headers; the rest is ignored
+#define REQUEST_TIMEOUT_US 2000000
+#define HEAD_MAX 192
+#define EVENT_PREFIX "data: "
+#define EVENT_PREFIX_LEN (sizeof(EVENT_PREFIX) - 1)
+
+static const char *TAG = "http";
+
+static const char STREAM_HEAD[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: text/event-stream\r\n"
+    "Cache-Control: no-cache\r\n"
+    "Access-Control-Allow-Origin: *\r\n"
+    "\r\n";
+
+// Bodies run to the end of the connection
+#define PLAIN_RESPONSE(status, body)    \
+    "HTTP/1.1 " status "\r\n"           \
+    "Content-Type: text/plain\r\n"      \
+    "Connection: close\r\n"             \
+    "\r\n" body "\n"
+
+static const char NOT_FOUND[] = PLAIN_RESPONSE("404 Not Found", "Try /stats or /events");
+static const char BAD_METHOD[] = PLAIN_RESPONSE("405 Method Not Allowed", "GET only");
+static const char TOO_LARGE[] = PLAIN_RESPONSE("431 Request Header Fields Too Large", "Request too large");
+
+// One capture, ready to send
+typedef struct {
+    uint32_t seq;                       // 0 until built
+    int64_t built_us;
+    uint8_t users;                      // clients sending from it
+    char head[HEAD_MAX];                // of the /stats response
+    size_t head_len;
+    size_t json_len;
+    // "data: " JSON "\n\n": the event as is, and from the JSON on the
+    // /stats body (which ends at the first newline)
+    char text[EVENT_PREFIX_LEN + TELEMETRY_HTTP_JSON_MAX + 2];
+} http_frame_t;
+
+typedef enum {
+    CLIENT_FREE,
+    CLIENT_READING,                     // the request
+    CLIENT_SNAPSHOT,                    // /stats; closed once sent
+    CLIENT_STREAM,                      // /events
+    CLIENT_CLOSING,                     // an error response; closed once sent
+} client_mode_t;
+
+typedef struct {
+    int sock;
+    client_mode_t mode;
+    int64_t since_us;                   // accepted
+    char request[REQUEST_MAX];
+    size_t request_len;
+
+    // What is being sent: up to two pieces, from a frame or constant text
+    http_frame_t *frame;                // NULL if not from a frame
+    const char *parts[2];
+    size_t part_len[2];
+    size_t n_parts;                     // 0 when idle
+    size_t part;
+    size_t offset;
+    bool waiting;                       // snapshots: for a fresh frame
+    uint32_t sent_seq;                  // streams: the newest frame sent
+} http_client_t;
+
+// Only the server task touches any of this
+static int listen_sock = -1;
+static int64_t period_us = 0;
+static http_client_t clients[TELEMETRY_HTTP_MAX_CLIENTS];
+static http_frame_t frames[2];
+static http_frame_t *latest = NULL;
+static uint32_t next_seq = 1;
+static int64_t next_frame_us = 0;
+static telemetry_snapshot_t captures[2];
+static int capture_cur = 0;
+static bool have_capture = false;
+static bool overflow_logged = false;
+// CPU shares are over the time since the previous frame
+static task_stats_window_t task_window;
+static task_cpu_stat_t task_stats[TASK_STATS_MAX];
+
+static void set_nonblocking(int sock)
+{
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+}
+
+static void close_client(http_client_t *c)
+{
+    if (c->frame != NULL) {
+        c->frame->users--;
+        c->frame = NULL;
+    }
+    close(c->sock);
+    c->sock = -1;
+    c->mode = CLIENT_FREE;
+    c->n_parts = 0;
+}
+
+static void send_text(http_client_t *c, const char *text, size_t len)
+{
+    c->parts[0] = text;
+    c->part_len[0] = len;
+    c->n_parts = 1;
+    c->part = 0;
+    c->offset = 0;
+}
+
+static void send_frame(http_client_t *c, http_frame_t *f)
+{
+    c->frame = f;
+    f->users++;
+    if (c->mode == CLIENT_STREAM) {
+        c->parts[0] = f->text;
+        c->part_len[0] = EVENT_PREFIX_LEN + f->json_len + 2;
+        c->n_parts = 1;
+    } else {
+        c->parts[0] = f->head;
+        c->part_len[0] = f->head_len;
+        c->parts[1] = f->text + EVENT_PREFIX_LEN;
+        c->part_len[1] = f->json_len + 1;
+        c->n_parts = 2;
+    }
+    c->part = 0;
+    c->offset = 0;
+}
+
+// snprintf() onto the frame's JSON; once it's full only the length grows
+static void __attribute__((format(printf, 2, 3))) append(http_frame_t *f, const char *fmt, ...)
+{
+    char *json = f->text + EVENT_PREFIX_LEN;
+    size_t room = f->json_len < TELEMETRY_HTTP_JSON_MAX ? TELEMETRY_HTTP_JSON_MAX - f->json_len : 0;
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(room > 0 ? json + f->json_len : NULL, room, fmt, args);
+    va_end(args);
+    if (n > 0) {
+        f->json_len += n;
+    }
+}
+
+static void format_frame(http_frame_t *f, const telemetry_snapshot_t *now, const telemetry_snapshot_t *prev)
+{
+    char *json = f->text + EVENT_PREFIX_LEN;
+    f->json_len = 0;
+    append(f, "{\"seq\":%" PRIu32 ",\"telemetry\":", f->seq);
+    size_t room = f->json_len < TELEMETRY_HTTP_JSON_MAX ? TELEMETRY_HTTP_JSON_MAX - f->json_len : 0;
+    f->json_len += telemetry_format_json(now, prev, room > 0 ? json + f->json_len : NULL, room);
+
+    append(f, ",\"deadlines\":[");
+    bool first = true;
+    for (int i = 0; i < DEADLINE_COUNT; i++) {
+        deadline_stats_t st;
+        deadline_get_stats((deadline_id_t)i, &st);
+        if (st.period_us == 0) {
+            continue;
+        }
+        append(f, "%s{\"name\":\"%s\",\"period_us\":%" PRIu32 ",\"budget_us\":%" PRIu32 ","
+               "\"passes\":%" PRIu32 ",\"late\":%" PRIu32 ","
+               "\"overruns\":%" PRIu32 ",\"max_interval_us\":%" PRIu32 ",\"max_duration_us\":%" PRIu32 "}",
+               first ? "" : ",", st.name, st.period_us, st.budget_us, st.passes, st.late, st.overruns,
+               st.max_interval_us, st.max_duration_us);
+        first = false;
+    }
+
+    analyzer_stats_t an;
+    analyzer_get_stats(&an);
+    analyzer_snapshot_t music;
+    analyzer_get(&music);
+    append(f, "],\"analyzer\":{\"analyses\":%" PRIu32 ",\"max_us\":%" PRIu32 ",\"track_max_us\":%" PRIu32 ","
+           "\"bpm\":%.1f,\"beats\":%" PRIu32 ","
+           "\"hits\":%" PRIu32 ",\"on_beat\":%" PRIu32 ",\"mean_offset_us\":%" PRId32 "}",
+           an.analyses, an.max_us, an.track_max_us, music.bpm, music.beats, an.hits, an.on_beat,
+           an.mean_offset_us);
+
+    append(f, ",\"tasks\":[");
+    size_t n_tasks = task_stats_sample(&task_window, task_stats, TASK_STATS_MAX);
+    for (size_t i = 0; i < n_tasks; i++) {
+        const task_cpu_stat_t *t = &task_stats[i];
+        append(f, "%s{\"name\":\"%s\",\"core\":%d,\"priority\":%u,\"cpu_permille\":%" PRIu32 ",\"stack_free\":%" PRIu32 "}",
+               i > 0 ? "," : "", t->name, t->core == tskNO_AFFINITY ? -1 : (int)t->core,
+               (unsigned)t->priority, t->cpu_permille, t->stack_free);
+    }
+
+    // Cumulative over the latest network stream, like the console's 'audio'
+    audio_status_t audio;
+    audio_get_status(&audio);
+    const net_audio_stats_t *net = &audio.net_stats;
+    append(f, "],\"net_audio\":{\"active\":%s,\"playing\":%s,\"sample_rate\":%" PRIu32 ",\"packets\":%" PRIu32 ","
+           "\"late\":%" PRIu32 ",\"concealed\":%" PRIu32 ",\"underruns\":%" PRIu32 ","
+           "\"depth_frames\":%" PRIu32 ",\"target_frames\":%" PRIu32 ","
+           "\"jitter_us\":%" PRIu32 ",\"drift_ppm\":%" PRId32 "}}",
+           audio.net ? "true" : "false", net->playing ? "true" : "false", net->sample_rate, net->packets,
+           net->late, net->concealed, net->underruns, net->depth_frames, net->target_frames,
+           net->jitter_us, net->drift_ppm);
+
+    if (f->json_len >= TELEMETRY_HTTP_JSON_MAX) {
+        if (!overflow_logged) {
+            ESP_LOGE(TAG, "Stats need %u bytes, TELEMETRY_HTTP_JSON_MAX is %u", (unsigned)f->json_len,
+                     (unsigned)TELEMETRY_HTTP_JSON_MAX);
+            overflow_logged = true;
+        }
+        f->json_len = 0;
+        append(f, "{\"seq\":%" PRIu32 ",\"error\":\"too large\"}", f->seq);
+    }
+}
+
+// Capture and format into the frame nobody is reading, if need be by
+// dropping whoever is still on it
+static void build_frame(int64_t now_us)
+{
+    http_frame_t *f = latest == &frames[0] ? &frames[1] : &frames[0];
+    for (int i = 0; i < TELEMETRY_HTTP_MAX_CLIENTS; i++) {
+        if (clients[i].sock >= 0 && clients[i].frame == f) {
+            ESP_LOGW(TAG, "Dropping a client two frames behind");
+            close_client(&clients[i]);
+        }
+    }
+
+    telemetry_snapshot_t *now = &captures[capture_cur];
+    telemetry_capture(now);
+    const telemetry_snapshot_t *prev = have_capture ? &captures[1 - capture_cur] : NULL;
+    capture_cur = 1 - capture_cur;
+    have_capture = true;
+
+    f->seq = next_seq++;
+    f->built_us = now_us;
+    format_frame(f, now, prev);
+    memcpy(f->text, EVENT_PREFIX, EVENT_PREFIX_LEN);
+    f->text[EVENT_PREFIX_LEN + f->json_len] = '\n';
+    f->text[EVENT_PREFIX_LEN + f->json_len + 1] = '\n';
+    int n = snprintf(f->head, sizeof(f->head),
+                     "HTTP/1.1 200 OK\r\n"
+                     "Content-Type: application/json\r\n"
+                     "Content-Length: %u\r\n"
+                     "Cache-Control: no-cache\r\n"
+                     "Access-Control-Allow-Origin: *\r\n"
+                     "Connection: close\r\n"
+                     "\r\n",
+                     (unsigned)(f->json_len + 1));
+    f->head_len = (size_t)n;
+    latest = f;
+}
+
+static void accept_client(int64_t now_us)
+{
+    int sock = accept(listen_sock, NULL, NULL);
+    if (sock < 0) {
+        return;
+    }
+    for (int i = 0; i < TELEMETRY_HTTP_MAX_CLIENTS; i++) {
+        http_client_t *c = &clients[i];
+        if (c->sock < 0) {
+            set_nonblocking(sock);
+            c->sock = sock;
+            c->mode = CLIENT_READING;
+            c->since_us = now_us;
+            c->request_len = 0;
+            c->frame = NULL;
+            c->n_parts = 0;
+            c->waiting = false;
+            c->sent_seq = 0;
+            return;
+        }
+    }
+    // Full; closing at once is cheaper than a 503
+    close(sock);
+}
+
+static void route(http_client_t *c)
+{
+    if (strncmp(c->request, "GET ", 4) != 0) {
+        c->mode = CLIENT_CLOSING;
+        send_text(c, BAD_METHOD, sizeof(BAD_METHOD) - 1);
+        return;
+    }
+    const char *path = c->request + 4;
+    size_t len = strcspn(path, " ?\r\n");
+    if (len == 6 && strncmp(path, "/stats", len) == 0) {
+        c->mode = CLIENT_SNAPSHOT;
+        c->waiting = true;
+    } else if (len == 7 && strncmp(path, "/events", len) == 0) {
+        c->mode = CLIENT_STREAM;
+        send_text(c, STREAM_HEAD, sizeof(STREAM_HEAD) - 1);
+    } else {
+        c->mode = CLIENT_CLOSING;
+        send_text(c, NOT_FOUND, sizeof(NOT_FOUND) - 1);
+    }
+}
+
+static void read_client(http_client_t *c)
+{
+    if (c->mode == CLIENT_STREAM) {
+        // Nothing is expected; this is how a stream's end shows up
+        char scratch[64];
+        ssize_t n = recv(c->sock, scratch, sizeof(scratch), 0);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            close_client(c);
+        }
+        return;
+    }
+
+    ssize_t n = recv(c->sock, c->request + c->request_len, REQUEST_MAX - 1 - c->request_len, 0);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        close_client(c);
+        return;
+    }
+    if (n < 0) {
+        return;
+    }
+    c->request_len += n;
+    c->request[c->request_len] = '\0';
+    if (strstr(c->request, "\r\n\r\n") != NULL) {
+        route(c);
+    } else if (c->request_len == REQUEST_MAX - 1) {
+        c->mode = CLIENT_CLOSING;
+        send_text(c, TOO_LARGE, sizeof(TOO_LARGE) - 1);
+    }
+}
+
+static void write_client(http_client_t *c)
+{
+    while (c->part < c->n_parts) {
+        ssize_t n = send(c->sock, c->parts[c->part] + c->offset, c->part_len[c->part] - c->offset, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                close_client(c);
+            }
+            return;
+        }
+        c->offset += n;
+        if (c->offset == c->part_len[c->part]) {
+            c->part++;
+            c->offset = 0;
+        }
+    }
+
+    c->n_parts = 0;
+    if (c->frame != NULL) {
+        c->sent_seq = c->frame->seq;
+        c->frame->users--;
+        c->frame = NULL;
+    }
+    if (c->mode != CLIENT_STREAM) {
+        close_client(c);
+    }
+}
+
+// Start sending the latest frame to a client that is owed it
+static bool pick_frame(http_client_t *c)
+{
+    if (latest == NULL) {
+        return false;
+    }
+    if (c->waiting) {
+        c->waiting = false;
+        send_frame(c, latest);
+        return true;
+    }
+    if (c->mode == CLIENT_STREAM && latest->seq != c->sent_seq) {
+        send_frame(c, latest);
+        return true;
+    }
+    return false;
+}
+
+static void server_step(void)
+{
+    fd_set readable, writable;
+    FD_ZERO(&readable);
+    FD_ZERO(&writable);
+    FD_SET(listen_sock, &readable);
+    int max_fd = listen_sock;
+    bool streaming = false;
+    for (int i = 0; i < TELEMETRY_HTTP_MAX_CLIENTS; i++) {
+        http_client_t *c = &clients[i];
+        if (c->sock < 0) {
+            continue;
+        }
+        if (c->mode == CLIENT_READING || c->mode == CLIENT_STREAM) {
+            FD_SET(c->sock, &readable);
+        }
+        if (c->n_parts > 0) {
+            FD_SET(c->sock, &writable);
+        }
+        streaming |= c->mode == CLIENT_STREAM;
+        if (c->sock > max_fd) {
+            max_fd = c->sock;
+        }
+    }
+
+    // Wake for the next stream frame, or now and then to time out requests
+    int64_t now_us = esp_timer_get_time();
+    int64_t wait_us = REQUEST_TIMEOUT_US / 4;
+    if (streaming && next_frame_us - now_us < wait_us) {
+        wait_us = next_frame_us > now_us ? next_frame_us - now_us : 0;
+    }
+    struct timeval timeout = {(time_t)(wait_us / 1000000), (suseconds_t)(wait_us % 1000000)};
+    int ready = select(max_fd + 1, &readable, &writable, NULL, &timeout);
+    if (ready < 0 && errno != EINTR) {
+        ESP_LOGE(TAG, "select() failed: errno %d", errno);
+        vTaskDelay(pdMS_TO_TICKS(100));
+        return;
+    }
+
+    now_us = esp_timer_get_time();
+    if (ready > 0) {
+        if (FD_ISSET(listen_sock, &readable)) {
+            accept_client(now_us);
+        }
+        for (int i = 0; i < TELEMETRY_HTTP_MAX_CLIENTS; i++) {
+            http_client_t *c = &clients[i];
+            if (c->sock >= 0 && FD_ISSET(c->sock, &readable)) {
+                read_client(c);
+            }
+        }
+    }
+
+    // At most one capture per period: snapshots share the latest frame
+    // while it is that fresh, streams get a new one each period
+    bool stale = latest == NULL || now_us - latest->built_us >= period_us;
+    bool build = false;
+    streaming = false;
+    for (int i = 0; i < TELEMETRY_HTTP_MAX_CLIENTS; i++) {
+        build |= clients[i].sock >= 0 && clients[i].waiting && stale;
+        streaming |= clients[i].sock >= 0 && clients[i].mode == CLIENT_STREAM;
+    }
+    if (streaming && now_us >= next_frame_us) {
+        build = true;
+        next_frame_us += period_us;
+        if (next_frame_us <= now_us) {
+            next_frame_us = now_us + period_us;
+        }
+    }
+    if (build) {
+        build_frame(now_us);
+    }
+
+    for (int i = 0; i < TELEMETRY_HTTP_MAX_CLIENTS; i++) {
+        http_client_t *c = &clients[i];
+        if (c->sock < 0) {
+            continue;
+        }
+        if (c->mode == CLIENT_READING && now_us - c->since_us > REQUEST_TIMEOUT_US) {
+            close_client(c);
+            continue;
+        }
+        if (c->n_parts == 0) {
+            pick_frame(c);
+        }
+        if (c->n_parts > 0) {
+            write_client(c);
+        }
+        // A stream that just finished its head or a frame may be owed the latest
+        if (c->sock >= 0 && c->n_parts == 0 && pick_frame(c)) {
+            write_client(c);
+        }
+    }
+}
+
+static void http_task(void *pvParameters)
+{
+    while (1) {
+        server_step();
+    }
+}
+
+#if CONFIG_IDF_TARGET_LINUX
+static int env_int(const char *name, int fallback)
+{
+    const char *value = getenv(name);
+    return value ? atoi(value) : fallback;
+}
+#endif
+
+esp_err_t telemetry_http_start(void)
+{
+    int port = CONFIG_MCHACKS_HTTP_PORT;
+    int period_ms = CONFIG_MCHACKS_HTTP_PERIOD_MS;
+#if CONFIG_IDF_TARGET_LINUX
+    port = env_int("MCHACKS_HTTP_PORT", port);
+    period_ms = env_int("MCHACKS_HTTP_PERIOD_MS", period_ms);
+#endif
+    if (period_ms < TELEMETRY_HTTP_MIN_PERIOD_MS) {
+        period_ms = TELEMETRY_HTTP_MIN_PERIOD_MS;
+    }
+    period_us = (int64_t)period_ms * 1000;
+    for (int i = 0; i < TELEMETRY_HTTP_MAX_CLIENTS; i++) {
+        clients[i].sock = -1;
+    }
+
+    listen_sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_sock < 0) {
+        ESP_LOGE(TAG, "socket() failed: errno %d", errno);
+        return ESP_FAIL;
+    }
+    int on = 1;
+    setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(listen_sock, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(listen_sock, LISTEN_BACKLOG) != 0) {
+        ESP_LOGE(TAG, "Can't listen on port %d: errno %d", port, errno);
+        close(listen_sock);
+        listen_sock = -1;
+        return ESP_FAIL;
+    }
+    set_nonblocking(listen_sock);
+
+    if (task_start(TASK_HTTP, http_task, NULL, NULL) != pdPASS) {
+        close(listen_sock);
+        listen_sock = -1;
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "Telemetry on port %d, events every %d ms", port, period_ms);
+    return ESP_OK;
+}
+
+#else
+
+esp_err_t telemetry_http_start(void)
+{
+    return ESP_OK;
+}
+
+#endif
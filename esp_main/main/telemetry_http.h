@@ -0,0 +1,47 @@
+#ifndef TELEMETRY_HTTP_H
+#define TELEMETRY_HTTP_H
+
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+/*
+ * Telemetry over HTTP
+ * -------------------
+ * A small HTTP/1.1 server on plain BSD sockets, so the same code runs on
+ * lwIP and on the Linux target:
+ *
+ *   GET /stats    one JSON object: telemetry_format_json() of a capture,
+ *                 the deadline monitors, the audio analyzer, per-task CPU
+ *                 and stack, and the network audio jitter buffer
+ *   GET /events   text/event-stream; the same object as a server-sent event
+ *                 every stream period, for as long as the client stays
+ *
+ * e.g. curl http://<board>:8080/stats or curl -N http://<board>:8080/events;
+ * in a browser, new EventSource("/events"). Rates in a capture are over
+ * the time since the one before it.
+ *
+ * One low-priority task on core 0 does everything with select(), and the
+ * responses are built before anyone is served: at most one capture per
+ * stream period, however many clients ask, formatted once into one of two
+ * fixed frames that every client is sent from. Sockets are non-blocking; a
+ * client still sending a frame when the one after next is due is too slow
+ * and is dropped rather than buffered for. The render and audio tasks never
+ * see the server beyond what a capture reads from their counters.
+ *
+ * Port and period come from menuconfig (MCHACKS_HTTP_PORT,
+ * MCHACKS_HTTP_PERIOD_MS); on the Linux target the environment variables
+ * of the same names override them, so several instances can run side by
+ * side.
+ */
+
+#define TELEMETRY_HTTP_MAX_CLIENTS 4
+#define TELEMETRY_HTTP_JSON_MAX 8192
+#define TELEMETRY_HTTP_MIN_PERIOD_MS 50
+
+/**
+ * @brief Open the listening socket and start the server task; after the
+ *        network is up
+ */
+esp_err_t telemetry_http_start(void);
+
+#endif // TELEMETRY_HTTP_H
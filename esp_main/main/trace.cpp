@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <string.h>
+#include "trace.h"
+
+#if CONFIG_MCHACKS_TRACE
+
+#include <unistd.h>
+#include <atomic>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#define TRACE_VERSION 1
+#define TRACE_EVENTS CONFIG_MCHACKS_TRACE_EVENTS
+#define TRACE_MAX_TASKS 32
+
+static const char *TAG = "trace";
+
+static const char *const trace_event_names[TRACE_EVENT_COUNT] = {
+    "frame",
+    "present",
+    "audio_chunk",
+    "audio_write",
+    "sd_read",
+    "imu_ingest",
+    "imu_sample",
+    "game_tick",
+    "hit",
+    "deadline_miss",
+    "audio_conceal",
+};
+
+typedef struct {
+    std::atomic<uint32_t> next;   // total events ever claimed on this core
+    trace_event_t events[TRACE_EVENTS];
+} trace_ring_t;
+
+static trace_ring_t rings[portNUM_PROCESSORS];
+static std::atomic<bool> recording(true);
+
+void trace_record(trace_event_id_t id, trace_type_t type, uint32_t arg)
+{
+    if (!recording.load(std::memory_order_relaxed)) {
+        return;
+    }
+    trace_ring_t *ring = &rings[xPortGetCoreID()];
+    uint32_t slot = ring->next.fetch_add(1, std::memory_order_relaxed) % TRACE_EVENTS;
+
+    trace_event_t *event = &ring->events[slot];
+    event->time_us = esp_timer_get_time();
+    event->arg = arg;
+    event->task = (uint16_t)uxTaskGetTaskNumber(xTaskGetCurrentTaskHandle());
+    event->id = id;
+    event->type = type;
+}
+
+void trace_set_enabled(bool enabled)
+{
+    recording.store(enabled, std::memory_order_relaxed);
+}
+
+size_t trace_recent(int core, trace_event_t *out, size_t max)
+{
+    trace_ring_t *ring = &rings[core];
+    uint32_t next = ring->next.load(std::memory_order_relaxed);
+    size_t count = next < TRACE_EVENTS ? next : TRACE_EVENTS;
+    if (count > max) {
+        count = max;
+    }
+    for (size_t i = 0; i < count; i++) {
+        out[i] = ring->events[(next - count + i) % TRACE_EVENTS];
+    }
+    return count;
+}
+
+const char *trace_event_name(uint8_t id)
+{
+    return id < TRACE_EVENT_COUNT ? trace_event_names[id] : "?";
+}
+
+typedef bool (*trace_write_fn)(void *ctx, const void *data, size_t len);
+
+static bool write_u8(trace_write_fn write, void *ctx, uint8_t v)
+{
+    return write(ctx, &v, 1);
+}
+
+static bool write_u16(trace_write_fn write, void *ctx, uint16_t v)
+{
+    uint8_t b[2] = {(uint8_t)v, (uint8_t)(v >> 8)};
+    return write(ctx, b, 2);
+}
+
+static bool write_u32(trace_write_fn write, void *ctx, uint32_t v)
+{
+    return write_u16(write, ctx, v & 0xFFFF) && write_u16(write, ctx, v >> 16);
+}
+
+static bool write_string(trace_write_fn write, void *ctx, const char *s)
+{
+    size_t len = strnlen(s, 255);
+    return write_u8(write, ctx, (uint8_t)len) && write(ctx, s, len);
+}
+
+static esp_err_t trace_dump(trace_write_fn write, void *ctx)
+{
+    static TaskStatus_t tasks[TRACE_MAX_TASKS];
+
+    bool was_recording = recording.exchange(false, std::memory_order_acquire);
+    // Let any event that was mid-store when recording stopped finish
+    vTaskDelay(1);
+
+    bool ok = write(ctx, "MHTR", 4) &&
+              write_u8(write, ctx, TRACE_VERSION) &&
+              write_u8(write, ctx, portNUM_PROCESSORS) &&
+              write_u16(write, ctx, TRACE_EVENT_COUNT);
+    for (int i = 0; ok && i < TRACE_EVENT_COUNT; i++) {
+        ok = write_string(write, ctx, trace_event_names[i]);
+    }
+
+    UBaseType_t n_tasks = uxTaskGetSystemState(tasks, TRACE_MAX_TASKS, NULL);
+    ok = ok && write_u16(write, ctx, n_tasks);
+    for (UBaseType_t i = 0; ok && i < n_tasks; i++) {
+        ok = write_u16(write, ctx, tasks[i].xTaskNumber) &&
+             write_string(write, ctx, tasks[i].pcTaskName);
+    }
+
+    for (int core = 0; ok && core < portNUM_PROCESSORS; core++) {
+        trace_ring_t *ring = &rings[core];
+        uint32_t next = ring->next.load(std::memory_order_relaxed);
+        uint32_t count = next < TRACE_EVENTS ? next : TRACE_EVENTS;
+        uint32_t first = next - count;
+
+        ok = write_u32(write, ctx, count);
+        // Oldest first: the tail of the ring, then its head
+        uint32_t start = first % TRACE_EVENTS;
+        uint32_t tail = count < TRACE_EVENTS - start ? count : TRACE_EVENTS - start;
+        ok = ok && write(ctx, &ring->events[start], tail * sizeof(trace_event_t));
+        ok = ok && write(ctx, &ring->events[0], (count - tail) * sizeof(trace_event_t));
+    }
+
+    recording.store(was_recording, std::memory_order_release);
+    return ok ? ESP_OK : ESP_FAIL;
+}
+
+static bool write_file(void *ctx, const void *data, size_t len)
+{
+    return fwrite(data, 1, len, (FILE *)ctx) == len;
+}
+
+esp_err_t trace_dump_file(const char *path)
+{
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        ESP_LOGE(TAG, "Failed to open %s", path);
+        return ESP_FAIL;
+    }
+    esp_err_t ret = trace_dump(write_file, f);
+    fclose(f);
+    ESP_LOGI(TAG, "Trace written to %s", path);
+    return ret;
+}
+
+static bool write_socket(void *ctx, const void *data, size_t len)
+{
+    int sock = *(int *)ctx;
+    const uint8_t *p = (const uint8_t *)data;
+    while (len > 0) {
+        ssize_t sent = send(sock, p, len, 0);
+        if (sent <= 0) {
+            return false;
+        }
+        p += sent;
+        len -= sent;
+    }
+    return true;
+}
+
+esp_err_t trace_dump_tcp(const char *host, uint16_t port)
+{
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+        ESP_LOGE(TAG, "Invalid address %s", host);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {
+        return ESP_FAIL;
+    }
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        ESP_LOGE(TAG, "Failed to connect to %s:%u", host, port);
+        close(sock);
+        return ESP_FAIL;
+    }
+    esp_err_t ret = trace_dump(write_socket, &sock);
+    close(sock);
+    return ret;
+}
+
+#else
+
+void trace_set_enabled(bool enabled)
+{
+}
+
+size_t trace_recent(int core, trace_event_t *out, size_t max)
+{
+    return 0;
+}
+
+const char *trace_event_name(uint8_t id)
+{
+    return "?";
+}
+
+esp_err_t trace_dump_file(const char *path)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t trace_dump_tcp(const char *host, uint16_t port)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+#endif // CONFIG_MCHACKS_TRACE
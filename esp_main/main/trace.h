@@ -0,0 +1,106 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+/*
+ * Event tracer
+ * ------------
+ * Each core owns a ring of fixed-size events. Recording an event is one
+ * esp_timer read, one atomic slot claim and a 16-byte store, with no locks, so
+ * trace points can sit in the audio loop. Tasks on the same core share a ring;
+ * ISRs may record too.
+ *
+ * Enabled with CONFIG_MCHACKS_TRACE. Without it the TRACE_* macros expand to
+ * nothing and the dump functions return ESP_ERR_NOT_SUPPORTED.
+ *
+ * Dump format (little-endian), converted by tools/trace_to_chrome.py:
+ *   "MHTR", u8 version, u8 core count, u16 event name count
+ *   per name:   u8 length, characters
+ *   u16 task count, then per task: u16 task number, u8 length, characters
+ *   per core:   u32 event count, then that many events, oldest first, each
+ *               i64 time_us, u32 arg, u16 task number, u8 name, u8 type
+ */
+
+// Event names; keep trace_event_names in trace.cpp in the same order
+typedef enum {
+    TRACE_FRAME,        // render one frame
+    TRACE_PRESENT,      // push the frame to the panel
+    TRACE_AUDIO_CHUNK,  // decimate and mix one file chunk
+    TRACE_AUDIO_WRITE,  // hand one mix block to the output
+    TRACE_SD_READ,      // arg: bytes read
+    TRACE_IMU_INGEST,   // poll the transport for new samples
+    TRACE_IMU_SAMPLE,   // arg: device
+    TRACE_GAME_TICK,
+    TRACE_HIT,          // arg: cursor << 8 | junimo
+    TRACE_DEADLINE_MISS, // arg: deadline_id_t (see deadline.h)
+    TRACE_AUDIO_CONCEAL, // arg: network audio packets concealed in the block
+    TRACE_EVENT_COUNT,
+} trace_event_id_t;
+
+typedef enum {
+    TRACE_TYPE_BEGIN,
+    TRACE_TYPE_END,
+    TRACE_TYPE_INSTANT,
+} trace_type_t;
+
+typedef struct {
+    int64_t time_us;
+    uint32_t arg;
+    uint16_t task;      // FreeRTOS task number
+    uint8_t id;         // trace_event_id_t
+    uint8_t type;       // trace_type_t
+} trace_event_t;
+
+#if CONFIG_MCHACKS_TRACE
+
+void trace_record(trace_event_id_t id, trace_type_t type, uint32_t arg);
+
+#define TRACE_BEGIN(id) trace_record((id), TRACE_TYPE_BEGIN, 0)
+#define TRACE_END(id, arg) trace_record((id), TRACE_TYPE_END, (arg))
+#define TRACE_INSTANT(id, arg) trace_record((id), TRACE_TYPE_INSTANT, (arg))
+
+#else
+
+#define TRACE_BEGIN(id) do {} while (0)
+#define TRACE_END(id, arg) do {} while (0)
+#define TRACE_INSTANT(id, arg) do {} while (0)
+
+#endif
+
+/**
+ * @brief Pause or resume recording (recording starts enabled)
+ */
+void trace_set_enabled(bool enabled);
+
+/**
+ * @brief Copy the newest events of one core's ring, oldest first
+ *
+ * Recording goes on meanwhile, so an event stored during the copy can come
+ * out torn; fine for a post-mortem look, not for the dumps.
+ *
+ * @return Events written to out, 0 without CONFIG_MCHACKS_TRACE
+ */
+size_t trace_recent(int core, trace_event_t *out, size_t max);
+
+/**
+ * @brief Name of an event, as it appears in the dumps
+ */
+const char *trace_event_name(uint8_t id);
+
+/**
+ * @brief Write every core's ring to a file, e.g. on the SD card
+ *
+ * Recording is paused for the duration so the rings hold still.
+ */
+esp_err_t trace_dump_file(const char *path);
+
+/**
+ * @brief Stream the dump to a TCP listener (tools/trace_to_chrome.py --listen)
+ */
+esp_err_t trace_dump_tcp(const char *host, uint16_t port);
+
+#endif // TRACE_H
@@ -0,0 +1,33 @@
+#include <string.h>
+#include "audio_dsp.h"
+
+void audio_apply_gain(int16_t *buf, size_t samples, int32_t gain_q8)
+{
+    if (gain_q8 == 256) {
+        return;
+    }
+    for (size_t i = 0; i < samples; i++) {
+        buf[i] = (int16_t)((buf[i] * gain_q8) >> 8);
+    }
+}
+
+void audio_downmix_mono(const int16_t *in, size_t frames, size_t channels, int16_t *out)
+{
+    if (channels == 1) {
+        memcpy(out, in, frames * sizeof(int16_t));
+        return;
+    }
+    if (channels == 2) {
+        for (size_t i = 0; i < frames; i++) {
+            out[i] = (int16_t)((in[2 * i] + in[2 * i + 1]) >> 1);
+        }
+        return;
+    }
+    for (size_t i = 0; i < frames; i++) {
+        int32_t sum = 0;
+        for (size_t c = 0; c < channels; c++) {
+            sum += in[i * channels + c];
+        }
+        out[i] = (int16_t)(sum / (int32_t)channels);
+    }
+}
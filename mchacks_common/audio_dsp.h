@@ -0,0 +1,25 @@
+#ifndef MCHACKS_AUDIO_DSP_H
+#define MCHACKS_AUDIO_DSP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Sample-level audio kernels
+ * --------------------------
+ * The inner loops of the playback path, kept free of I/O and driver calls so
+ * esp_bench can time exactly the code the firmware runs. Decoding and frame
+ * skipping live in audio_pipeline.h.
+ */
+
+/**
+ * @brief Scale samples by a Q8 gain (256 = unity, which returns at once)
+ */
+void audio_apply_gain(int16_t *buf, size_t samples, int32_t gain_q8);
+
+/**
+ * @brief Average interleaved frames down to one channel
+ */
+void audio_downmix_mono(const int16_t *in, size_t frames, size_t channels, int16_t *out);
+
+#endif // MCHACKS_AUDIO_DSP_H
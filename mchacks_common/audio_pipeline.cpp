@@ -0,0 +1,111 @@
+#include <string.h>
+#include <array>
+#include <utility>
+#include "audio_pipeline.h"
+
+#define LAYOUT_COUNT 2      // mono, stereo
+
+template <audio_format_t Format> struct SampleFormat;
+
+template <> struct SampleFormat<AUDIO_FORMAT_PCM16> {
+    typedef int16_t raw_t;
+    static inline int16_t decode(int16_t s) { return s; }
+};
+
+template <> struct SampleFormat<AUDIO_FORMAT_PCM8> {
+    typedef uint8_t raw_t;
+    static inline int16_t decode(uint8_t s) { return (int16_t)((s - 128) << 8); }
+};
+
+template <audio_format_t Format, uint16_t Channels, audio_resample_t Resample>
+static size_t convert(const audio_pipeline_t *p, const void *in, size_t frames, int16_t *out)
+{
+    typedef SampleFormat<Format> F;
+    const typename F::raw_t *src = (const typename F::raw_t *)in;
+
+    if constexpr (Resample == AUDIO_RESAMPLE_NONE) {
+        size_t samples = frames * Channels;
+        if constexpr (Format == AUDIO_FORMAT_PCM16) {
+            // Already in output form; at most a short chunk has to move down
+            if ((const void *)out != in) {
+                memmove(out, in, samples * sizeof(int16_t));
+            }
+        } else {
+            for (size_t i = 0; i < samples; i++) {
+                out[i] = F::decode(src[i]);
+            }
+        }
+        return samples;
+    } else {
+        uint32_t step = p->step_q16;
+        uint32_t end = (uint32_t)frames << 16;
+        int16_t *dst = out;
+        for (uint32_t pos = 0; pos < end; pos += step) {
+            const typename F::raw_t *frame = src + (pos >> 16) * Channels;
+            for (uint16_t c = 0; c < Channels; c++) {
+                dst[c] = F::decode(frame[c]);
+            }
+            dst += Channels;
+        }
+        return dst - out;
+    }
+}
+
+// Every flag decided per frame: what the specializations compile away
+static size_t convert_generic(const audio_pipeline_t *p, const void *in, size_t frames, int16_t *out)
+{
+    size_t written = 0;
+    float ratio = p->resample == AUDIO_RESAMPLE_NONE ? 1.0f : p->step_q16 / 65536.0f;
+    float position = 0.0f;
+
+    while (position < frames) {
+        size_t index = (size_t)position * p->channels;
+        for (uint16_t c = 0; c < p->channels; c++) {
+            if (p->format == AUDIO_FORMAT_PCM8) {
+                out[written++] = SampleFormat<AUDIO_FORMAT_PCM8>::decode(((const uint8_t *)in)[index + c]);
+            } else {
+                out[written++] = ((const int16_t *)in)[index + c];
+            }
+        }
+        position += ratio;
+    }
+    return written;
+}
+
+// Entry i handles format i / (LAYOUT_COUNT * AUDIO_RESAMPLE_COUNT), layout
+// (i / AUDIO_RESAMPLE_COUNT) % LAYOUT_COUNT and mode i % AUDIO_RESAMPLE_COUNT
+template <size_t... I>
+static constexpr std::array<audio_convert_fn, sizeof...(I)> make_table(std::index_sequence<I...>)
+{
+    return {{&convert<(audio_format_t)(I / (LAYOUT_COUNT * AUDIO_RESAMPLE_COUNT)),
+                      (uint16_t)((I / AUDIO_RESAMPLE_COUNT) % LAYOUT_COUNT + 1),
+                      (audio_resample_t)(I % AUDIO_RESAMPLE_COUNT)>...}};
+}
+
+static constexpr auto CONVERT_TABLE =
+    make_table(std::make_index_sequence<AUDIO_FORMAT_COUNT * LAYOUT_COUNT * AUDIO_RESAMPLE_COUNT>{});
+
+static void setup(audio_pipeline_t *p, audio_format_t format, uint16_t channels, float ratio)
+{
+    p->format = format;
+    p->channels = channels;
+    p->resample = ratio > 1.0f ? AUDIO_RESAMPLE_DECIMATE : AUDIO_RESAMPLE_NONE;
+    p->step_q16 = ratio > 1.0f ? (uint32_t)(ratio * 65536.0f + 0.5f) : 1u << 16;
+    p->convert = convert_generic;
+    p->specialized = false;
+}
+
+void audio_pipeline_init(audio_pipeline_t *p, audio_format_t format, uint16_t channels, float ratio)
+{
+    setup(p, format, channels, ratio);
+    if (channels >= 1 && channels <= LAYOUT_COUNT && format < AUDIO_FORMAT_COUNT) {
+        size_t index = ((size_t)format * LAYOUT_COUNT + (channels - 1)) * AUDIO_RESAMPLE_COUNT + p->resample;
+        p->convert = CONVERT_TABLE[index];
+        p->specialized = true;
+    }
+}
+
+void audio_pipeline_init_generic(audio_pipeline_t *p, audio_format_t format, uint16_t channels, float ratio)
+{
+    setup(p, format, channels, ratio);
+}
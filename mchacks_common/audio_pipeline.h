@@ -0,0 +1,93 @@
+#ifndef MCHACKS_AUDIO_PIPELINE_H
+#define MCHACKS_AUDIO_PIPELINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Stream sample pipeline
+ * ----------------------
+ * Turns a chunk of raw WAV data into the interleaved 16-bit frames the sink
+ * plays: decode the input format, keep the channel layout, and drop frames
+ * when the requested speed is above what the output rate can reach.
+ *
+ * Every supported combination of format, layout (mono, stereo) and
+ * resampling mode is its own template instance with those three fixed at
+ * compile time, so the per-sample loop has no branches left in it. The
+ * instance is picked once per stream from a table built at compile time.
+ * Layouts with more channels fall back to the generic path, which makes the
+ * same decisions at run time for every frame; esp_bench times both.
+ *
+ * Conversion works in place: read the raw input to the offset given by
+ * audio_pipeline_input_offset() for the largest chunk and pass the buffer
+ * itself as out. The output never gets ahead of the input, so no sample is
+ * overwritten before it has been read, short chunks included.
+ */
+
+typedef enum {
+    AUDIO_FORMAT_PCM16,         // signed 16-bit little-endian
+    AUDIO_FORMAT_PCM8,          // unsigned 8-bit, as WAV stores it
+    AUDIO_FORMAT_COUNT,
+} audio_format_t;
+
+typedef enum {
+    AUDIO_RESAMPLE_NONE,        // every frame plays
+    AUDIO_RESAMPLE_DECIMATE,    // keep one frame every step_q16 / 65536 input frames
+    AUDIO_RESAMPLE_COUNT,
+} audio_resample_t;
+
+typedef struct audio_pipeline audio_pipeline_t;
+
+// Converts frames of raw input into out; returns samples (not frames) written
+typedef size_t (*audio_convert_fn)(const audio_pipeline_t *p, const void *in, size_t frames, int16_t *out);
+
+struct audio_pipeline {
+    audio_format_t format;
+    uint16_t channels;
+    audio_resample_t resample;
+    uint32_t step_q16;          // input frames per output frame, Q16.16
+    audio_convert_fn convert;
+    bool specialized;           // false on the generic path
+};
+
+/**
+ * @brief Set up the pipeline for a stream
+ *
+ * @param ratio Input frames consumed per output frame; 1 plays every frame,
+ *              above 1 decimates (2.5 keeps two frames out of five)
+ */
+void audio_pipeline_init(audio_pipeline_t *p, audio_format_t format, uint16_t channels, float ratio);
+
+/**
+ * @brief Same, but always on the generic path (for benchmarks)
+ */
+void audio_pipeline_init_generic(audio_pipeline_t *p, audio_format_t format, uint16_t channels, float ratio);
+
+/**
+ * @brief Bytes one input sample takes in the file
+ */
+static inline size_t audio_format_bytes(audio_format_t format)
+{
+    return format == AUDIO_FORMAT_PCM8 ? 1 : 2;
+}
+
+/**
+ * @brief Byte offset in an out buffer of out_samples at which raw chunks of
+ *        up to frames can be converted in place
+ */
+static inline size_t audio_pipeline_input_offset(const audio_pipeline_t *p, size_t frames, size_t out_samples)
+{
+    return out_samples * sizeof(int16_t) - frames * p->channels * audio_format_bytes(p->format);
+}
+
+/**
+ * @brief Convert one chunk; frames must stay below 65536
+ *
+ * @return Samples written to out
+ */
+static inline size_t audio_pipeline_run(const audio_pipeline_t *p, const void *in, size_t frames, int16_t *out)
+{
+    return p->convert(p, in, frames, out);
+}
+
+#endif // MCHACKS_AUDIO_PIPELINE_H
@@ -0,0 +1,259 @@
+#include <math.h>
+#include <string.h>
+#include "beat.h"
+
+#define LEVEL_FLOOR 48                  // see spectrum.h
+#define MEAN_HOPS 32.0f                 // running mean of the flux, ~0.2 s at 44.1 kHz
+#define ONSET_RATIO 1.0f                // an onset's flux rises as far again over the mean...
+#define ONSET_FLOOR 64.0f               // ...and by this many levels besides (8 doublings, across bands)
+#define ONSET_MIN_GAP_S 0.05f
+#define PRIOR_OCTAVES 0.9f              // width of the tempo preference
+#define TEMPO_SWITCH 1.2f               // a new tempo must beat the current one by this much
+#define TEMPO_FOLLOW 0.1f               // nearby estimates move the period this far per hop
+#define TEMPO_NEAR 0.04f                // how close counts as nearby
+#define PHASE_GAIN 0.05f                // of the phase error corrected per hop
+
+void BeatTracker::init(uint32_t sample_rate)
+{
+    spectrum_plan_init(&_plan);
+    _fill = 0;
+    _rate = sample_rate;
+    _hops = 0;
+    memset(_levels, 0, sizeof(_levels));
+    memset(_prev_levels, 0, sizeof(_prev_levels));
+    memset(_flux, 0, sizeof(_flux));
+    _mean = 0;
+    _prev_raw = 0;
+    _prev_prev_raw = 0;
+    _prev_above = 0;
+    _prev_prev_above = 0;
+    _last_onset = 0;
+
+    float hops_per_s = (float)sample_rate / BEAT_HOP;
+    _min_lag = (uint32_t)(hops_per_s * 60.0f / BEAT_MAX_BPM);
+    _max_lag = (uint32_t)ceilf(hops_per_s * 60.0f / BEAT_MIN_BPM);
+    if (_min_lag < 2) {
+        _min_lag = 2;
+    }
+    if (_max_lag > BEAT_MAX_LAG) {
+        _max_lag = BEAT_MAX_LAG;
+    }
+    _decay = expf(-1.0f / (BEAT_MEMORY_S * hops_per_s));
+    float prior_lag = hops_per_s * 60.0f / BEAT_PRIOR_BPM;
+    memset(_acf, 0, sizeof(_acf));
+    for (uint32_t l = 0; l <= BEAT_MAX_LAG; l++) {
+        float octaves = l != 0 ? log2f((float)l / prior_lag) / PRIOR_OCTAVES : 0;
+        _prior[l] = expf(-0.5f * octaves * octaves);
+    }
+    _period = 0;
+    _confidence = 0;
+    _locked = false;
+    _next_beat = 0;
+}
+
+float BeatTracker::flux_at(uint64_t hop) const
+{
+    if (hop + 1 >= _hops || _hops - hop > BEAT_HISTORY) {
+        return 0;
+    }
+    return _flux[hop % BEAT_HISTORY];
+}
+
+float BeatTracker::bpm() const
+{
+    return _period > 0 ? 60.0f * _rate / (BEAT_HOP * _period) : 0;
+}
+
+// Tempo score of lag l: its own autocorrelation plus half that of twice the
+// lag, so a period whose double also repeats (a beat inside a bar) wins over
+// one that only lines up with a syncopated figure
+float BeatTracker::tempo_score(uint32_t l) const
+{
+    float twice = _acf[2 * l];
+    if (_acf[2 * l - 1] > twice) {
+        twice = _acf[2 * l - 1];
+    }
+    if (2 * l + 1 <= 2 * _max_lag && _acf[2 * l + 1] > twice) {
+        twice = _acf[2 * l + 1];
+    }
+    return _prior[l] * (_acf[l] + 0.5f * twice);
+}
+
+// Fold the newest flux into the autocorrelation and pick the period
+void BeatTracker::update_tempo()
+{
+    uint64_t now = _hops - 2;
+    float x = flux_at(now);
+    for (uint32_t l = _min_lag; l <= 2 * _max_lag; l++) {
+        _acf[l] = _acf[l] * _decay + (now >= l ? x * flux_at(now - l) : 0);
+    }
+
+    float best = 0;
+    uint32_t best_lag = 0;
+    float total = 0;
+    for (uint32_t l = _min_lag; l <= _max_lag; l++) {
+        float score = tempo_score(l);
+        total += score;
+        if (score > best) {
+            best = score;
+            best_lag = l;
+        }
+    }
+    if (best_lag == 0 || total <= 0) {
+        return;
+    }
+    _confidence = best * (float)(_max_lag - _min_lag + 1) / total;
+
+    // Between lags: the peak of a parabola through the best and its neighbours
+    float candidate = (float)best_lag;
+    if (best_lag > _min_lag && best_lag < _max_lag) {
+        float a = tempo_score(best_lag - 1);
+        float c = tempo_score(best_lag + 1);
+        float denom = a - 2 * best + c;
+        if (denom < 0) {
+            candidate += 0.5f * (a - c) / denom;
+        }
+    }
+
+    if (_period == 0) {
+        _period = candidate;
+    } else if (fabsf(candidate - _period) <= TEMPO_NEAR * _period) {
+        _period += TEMPO_FOLLOW * (candidate - _period);
+    } else {
+        uint32_t current = (uint32_t)lrintf(_period);
+        float held = current >= _min_lag && current <= _max_lag ? tempo_score(current) : 0;
+        if (best > TEMPO_SWITCH * held) {
+            _period = candidate;
+        }
+    }
+}
+
+// Hops since the most recent beat, going by the last few periods of flux
+float BeatTracker::comb_phase()
+{
+    uint32_t span = (uint32_t)_period;
+    uint64_t now = _hops - 2;
+    float best = -1;
+    uint32_t best_phase = 0;
+    for (uint32_t phase = 0; phase <= span; phase++) {
+        float score = 0;
+        for (uint32_t k = 0; k < BEAT_COMB_BEATS; k++) {
+            uint64_t back = phase + (uint64_t)lrintf(k * _period);
+            if (back > now) {
+                break;
+            }
+            // Older beats count for less, so the comb follows a drifting tempo
+            score += flux_at(now - back) * (float)(BEAT_COMB_BEATS - k);
+        }
+        if (score > best) {
+            best = score;
+            best_phase = phase;
+        }
+    }
+    return (float)best_phase;
+}
+
+void BeatTracker::hop(beat_event_t *events, size_t max_events, size_t *n_events)
+{
+    uint8_t levels[SPECTRUM_BANDS];
+    spectrum_analyze(&_plan, _window, &_work, levels);
+    float raw = 0;
+    for (size_t b = 0; b < SPECTRUM_BANDS; b++) {
+        // Below the FFT's own rounding noise a band only flickers
+        if (levels[b] < LEVEL_FLOOR) {
+            levels[b] = LEVEL_FLOOR;
+        }
+        // Against the louder of the last two hops, so tones beating inside
+        // one band don't read as a stream of small onsets
+        uint8_t ref = _levels[b] > _prev_levels[b] ? _levels[b] : _prev_levels[b];
+        if (levels[b] > ref) {
+            raw += (float)(levels[b] - ref);
+        }
+    }
+    memcpy(_prev_levels, _levels, sizeof(_levels));
+    memcpy(_levels, levels, sizeof(_levels));
+
+    uint64_t now = _hops;
+    float above = raw > _mean ? raw - _mean : 0;
+    _mean += (raw - _mean) / MEAN_HOPS;
+    _hops++;
+
+    // Tempo and phase work on the flux smoothed over three hops: an onset
+    // that straddles two hops, or a beat that isn't a whole number of hops
+    // long, still lines up with itself. The smoothed value is for the
+    // previous hop, so _flux runs one hop behind.
+    float prev = _prev_above;
+    if (now >= 1) {
+        _flux[(now - 1) % BEAT_HISTORY] = (_prev_prev_above + 2 * prev + above) / 4;
+    }
+    _prev_prev_above = prev;
+    _prev_above = above;
+
+    // The previous hop is an onset if its flux peaked high enough
+    uint32_t min_gap = (uint32_t)(ONSET_MIN_GAP_S * _rate / BEAT_HOP);
+    if (now >= 2 && _prev_raw > _prev_prev_raw && _prev_raw >= raw &&
+        prev > ONSET_RATIO * _mean + ONSET_FLOOR && (_last_onset == 0 || now - 1 - _last_onset >= min_gap)) {
+        _last_onset = now - 1;
+        if (*n_events < max_events) {
+            beat_event_t *e = &events[(*n_events)++];
+            e->kind = BEAT_EVENT_ONSET;
+            e->sample = (now - 1) * BEAT_HOP + BEAT_HOP / 2;
+            e->next_sample = 0;
+            e->period = 0;
+            e->strength = prev - ONSET_RATIO * _mean;
+        }
+    }
+    _prev_prev_raw = _prev_raw;
+    _prev_raw = raw;
+
+    if (now < 2) {
+        return;
+    }
+    update_tempo();
+    if (_period == 0 || _confidence < BEAT_MIN_CONFIDENCE) {
+        _locked = false;
+        return;
+    }
+
+    // Where the comb puts the latest beat, against the grid's nearest
+    double observed = (double)(now - 1) - comb_phase();
+    if (!_locked) {
+        _next_beat = observed + _period;
+        _locked = true;
+    } else {
+        double grid = _next_beat - _period * round((_next_beat - observed) / _period);
+        _next_beat += PHASE_GAIN * (observed - grid);
+    }
+
+    while (_next_beat <= (double)(now - 1)) {
+        if (*n_events < max_events) {
+            beat_event_t *e = &events[(*n_events)++];
+            e->kind = BEAT_EVENT_BEAT;
+            e->sample = (uint64_t)llround(_next_beat * BEAT_HOP) + BEAT_HOP / 2;
+            e->next_sample = e->sample + (uint64_t)llround(_period * BEAT_HOP);
+            e->period = _period * BEAT_HOP;
+            e->strength = _confidence;
+        }
+        _next_beat += _period;
+    }
+}
+
+size_t BeatTracker::push(const int16_t *samples, size_t count, beat_event_t *events, size_t max_events)
+{
+    size_t n_events = 0;
+    while (count > 0) {
+        size_t take = BEAT_HOP - _fill;
+        if (take > count) {
+            take = count;
+        }
+        memcpy(_window + _fill, samples, take * sizeof(int16_t));
+        _fill += take;
+        samples += take;
+        count -= take;
+        if (_fill == BEAT_HOP) {
+            _fill = 0;
+            hop(events, max_events, &n_events);
+        }
+    }
+    return n_events;
+}
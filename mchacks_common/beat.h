@@ -0,0 +1,119 @@
+#ifndef MCHACKS_BEAT_H
+#define MCHACKS_BEAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "spectrum.h"
+
+/*
+ * Onset and beat tracking
+ * -----------------------
+ * BeatTracker follows a mono stream as it is pushed, a block at a time, and
+ * reports onsets and beats on the stream's own sample clock:
+ *
+ *   onsets   every BEAT_HOP samples the window is analyzed (spectrum.h) and
+ *            the rise of the band levels since the previous hop summed up
+ *            (log spectral flux). A hop whose flux peaks above a running
+ *            mean is an onset, reported one hop later.
+ *   tempo    a leaky autocorrelation of the flux over the lags of
+ *            BEAT_MIN_BPM to BEAT_MAX_BPM and their doubles. A lag scores
+ *            with half of its double added, so syncopation doesn't pass for
+ *            the beat, and is weighted towards ~120 BPM so the tracker
+ *            prefers the tempo people tap along to over its halves and
+ *            doubles. It forgets over BEAT_MEMORY_S.
+ *   phase    a comb over the last BEAT_COMB_BEATS periods of flux finds
+ *            where the beats have been falling; a phase-locked loop pulls
+ *            the predicted beat grid towards it, so one missing or extra
+ *            onset barely moves it.
+ *
+ * A beat is reported once the audio it falls in has been analyzed, with
+ * the predicted time of the next one. Work per hop is fixed: one FFT, one
+ * pass over the lags and one over a period of comb, whatever the music.
+ */
+
+#define BEAT_HOP SPECTRUM_FFT_SIZE      // samples per flux value, ~6 ms at 44.1 kHz
+#define BEAT_MIN_BPM 60
+#define BEAT_MAX_BPM 200
+#define BEAT_PRIOR_BPM 120
+#define BEAT_MAX_LAG 192                // hops; BEAT_MIN_BPM at 48 kHz
+#define BEAT_COMB_BEATS 4
+#define BEAT_HISTORY 1024               // hops of flux kept; covers the comb at any rate
+#define BEAT_MEMORY_S 4.0f
+#define BEAT_MIN_CONFIDENCE 1.5f        // tempo peak over the average lag; no beats below it
+
+typedef enum {
+    BEAT_EVENT_ONSET,
+    BEAT_EVENT_BEAT,
+} beat_event_kind_t;
+
+typedef struct {
+    beat_event_kind_t kind;
+    uint64_t sample;                    // where it falls, in samples since init()
+    uint64_t next_sample;               // BEAT only: the predicted next beat
+    float period;                       // BEAT only: samples per beat
+    float strength;                     // ONSET: flux over the threshold; BEAT: tempo confidence
+} beat_event_t;
+
+class BeatTracker {
+    spectrum_plan_t _plan;
+    spectrum_work_t _work;
+    int16_t _window[BEAT_HOP];
+    size_t _fill = 0;
+
+    uint32_t _rate = 0;
+    uint64_t _hops = 0;                 // analyzed so far
+    uint8_t _levels[SPECTRUM_BANDS] = {};
+    uint8_t _prev_levels[SPECTRUM_BANDS] = {};
+
+    // Onsets
+    float _flux[BEAT_HISTORY] = {};     // above the running mean and smoothed, by hop
+    float _mean = 0;
+    float _prev_raw = 0;
+    float _prev_prev_raw = 0;
+    float _prev_above = 0;
+    float _prev_prev_above = 0;
+    uint64_t _last_onset = 0;           // hop, 0 if none
+
+    // Tempo
+    uint32_t _min_lag = 0;
+    uint32_t _max_lag = 0;
+    float _decay = 0;
+    float _acf[2 * BEAT_MAX_LAG + 1] = {};   // up to twice the longest period
+    float _prior[BEAT_MAX_LAG + 1] = {};
+    float _period = 0;                  // hops, 0 until a tempo is found
+    float _confidence = 0;
+
+    // Phase
+    bool _locked = false;
+    double _next_beat = 0;              // hops
+
+    float flux_at(uint64_t hop) const;
+    float tempo_score(uint32_t l) const;
+    void update_tempo();
+    float comb_phase();
+    void hop(beat_event_t *events, size_t max_events, size_t *n_events);
+
+public:
+    /**
+     * @brief Forget the stream and start over at sample 0
+     */
+    void init(uint32_t sample_rate);
+
+    /**
+     * @brief Take the next count mono samples
+     *
+     * @return Events written to events (at most max_events; with a block of
+     *         at most BEAT_HOP samples that is two)
+     */
+    size_t push(const int16_t *samples, size_t count, beat_event_t *events, size_t max_events);
+
+    uint32_t sample_rate() const { return _rate; }
+    // Samples pushed since init()
+    uint64_t position() const { return _hops * BEAT_HOP + _fill; }
+    // 0 until a tempo is found
+    float bpm() const;
+    float confidence() const { return _confidence; }
+    bool locked() const { return _locked; }
+};
+
+#endif // MCHACKS_BEAT_H
@@ -0,0 +1,153 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "bench.h"
+#if !CONFIG_IDF_TARGET_LINUX
+#include "esp_cpu.h"
+#elif defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+static const char *TAG = "bench";
+
+uint64_t bench_now(void)
+{
+#if !CONFIG_IDF_TARGET_LINUX
+    // 32 bits wrap after ~18 s at 240 MHz; deltas of single runs are fine
+    return esp_cpu_get_cycle_count();
+#elif defined(__x86_64__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+
+const char *bench_unit(void)
+{
+#if !CONFIG_IDF_TARGET_LINUX
+    return "cycles";
+#elif defined(__x86_64__)
+    return "tsc";
+#else
+    return "ns";
+#endif
+}
+
+static uint64_t elapsed(uint64_t start, uint64_t end)
+{
+#if !CONFIG_IDF_TARGET_LINUX
+    return (uint32_t)end - (uint32_t)start;
+#else
+    return end - start;
+#endif
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+esp_err_t bench_run(const bench_kernel_t *kernel, const bench_config_t *config, bench_result_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    out->name = kernel->name;
+    out->item_unit = kernel->item_unit;
+    if (config->runs == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    uint64_t *samples = (uint64_t *)malloc(config->runs * sizeof(uint64_t));
+    if (samples == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (kernel->setup != NULL) {
+        esp_err_t err = kernel->setup();
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG, "Skipping %s: setup failed (%s)", kernel->name, esp_err_to_name(err));
+            free(samples);
+            return err;
+        }
+    }
+
+    for (uint32_t i = 0; i < config->warmup; i++) {
+        kernel->run();
+    }
+
+    // Cost of reading the counter itself, taken off every sample
+    uint64_t overhead = UINT64_MAX;
+    for (int i = 0; i < 16; i++) {
+        uint64_t start = bench_now();
+        uint64_t d = elapsed(start, bench_now());
+        if (d < overhead) {
+            overhead = d;
+        }
+    }
+
+    for (uint32_t i = 0; i < config->runs; i++) {
+        uint64_t start = bench_now();
+        kernel->run();
+        uint64_t d = elapsed(start, bench_now());
+        samples[i] = d > overhead ? d - overhead : 0;
+    }
+
+    if (kernel->teardown != NULL) {
+        kernel->teardown();
+    }
+
+    double sum = 0;
+    for (uint32_t i = 0; i < config->runs; i++) {
+        sum += samples[i];
+    }
+    double mean = sum / config->runs;
+    double var = 0;
+    for (uint32_t i = 0; i < config->runs; i++) {
+        var += (samples[i] - mean) * (samples[i] - mean);
+    }
+
+    qsort(samples, config->runs, sizeof(uint64_t), compare_u64);
+    out->runs = config->runs;
+    out->min = samples[0];
+    out->median = samples[config->runs / 2];
+    out->p90 = samples[(config->runs * 9) / 10];
+    out->max = samples[config->runs - 1];
+    out->mean = mean;
+    out->stddev = config->runs > 1 ? sqrt(var / (config->runs - 1)) : 0;
+    out->per_item = kernel->items > 0 ? mean / kernel->items : 0;
+
+    free(samples);
+    return ESP_OK;
+}
+
+void bench_print_csv(FILE *out, const bench_result_t *results, size_t count)
+{
+    fprintf(out, "kernel,unit,runs,min,median,p90,max,mean,stddev,per_item,item_unit\n");
+    for (size_t i = 0; i < count; i++) {
+        const bench_result_t *r = &results[i];
+        fprintf(out, "%s,%s,%lu,%llu,%llu,%llu,%llu,%.1f,%.1f,%.3f,%s\n", r->name, bench_unit(),
+                (unsigned long)r->runs, (unsigned long long)r->min, (unsigned long long)r->median,
+                (unsigned long long)r->p90, (unsigned long long)r->max, r->mean, r->stddev,
+                r->per_item, r->item_unit ? r->item_unit : "");
+    }
+}
+
+void bench_print_json(FILE *out, const bench_result_t *results, size_t count)
+{
+    fprintf(out, "{\"unit\": \"%s\", \"results\": [", bench_unit());
+    for (size_t i = 0; i < count; i++) {
+        const bench_result_t *r = &results[i];
+        fprintf(out, "%s\n  {\"kernel\": \"%s\", \"runs\": %lu, \"min\": %llu, \"median\": %llu, "
+                "\"p90\": %llu, \"max\": %llu, \"mean\": %.1f, \"stddev\": %.1f, "
+                "\"per_item\": %.3f, \"item_unit\": \"%s\"}",
+                i > 0 ? "," : "", r->name, (unsigned long)r->runs, (unsigned long long)r->min,
+                (unsigned long long)r->median, (unsigned long long)r->p90, (unsigned long long)r->max,
+                r->mean, r->stddev, r->per_item, r->item_unit ? r->item_unit : "");
+    }
+    fprintf(out, "\n]}\n");
+}
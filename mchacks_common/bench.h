@@ -0,0 +1,77 @@
+#ifndef MCHACKS_BENCH_H
+#define MCHACKS_BENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "esp_err.h"
+
+/*
+ * Micro-benchmarks
+ * ----------------
+ * A kernel is one iteration of some hot loop, timed on its own after a few
+ * untimed warm-up iterations. Timing uses the cheapest counter each target
+ * has:
+ *
+ *   ESP32-S3    CPU cycles (esp_cpu_get_cycle_count)
+ *   x86-64 host TSC ticks (rdtsc; constant rate, close to nominal cycles)
+ *   other hosts nanoseconds (clock_gettime, CLOCK_MONOTONIC)
+ *
+ * bench_unit() names the one in use, and it is written next to every result
+ * so numbers from different targets are never mixed up. The esp_bench
+ * project runs every registered kernel and prints the results as CSV or
+ * JSON.
+ */
+
+typedef struct {
+    const char *name;
+    // Optional, run once before the warm-up; a failure skips the kernel
+    esp_err_t (*setup)(void);
+    // One timed iteration
+    void (*run)(void);
+    // Optional, run once after the last iteration
+    void (*teardown)(void);
+    uint32_t items;         // units of work per iteration, for the per-item cost
+    const char *item_unit;  // what an item is ("sample", "pixel", ...)
+} bench_kernel_t;
+
+typedef struct {
+    uint32_t warmup;        // untimed iterations first
+    uint32_t runs;          // timed iterations
+} bench_config_t;
+
+typedef struct {
+    const char *name;
+    uint32_t runs;
+    uint64_t min;
+    uint64_t median;
+    uint64_t p90;
+    uint64_t max;
+    double mean;
+    double stddev;
+    double per_item;        // mean / items, 0 if the kernel has no items
+    const char *item_unit;
+} bench_result_t;
+
+// Keep the compiler from optimising away a result nobody reads
+#define BENCH_KEEP(p) __asm__ __volatile__("" : : "r"(p) : "memory")
+
+/**
+ * @brief Current value of the bench counter
+ */
+uint64_t bench_now(void);
+
+/**
+ * @brief Name of the counter unit ("cycles", "tsc" or "ns")
+ */
+const char *bench_unit(void);
+
+/**
+ * @brief Warm up and time one kernel
+ */
+esp_err_t bench_run(const bench_kernel_t *kernel, const bench_config_t *config, bench_result_t *out);
+
+void bench_print_csv(FILE *out, const bench_result_t *results, size_t count);
+void bench_print_json(FILE *out, const bench_result_t *results, size_t count);
+
+#endif // MCHACKS_BENCH_H
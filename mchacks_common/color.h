@@ -0,0 +1,49 @@
+#ifndef MCHACKS_COLOR_H
+#define MCHACKS_COLOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Fully saturated hue (0-255 around the wheel) at the given value
+ */
+static inline void hue_to_rgb(uint8_t hue, uint8_t value, uint8_t *r, uint8_t *g, uint8_t *b)
+{
+    uint8_t region = hue / 43;
+    uint8_t remainder = (hue - (region * 43)) * 6;
+    uint8_t p = 0;
+    uint8_t q = (value * (255 - remainder)) / 255;
+    uint8_t t = (value * remainder) / 255;
+
+    switch (region) {
+    case 0:
+        *r = value; *g = t; *b = p;
+        break;
+    case 1:
+        *r = q; *g = value; *b = p;
+        break;
+    case 2:
+        *r = p; *g = value; *b = t;
+        break;
+    case 3:
+        *r = p; *g = q; *b = value;
+        break;
+    case 4:
+        *r = t; *g = p; *b = value;
+        break;
+    default:
+        *r = value; *g = p; *b = q;
+        break;
+    }
+}
+
+/**
+ * @brief RGB565 in the byte order the panel and the canvases store
+ */
+static inline uint16_t rgb565_swapped(uint8_t r, uint8_t g, uint8_t b)
+{
+    uint16_t c = (uint16_t)(((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3));
+    return (uint16_t)((c >> 8) | (c << 8));
+}
+
+#endif // MCHACKS_COLOR_H
@@ -0,0 +1,18 @@
+#ifndef MCHACKS_CONSOLE_REPL_H
+#define MCHACKS_CONSOLE_REPL_H
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+/**
+ * @brief Start the esp_console REPL on whichever port the IDF console uses
+ *        (UART, USB CDC or USB Serial/JTAG, from sdkconfig)
+ *
+ * Commands can be registered with esp_console_cmd_register() before or after.
+ * The REPL task is created with the given scheduling so each firmware can
+ * keep it in its own task plan.
+ */
+esp_err_t console_repl_start(const char *prompt, UBaseType_t priority, uint32_t stack, BaseType_t core);
+
+#endif // MCHACKS_CONSOLE_REPL_H
@@ -0,0 +1,223 @@
+#include <stdlib.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "coro.h"
+
+static const char *TAG = "coro";
+
+#define TICK_US ((int64_t)portTICK_PERIOD_MS * 1000)
+
+static MemPool *frame_pool = nullptr;
+static std::atomic<uint32_t> frame_bytes{0};
+static std::atomic<uint32_t> frame_peak{0};
+static std::atomic<uint32_t> frame_failures{0};
+
+void co_set_frame_pool(MemPool *pool)
+{
+    frame_pool = pool;
+}
+
+void *co_frame_alloc(size_t size)
+{
+    void *frame;
+    if (frame_pool != nullptr) {
+        frame = size <= frame_pool->block_size() ? frame_pool->alloc() : nullptr;
+    } else {
+        frame = malloc(size);
+    }
+    if (frame == nullptr) {
+        frame_failures.fetch_add(1, std::memory_order_relaxed);
+        ESP_LOGE(TAG, "No frame for a %u-byte job", (unsigned)size);
+        return nullptr;
+    }
+
+    uint32_t bytes = frame_bytes.fetch_add(size, std::memory_order_relaxed) + size;
+    uint32_t peak = frame_peak.load(std::memory_order_relaxed);
+    while (bytes > peak && !frame_peak.compare_exchange_weak(peak, bytes, std::memory_order_relaxed)) {
+    }
+    return frame;
+}
+
+void co_frame_free(void *frame, size_t size)
+{
+    frame_bytes.fetch_sub(size, std::memory_order_relaxed);
+    if (frame_pool != nullptr) {
+        frame_pool->free(frame);
+    } else {
+        free(frame);
+    }
+}
+
+esp_err_t CoExecutor::spawn(CoJob job)
+{
+    if (!job.valid()) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (_jobs_alive.fetch_add(1, std::memory_order_relaxed) >= CO_MAX_JOBS) {
+        _jobs_alive.fetch_sub(1, std::memory_order_relaxed);
+        _rejected.fetch_add(1, std::memory_order_relaxed);
+        ESP_LOGE(TAG, "%s: %d jobs alive already", _name, CO_MAX_JOBS);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // The executor owns the frame from here; it goes away when the job returns
+    job._h.promise().executor = this;
+    void *handle = job._h.address();
+    job._h = nullptr;
+    _jobs_started.fetch_add(1, std::memory_order_relaxed);
+    schedule(handle);
+    return ESP_OK;
+}
+
+void CoExecutor::wake_one()
+{
+    size_t n = _n_workers.load(std::memory_order_acquire);
+    if (n == 0) {
+        return;
+    }
+    // A worker still registering is skipped; it drains the queue when it starts
+    uint32_t index = _next_worker.fetch_add(1, std::memory_order_relaxed) % n;
+    TaskHandle_t worker = _workers[index].load(std::memory_order_acquire);
+    if (worker != nullptr) {
+        xTaskNotifyGive(worker);
+    }
+}
+
+// A job is never in the ready queue twice and at most CO_MAX_JOBS are
+// alive, so the push always finds room
+void CoExecutor::schedule(void *job)
+{
+    _ready.push(job);
+    wake_one();
+}
+
+void CoExecutor::schedule_from_isr(void *job, BaseType_t *woken)
+{
+    _ready.push(job);
+    size_t n = _n_workers.load(std::memory_order_acquire);
+    if (n == 0) {
+        return;
+    }
+    uint32_t index = _next_worker.fetch_add(1, std::memory_order_relaxed) % n;
+    TaskHandle_t worker = _workers[index].load(std::memory_order_acquire);
+    if (worker != nullptr) {
+        vTaskNotifyGiveFromISR(worker, woken);
+    }
+}
+
+size_t CoExecutor::run_ready(size_t max)
+{
+    size_t n = 0;
+    void *job;
+    while (n < max && _ready.pop(&job)) {
+        _resumes.fetch_add(1, std::memory_order_relaxed);
+        CoJob::handle_t::from_address(job).resume();
+        n++;
+    }
+    return n;
+}
+
+bool CoExecutor::SleepAwaiter::await_ready() const noexcept
+{
+    return deadline_us <= esp_timer_get_time();
+}
+
+CoExecutor::SleepAwaiter CoExecutor::sleep_us(int64_t us)
+{
+    return SleepAwaiter{this, esp_timer_get_time() + us};
+}
+
+void CoExecutor::add_timer(int64_t deadline_us, void *job)
+{
+    _new_timers.push(Timer{deadline_us, job});
+    TaskHandle_t timer_worker = _workers[0].load(std::memory_order_acquire);
+    if (timer_worker != nullptr) {
+        xTaskNotifyGive(timer_worker);
+    }
+}
+
+TickType_t CoExecutor::service_timers()
+{
+    // Sift each new timer up the heap
+    Timer timer;
+    while (_new_timers.pop(&timer)) {
+        size_t i = _n_timers++;
+        while (i > 0 && _timers[(i - 1) / 2].deadline_us > timer.deadline_us) {
+            _timers[i] = _timers[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+        _timers[i] = timer;
+    }
+
+    int64_t now = esp_timer_get_time();
+    bool fired = false;
+    while (_n_timers > 0 && _timers[0].deadline_us <= now) {
+        _ready.push(_timers[0].job);
+        fired = true;
+
+        // Move the last timer to the root and sift it down
+        Timer last = _timers[--_n_timers];
+        size_t i = 0;
+        while (1) {
+            size_t child = 2 * i + 1;
+            if (child >= _n_timers) {
+                break;
+            }
+            if (child + 1 < _n_timers && _timers[child + 1].deadline_us < _timers[child].deadline_us) {
+                child++;
+            }
+            if (_timers[child].deadline_us >= last.deadline_us) {
+                break;
+            }
+            _timers[i] = _timers[child];
+            i = child;
+        }
+        _timers[i] = last;
+    }
+
+    if (fired) {
+        return 0;
+    }
+    if (_n_timers == 0) {
+        return portMAX_DELAY;
+    }
+    // Round up so the job never wakes before its deadline
+    return (TickType_t)((_timers[0].deadline_us - now + TICK_US - 1) / TICK_US);
+}
+
+void CoExecutor::worker(void *pvParameters)
+{
+    CoExecutor *ex = (CoExecutor *)pvParameters;
+    size_t index = ex->_n_workers.fetch_add(1, std::memory_order_acq_rel);
+    if (index >= CO_MAX_WORKERS) {
+        ex->_n_workers.fetch_sub(1, std::memory_order_relaxed);
+        ESP_LOGE(TAG, "%s: more than %d workers", ex->_name, CO_MAX_WORKERS);
+        vTaskDelete(NULL);
+        return;
+    }
+    ex->_workers[index].store(xTaskGetCurrentTaskHandle(), std::memory_order_release);
+    ESP_LOGI(TAG, "%s: worker %u up", ex->_name, (unsigned)index);
+
+    while (1) {
+        ex->run_ready(SIZE_MAX);
+        TickType_t wait = index == 0 ? ex->service_timers() : portMAX_DELAY;
+        if (wait == 0) {
+            continue;
+        }
+        // Every schedule() notifies after its push, so a job made ready
+        // since run_ready() came back finds the notification pending
+        ulTaskNotifyTake(pdTRUE, wait);
+    }
+}
+
+void CoExecutor::stats(co_stats_t *out) const
+{
+    out->jobs_started = _jobs_started.load(std::memory_order_relaxed);
+    out->jobs_alive = _jobs_alive.load(std::memory_order_relaxed);
+    out->resumes = _resumes.load(std::memory_order_relaxed);
+    out->frame_bytes = frame_bytes.load(std::memory_order_relaxed);
+    out->frame_peak = frame_peak.load(std::memory_order_relaxed);
+    out->frame_failures = frame_failures.load(std::memory_order_relaxed);
+    out->rejected = _rejected.load(std::memory_order_relaxed);
+    out->workers = _n_workers.load(std::memory_order_relaxed);
+}
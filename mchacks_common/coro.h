@@ -0,0 +1,394 @@
+#ifndef MCHACKS_CORO_H
+#define MCHACKS_CORO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <atomic>
+#include <coroutine>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_err.h"
+#include "lf_queue.h"
+#include "mem_pool.h"
+
+/*
+ * Cooperative jobs
+ * ----------------
+ * Activities that spend most of their life waiting (for a file, a queue, a
+ * timer, a DMA transfer) don't need a FreeRTOS task and stack each. A
+ * CoJob is a C++20 coroutine: its locals live in a frame of a few hundred
+ * bytes, and whenever it co_awaits something that isn't ready yet it hands
+ * its worker back instead of blocking it. A CoExecutor runs any number of
+ * jobs on one or two worker tasks the firmware starts (pinned through
+ * tasks.h like every other task).
+ *
+ * Jobs must not block their worker for long: no portMAX_DELAY queue calls,
+ * no busy loops. Short stdio calls are fine. Everything a job waits for goes
+ * through an awaitable:
+ *
+ *   co_await ex->sleep_ms(10)     timer (worker 0 keeps the timer heap)
+ *   co_await channel.pop(&v)      CoChannel read; push() waits while full
+ *   co_await event                CoEvent, set by an I/O completion or from
+ *                                 an ISR (DMA done) with set_from_isr()
+ *
+ * A job may resume on a different worker than the one it suspended on.
+ * Frames come from the pool given to co_set_frame_pool() when there is one,
+ * so spawning jobs after boot doesn't touch the heap.
+ */
+
+#define CO_MAX_WORKERS 2
+#define CO_MAX_JOBS 64          // live jobs per executor; sizes the ready and timer queues,
+                                // so waking or sleeping a job can never find them full
+
+class CoExecutor;
+
+typedef struct {
+    uint32_t jobs_started;
+    uint32_t jobs_alive;
+    uint32_t resumes;           // coroutine switches so far
+    uint32_t frame_bytes;       // frames of the live jobs
+    uint32_t frame_peak;
+    uint32_t frame_failures;    // jobs not started for lack of a frame
+    uint32_t rejected;          // jobs not started because CO_MAX_JOBS were alive
+    size_t workers;
+} co_stats_t;
+
+/**
+ * @brief Take coroutine frames from pool instead of the heap
+ *
+ * Call at boot, before the first job is created. A frame larger than the
+ * pool's block size fails to allocate and the job never starts.
+ */
+void co_set_frame_pool(MemPool *pool);
+
+void *co_frame_alloc(size_t size);
+void co_frame_free(void *frame, size_t size);
+
+// Return type of a job coroutine; hand it to CoExecutor::spawn()
+class CoJob {
+public:
+    struct promise_type {
+        CoExecutor *executor = nullptr;
+
+        static void *operator new(size_t size) noexcept { return co_frame_alloc(size); }
+        static void operator delete(void *frame, size_t size) noexcept { co_frame_free(frame, size); }
+        static CoJob get_return_object_on_allocation_failure() noexcept { return CoJob(); }
+
+        CoJob get_return_object() noexcept
+        {
+            return CoJob(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        // Nothing runs until spawn(); the frame goes away when the job returns
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept;
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { abort(); }
+    };
+
+    typedef std::coroutine_handle<promise_type> handle_t;
+
+    CoJob() = default;
+    explicit CoJob(handle_t h) : _h(h) {}
+    CoJob(CoJob &&other) noexcept : _h(other._h) { other._h = nullptr; }
+    CoJob(const CoJob &) = delete;
+    CoJob &operator=(const CoJob &) = delete;
+    // A job that was never spawned is destroyed with its handle
+    ~CoJob()
+    {
+        if (_h) {
+            _h.destroy();
+        }
+    }
+
+    bool valid() const { return (bool)_h; }
+
+private:
+    friend class CoExecutor;
+    handle_t _h = nullptr;
+};
+
+class CoExecutor {
+    struct Timer {
+        int64_t deadline_us;
+        void *job;
+    };
+
+    const char *_name;
+    LfQueue<void *, CO_MAX_JOBS> _ready;
+    LfQueue<Timer, CO_MAX_JOBS> _new_timers;
+    Timer _timers[CO_MAX_JOBS];         // min-heap on deadline, worker 0 only
+    size_t _n_timers = 0;
+    std::atomic<TaskHandle_t> _workers[CO_MAX_WORKERS] = {};
+    std::atomic<size_t> _n_workers{0};
+    std::atomic<uint32_t> _next_worker{0};
+    std::atomic<uint32_t> _jobs_started{0};
+    std::atomic<uint32_t> _jobs_alive{0};
+    std::atomic<uint32_t> _resumes{0};
+    std::atomic<uint32_t> _rejected{0};
+
+    void wake_one();
+    void add_timer(int64_t deadline_us, void *job);
+    TickType_t service_timers();
+
+public:
+    explicit CoExecutor(const char *name) : _name(name) {}
+
+    /**
+     * @brief Make a job runnable for the first time
+     *
+     * @return ESP_ERR_NO_MEM when the job has no frame (pool exhausted or too
+     *         small), ESP_ERR_INVALID_STATE when CO_MAX_JOBS are alive
+     */
+    esp_err_t spawn(CoJob job);
+
+    /**
+     * @brief FreeRTOS entry of a worker task; pvParameters is the executor
+     *
+     * Start up to CO_MAX_WORKERS of these with task_start(). The first one to
+     * come up also runs the timers.
+     */
+    static void worker(void *pvParameters);
+
+    /**
+     * @brief Resume runnable jobs on the calling task until none are left
+     *        or max have run
+     *
+     * For executors without workers (benchmarks, host tests); timers only
+     * fire on a worker.
+     *
+     * @return Jobs resumed
+     */
+    size_t run_ready(size_t max);
+
+    // Wake a suspended job; any task
+    void schedule(void *job);
+    // Same from an ISR
+    void schedule_from_isr(void *job, BaseType_t *woken);
+
+    void job_done() { _jobs_alive.fetch_sub(1, std::memory_order_relaxed); }
+
+    struct SleepAwaiter {
+        CoExecutor *executor;
+        int64_t deadline_us;
+
+        bool await_ready() const noexcept;
+        void await_suspend(CoJob::handle_t h) noexcept { executor->add_timer(deadline_us, h.address()); }
+        void await_resume() const noexcept {}
+    };
+
+    SleepAwaiter sleep_us(int64_t us);
+    SleepAwaiter sleep_ms(uint32_t ms) { return sleep_us((int64_t)ms * 1000); }
+
+    void stats(co_stats_t *out) const;
+};
+
+inline std::suspend_never CoJob::promise_type::final_suspend() noexcept
+{
+    executor->job_done();
+    return {};
+}
+
+// Executor a suspended job belongs to, from the address its waiter slot holds
+static inline CoExecutor *co_executor_of(void *job)
+{
+    return CoJob::handle_t::from_address(job).promise().executor;
+}
+
+// One parked job: registered by the awaiter, taken by whoever wakes it.
+// Whichever side wins the exchange decides who resumes the job, so a wake-up
+// that races with the job going to sleep is never lost.
+class CoWaiter {
+    std::atomic<void *> _job{nullptr};
+
+public:
+    // Ordered before the caller's re-check of the condition it waits for
+    void park(void *job)
+    {
+        _job.exchange(job, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    // true if the job was still parked and is now ours to resume inline
+    bool unpark(void *job)
+    {
+        void *expected = job;
+        return _job.compare_exchange_strong(expected, nullptr, std::memory_order_seq_cst);
+    }
+
+    // The parked job, now ours to schedule; NULL if none. Ordered after the
+    // caller's change to the condition.
+    void *take()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return _job.exchange(nullptr, std::memory_order_seq_cst);
+    }
+
+    void wake()
+    {
+        void *job = take();
+        if (job != nullptr) {
+            co_executor_of(job)->schedule(job);
+        }
+    }
+
+    void wake_from_isr(BaseType_t *woken)
+    {
+        void *job = take();
+        if (job != nullptr) {
+            co_executor_of(job)->schedule_from_isr(job, woken);
+        }
+    }
+};
+
+/**
+ * Bounded channel into a job. Each end has one owner at a time: one job or
+ * task (or ISR) pushing, one popping. A job waits with co_await on its end,
+ * everything else uses the try_ calls.
+ */
+template <typename T, size_t Capacity>
+class CoChannel {
+    LfQueue<T, Capacity> _queue;
+    CoWaiter _reader;
+    CoWaiter _writer;
+
+public:
+    bool try_push(const T &value)
+    {
+        if (!_queue.push(value)) {
+            return false;
+        }
+        _reader.wake();
+        return true;
+    }
+
+    bool try_push_from_isr(const T &value, BaseType_t *woken)
+    {
+        if (!_queue.push(value)) {
+            return false;
+        }
+        _reader.wake_from_isr(woken);
+        return true;
+    }
+
+    bool try_pop(T *out)
+    {
+        if (!_queue.pop(out)) {
+            return false;
+        }
+        _writer.wake();
+        return true;
+    }
+
+    // Once a job is parked another worker may resume it, so await_suspend()
+    // touches nothing in the job's frame (the awaiter included) after parking
+    // unless it got the job back with unpark()
+    struct PopAwaiter {
+        CoChannel *ch;
+        T *out;
+        bool done;
+
+        bool await_ready() noexcept { return done = ch->try_pop(out); }
+        bool await_suspend(CoJob::handle_t h) noexcept
+        {
+            CoChannel *c = ch;
+            c->_reader.park(h.address());
+            // A push may have landed between the check and parking: carry on
+            // now, unless the pusher already took the job and will resume it
+            if (!c->_queue.can_pop() || !c->_reader.unpark(h.address())) {
+                return true;
+            }
+            done = c->try_pop(out);
+            return false;
+        }
+        void await_resume() noexcept
+        {
+            if (!done) {
+                ch->try_pop(out);
+            }
+        }
+    };
+
+    struct PushAwaiter {
+        CoChannel *ch;
+        T value;
+        bool done;
+
+        bool await_ready() noexcept { return done = ch->try_push(value); }
+        bool await_suspend(CoJob::handle_t h) noexcept
+        {
+            CoChannel *c = ch;
+            c->_writer.park(h.address());
+            if (!c->_queue.can_push() || !c->_writer.unpark(h.address())) {
+                return true;
+            }
+            done = c->try_push(value);
+            return false;
+        }
+        void await_resume() noexcept
+        {
+            if (!done) {
+                ch->try_push(value);
+            }
+        }
+    };
+
+    // Only from a job; waits while the channel is empty
+    PopAwaiter pop(T *out) { return PopAwaiter{this, out, false}; }
+    // Only from a job; waits while the channel is full
+    PushAwaiter push(const T &value) { return PushAwaiter{this, value, false}; }
+
+    size_t size() const { return _queue.size(); }
+};
+
+/**
+ * Auto-reset event for one waiting job: I/O completions, DMA done. Sets that
+ * arrive while nobody waits are remembered (once).
+ */
+class CoEvent {
+    std::atomic<bool> _set{false};
+    CoWaiter _waiter;
+
+    // Flag first, then look for a waiter: a job parking in between finds the
+    // flag. When the waiter is taken the wake-up is the set, so the flag goes.
+    void *arm()
+    {
+        _set.store(true, std::memory_order_seq_cst);
+        void *job = _waiter.take();
+        if (job != nullptr) {
+            _set.store(false, std::memory_order_relaxed);
+        }
+        return job;
+    }
+
+public:
+    void set()
+    {
+        void *job = arm();
+        if (job != nullptr) {
+            co_executor_of(job)->schedule(job);
+        }
+    }
+
+    void set_from_isr(BaseType_t *woken)
+    {
+        void *job = arm();
+        if (job != nullptr) {
+            co_executor_of(job)->schedule_from_isr(job, woken);
+        }
+    }
+
+    bool await_ready() noexcept { return _set.exchange(false, std::memory_order_acq_rel); }
+    bool await_suspend(CoJob::handle_t h) noexcept
+    {
+        _waiter.park(h.address());
+        if (_set.exchange(false, std::memory_order_seq_cst)) {
+            // Carry on now, unless a setter already took the job
+            return !_waiter.unpark(h.address());
+        }
+        return true;
+    }
+    void await_resume() noexcept {}
+};
+
+#endif // MCHACKS_CORO_H
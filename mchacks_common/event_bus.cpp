@@ -0,0 +1,93 @@
+#include "esp_log.h"
+#include "event_bus.h"
+
+static const char *TAG = "event_bus";
+
+static BusTopicBase *topics[BUS_MAX_TOPICS];
+static std::atomic<size_t> n_topics(0);
+
+// Topics are globals, so this runs during static initialisation
+BusTopicBase::BusTopicBase(const char *name, uint32_t capacity)
+    : _name(name), _capacity(capacity)
+{
+    size_t n = n_topics.load(std::memory_order_relaxed);
+    if (n >= BUS_MAX_TOPICS) {
+        ESP_LOGW(TAG, "Too many topics, not tracking stats for %s", name);
+        return;
+    }
+    topics[n] = this;
+    n_topics.store(n + 1, std::memory_order_release);
+}
+
+void BusTopicBase::notify()
+{
+    for (size_t i = 0; i < BUS_MAX_SUBSCRIBERS; i++) {
+        BusSubscriber *sub = _subs[i].load(std::memory_order_acquire);
+        if (sub != nullptr && sub->_task != nullptr) {
+            xTaskNotifyGive(sub->_task);
+        }
+    }
+}
+
+esp_err_t BusTopicBase::subscribe(BusSubscriber *sub, const char *name, bool notify)
+{
+    sub->_name = name;
+    sub->_task = notify ? xTaskGetCurrentTaskHandle() : nullptr;
+    sub->_next.store(_head.load(std::memory_order_acquire), std::memory_order_relaxed);
+    sub->_received.store(0, std::memory_order_relaxed);
+    sub->_lost.store(0, std::memory_order_relaxed);
+
+    for (size_t i = 0; i < BUS_MAX_SUBSCRIBERS; i++) {
+        BusSubscriber *expected = nullptr;
+        if (_subs[i].compare_exchange_strong(expected, sub, std::memory_order_release,
+                                             std::memory_order_relaxed)) {
+            return ESP_OK;
+        }
+    }
+    ESP_LOGE(TAG, "Topic %s has no room for subscriber %s", _name, name);
+    return ESP_ERR_NO_MEM;
+}
+
+void BusTopicBase::unsubscribe(BusSubscriber *sub)
+{
+    for (size_t i = 0; i < BUS_MAX_SUBSCRIBERS; i++) {
+        BusSubscriber *expected = sub;
+        if (_subs[i].compare_exchange_strong(expected, nullptr, std::memory_order_relaxed)) {
+            return;
+        }
+    }
+}
+
+void BusTopicBase::stats(bus_topic_stats_t *out) const
+{
+    uint32_t head = _head.load(std::memory_order_acquire);
+    out->name = _name;
+    out->published = head;
+    out->capacity = _capacity;
+    out->n_subscribers = 0;
+    for (size_t i = 0; i < BUS_MAX_SUBSCRIBERS; i++) {
+        BusSubscriber *sub = _subs[i].load(std::memory_order_acquire);
+        if (sub == nullptr) {
+            continue;
+        }
+        bus_subscriber_stats_t *s = &out->subscribers[out->n_subscribers++];
+        s->name = sub->_name;
+        s->received = sub->_received.load(std::memory_order_relaxed);
+        s->lost = sub->_lost.load(std::memory_order_relaxed);
+        uint32_t lag = head - sub->_next.load(std::memory_order_relaxed);
+        // Anything beyond the ring is already lost, it just hasn't been counted yet
+        s->lag = (int32_t)lag > 0 ? (lag < _capacity ? lag : _capacity) : 0;
+    }
+}
+
+size_t bus_topic_stats(bus_topic_stats_t *out, size_t max)
+{
+    size_t n = n_topics.load(std::memory_order_acquire);
+    if (n > max) {
+        n = max;
+    }
+    for (size_t i = 0; i < n; i++) {
+        topics[i]->stats(&out[i]);
+    }
+    return n;
+}
@@ -0,0 +1,161 @@
+#ifndef MCHACKS_EVENT_BUS_H
+#define MCHACKS_EVENT_BUS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <type_traits>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_err.h"
+
+/*
+ * In-process event bus
+ * --------------------
+ * A BusTopic<T, N> is a broadcast ring of the last N messages of one type,
+ * written by a single producer task. Every subscriber keeps its own read
+ * position, so consumers come and go without the producer knowing about
+ * them, and none of them can slow down another.
+ *
+ * The producer never waits: a subscriber that falls more than N messages
+ * behind loses the oldest ones and sees them counted in its stats. Each
+ * slot carries a sequence number (odd while being written), so a reader
+ * that loses the race against a wrap-around notices and drops that message
+ * instead of returning a torn one.
+ *
+ * Subscribers either poll() whenever it suits them, or subscribe with
+ * notify set and block in ulTaskNotifyTake() until the producer publishes
+ * (xTaskNotifyGive, so the task's notification value is shared with any
+ * other use of it).
+ *
+ * Every topic shows up in bus_topic_stats() with its message count and each
+ * subscriber's lag, for throughput and backlog reports.
+ */
+
+#define BUS_MAX_TOPICS 8
+#define BUS_MAX_SUBSCRIBERS 4
+
+typedef struct {
+    const char *name;
+    uint32_t received;
+    uint32_t lost;          // overwritten before this subscriber got to them
+    uint32_t lag;           // published but not yet read
+} bus_subscriber_stats_t;
+
+typedef struct {
+    const char *name;
+    uint32_t published;
+    uint32_t capacity;
+    size_t n_subscribers;
+    bus_subscriber_stats_t subscribers[BUS_MAX_SUBSCRIBERS];
+} bus_topic_stats_t;
+
+// Read state of one consumer; must outlive its subscription
+class BusSubscriber {
+    friend class BusTopicBase;
+    template <typename T, size_t Capacity> friend class BusTopic;
+
+    const char *_name = nullptr;
+    TaskHandle_t _task = nullptr;
+    std::atomic<uint32_t> _next{0};
+    std::atomic<uint32_t> _received{0};
+    std::atomic<uint32_t> _lost{0};
+};
+
+class BusTopicBase {
+protected:
+    const char *_name;
+    uint32_t _capacity;
+    std::atomic<uint32_t> _head{0};     // messages published so far
+    std::atomic<BusSubscriber *> _subs[BUS_MAX_SUBSCRIBERS] = {};
+
+    BusTopicBase(const char *name, uint32_t capacity);
+    void notify();
+
+public:
+    /**
+     * Start reading from the next message published
+     *
+     * @param notify Wake the calling task on every publish
+     * @return ESP_ERR_NO_MEM when the topic has BUS_MAX_SUBSCRIBERS already
+     */
+    esp_err_t subscribe(BusSubscriber *sub, const char *name, bool notify);
+
+    // The producer may still wake the task once after this returns
+    void unsubscribe(BusSubscriber *sub);
+
+    void stats(bus_topic_stats_t *out) const;
+};
+
+template <typename T, size_t Capacity>
+class BusTopic : public BusTopicBase {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+                  "BusTopic capacity must be a power of two");
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "BusTopic messages are copied as bytes");
+
+    struct Slot {
+        std::atomic<uint32_t> seq{0};   // 2n + 2 once message n is in, odd while writing
+        T value;
+    };
+    Slot _slots[Capacity];
+
+public:
+    explicit BusTopic(const char *name) : BusTopicBase(name, Capacity) {}
+
+    // Producer task only
+    void publish(const T &value)
+    {
+        uint32_t n = _head.load(std::memory_order_relaxed);
+        Slot &slot = _slots[n & (Capacity - 1)];
+        slot.seq.store(2 * n + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(&slot.value, &value, sizeof(T));
+        slot.seq.store(2 * n + 2, std::memory_order_release);
+        _head.store(n + 1, std::memory_order_release);
+        notify();
+    }
+
+    // Next message for this subscriber, false when it is up to date
+    bool poll(BusSubscriber *sub, T *out)
+    {
+        uint32_t next = sub->_next.load(std::memory_order_relaxed);
+        while (1) {
+            uint32_t head = _head.load(std::memory_order_acquire);
+            if (next == head) {
+                sub->_next.store(next, std::memory_order_relaxed);
+                return false;
+            }
+            if (head - next > Capacity) {
+                // Lapped: skip to the oldest message still in the ring
+                sub->_lost.fetch_add(head - Capacity - next, std::memory_order_relaxed);
+                next = head - Capacity;
+            }
+
+            Slot &slot = _slots[next & (Capacity - 1)];
+            uint32_t before = slot.seq.load(std::memory_order_acquire);
+            if (before == 2 * next + 2) {
+                memcpy(out, &slot.value, sizeof(T));
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (slot.seq.load(std::memory_order_relaxed) == before) {
+                    sub->_next.store(next + 1, std::memory_order_relaxed);
+                    sub->_received.fetch_add(1, std::memory_order_relaxed);
+                    return true;
+                }
+            }
+            // Overwritten while we looked
+            sub->_lost.fetch_add(1, std::memory_order_relaxed);
+            next++;
+        }
+    }
+};
+
+/**
+ * @brief Stats of every topic
+ *
+ * @return Number of entries written to out
+ */
+size_t bus_topic_stats(bus_topic_stats_t *out, size_t max);
+
+#endif // MCHACKS_EVENT_BUS_H
@@ -0,0 +1,142 @@
+#ifndef MCHACKS_HAL_H
+#define MCHACKS_HAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+/*
+ * Hardware abstraction layer
+ * --------------------------
+ * Every driver the firmwares touch sits behind one of the narrow interfaces
+ * below. Device builds get the ESP-IDF implementations (hal_esp.cpp in each
+ * firmware); the Linux target gets the host stand-ins from hal_host.cpp:
+ *
+ *   AudioSink     I2S PDM TX          -> WAV file (HAL_HOST_AUDIO_FILE)
+ *   BlockStorage  SD card over SPI    -> directory (HAL_STORAGE_ROOT)
+ *   DisplayPanel  ST7789 via LGFX     -> PPM snapshots of the framebuffer
+ *   ImuSource     MPU6050             -> synthetic motion
+ *   NetTransport  esp_server/client   -> UDP on the loopback interface
+ */
+
+#if CONFIG_IDF_TARGET_LINUX
+// The MPU6050 driver doesn't build for the host; mirror its sample layout
+typedef struct {
+    int16_t accel_x;
+    int16_t accel_y;
+    int16_t accel_z;
+    int16_t gyro_x;
+    int16_t gyro_y;
+    int16_t gyro_z;
+    int device_id;
+} IMU_DATA;
+
+#define HAL_STORAGE_ROOT "sdcard"
+#define HAL_HOST_AUDIO_FILE "audio_out.wav"
+#define HAL_HOST_DISPLAY_FILE "display.ppm"
+#define HAL_LOOPBACK_PORT 47100
+#else
+#include "mp6050.h"
+
+#define HAL_STORAGE_ROOT "/sdcard"
+#endif
+
+#define HAL_MAX_IMU_DEVICES 32
+
+// Where a control datagram came from or goes to (see imu_control.h)
+typedef struct {
+    uint32_t addr;                      // IPv4, network byte order
+    uint16_t port;                      // network byte order
+} net_peer_t;
+
+class AudioSink {
+public:
+    virtual ~AudioSink() {}
+
+    // Start a stream of interleaved 16-bit samples
+    virtual esp_err_t open(uint32_t sample_rate, uint16_t channels) = 0;
+    // Blocks until every sample has been queued for output
+    virtual esp_err_t write(const int16_t *samples, size_t count) = 0;
+    virtual void close() = 0;
+    // Frames that are always queued ahead of a write, i.e. the fixed output latency
+    virtual uint32_t queued_frames() const = 0;
+    // Times the output ran dry since boot
+    virtual uint32_t underruns() const = 0;
+};
+
+class BlockStorage {
+public:
+    virtual ~BlockStorage() {}
+
+    // Make HAL_STORAGE_ROOT usable with stdio; safe to call repeatedly
+    virtual esp_err_t mount() = 0;
+    virtual void unmount() = 0;
+    virtual bool mounted() const = 0;
+};
+
+class DisplayPanel {
+public:
+    virtual ~DisplayPanel() {}
+
+    virtual esp_err_t init() = 0;
+    // width x height RGB565 pixels in panel byte order (big-endian, as LGFX sprites keep them)
+    virtual void present(const uint16_t *pixels, int32_t width, int32_t height) = 0;
+};
+
+class ImuSource {
+public:
+    virtual ~ImuSource() {}
+
+    virtual esp_err_t init() = 0;
+    virtual esp_err_t read(IMU_DATA *out) = 0;
+    // Full-scale ranges as imu_accel_range_t / imu_gyro_range_t (see
+    // imu_control.h); unchanged if the sensor won't take them
+    virtual esp_err_t set_range(uint8_t accel_range, uint8_t gyro_range) = 0;
+};
+
+class NetTransport {
+public:
+    virtual ~NetTransport() {}
+
+    // Bring up the link (WiFi on device, sockets on the host)
+    virtual esp_err_t start() = 0;
+    // Node side: hand one sample to the uplink
+    virtual esp_err_t send_sample(const IMU_DATA &sample) = 0;
+    // Node side: hand count samples to the uplink, in one message where the
+    // link allows
+    virtual esp_err_t send_samples(const IMU_DATA *samples, size_t count) = 0;
+    // Node side: false while samples handed to the uplink would be lost
+    // (see imu_backlog.h)
+    virtual bool link_up() const = 0;
+    // Main side: most recent sample received from a device, false if none yet
+    virtual bool latest_sample(int device, IMU_DATA *out) = 0;
+    // Main side: samples received from a device since boot, 0 if the link can't count them
+    virtual uint32_t received(int device) const = 0;
+    // Main side: sample datagrams lost on the way in since boot (receive
+    // buffer overruns, for any device), 0 if the link can't tell
+    virtual uint32_t lost() const = 0;
+    // Main side: esp_timer time the latest sample from a device reached the
+    // link, 0 if the link can't tell
+    virtual int64_t arrival_us(int device) const = 0;
+    // Main side: take the next datagram that reached NET_AUDIO_PORT (see
+    // net_audio.h) without waiting; false if none. arrival_us is when it
+    // reached the link, on the esp_timer clock.
+    virtual bool receive_audio(uint8_t *buf, size_t max, size_t *len, int64_t *arrival_us) = 0;
+    // Send a datagram on IMU_CONTROL_PORT (see imu_control.h). On a node, to
+    // is NULL: it goes to the main board, or is broadcast until the main
+    // board has been heard from.
+    virtual esp_err_t send_control(const net_peer_t *to, const void *buf, size_t len) = 0;
+    // Take the next control datagram without waiting; false if none. from
+    // is where it came from, for the reply.
+    virtual bool receive_control(void *buf, size_t max, size_t *len, net_peer_t *from) = 0;
+};
+
+// Per-target singletons. A firmware only links the ones it uses.
+AudioSink *hal_audio_sink();
+BlockStorage *hal_storage();
+DisplayPanel *hal_display();
+ImuSource *hal_imu_source();
+NetTransport *hal_net();
+
+#endif // MCHACKS_HAL_H
@@ -0,0 +1,561 @@
+// Host stand-ins for the hardware drivers, used by the ESP-IDF Linux target.
+// Each one keeps the timing and data shape of the real device closely enough
+// that the firmware above it runs unchanged under perf and the sanitizers.
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "hal.h"
+#include "imu_control.h"
+#include "imu_decode.h"
+#include "net_audio.h"
+
+static const char *TAG = "hal_host";
+
+static int env_int(const char *name, int fallback)
+{
+    const char *value = getenv(name);
+    return value ? atoi(value) : fallback;
+}
+
+static void put_le16(uint8_t *p, uint16_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    put_le16(p, v & 0xFFFF);
+    put_le16(p + 2, v >> 16);
+}
+
+// Writes the stream to a WAV file. By default writes are paced to the sample
+// clock like the I2S DMA would be; MCHACKS_AUDIO_REALTIME=0 runs unthrottled.
+// Falling further behind the clock than a DMA queue could cover counts as an
+// underrun, after which the clock is restarted from the late write.
+#define HOST_UNDERRUN_SLACK_US 20000
+
+class WavFileSink : public AudioSink {
+    FILE *_file = NULL;
+    uint32_t _sample_rate = 0;
+    uint16_t _channels = 0;
+    uint32_t _data_bytes = 0;
+    uint64_t _frames = 0;
+    int64_t _start_us = 0;
+    bool _realtime = true;
+    uint32_t _underruns = 0;
+
+    void write_header()
+    {
+        uint8_t h[44];
+        memcpy(h, "RIFF", 4);
+        put_le32(h + 4, 36 + _data_bytes);
+        memcpy(h + 8, "WAVEfmt ", 8);
+        put_le32(h + 16, 16);
+        put_le16(h + 20, 1);
+        put_le16(h + 22, _channels);
+        put_le32(h + 24, _sample_rate);
+        put_le32(h + 28, _sample_rate * _channels * 2);
+        put_le16(h + 32, _channels * 2);
+        put_le16(h + 34, 16);
+        memcpy(h + 36, "data", 4);
+        put_le32(h + 40, _data_bytes);
+        fseek(_file, 0, SEEK_SET);
+        fwrite(h, 1, sizeof(h), _file);
+        fseek(_file, 0, SEEK_END);
+    }
+
+public:
+    esp_err_t open(uint32_t sample_rate, uint16_t channels) override
+    {
+        _file = fopen(HAL_HOST_AUDIO_FILE, "wb");
+        if (_file == NULL) {
+            ESP_LOGE(TAG, "Failed to open %s", HAL_HOST_AUDIO_FILE);
+            return ESP_FAIL;
+        }
+        _sample_rate = sample_rate;
+        _channels = channels;
+        _data_bytes = 0;
+        _frames = 0;
+        _start_us = esp_timer_get_time();
+        _realtime = env_int("MCHACKS_AUDIO_REALTIME", 1) != 0;
+        write_header();
+        return ESP_OK;
+    }
+
+    esp_err_t write(const int16_t *samples, size_t count) override
+    {
+        if (fwrite(samples, sizeof(int16_t), count, _file) != count) {
+            return ESP_FAIL;
+        }
+        _data_bytes += count * sizeof(int16_t);
+        _frames += count / _channels;
+
+        if (_realtime) {
+            int64_t due_us = _start_us + (int64_t)(_frames * 1000000 / _sample_rate);
+            int64_t ahead_us = due_us - esp_timer_get_time();
+            if (ahead_us < -HOST_UNDERRUN_SLACK_US) {
+                _underruns++;
+                _start_us -= ahead_us;
+            } else if (ahead_us > 1000) {
+                vTaskDelay(pdMS_TO_TICKS(ahead_us / 1000) > 0 ? pdMS_TO_TICKS(ahead_us / 1000) : 1);
+            }
+        }
+        return ESP_OK;
+    }
+
+    void close() override
+    {
+        if (_file == NULL) {
+            return;
+        }
+        write_header();
+        fclose(_file);
+        _file = NULL;
+    }
+
+    uint32_t queued_frames() const override
+    {
+        return 0;
+    }
+
+    uint32_t underruns() const override
+    {
+        return _underruns;
+    }
+};
+
+class DirectoryStorage : public BlockStorage {
+    bool _mounted = false;
+
+public:
+    esp_err_t mount() override
+    {
+        if (_mounted) {
+            return ESP_OK;
+        }
+        if (mkdir(HAL_STORAGE_ROOT, 0755) != 0 && errno != EEXIST) {
+            ESP_LOGE(TAG, "Failed to create %s: %s", HAL_STORAGE_ROOT, strerror(errno));
+            return ESP_FAIL;
+        }
+        ESP_LOGI(TAG, "Storage backed by ./%s", HAL_STORAGE_ROOT);
+        _mounted = true;
+        return ESP_OK;
+    }
+
+    void unmount() override
+    {
+        _mounted = false;
+    }
+
+    bool mounted() const override
+    {
+        return _mounted;
+    }
+};
+
+// Dumps every Nth frame (MCHACKS_PPM_EVERY, default 50) to a PPM file.
+// Written to a temp file and renamed so a viewer never sees half a frame.
+class PpmPanel : public DisplayPanel {
+    uint32_t _frames = 0;
+    uint32_t _every = 50;
+    uint8_t *_rgb = NULL;
+
+public:
+    esp_err_t init() override
+    {
+        _every = env_int("MCHACKS_PPM_EVERY", 50);
+        return ESP_OK;
+    }
+
+    void present(const uint16_t *pixels, int32_t width, int32_t height) override
+    {
+        if (_every == 0 || _frames++ % _every != 0) {
+            return;
+        }
+        if (_rgb == NULL) {
+            _rgb = (uint8_t *)malloc(width * height * 3);
+            if (_rgb == NULL) {
+                return;
+            }
+        }
+
+        for (int32_t i = 0; i < width * height; i++) {
+            uint16_t p = (uint16_t)((pixels[i] >> 8) | (pixels[i] << 8));
+            _rgb[i * 3 + 0] = ((p >> 11) & 0x1F) << 3;
+            _rgb[i * 3 + 1] = ((p >> 5) & 0x3F) << 2;
+            _rgb[i * 3 + 2] = (p & 0x1F) << 3;
+        }
+
+        FILE *f = fopen(HAL_HOST_DISPLAY_FILE ".tmp", "wb");
+        if (f == NULL) {
+            return;
+        }
+        fprintf(f, "P6\n%ld %ld\n255\n", (long)width, (long)height);
+        fwrite(_rgb, 1, width * height * 3, f);
+        fclose(f);
+        rename(HAL_HOST_DISPLAY_FILE ".tmp", HAL_HOST_DISPLAY_FILE);
+    }
+};
+
+// Smooth, slightly different motion per process so two nodes don't overlap.
+// A wider range reads out fewer counts for the same motion, as on the sensor.
+class SyntheticImuSource : public ImuSource {
+    double _phase = 0;
+    uint8_t _accel_range = IMU_ACCEL_2G;
+    uint8_t _gyro_range = IMU_GYRO_250DPS;
+
+public:
+    esp_err_t init() override
+    {
+        _phase = (getpid() % 628) / 100.0;
+        return ESP_OK;
+    }
+
+    esp_err_t read(IMU_DATA *out) override
+    {
+        // Build the register burst the sensor would return, then decode it
+        double t = esp_timer_get_time() / 1e6;
+        uint8_t raw[IMU_BURST_SIZE] = {};
+        imu_encode_be16(raw + 4, 16384 >> _accel_range); // 1g
+        imu_encode_be16(raw + 10, (int16_t)(12000 * sin(2 * M_PI * 0.17 * t + _phase)) >> _gyro_range);
+        imu_encode_be16(raw + 12, (int16_t)(15000 * sin(2 * M_PI * 0.31 * t + _phase * 1.7)) >> _gyro_range);
+
+        memset(out, 0, sizeof(*out));
+        imu_decode_burst(raw, out);
+        return ESP_OK;
+    }
+
+    esp_err_t set_range(uint8_t accel_range, uint8_t gyro_range) override
+    {
+        if (accel_range > IMU_ACCEL_16G || gyro_range > IMU_GYRO_2000DPS) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        _accel_range = accel_range;
+        _gyro_range = gyro_range;
+        return ESP_OK;
+    }
+};
+
+// Kernel receive stamps are CLOCK_REALTIME; move one onto the esp_timer
+// clock. Falls back to now_us when the message carries no stamp.
+static int64_t arrival_from_msg(struct msghdr *msg, int64_t now_us, int64_t realtime_us)
+{
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(msg); c != NULL; c = CMSG_NXTHDR(msg, c)) {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPNS) {
+            struct timespec ts;
+            memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+            int64_t age_us = realtime_us - ((int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+            return now_us - (age_us > 0 ? age_us : 0);
+        }
+    }
+    return now_us;
+}
+
+static int64_t realtime_now_us(void)
+{
+    struct timespec realtime;
+    clock_gettime(CLOCK_REALTIME, &realtime);
+    return (int64_t)realtime.tv_sec * 1000000 + realtime.tv_nsec / 1000;
+}
+
+// Nodes send raw IMU_DATA datagrams, one sample or a batch back to back, to
+// 127.0.0.1; the main board binds the port the first time it asks for a
+// sample. Sockets are non-blocking and drained on demand so no FreeRTOS task
+// ever blocks in a syscall. The kernel stamps each datagram on arrival
+// (SO_TIMESTAMPNS), so the time a sample sat in the socket before the game
+// picked it up is known, and it reports datagrams it had to drop for lack of
+// buffer room (SO_RXQ_OVFL), so transport loss is too. Network audio datagrams arrive on a second port the
+// same way, and control messages on a third, where the main board listens
+// and each node sends from a port of its own.
+class LoopbackTransport : public NetTransport {
+    int _sock = -1;
+    bool _bound = false;
+    struct sockaddr_in _addr = {};
+    IMU_DATA _latest[HAL_MAX_IMU_DEVICES] = {};
+    bool _have[HAL_MAX_IMU_DEVICES] = {};
+    uint32_t _received[HAL_MAX_IMU_DEVICES] = {};
+    uint32_t _lost = 0;
+    int64_t _arrival_us[HAL_MAX_IMU_DEVICES] = {};
+    int _audio_sock = -1;
+    bool _audio_failed = false;
+    int _control_sock = -1;
+    bool _control_failed = false;
+
+    void drain()
+    {
+        IMU_DATA batch[IMU_BATCH_MAX];
+        char control[CMSG_SPACE(sizeof(struct timespec)) + CMSG_SPACE(sizeof(uint32_t))];
+        struct iovec iov = {batch, sizeof(batch)};
+
+        int64_t now_us = esp_timer_get_time();
+        int64_t realtime_us = realtime_now_us();
+
+        while (1) {
+            struct msghdr msg = {};
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            ssize_t n = recvmsg(_sock, &msg, MSG_DONTWAIT);
+            if (n < (ssize_t)sizeof(IMU_DATA)) {
+                break;
+            }
+            if (n % sizeof(IMU_DATA) != 0) {
+                continue;
+            }
+
+            // The kernel's running count of datagrams it dropped on this socket
+            for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c != NULL; c = CMSG_NXTHDR(&msg, c)) {
+                if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SO_RXQ_OVFL) {
+                    memcpy(&_lost, CMSG_DATA(c), sizeof(_lost));
+                }
+            }
+            int64_t arrival_us = arrival_from_msg(&msg, now_us, realtime_us);
+            for (size_t i = 0; i < n / sizeof(IMU_DATA); i++) {
+                const IMU_DATA &sample = batch[i];
+                if (sample.device_id < 0 || sample.device_id >= HAL_MAX_IMU_DEVICES) {
+                    continue;
+                }
+                _latest[sample.device_id] = sample;
+                _have[sample.device_id] = true;
+                _received[sample.device_id]++;
+                _arrival_us[sample.device_id] = arrival_us;
+            }
+        }
+    }
+
+    // The main board listens on the control port; a node's socket is opened
+    // by its first send and gets a port of its own
+    bool open_control(bool listen)
+    {
+        if (_control_sock >= 0) {
+            return true;
+        }
+        if (_control_failed) {
+            return false;
+        }
+        _control_sock = socket(AF_INET, SOCK_DGRAM, 0);
+        struct sockaddr_in addr = control_addr();
+        if (_control_sock < 0 ||
+            (listen && bind(_control_sock, (struct sockaddr *)&addr, sizeof(addr)) != 0)) {
+            ESP_LOGE(TAG, "Control socket failed: %s", strerror(errno));
+            if (_control_sock >= 0) {
+                close(_control_sock);
+                _control_sock = -1;
+            }
+            _control_failed = true;
+            return false;
+        }
+        if (listen) {
+            ESP_LOGI(TAG, "Node control on udp://127.0.0.1:%d", ntohs(addr.sin_port));
+        }
+        return true;
+    }
+
+    static struct sockaddr_in control_addr()
+    {
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(env_int("MCHACKS_CONTROL_PORT", IMU_CONTROL_PORT));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        return addr;
+    }
+
+public:
+    esp_err_t start() override
+    {
+        _sock = socket(AF_INET, SOCK_DGRAM, 0);
+        if (_sock < 0) {
+            ESP_LOGE(TAG, "socket() failed: %s", strerror(errno));
+            return ESP_FAIL;
+        }
+        int on = 1;
+        setsockopt(_sock, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+        setsockopt(_sock, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on));
+        _addr.sin_family = AF_INET;
+        _addr.sin_port = htons(env_int("MCHACKS_LOOPBACK_PORT", HAL_LOOPBACK_PORT));
+        _addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        return ESP_OK;
+    }
+
+    esp_err_t send_sample(const IMU_DATA &sample) override
+    {
+        ssize_t sent = sendto(_sock, &sample, sizeof(sample), MSG_DONTWAIT,
+                              (struct sockaddr *)&_addr, sizeof(_addr));
+        return sent == (ssize_t)sizeof(sample) ? ESP_OK : ESP_FAIL;
+    }
+
+    esp_err_t send_samples(const IMU_DATA *samples, size_t count) override
+    {
+        if (count == 0 || count > IMU_BATCH_MAX) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        ssize_t sent = sendto(_sock, samples, count * sizeof(IMU_DATA), MSG_DONTWAIT,
+                              (struct sockaddr *)&_addr, sizeof(_addr));
+        return sent == (ssize_t)(count * sizeof(IMU_DATA)) ? ESP_OK : ESP_FAIL;
+    }
+
+    // Loopback never drops; MCHACKS_LINK_DOWN names a file whose presence
+    // stands in for an outage, to exercise a node's backlog
+    bool link_up() const override
+    {
+        const char *flag = getenv("MCHACKS_LINK_DOWN");
+        return flag == NULL || access(flag, F_OK) != 0;
+    }
+
+    bool latest_sample(int device, IMU_DATA *out) override
+    {
+        if (_sock < 0) {
+            return false;
+        }
+        if (!_bound) {
+            if (bind(_sock, (struct sockaddr *)&_addr, sizeof(_addr)) != 0) {
+                ESP_LOGE(TAG, "bind() failed: %s", strerror(errno));
+                close(_sock);
+                _sock = -1;
+                return false;
+            }
+            _bound = true;
+        }
+        drain();
+        if (device < 0 || device >= HAL_MAX_IMU_DEVICES || !_have[device]) {
+            return false;
+        }
+        *out = _latest[device];
+        return true;
+    }
+
+    uint32_t received(int device) const override
+    {
+        return device >= 0 && device < HAL_MAX_IMU_DEVICES ? _received[device] : 0;
+    }
+
+    uint32_t lost() const override
+    {
+        return _lost;
+    }
+
+    int64_t arrival_us(int device) const override
+    {
+        return device >= 0 && device < HAL_MAX_IMU_DEVICES ? _arrival_us[device] : 0;
+    }
+
+    // Bound on first use, like the sample socket, so only the side that
+    // listens takes the port
+    bool receive_audio(uint8_t *buf, size_t max, size_t *len, int64_t *arrival_us) override
+    {
+        if (_audio_sock < 0) {
+            if (_audio_failed) {
+                return false;
+            }
+            _audio_sock = socket(AF_INET, SOCK_DGRAM, 0);
+            struct sockaddr_in addr = {};
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(env_int("MCHACKS_NET_AUDIO_PORT", NET_AUDIO_PORT));
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            int on = 1;
+            if (_audio_sock < 0 ||
+                setsockopt(_audio_sock, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) != 0 ||
+                bind(_audio_sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+                ESP_LOGE(TAG, "Network audio socket failed: %s", strerror(errno));
+                if (_audio_sock >= 0) {
+                    close(_audio_sock);
+                    _audio_sock = -1;
+                }
+                _audio_failed = true;
+                return false;
+            }
+            ESP_LOGI(TAG, "Network audio on udp://127.0.0.1:%d", ntohs(addr.sin_port));
+        }
+
+        char control[CMSG_SPACE(sizeof(struct timespec))];
+        struct iovec iov = {buf, max};
+        struct msghdr msg = {};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        ssize_t n = recvmsg(_audio_sock, &msg, MSG_DONTWAIT);
+        if (n < 0) {
+            return false;
+        }
+        *len = (size_t)n;
+        *arrival_us = arrival_from_msg(&msg, esp_timer_get_time(), realtime_now_us());
+        return true;
+    }
+
+    esp_err_t send_control(const net_peer_t *to, const void *buf, size_t len) override
+    {
+        if (!open_control(false)) {
+            return ESP_FAIL;
+        }
+        struct sockaddr_in addr = control_addr();
+        if (to != NULL) {
+            addr.sin_addr.s_addr = to->addr;
+            addr.sin_port = to->port;
+        }
+        ssize_t sent = sendto(_control_sock, buf, len, MSG_DONTWAIT, (struct sockaddr *)&addr, sizeof(addr));
+        return sent == (ssize_t)len ? ESP_OK : ESP_FAIL;
+    }
+
+    bool receive_control(void *buf, size_t max, size_t *len, net_peer_t *from) override
+    {
+        if (!open_control(true)) {
+            return false;
+        }
+        struct sockaddr_in addr = {};
+        socklen_t addr_len = sizeof(addr);
+        ssize_t n = recvfrom(_control_sock, buf, max, MSG_DONTWAIT, (struct sockaddr *)&addr, &addr_len);
+        if (n < 0) {
+            return false;
+        }
+        *len = (size_t)n;
+        from->addr = addr.sin_addr.s_addr;
+        from->port = addr.sin_port;
+        return true;
+    }
+};
+
+AudioSink *hal_audio_sink()
+{
+    static WavFileSink sink;
+    return &sink;
+}
+
+BlockStorage *hal_storage()
+{
+    static DirectoryStorage storage;
+    return &storage;
+}
+
+DisplayPanel *hal_display()
+{
+    static PpmPanel panel;
+    return &panel;
+}
+
+ImuSource *hal_imu_source()
+{
+    static SyntheticImuSource source;
+    return &source;
+}
+
+NetTransport *hal_net()
+{
+    static LoopbackTransport transport;
+    return &transport;
+}
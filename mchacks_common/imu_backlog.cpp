@@ -0,0 +1,99 @@
+#include <string.h>
+#include "imu_backlog.h"
+
+void ImuBacklog::init()
+{
+    _head = 0;
+    _count = 0;
+    _lost = 0;
+    _uploaded = 0;
+    _resends = 0;
+    _seq = 0;
+    _next_us = 0;
+    _flight = 0;
+    _sent = false;
+    _sent_us = 0;
+}
+
+void ImuBacklog::push(const IMU_DATA *sample, int64_t time_us)
+{
+    if (_count == IMU_BACKLOG_CAPACITY) {
+        // Full: the oldest goes, so what is kept runs right up to the reconnect.
+        // One already out awaiting its ACK has reached the link at least.
+        _head = (_head + 1) % IMU_BACKLOG_CAPACITY;
+        _count--;
+        if (_sent && _flight > 0) {
+            _flight--;
+        } else {
+            _lost++;
+        }
+    }
+    entry_t *e = &_ring[(_head + _count) % IMU_BACKLOG_CAPACITY];
+    e->time_us = time_us;
+    e->accel[0] = sample->accel_x;
+    e->accel[1] = sample->accel_y;
+    e->accel[2] = sample->accel_z;
+    e->gyro[0] = sample->gyro_x;
+    e->gyro[1] = sample->gyro_y;
+    e->gyro[2] = sample->gyro_z;
+    _count++;
+}
+
+const imu_backlog_msg_t *ImuBacklog::next(int64_t now_us, uint8_t device, size_t *len)
+{
+    if (_sent) {
+        if (now_us - _sent_us < IMU_BACKLOG_ACK_TIMEOUT_US) {
+            return NULL;
+        }
+        // No ACK: the same message again, records and seq unchanged
+        _resends++;
+        *len = IMU_BACKLOG_HEADER_SIZE + _msg.count * sizeof(imu_backlog_record_t);
+        return &_msg;
+    }
+    if (_count == 0 || now_us < _next_us) {
+        return NULL;
+    }
+    size_t n = _count < IMU_BACKLOG_BATCH ? _count : IMU_BACKLOG_BATCH;
+    const entry_t *first = &_ring[_head];
+    memset(&_msg, 0, IMU_BACKLOG_HEADER_SIZE);
+    _msg.magic = IMU_CONTROL_MAGIC;
+    _msg.version = IMU_CONTROL_VERSION;
+    _msg.type = IMU_CONTROL_BACKLOG;
+    _msg.device = device;
+    _msg.count = (uint8_t)n;
+    _msg.seq = _seq;
+    _msg.base_us = first->time_us;
+    _msg.lost = _lost;
+    _msg.remaining = (uint32_t)(_count - n);
+    for (size_t i = 0; i < n; i++) {
+        const entry_t *e = &_ring[(_head + i) % IMU_BACKLOG_CAPACITY];
+        imu_backlog_record_t *r = &_msg.records[i];
+        r->offset_us = (uint32_t)(e->time_us - first->time_us);
+        memcpy(r->accel, e->accel, sizeof(r->accel));
+        memcpy(r->gyro, e->gyro, sizeof(r->gyro));
+    }
+    _flight = n;
+    *len = IMU_BACKLOG_HEADER_SIZE + n * sizeof(imu_backlog_record_t);
+    return &_msg;
+}
+
+void ImuBacklog::sent(int64_t now_us)
+{
+    _sent = true;
+    _sent_us = now_us;
+}
+
+bool ImuBacklog::ack(uint16_t seq, int64_t now_us)
+{
+    if (!_sent || seq != _msg.seq) {
+        return false;
+    }
+    _head = (_head + _flight) % IMU_BACKLOG_CAPACITY;
+    _count -= _flight;
+    _uploaded += _msg.count;
+    _flight = 0;
+    _sent = false;
+    _seq++;
+    _next_us = now_us + IMU_BACKLOG_INTERVAL_US;
+    return true;
+}
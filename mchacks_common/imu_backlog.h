@@ -0,0 +1,98 @@
+#ifndef MCHACKS_IMU_BACKLOG_H
+#define MCHACKS_IMU_BACKLOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "hal.h"
+#include "imu_control.h"
+
+/*
+ * IMU node backlog
+ * ----------------
+ * While a node's link is down, the samples it would have sent go into a
+ * ring of IMU_BACKLOG_CAPACITY timestamped records instead of being lost:
+ * IMU_BACKLOG_SECONDS at IMU_DEFAULT_RATE_HZ, less at higher rates. An
+ * outage longer than that keeps its latest samples and counts the oldest
+ * as lost.
+ *
+ * Once the link is back, the backlog goes up over the control socket as
+ * BACKLOG messages (see imu_control.h) of up to IMU_BACKLOG_BATCH records,
+ * one every IMU_BACKLOG_INTERVAL_US at most. Live samples keep going out
+ * first and at their own rate; the backlog takes what is left, about
+ * IMU_BACKLOG_BATCH * 1000000 / IMU_BACKLOG_INTERVAL_US samples a second,
+ * so 8 s of backlog is caught up in well under a second without bursting.
+ *
+ * One message is out at a time. Its records stay in the ring until the main
+ * board acknowledges its seq, and it goes again, unchanged, every
+ * IMU_BACKLOG_ACK_TIMEOUT_US until then, so a lost datagram costs a resend
+ * rather than samples. The main board acknowledges repeats too and keeps
+ * only the first.
+ *
+ * Records carry the node's own timestamps, so the main board can put them
+ * where they belong in time rather than treating them as the latest
+ * sample. Like imu_control.h, nothing here does I/O or reads a clock.
+ */
+
+#define IMU_BACKLOG_SECONDS 8
+#define IMU_BACKLOG_CAPACITY (IMU_BACKLOG_SECONDS * IMU_DEFAULT_RATE_HZ)
+#define IMU_BACKLOG_INTERVAL_US 50000
+#define IMU_BACKLOG_ACK_TIMEOUT_US 200000
+
+class ImuBacklog {
+    typedef struct {
+        int64_t time_us;
+        int16_t accel[3];
+        int16_t gyro[3];
+    } entry_t;
+
+    entry_t _ring[IMU_BACKLOG_CAPACITY];
+    size_t _head = 0;                   // oldest
+    size_t _count = 0;
+    uint32_t _lost = 0;
+    uint32_t _uploaded = 0;
+    uint32_t _resends = 0;
+    uint16_t _seq = 0;
+    int64_t _next_us = 0;               // no message before this
+    size_t _flight = 0;                 // records of _msg, at the head, awaiting the ACK
+    bool _sent = false;                 // _msg is out
+    int64_t _sent_us = 0;
+    imu_backlog_msg_t _msg;
+
+public:
+    void init();
+
+    /**
+     * @brief Keep a sample that couldn't go out; drops the oldest when full
+     */
+    void push(const IMU_DATA *sample, int64_t time_us);
+
+    /**
+     * @brief The BACKLOG message to send now, if any: the one awaiting its
+     *        ACK once IMU_BACKLOG_ACK_TIMEOUT_US has passed, otherwise a new
+     *        one once the interval has
+     *
+     * @return The message, with *len its size on the wire; NULL if there is
+     *         nothing to send yet
+     */
+    const imu_backlog_msg_t *next(int64_t now_us, uint8_t device, size_t *len);
+
+    /**
+     * @brief The message from next() went out; its records are kept until
+     *        ack()
+     */
+    void sent(int64_t now_us);
+
+    /**
+     * @brief The main board has the message numbered seq: drop its records
+     *
+     * @return false if that isn't the message awaiting an ACK
+     */
+    bool ack(uint16_t seq, int64_t now_us);
+
+    size_t count() const { return _count; }
+    uint32_t lost() const { return _lost; }
+    uint32_t uploaded() const { return _uploaded; }
+    uint32_t resends() const { return _resends; }
+};
+
+#endif // MCHACKS_IMU_BACKLOG_H
@@ -0,0 +1,341 @@
+#include <string.h>
+#include "imu_control.h"
+
+void imu_settings_default(imu_settings_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    out->rate_hz = IMU_DEFAULT_RATE_HZ;
+    out->batch = 1;
+    out->accel_range = IMU_ACCEL_2G;
+    out->gyro_range = IMU_GYRO_250DPS;
+    out->dead_band = 0;
+    out->uplink = IMU_UPLINK_SAMPLES;
+}
+
+bool imu_settings_clamp(const imu_settings_t *wanted, uint16_t max_rate_hz, imu_settings_t *out)
+{
+    imu_settings_t s = *wanted;
+    if (max_rate_hz > IMU_RATE_MAX_HZ) {
+        max_rate_hz = IMU_RATE_MAX_HZ;
+    }
+    if (s.rate_hz < IMU_RATE_MIN_HZ) {
+        s.rate_hz = IMU_RATE_MIN_HZ;
+    } else if (s.rate_hz > max_rate_hz) {
+        s.rate_hz = max_rate_hz;
+    }
+    if (s.batch < 1) {
+        s.batch = 1;
+    } else if (s.batch > IMU_BATCH_MAX) {
+        s.batch = IMU_BATCH_MAX;
+    }
+    if (s.accel_range > IMU_ACCEL_16G) {
+        s.accel_range = IMU_ACCEL_16G;
+    }
+    if (s.gyro_range > IMU_GYRO_2000DPS) {
+        s.gyro_range = IMU_GYRO_2000DPS;
+    }
+    if (s.uplink > IMU_UPLINK_BOTH) {
+        s.uplink = IMU_UPLINK_SAMPLES;
+    }
+    bool changed = !imu_settings_equal(&s, wanted);
+    *out = s;
+    return changed;
+}
+
+bool imu_settings_equal(const imu_settings_t *a, const imu_settings_t *b)
+{
+    return a->rate_hz == b->rate_hz && a->batch == b->batch && a->accel_range == b->accel_range &&
+           a->gyro_range == b->gyro_range && a->dead_band == b->dead_band && a->uplink == b->uplink;
+}
+
+uint32_t imu_settings_period_us(const imu_settings_t *s)
+{
+    return 1000000 / (s->rate_hz != 0 ? s->rate_hz : IMU_DEFAULT_RATE_HZ);
+}
+
+// Each range step doubles full scale, so a count is worth twice as much
+static int16_t scale_up(int16_t v, uint8_t shift)
+{
+    int32_t x = (int32_t)v << shift;
+    if (x > INT16_MAX) {
+        return INT16_MAX;
+    }
+    if (x < INT16_MIN) {
+        return INT16_MIN;
+    }
+    return (int16_t)x;
+}
+
+void imu_settings_normalize(const imu_settings_t *s, IMU_DATA *sample)
+{
+    if (s->accel_range != IMU_ACCEL_2G) {
+        sample->accel_x = scale_up(sample->accel_x, s->accel_range);
+        sample->accel_y = scale_up(sample->accel_y, s->accel_range);
+        sample->accel_z = scale_up(sample->accel_z, s->accel_range);
+    }
+    if (s->gyro_range != IMU_GYRO_250DPS) {
+        sample->gyro_x = scale_up(sample->gyro_x, s->gyro_range);
+        sample->gyro_y = scale_up(sample->gyro_y, s->gyro_range);
+        sample->gyro_z = scale_up(sample->gyro_z, s->gyro_range);
+    }
+}
+
+static bool axis_moved(int16_t a, int16_t b, uint16_t dead_band)
+{
+    int32_t d = (int32_t)a - b;
+    return (d < 0 ? -d : d) > dead_band;
+}
+
+bool imu_dead_band_exceeded(const IMU_DATA *sample, const IMU_DATA *sent, uint16_t dead_band)
+{
+    return axis_moved(sample->accel_x, sent->accel_x, dead_band) ||
+           axis_moved(sample->accel_y, sent->accel_y, dead_band) ||
+           axis_moved(sample->accel_z, sent->accel_z, dead_band) ||
+           axis_moved(sample->gyro_x, sent->gyro_x, dead_band) ||
+           axis_moved(sample->gyro_y, sent->gyro_y, dead_band) ||
+           axis_moved(sample->gyro_z, sent->gyro_z, dead_band);
+}
+
+void imu_control_make(imu_control_msg_t *msg, imu_control_type_t type, uint8_t device, uint16_t seq,
+                      const imu_settings_t *settings)
+{
+    memset(msg, 0, sizeof(*msg));
+    msg->magic = IMU_CONTROL_MAGIC;
+    msg->version = IMU_CONTROL_VERSION;
+    msg->type = (uint8_t)type;
+    msg->device = device;
+    msg->seq = seq;
+    msg->settings = *settings;
+}
+
+bool imu_control_parse(const void *buf, size_t len, imu_control_msg_t *out)
+{
+    if (len != sizeof(imu_control_msg_t)) {
+        return false;
+    }
+    memcpy(out, buf, sizeof(*out));
+    return out->magic == IMU_CONTROL_MAGIC && out->version == IMU_CONTROL_VERSION &&
+           (out->type <= IMU_CONTROL_ACK || out->type == IMU_CONTROL_BACKLOG_ACK) &&
+           out->device < HAL_MAX_IMU_DEVICES;
+}
+
+void imu_event_make(imu_event_msg_t *msg, uint8_t device, uint16_t seq, const imu_event_t *event)
+{
+    memset(msg, 0, sizeof(*msg));
+    msg->magic = IMU_CONTROL_MAGIC;
+    msg->version = IMU_CONTROL_VERSION;
+    msg->type = IMU_CONTROL_EVENT;
+    msg->device = device;
+    msg->kind = event->kind;
+    msg->seq = seq;
+    msg->time_ms = (uint32_t)(event->time_us / 1000);
+    msg->strength = event->strength;
+}
+
+bool imu_event_parse(const void *buf, size_t len, imu_event_msg_t *out)
+{
+    if (len != sizeof(imu_event_msg_t)) {
+        return false;
+    }
+    memcpy(out, buf, sizeof(*out));
+    return out->magic == IMU_CONTROL_MAGIC && out->version == IMU_CONTROL_VERSION &&
+           out->type == IMU_CONTROL_EVENT && out->device < HAL_MAX_IMU_DEVICES &&
+           out->kind > IMU_EVENT_NONE && out->kind <= IMU_EVENT_STILL;
+}
+
+bool imu_backlog_parse(const void *buf, size_t len, imu_backlog_msg_t *out)
+{
+    if (len < IMU_BACKLOG_HEADER_SIZE || len > sizeof(imu_backlog_msg_t)) {
+        return false;
+    }
+    memcpy(out, buf, len);
+    return out->magic == IMU_CONTROL_MAGIC && out->version == IMU_CONTROL_VERSION &&
+           out->type == IMU_CONTROL_BACKLOG && out->device < HAL_MAX_IMU_DEVICES &&
+           out->count > 0 && out->count <= IMU_BACKLOG_BATCH &&
+           len == IMU_BACKLOG_HEADER_SIZE + out->count * sizeof(imu_backlog_record_t);
+}
+
+// Messages missing between the latest seq seen and this one. A node that
+// restarted numbers from 0 again; that isn't counted.
+static uint16_t seq_gap(uint16_t latest, uint16_t seq)
+{
+    uint16_t gap = (uint16_t)(seq - latest - 1);
+    return gap < 0x8000 && seq != 0 ? gap : 0;
+}
+
+void ImuControlNode::init(uint8_t device, uint16_t max_rate_hz)
+{
+    _device = device;
+    _max_rate_hz = max_rate_hz;
+    imu_settings_default(&_settings);
+    _have_seq = false;
+    _seq = 0;
+    _flags = 0;
+}
+
+bool ImuControlNode::handle(const void *buf, size_t len, ImuSource *imu, imu_control_msg_t *reply)
+{
+    imu_control_msg_t msg;
+    if (!imu_control_parse(buf, len, &msg) || msg.type != IMU_CONTROL_SET || msg.device != _device) {
+        return false;
+    }
+
+    // A resend of the SET already applied: its ACK was lost, say it again
+    if (!_have_seq || msg.seq != _seq) {
+        imu_settings_t next;
+        bool adjusted = imu_settings_clamp(&msg.settings, _max_rate_hz, &next);
+        if (next.accel_range != _settings.accel_range || next.gyro_range != _settings.gyro_range) {
+            if (imu->set_range(next.accel_range, next.gyro_range) != ESP_OK) {
+                next.accel_range = _settings.accel_range;
+                next.gyro_range = _settings.gyro_range;
+                adjusted = true;
+            }
+        }
+        _settings = next;
+        _seq = msg.seq;
+        _have_seq = true;
+        _flags = adjusted ? IMU_CONTROL_ADJUSTED : 0;
+    }
+    imu_control_make(reply, IMU_CONTROL_ACK, _device, _seq, &_settings);
+    reply->flags = _flags;
+    return true;
+}
+
+void ImuControlNode::hello(imu_control_msg_t *out) const
+{
+    imu_control_make(out, IMU_CONTROL_HELLO, _device, _seq, &_settings);
+}
+
+void ImuControlHub::init()
+{
+    memset(_nodes, 0, sizeof(_nodes));
+}
+
+bool ImuControlHub::handle(const void *buf, size_t len, const net_peer_t *from, int64_t now_us)
+{
+    imu_control_msg_t msg;
+    if (!imu_control_parse(buf, len, &msg) || msg.type == IMU_CONTROL_SET ||
+        msg.type == IMU_CONTROL_BACKLOG_ACK) {
+        return false;
+    }
+    imu_node_state_t *n = &_nodes[msg.device];
+    bool seen = n->seen;
+    n->seen = true;
+    n->peer = *from;
+    n->heard_us = now_us;
+
+    if (msg.type == IMU_CONTROL_ACK) {
+        if (n->pending && msg.seq == n->seq) {
+            n->pending = false;
+            n->adjusted = (msg.flags & IMU_CONTROL_ADJUSTED) != 0;
+            n->effective = msg.settings;
+            n->acks++;
+        }
+        return true;
+    }
+
+    // HELLO. Settings changing with no SET out means the node started over
+    // (a reboot brings back the defaults): send it ours again.
+    bool changed = seen && !imu_settings_equal(&n->effective, &msg.settings);
+    n->effective = msg.settings;
+    if (changed && n->has_wanted && !n->pending) {
+        n->seq++;
+        n->pending = true;
+        n->failed = false;
+        n->tries = 0;
+    }
+    return true;
+}
+
+bool ImuControlHub::handle_event(const void *buf, size_t len, const net_peer_t *from, int64_t now_us,
+                                 imu_event_msg_t *out)
+{
+    if (!imu_event_parse(buf, len, out)) {
+        return false;
+    }
+    imu_node_state_t *n = &_nodes[out->device];
+    n->seen = true;
+    n->peer = *from;
+    n->heard_us = now_us;
+    if (n->events != 0) {
+        n->events_lost += seq_gap(n->event_seq, out->seq);
+    }
+    n->event_seq = out->seq;
+    n->events++;
+    return true;
+}
+
+bool ImuControlHub::handle_backlog(const void *buf, size_t len, const net_peer_t *from, int64_t now_us,
+                                   imu_backlog_msg_t *out, bool *fresh, imu_control_msg_t *ack)
+{
+    if (!imu_backlog_parse(buf, len, out)) {
+        return false;
+    }
+    imu_node_state_t *n = &_nodes[out->device];
+    n->seen = true;
+    n->peer = *from;
+    n->heard_us = now_us;
+
+    imu_settings_t none = {};
+    imu_control_make(ack, IMU_CONTROL_BACKLOG_ACK, out->device, out->seq, &none);
+    // A node sends its next message only once this one is acknowledged, so
+    // only the latest can come again
+    *fresh = n->backlog_msgs == 0 || out->seq != n->backlog_seq;
+    if (!*fresh) {
+        n->backlog_repeats++;
+        return true;
+    }
+    if (n->backlog_msgs != 0) {
+        n->backlog_msgs_lost += seq_gap(n->backlog_seq, out->seq);
+    }
+    n->backlog_seq = out->seq;
+    n->backlog_msgs++;
+    n->backlog_samples += out->count;
+    n->backlog_dropped = out->lost;
+    n->backlog_remaining = out->remaining;
+    n->backlog_until_us = out->base_us + out->records[out->count - 1].offset_us;
+    return true;
+}
+
+esp_err_t ImuControlHub::set(uint8_t device, const imu_settings_t *wanted)
+{
+    if (device >= HAL_MAX_IMU_DEVICES) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    imu_node_state_t *n = &_nodes[device];
+    n->wanted = *wanted;
+    n->has_wanted = true;
+    n->seq++;
+    n->pending = true;
+    n->failed = false;
+    n->tries = 0;
+    return ESP_OK;
+}
+
+size_t ImuControlHub::poll(int64_t now_us, imu_control_msg_t *out, net_peer_t *to, size_t max)
+{
+    size_t count = 0;
+    for (uint8_t d = 0; d < HAL_MAX_IMU_DEVICES && count < max; d++) {
+        imu_node_state_t *n = &_nodes[d];
+        if (!n->pending || !n->seen) {
+            continue;
+        }
+        if (n->tries > 0 && now_us - n->sent_us < IMU_CONTROL_RETRY_US) {
+            continue;
+        }
+        if (n->tries >= IMU_CONTROL_TRIES) {
+            n->pending = false;
+            n->failed = true;
+            continue;
+        }
+        if (n->tries > 0) {
+            n->resends++;
+        }
+        n->tries++;
+        n->sent_us = now_us;
+        imu_control_make(&out[count], IMU_CONTROL_SET, d, n->seq, &n->wanted);
+        to[count] = n->peer;
+        count++;
+    }
+    return count;
+}
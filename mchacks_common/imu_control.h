@@ -0,0 +1,308 @@
+#ifndef MCHACKS_IMU_CONTROL_H
+#define MCHACKS_IMU_CONTROL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "hal.h"
+#include "imu_features.h"
+
+/*
+ * IMU node control
+ * ----------------
+ * The main board tunes each node over the same link the samples take, as
+ * small UDP datagrams on IMU_CONTROL_PORT:
+ *
+ *   HELLO  node -> main   every IMU_CONTROL_HELLO_US, with the settings in
+ *                         effect; tells the main board where the node is
+ *   SET    main -> node   the settings the main board wants
+ *   ACK    node -> main   answer to a SET, with the settings now in effect
+ *   EVENT  node -> main   a tap, swing or still the node saw (see
+ *                         imu_features.h), numbered so losses show
+ *   BACKLOG node -> main  samples held through a link outage, with their
+ *                         timestamps (see imu_backlog.h)
+ *   BACKLOG_ACK main -> node  a BACKLOG message arrived, by its seq; the
+ *                         node only lets go of the samples once it has this
+ *
+ * Settings are the sample rate, how many samples go out per uplink message,
+ * a dead band below which a sample that barely moved isn't sent at all, the
+ * sensor's full-scale ranges, and what goes up: raw samples, only events,
+ * or both. A node in events mode sends a few datagrams a minute instead of
+ * IMU_DEFAULT_RATE_HZ a second; setting it back to samples is how the main
+ * board asks for raw data again. A node takes what it can and clamps the
+ * rest (a rate its tick can't pace, a range the sensor won't take), then
+ * acknowledges with what it actually did, so the main board always knows
+ * the settings behind the samples it is getting.
+ *
+ * UDP may lose either half: ImuControlHub resends a SET every
+ * IMU_CONTROL_RETRY_US until it is acknowledged or IMU_CONTROL_TRIES run
+ * out, and ImuControlNode answers a repeated SET with the same ACK without
+ * applying it twice. A node that reboots comes back with the defaults; the
+ * hub sees that in its HELLO and sends the SET again.
+ *
+ * Neither class does any I/O or keeps time of its own, so both run the same
+ * under the host build.
+ */
+
+#define IMU_CONTROL_PORT 47120
+#define IMU_CONTROL_MAGIC 0x4349        // "IC" on the wire
+#define IMU_CONTROL_VERSION 1
+
+#define IMU_RATE_MIN_HZ 1
+#define IMU_RATE_MAX_HZ 200
+#define IMU_DEFAULT_RATE_HZ 50          // the 20 ms the nodes always ran at
+#define IMU_BATCH_MAX 8                 // samples per uplink message
+#define IMU_KEEPALIVE_US 1000000        // with a dead band, a sample still goes out this often
+#define IMU_CONTROL_HELLO_US 1000000
+#define IMU_CONTROL_RETRY_US 200000
+#define IMU_CONTROL_TRIES 10
+#define IMU_BACKLOG_BATCH 32            // records per BACKLOG message, 536 bytes
+
+// MPU-6050 AFS_SEL, +/-2g to +/-16g
+typedef enum {
+    IMU_ACCEL_2G,
+    IMU_ACCEL_4G,
+    IMU_ACCEL_8G,
+    IMU_ACCEL_16G,
+} imu_accel_range_t;
+
+// MPU-6050 FS_SEL, +/-250 to +/-2000 degrees/s
+typedef enum {
+    IMU_GYRO_250DPS,
+    IMU_GYRO_500DPS,
+    IMU_GYRO_1000DPS,
+    IMU_GYRO_2000DPS,
+} imu_gyro_range_t;
+
+typedef enum {
+    IMU_UPLINK_SAMPLES,                 // raw samples, as always
+    IMU_UPLINK_EVENTS,                  // only EVENT messages
+    IMU_UPLINK_BOTH,
+} imu_uplink_t;
+
+typedef enum {
+    IMU_CONTROL_HELLO,
+    IMU_CONTROL_SET,
+    IMU_CONTROL_ACK,
+    IMU_CONTROL_EVENT,
+    IMU_CONTROL_BACKLOG,
+    IMU_CONTROL_BACKLOG_ACK,            // an imu_control_msg_t, settings unused
+} imu_control_type_t;
+
+#define IMU_CONTROL_ADJUSTED 0x01       // ACK: not everything asked for could be done
+
+typedef struct __attribute__((packed)) {
+    uint16_t rate_hz;
+    uint8_t batch;                      // 1 sends every sample on its own
+    uint8_t accel_range;                // imu_accel_range_t
+    uint8_t gyro_range;                 // imu_gyro_range_t
+    uint8_t uplink;                     // imu_uplink_t
+    uint16_t dead_band;                 // raw counts at the node's range; 0 sends every sample
+} imu_settings_t;
+
+// Datagram; both ends are little-endian
+typedef struct __attribute__((packed)) {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t type;                       // imu_control_type_t
+    uint8_t device;
+    uint8_t flags;                      // IMU_CONTROL_ADJUSTED
+    uint16_t seq;                       // SET: +1 per new request; ACK: the SET's;
+                                        // BACKLOG_ACK: the BACKLOG's
+    imu_settings_t settings;            // SET: wanted; HELLO and ACK: in effect
+} imu_control_msg_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t type;                       // IMU_CONTROL_EVENT
+    uint8_t device;
+    uint8_t kind;                       // imu_event_kind_t
+    uint16_t seq;                       // +1 per event
+    uint32_t time_ms;                   // node's clock
+    uint16_t strength;
+    uint16_t reserved;
+} imu_event_msg_t;
+
+// One backlogged sample
+typedef struct __attribute__((packed)) {
+    uint32_t offset_us;                 // after the message's base_us
+    int16_t accel[3];
+    int16_t gyro[3];
+} imu_backlog_record_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t type;                       // IMU_CONTROL_BACKLOG
+    uint8_t device;
+    uint8_t count;                      // records that follow
+    uint16_t seq;                       // +1 per message
+    int64_t base_us;                    // node's clock, the oldest record's time
+    uint32_t lost;                      // samples the ring had to drop, since boot
+    uint32_t remaining;                 // still queued after this message
+    imu_backlog_record_t records[IMU_BACKLOG_BATCH];
+} imu_backlog_msg_t;
+
+#define IMU_BACKLOG_HEADER_SIZE offsetof(imu_backlog_msg_t, records)
+
+/**
+ * @brief Settings a node starts with: IMU_DEFAULT_RATE_HZ, every sample on
+ *        its own, no dead band, the sensor's power-on ranges
+ */
+void imu_settings_default(imu_settings_t *out);
+
+/**
+ * @brief Clamp wanted into what a node can do, max_rate_hz being the
+ *        fastest it can pace
+ *
+ * @return true if anything had to change
+ */
+bool imu_settings_clamp(const imu_settings_t *wanted, uint16_t max_rate_hz, imu_settings_t *out);
+
+bool imu_settings_equal(const imu_settings_t *a, const imu_settings_t *b);
+
+uint32_t imu_settings_period_us(const imu_settings_t *s);
+
+/**
+ * @brief Rescale a sample taken at s's ranges to the power-on ranges, so
+ *        one count means the same whatever a node runs at; saturates
+ */
+void imu_settings_normalize(const imu_settings_t *s, IMU_DATA *sample);
+
+/**
+ * @brief true if any axis of sample is more than dead_band away from sent
+ */
+bool imu_dead_band_exceeded(const IMU_DATA *sample, const IMU_DATA *sent, uint16_t dead_band);
+
+void imu_control_make(imu_control_msg_t *msg, imu_control_type_t type, uint8_t device, uint16_t seq,
+                      const imu_settings_t *settings);
+
+/**
+ * @brief Check a received datagram and copy it out
+ *
+ * @return false if it isn't a control message of this version
+ */
+bool imu_control_parse(const void *buf, size_t len, imu_control_msg_t *out);
+
+void imu_event_make(imu_event_msg_t *msg, uint8_t device, uint16_t seq, const imu_event_t *event);
+
+/**
+ * @brief Like imu_control_parse(), for EVENT messages
+ */
+bool imu_event_parse(const void *buf, size_t len, imu_event_msg_t *out);
+
+/**
+ * @brief Like imu_control_parse(), for BACKLOG messages, whose length goes
+ *        by their count
+ */
+bool imu_backlog_parse(const void *buf, size_t len, imu_backlog_msg_t *out);
+
+class ImuControlNode {
+    uint8_t _device = 0;
+    uint16_t _max_rate_hz = IMU_RATE_MAX_HZ;
+    imu_settings_t _settings = {};
+    bool _have_seq = false;
+    uint16_t _seq = 0;                  // latest SET applied
+    uint8_t _flags = 0;                 // of its ACK
+
+public:
+    /**
+     * @brief Start from the defaults
+     *
+     * @param max_rate_hz Fastest rate the node's loop can pace
+     */
+    void init(uint8_t device, uint16_t max_rate_hz);
+
+    /**
+     * @brief Take one datagram from the main board; SETs for this device are
+     *        clamped, their ranges applied to imu, and answered
+     *
+     * @return true if reply must be sent back
+     */
+    bool handle(const void *buf, size_t len, ImuSource *imu, imu_control_msg_t *reply);
+
+    void hello(imu_control_msg_t *out) const;
+
+    const imu_settings_t &settings() const { return _settings; }
+    uint8_t device() const { return _device; }
+};
+
+typedef struct {
+    bool seen;                          // a HELLO or ACK has come in
+    bool pending;                       // a SET is out and not yet acknowledged
+    bool adjusted;                      // the latest ACK said the node clamped something
+    bool failed;                        // the latest SET ran out of tries
+    net_peer_t peer;                    // where the node's messages come from
+    int64_t heard_us;                   // latest message from the node
+    imu_settings_t effective;           // as the node last reported
+    imu_settings_t wanted;              // latest SET; valid once has_wanted
+    bool has_wanted;
+    uint16_t seq;                       // of the latest SET
+    uint8_t tries;
+    int64_t sent_us;
+    uint32_t acks;
+    uint32_t resends;
+    uint32_t events;
+    uint32_t events_lost;               // by gaps in their numbering
+    uint16_t event_seq;                 // latest; valid once events != 0
+    uint32_t backlog_samples;           // held through outages, received since
+    uint32_t backlog_msgs;
+    uint32_t backlog_msgs_lost;         // by gaps in their numbering
+    uint32_t backlog_repeats;           // resent by the node, their ACK lost
+    uint32_t backlog_dropped;           // the node's own count of samples its ring lost
+    uint32_t backlog_remaining;         // still queued on the node
+    int64_t backlog_until_us;           // node time of the newest sample caught up
+    uint16_t backlog_seq;               // latest; valid once backlog_msgs != 0
+} imu_node_state_t;
+
+class ImuControlHub {
+    imu_node_state_t _nodes[HAL_MAX_IMU_DEVICES] = {};
+
+public:
+    void init();
+
+    /**
+     * @brief Take one datagram from a node
+     *
+     * @return false if it was malformed or from an unknown device
+     */
+    bool handle(const void *buf, size_t len, const net_peer_t *from, int64_t now_us);
+
+    /**
+     * @brief Take one EVENT datagram from a node
+     *
+     * @return true with out filled if it was one
+     */
+    bool handle_event(const void *buf, size_t len, const net_peer_t *from, int64_t now_us,
+                      imu_event_msg_t *out);
+
+    /**
+     * @brief Take one BACKLOG datagram from a node
+     *
+     * Every one is acknowledged, repeats too: a node resends a message until
+     * its ACK gets through, so a repeat means the ACK was lost.
+     *
+     * @param fresh Set if out is new rather than a repeat of the latest
+     * @return true if it was one, with ack to go back to from
+     */
+    bool handle_backlog(const void *buf, size_t len, const net_peer_t *from, int64_t now_us,
+                        imu_backlog_msg_t *out, bool *fresh, imu_control_msg_t *ack);
+
+    /**
+     * @brief Ask for new settings; sent by the next poll() once the node has
+     *        been heard from
+     */
+    esp_err_t set(uint8_t device, const imu_settings_t *wanted);
+
+    /**
+     * @brief SETs due now, new ones and resends
+     *
+     * @return Messages written to out, each to go to the peer at the same index
+     */
+    size_t poll(int64_t now_us, imu_control_msg_t *out, net_peer_t *to, size_t max);
+
+    const imu_node_state_t &node(uint8_t device) const { return _nodes[device]; }
+};
+
+#endif // MCHACKS_IMU_CONTROL_H
@@ -0,0 +1,44 @@
+#ifndef MCHACKS_IMU_DECODE_H
+#define MCHACKS_IMU_DECODE_H
+
+#include <stdint.h>
+#include "hal.h"
+
+/*
+ * MPU-6050 sample decoding
+ * ------------------------
+ * One burst read from ACCEL_XOUT_H (0x3B) returns 14 bytes: accel x/y/z,
+ * temperature, gyro x/y/z, each a big-endian int16. The node's driver does
+ * this on the device; the host IMU stand-in produces the same bytes and goes
+ * through this decoder so the data path (and its cost) matches.
+ */
+
+#define IMU_BURST_REG 0x3B
+#define IMU_BURST_SIZE 14
+
+static inline int16_t imu_be16(const uint8_t *p)
+{
+    return (int16_t)((p[0] << 8) | p[1]);
+}
+
+static inline void imu_encode_be16(uint8_t *p, int16_t v)
+{
+    p[0] = (uint8_t)((uint16_t)v >> 8);
+    p[1] = (uint8_t)v;
+}
+
+/**
+ * @brief Decode one burst into out; device_id is left to the caller
+ */
+static inline void imu_decode_burst(const uint8_t raw[IMU_BURST_SIZE], IMU_DATA *out)
+{
+    out->accel_x = imu_be16(raw + 0);
+    out->accel_y = imu_be16(raw + 2);
+    out->accel_z = imu_be16(raw + 4);
+    // raw + 6 is the die temperature, which nothing uses
+    out->gyro_x = imu_be16(raw + 8);
+    out->gyro_y = imu_be16(raw + 10);
+    out->gyro_z = imu_be16(raw + 12);
+}
+
+#endif // MCHACKS_IMU_DECODE_H
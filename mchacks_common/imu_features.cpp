@@ -0,0 +1,83 @@
+#include "imu_features.h"
+#include "imu_fusion.h"
+
+#define ONE_G 16384                     // counts at +/-2g
+#define TAP_COUNTS ((int32_t)(IMU_TAP_G * ONE_G))
+#define STILL_ACCEL_COUNTS ((int32_t)(IMU_STILL_G * ONE_G))
+#define SWING_ON_COUNTS (IMU_SWING_ON_DPS * IMU_GYRO_COUNTS_PER_DPS)
+#define SWING_OFF_COUNTS (IMU_SWING_OFF_DPS * IMU_GYRO_COUNTS_PER_DPS)
+#define STILL_GYRO_COUNTS (IMU_STILL_DPS * IMU_GYRO_COUNTS_PER_DPS)
+
+static int64_t square(int64_t v)
+{
+    return v * v;
+}
+
+void ImuEdgeDetector::init()
+{
+    _started = false;
+    _baseline = 0;
+    _swinging = false;
+    _still_sent = false;
+    _rest_since_us = 0;
+    _tap_until_us = 0;
+}
+
+bool ImuEdgeDetector::push(const IMU_DATA *sample, int64_t time_us, imu_event_t *out)
+{
+    int64_t gyro_sq = square(sample->gyro_x) + square(sample->gyro_y) + square(sample->gyro_z);
+    int32_t accel = (int32_t)fusion_isqrt((uint64_t)(square(sample->accel_x) + square(sample->accel_y) +
+                                                     square(sample->accel_z)));
+    if (!_started) {
+        _baseline = accel;
+        _started = true;
+    }
+    int32_t off = accel - _baseline;
+    if (off < 0) {
+        off = -off;
+    }
+
+    out->kind = IMU_EVENT_NONE;
+    out->time_us = time_us;
+
+    // Swing, with hysteresis
+    if (!_swinging && gyro_sq > square(SWING_ON_COUNTS)) {
+        _swinging = true;
+        out->kind = IMU_EVENT_SWING;
+        uint32_t gyro = fusion_isqrt((uint64_t)gyro_sq);
+        out->strength = (uint16_t)(gyro > UINT16_MAX ? UINT16_MAX : gyro);
+    } else if (_swinging && gyro_sq < square(SWING_OFF_COUNTS)) {
+        _swinging = false;
+    }
+
+    // Tap: a jolt the gyro doesn't share. The baseline holds still through
+    // it, so the spike doesn't drag it along.
+    bool tapping = time_us < _tap_until_us;
+    if (out->kind == IMU_EVENT_NONE && !tapping && off > TAP_COUNTS && gyro_sq < square(SWING_ON_COUNTS)) {
+        out->kind = IMU_EVENT_TAP;
+        out->strength = (uint16_t)(off > UINT16_MAX ? UINT16_MAX : off);
+        _tap_until_us = time_us + IMU_TAP_REFRACTORY_US;
+        tapping = true;
+    }
+    if (!tapping) {
+        _baseline += (accel - _baseline) >> IMU_BASELINE_SHIFT;
+    }
+
+    // Still: at rest long enough; moving well past the rest levels re-arms
+    bool moved = gyro_sq > square(2 * STILL_GYRO_COUNTS) || off > 2 * STILL_ACCEL_COUNTS;
+    bool at_rest = gyro_sq <= square(STILL_GYRO_COUNTS) && off <= STILL_ACCEL_COUNTS;
+    if (moved) {
+        _rest_since_us = 0;
+        _still_sent = false;
+    } else if (at_rest) {
+        if (_rest_since_us == 0) {
+            _rest_since_us = time_us;
+        }
+        if (!_still_sent && out->kind == IMU_EVENT_NONE && time_us - _rest_since_us >= IMU_STILL_US) {
+            _still_sent = true;
+            out->kind = IMU_EVENT_STILL;
+            out->strength = 0;
+        }
+    }
+    return out->kind != IMU_EVENT_NONE;
+}
@@ -0,0 +1,73 @@
+#ifndef MCHACKS_IMU_FEATURES_H
+#define MCHACKS_IMU_FEATURES_H
+
+#include <stdint.h>
+#include "hal.h"
+
+/*
+ * IMU edge features
+ * -----------------
+ * ImuEdgeDetector runs on a node, one sample at a time, and turns the
+ * stream into the few moments the main board cares about:
+ *
+ *   TAP    |accel| jumps more than IMU_TAP_G away from its slow baseline
+ *          while the gyro stays under the swing level: a knock, not a
+ *          swing. Quiet for IMU_TAP_REFRACTORY_US after.
+ *   SWING  |gyro| rises past IMU_SWING_ON_DPS; not again until it has
+ *          fallen under IMU_SWING_OFF_DPS
+ *   STILL  gyro and accel both near rest for IMU_STILL_US; not again
+ *          until the node has moved
+ *
+ * Thresholds are in counts at the power-on ranges (see
+ * imu_settings_normalize()), so they hold at any range, and timing is by
+ * the samples' own timestamps, so they hold at any rate. Only integers and
+ * squared magnitudes in the hot path, and one square root for |accel|.
+ *
+ * The same code runs in the node firmware and the host build.
+ */
+
+#define IMU_GYRO_COUNTS_PER_DPS 131
+#define IMU_TAP_G 0.6f
+#define IMU_TAP_REFRACTORY_US 200000
+#define IMU_SWING_ON_DPS 150
+#define IMU_SWING_OFF_DPS 50
+#define IMU_STILL_DPS 5
+#define IMU_STILL_G 0.05f
+#define IMU_STILL_US 500000
+#define IMU_BASELINE_SHIFT 4            // |accel| baseline follows over 16 samples
+
+typedef enum {
+    IMU_EVENT_NONE,
+    IMU_EVENT_TAP,
+    IMU_EVENT_SWING,
+    IMU_EVENT_STILL,
+} imu_event_kind_t;
+
+typedef struct {
+    uint8_t kind;                       // imu_event_kind_t
+    uint16_t strength;                  // TAP: |accel| off the baseline; SWING: |gyro|; in counts
+    int64_t time_us;                    // of the sample that set it off
+} imu_event_t;
+
+class ImuEdgeDetector {
+    bool _started = false;
+    int32_t _baseline = 0;              // |accel|, smoothed
+    bool _swinging = false;
+    bool _still_sent = false;
+    int64_t _rest_since_us = 0;         // 0 while moving
+    int64_t _tap_until_us = 0;
+
+public:
+    void init();
+
+    /**
+     * @brief Take one sample at the power-on ranges
+     *
+     * @return true with out filled if it set off an event
+     */
+    bool push(const IMU_DATA *sample, int64_t time_us, imu_event_t *out);
+
+    bool swinging() const { return _swinging; }
+};
+
+#endif // MCHACKS_IMU_FEATURES_H
@@ -0,0 +1,234 @@
+#include <string.h>
+#include "imu_fusion.h"
+
+// Gyro counts (131 per degree/s) times microseconds to Q14 radians, x2^32
+#define GYRO_TO_Q14_RAD 9376
+#define ACCEL_TRUST_MIN (FUSION_ONE * 3 / 4)   // |accel| this close to 1 g is mostly gravity
+#define ACCEL_TRUST_MAX (FUSION_ONE * 5 / 4)
+// Below ~5 degrees/s on either device, what correlation there is is noise
+#define STILL_POWER ((5 * 131) * (5 * 131) / 256)
+
+uint32_t fusion_isqrt(uint64_t v)
+{
+    if (v == 0) {
+        return 0;
+    }
+    // Highest power of four not above v
+    uint64_t root = 0;
+    uint64_t bit = 1ull << ((63 - __builtin_clzll(v)) & ~1);
+    while (bit != 0) {
+        if (v >= root + bit) {
+            v -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (uint32_t)root;
+}
+
+// atan(z) for z in [0, 1] as Q15, in hundredths of a degree:
+// pi/4 z + 0.273 z (1 - z) radians, off by at most 0.22 degrees
+static int32_t atan_unit_cdeg(int64_t z)
+{
+    return (int32_t)((4500 * z + 1564 * z * (32768 - z) / 32768) / 32768);
+}
+
+int32_t fusion_atan2_cdeg(int32_t y, int32_t x)
+{
+    if (x == 0 && y == 0) {
+        return 0;
+    }
+    int64_t ax = x < 0 ? -(int64_t)x : x;
+    int64_t ay = y < 0 ? -(int64_t)y : y;
+    int32_t a = ax >= ay ? atan_unit_cdeg((ay << 15) / ax) : 9000 - atan_unit_cdeg((ax << 15) / ay);
+    if (x < 0) {
+        a = 18000 - a;
+    }
+    return y < 0 ? -a : a;
+}
+
+static void cross(const int32_t *a, const int32_t *b, int32_t *out)
+{
+    out[0] = (int32_t)(((int64_t)a[1] * b[2] - (int64_t)a[2] * b[1]) >> 14);
+    out[1] = (int32_t)(((int64_t)a[2] * b[0] - (int64_t)a[0] * b[2]) >> 14);
+    out[2] = (int32_t)(((int64_t)a[0] * b[1] - (int64_t)a[1] * b[0]) >> 14);
+}
+
+// Turn a gravity vector with the sensor for dt_us at the given gyro rate
+static void rotate(int32_t *g, const int16_t *gyro, int64_t dt_us)
+{
+    int32_t theta[3];
+    for (int i = 0; i < 3; i++) {
+        theta[i] = (int32_t)((int64_t)gyro[i] * dt_us * GYRO_TO_Q14_RAD >> 32);
+    }
+    int32_t turn[3];
+    cross(g, theta, turn);
+    for (int i = 0; i < 3; i++) {
+        g[i] += turn[i];
+    }
+}
+
+static uint32_t norm3(const int32_t *v)
+{
+    return fusion_isqrt((uint64_t)((int64_t)v[0] * v[0] + (int64_t)v[1] * v[1] + (int64_t)v[2] * v[2]));
+}
+
+size_t ImuFusion::pair_index(uint8_t a, uint8_t b)
+{
+    if (a > b) {
+        uint8_t t = a;
+        a = b;
+        b = t;
+    }
+    return a * (2 * FUSION_MAX_DEVICES - a - 1) / 2 + (b - a - 1);
+}
+
+void ImuFusion::init(uint8_t devices)
+{
+    _devices = devices < FUSION_MAX_DEVICES ? devices : FUSION_MAX_DEVICES;
+    _active = 0;
+    _energy = 0;
+    memset(_dev, 0, sizeof(_dev));
+    memset(_pairs, 0, sizeof(_pairs));
+}
+
+void ImuFusion::drop(fusion_device_t *d)
+{
+    d->active = false;
+    _energy -= d->motion;
+    _active--;
+    uint8_t n = (uint8_t)(d - _dev);
+    for (uint8_t o = 0; o < _devices; o++) {
+        if (o != n) {
+            _pairs[pair_index(n, o)].valid = false;
+        }
+    }
+}
+
+void ImuFusion::update_gravity(fusion_device_t *d, const IMU_DATA *sample, int64_t dt_us, uint32_t accel_norm)
+{
+    int32_t accel[3] = {sample->accel_x, sample->accel_y, sample->accel_z};
+    int32_t g[3];
+    if (!d->active) {
+        // Start from the accelerometer, or straight up without one
+        for (int i = 0; i < 3; i++) {
+            g[i] = accel_norm != 0 ? (int32_t)((int64_t)accel[i] * FUSION_ONE / accel_norm) : 0;
+        }
+        if (accel_norm == 0) {
+            g[2] = FUSION_ONE;
+        }
+    } else {
+        for (int i = 0; i < 3; i++) {
+            g[i] = d->gravity[i];
+        }
+        rotate(g, d->gyro, dt_us);
+        if (accel_norm >= ACCEL_TRUST_MIN && accel_norm <= ACCEL_TRUST_MAX) {
+            for (int i = 0; i < 3; i++) {
+                int32_t measured = (int32_t)((int64_t)accel[i] * FUSION_ONE / accel_norm);
+                g[i] += (measured - g[i]) >> FUSION_ACCEL_SHIFT;
+            }
+        }
+    }
+    uint32_t n = norm3(g);
+    for (int i = 0; i < 3; i++) {
+        d->gravity[i] = (int16_t)(n != 0 ? (int64_t)g[i] * FUSION_ONE / n : (i == 2 ? FUSION_ONE : 0));
+    }
+}
+
+void ImuFusion::update_pair(uint8_t a, uint8_t b)
+{
+    const fusion_device_t *da = &_dev[a];
+    const fusion_device_t *db = &_dev[b];
+    int64_t skew = da->time_us - db->time_us;
+    if (skew > FUSION_MAX_SKEW_US || skew < -FUSION_MAX_SKEW_US) {
+        return;
+    }
+
+    // Both gravities at the newer sample's time
+    int32_t ga[3], gb[3];
+    for (int i = 0; i < 3; i++) {
+        ga[i] = da->gravity[i];
+        gb[i] = db->gravity[i];
+    }
+    if (skew > 0) {
+        rotate(gb, db->gyro, skew);
+    } else if (skew < 0) {
+        rotate(ga, da->gyro, -skew);
+    }
+
+    fusion_pair_t *p = &_pairs[pair_index(a, b)];
+    int32_t between[3];
+    cross(ga, gb, between);
+    int32_t dot = (int32_t)(((int64_t)ga[0] * gb[0] + (int64_t)ga[1] * gb[1] + (int64_t)ga[2] * gb[2]) >> 14);
+    p->tilt_cdeg = (int16_t)fusion_atan2_cdeg((int32_t)norm3(between), dot);
+
+    int32_t gyro_dot = (int32_t)(((int64_t)da->gyro[0] * db->gyro[0] + (int64_t)da->gyro[1] * db->gyro[1] +
+                                  (int64_t)da->gyro[2] * db->gyro[2]) >> 8);
+    if (!p->valid) {
+        p->gyro_dot = gyro_dot;
+    } else {
+        p->gyro_dot += (gyro_dot - p->gyro_dot) >> FUSION_SMOOTH_SHIFT;
+    }
+    uint32_t scale = fusion_isqrt((uint64_t)da->gyro_power * db->gyro_power);
+    int32_t coherence = 0;
+    if (da->gyro_power >= STILL_POWER && db->gyro_power >= STILL_POWER && scale != 0) {
+        int64_t c = (int64_t)p->gyro_dot * FUSION_ONE / scale;
+        coherence = (int32_t)(c > FUSION_ONE ? FUSION_ONE : c < -FUSION_ONE ? -FUSION_ONE : c);
+    }
+    p->coherence = (int16_t)coherence;
+    p->time_us = da->time_us > db->time_us ? da->time_us : db->time_us;
+    p->valid = true;
+}
+
+void ImuFusion::push(uint8_t device, const IMU_DATA *sample, int64_t time_us)
+{
+    if (device >= _devices) {
+        return;
+    }
+    fusion_device_t *d = &_dev[device];
+
+    int64_t dt_us = d->active ? time_us - d->time_us : 0;
+    if (dt_us < 0) {
+        dt_us = 0;
+    } else if (dt_us > FUSION_MAX_DT_US) {
+        dt_us = FUSION_MAX_DT_US;
+    }
+    int32_t accel[3] = {sample->accel_x, sample->accel_y, sample->accel_z};
+    uint32_t accel_norm = norm3(accel);
+    update_gravity(d, sample, dt_us, accel_norm);
+
+    uint64_t gyro_sq = (uint64_t)((int64_t)sample->gyro_x * sample->gyro_x + (int64_t)sample->gyro_y * sample->gyro_y +
+                                  (int64_t)sample->gyro_z * sample->gyro_z);
+    int32_t linear = (int32_t)accel_norm - FUSION_ONE;
+    uint32_t motion = fusion_isqrt(gyro_sq) + 2 * (uint32_t)(linear < 0 ? -linear : linear);
+    uint32_t power = (uint32_t)(gyro_sq >> 8);
+    if (!d->active) {
+        d->motion = motion;
+        d->gyro_power = power;
+        d->active = true;
+        _active++;
+        _energy += motion;
+    } else {
+        uint32_t before = d->motion;
+        d->motion = (uint32_t)((int64_t)d->motion + (((int64_t)motion - d->motion) >> FUSION_SMOOTH_SHIFT));
+        d->gyro_power = (uint32_t)((int64_t)d->gyro_power + (((int64_t)power - d->gyro_power) >> FUSION_SMOOTH_SHIFT));
+        _energy += d->motion - before;
+    }
+    d->gyro[0] = sample->gyro_x;
+    d->gyro[1] = sample->gyro_y;
+    d->gyro[2] = sample->gyro_z;
+    d->time_us = time_us;
+
+    for (uint8_t o = 0; o < _devices; o++) {
+        if (o == device || !_dev[o].active) {
+            continue;
+        }
+        if (time_us - _dev[o].time_us > FUSION_STALE_US) {
+            drop(&_dev[o]);
+            continue;
+        }
+        update_pair(device, o);
+    }
+}
@@ -0,0 +1,108 @@
+#ifndef MCHACKS_IMU_FUSION_H
+#define MCHACKS_IMU_FUSION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "hal.h"
+#include "imu_control.h"
+
+/*
+ * Multi-IMU fusion
+ * ----------------
+ * ImuFusion takes the samples of several IMUs as they arrive and keeps
+ * signals that only exist between them:
+ *
+ *   gravity    per device, the direction of gravity in the sensor's frame:
+ *              the gyro turns it sample by sample, and the accelerometer
+ *              pulls it back 1/2^FUSION_ACCEL_SHIFT of the way whenever it
+ *              reads close to 1 g (so a swing doesn't drag it along)
+ *   motion     per device, |gyro| plus twice how far |accel| is from 1 g,
+ *              in gyro counts, smoothed over 2^FUSION_SMOOTH_SHIFT samples;
+ *              energy() is the sum over the active devices
+ *   tilt       per pair, the angle between the two gravity directions: how
+ *              differently two hands are held, whatever way the player faces
+ *   coherence  per pair, the smoothed correlation of the two gyro vectors,
+ *              +1 moving together, -1 mirrored, 0 unrelated
+ *
+ * The devices sample on their own clocks. A pair is only updated when its
+ * two latest samples are within FUSION_MAX_SKEW_US, and the older one's
+ * gravity is carried forward to the newer one's time by its gyro first. A
+ * device not heard from in FUSION_STALE_US drops out until it is. That is
+ * longer than IMU_KEEPALIVE_US, so a node held still inside its dead band
+ * stays in.
+ *
+ * Everything is integer: unit vectors in Q14, angles out of a rational
+ * atan2 (within ~0.3 degrees). A push() costs one gravity update plus one
+ * pair update per other active device, so it grows linearly with the
+ * number of devices (esp_bench's imu_fusion_* kernels).
+ *
+ * Samples are counts at the power-on ranges (see imu_settings_normalize()).
+ */
+
+#define FUSION_MAX_DEVICES 8
+#define FUSION_MAX_PAIRS (FUSION_MAX_DEVICES * (FUSION_MAX_DEVICES - 1) / 2)
+#define FUSION_MAX_SKEW_US 60000
+#define FUSION_STALE_US (2 * IMU_KEEPALIVE_US)
+#define FUSION_MAX_DT_US 100000         // longer gaps integrate as this long
+#define FUSION_ACCEL_SHIFT 5
+#define FUSION_SMOOTH_SHIFT 3
+#define FUSION_ONE 16384                // 1.0 in Q14, and 1 g at the +/-2g range
+
+static_assert(FUSION_STALE_US > IMU_KEEPALIVE_US, "a still node's keepalives must keep it in the fusion");
+
+typedef struct {
+    bool active;
+    int64_t time_us;                    // of the latest sample
+    int16_t gravity[3];                 // unit vector, Q14
+    int16_t gyro[3];                    // latest sample
+    uint32_t motion;                    // smoothed
+    uint32_t gyro_power;                // smoothed |gyro|^2 / 256
+} fusion_device_t;
+
+typedef struct {
+    bool valid;                         // updated within FUSION_STALE_US
+    int64_t time_us;
+    int16_t tilt_cdeg;                  // 0 to 18000, hundredths of a degree
+    int16_t coherence;                  // Q14, -FUSION_ONE to FUSION_ONE
+    int32_t gyro_dot;                   // smoothed gyro_a . gyro_b / 256
+} fusion_pair_t;
+
+/**
+ * @brief atan2(y, x) in hundredths of a degree, -18000 to 18000
+ */
+int32_t fusion_atan2_cdeg(int32_t y, int32_t x);
+
+uint32_t fusion_isqrt(uint64_t v);
+
+class ImuFusion {
+    uint8_t _devices = 0;
+    uint8_t _active = 0;
+    uint32_t _energy = 0;
+    fusion_device_t _dev[FUSION_MAX_DEVICES] = {};
+    fusion_pair_t _pairs[FUSION_MAX_PAIRS] = {};
+
+    static size_t pair_index(uint8_t a, uint8_t b);
+    void update_gravity(fusion_device_t *d, const IMU_DATA *sample, int64_t dt_us, uint32_t accel_norm);
+    void update_pair(uint8_t a, uint8_t b);
+    void drop(fusion_device_t *d);
+
+public:
+    /**
+     * @brief Forget everything; devices 0 to devices - 1 take part
+     */
+    void init(uint8_t devices);
+
+    /**
+     * @brief Take one sample of a device, taken at time_us
+     */
+    void push(uint8_t device, const IMU_DATA *sample, int64_t time_us);
+
+    uint8_t devices() const { return _devices; }
+    // Devices heard from within FUSION_STALE_US of the latest push
+    uint8_t active() const { return _active; }
+    uint32_t energy() const { return _energy; }
+    const fusion_device_t &device(uint8_t d) const { return _dev[d]; }
+    const fusion_pair_t &pair(uint8_t a, uint8_t b) const { return _pairs[pair_index(a, b)]; }
+};
+
+#endif // MCHACKS_IMU_FUSION_H
@@ -0,0 +1,116 @@
+#ifndef MCHACKS_LF_QUEUE_H
+#define MCHACKS_LF_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+/*
+ * Bounded lock-free queue
+ * -----------------------
+ * Any number of producers and consumers, fixed capacity, no heap. Every slot
+ * carries a sequence number telling whose turn it is: a producer may fill
+ * slot i on lap n when its sequence is n * Capacity + i, a consumer may take
+ * it once the producer has bumped it by one. push() and pop() never block
+ * and never take a lock; a producer preempted between claiming and filling a
+ * slot only makes the queue look empty from that slot on until it resumes.
+ *
+ * Capacity must be a power of two. T is copied in and out, so keep it small.
+ */
+
+template <typename T, size_t Capacity>
+class LfQueue {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+                  "LfQueue capacity must be a power of two");
+
+    struct Slot {
+        std::atomic<uint32_t> seq;
+        T value;
+    };
+
+    Slot _slots[Capacity];
+    std::atomic<uint32_t> _head{0};   // next slot to pop
+    std::atomic<uint32_t> _tail{0};   // next slot to push
+    std::atomic<uint32_t> _dropped{0};
+
+public:
+    LfQueue()
+    {
+        for (uint32_t i = 0; i < Capacity; i++) {
+            _slots[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // false (and counted in dropped()) when the queue is full
+    bool push(const T &value)
+    {
+        uint32_t pos = _tail.load(std::memory_order_relaxed);
+        while (1) {
+            Slot &slot = _slots[pos & (Capacity - 1)];
+            int32_t diff = (int32_t)(slot.seq.load(std::memory_order_acquire) - pos);
+            if (diff == 0) {
+                if (_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    slot.value = value;
+                    slot.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                _dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            } else {
+                pos = _tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // false when the queue is empty
+    bool pop(T *out)
+    {
+        uint32_t pos = _head.load(std::memory_order_relaxed);
+        while (1) {
+            Slot &slot = _slots[pos & (Capacity - 1)];
+            int32_t diff = (int32_t)(slot.seq.load(std::memory_order_acquire) - (pos + 1));
+            if (diff == 0) {
+                if (_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    *out = slot.value;
+                    slot.seq.store(pos + Capacity, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = _head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Whether pop() would find a value right now. Exact when the caller is
+    // the only consumer: a slot a producer has claimed but not filled yet
+    // doesn't count, where size() already counts it.
+    bool can_pop() const
+    {
+        uint32_t pos = _head.load(std::memory_order_relaxed);
+        return _slots[pos & (Capacity - 1)].seq.load(std::memory_order_acquire) == pos + 1;
+    }
+
+    // Whether push() would find room right now; exact for the only producer
+    bool can_push() const
+    {
+        uint32_t pos = _tail.load(std::memory_order_relaxed);
+        return _slots[pos & (Capacity - 1)].seq.load(std::memory_order_acquire) == pos;
+    }
+
+    // Approximate while other tasks are pushing or popping
+    size_t size() const
+    {
+        uint32_t tail = _tail.load(std::memory_order_relaxed);
+        uint32_t head = _head.load(std::memory_order_relaxed);
+        return (int32_t)(tail - head) > 0 ? tail - head : 0;
+    }
+
+    static constexpr size_t capacity() { return Capacity; }
+
+    uint32_t dropped() const { return _dropped.load(std::memory_order_relaxed); }
+};
+
+#endif // MCHACKS_LF_QUEUE_H
@@ -0,0 +1,209 @@
+#include <stdlib.h>
+#include <new>
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "mem_pool.h"
+#if !CONFIG_IDF_TARGET_LINUX
+#include "esp_heap_caps.h"
+#endif
+
+#define POOL_END 0xFFFF
+
+static const char *TAG = "mem_pool";
+
+static MemRegion *regions[MEM_MAX_REGIONS];
+static std::atomic<size_t> n_regions(0);
+
+static void *reserve(size_t size, mem_caps_t caps)
+{
+#if CONFIG_IDF_TARGET_LINUX
+    return malloc(size);
+#else
+    switch (caps) {
+    case MEM_PSRAM: {
+        void *p = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        return p ? p : heap_caps_malloc(size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    }
+    case MEM_DMA:
+        return heap_caps_malloc(size, MALLOC_CAP_DMA | MALLOC_CAP_8BIT);
+    default:
+        return heap_caps_malloc(size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    }
+#endif
+}
+
+// Regions are set up from one task at boot; readers may run concurrently
+static void register_region(MemRegion *region)
+{
+    size_t n = n_regions.load(std::memory_order_relaxed);
+    if (n >= MEM_MAX_REGIONS) {
+        ESP_LOGW(TAG, "Too many regions, not tracking stats");
+        return;
+    }
+    regions[n] = region;
+    n_regions.store(n + 1, std::memory_order_release);
+}
+
+static void update_peak(std::atomic<size_t> &peak, size_t value)
+{
+    size_t seen = peak.load(std::memory_order_relaxed);
+    while (value > seen && !peak.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {
+    }
+}
+
+esp_err_t MemArena::init(size_t capacity, mem_caps_t caps)
+{
+    if (_base != nullptr) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    _base = (uint8_t *)reserve(capacity, caps);
+    if (_base == nullptr) {
+        ESP_LOGE(TAG, "No room for arena %s (%u bytes)", _name, (unsigned)capacity);
+        return ESP_ERR_NO_MEM;
+    }
+    _capacity = capacity;
+    register_region(this);
+    return ESP_OK;
+}
+
+void *MemArena::alloc(size_t size, size_t align)
+{
+    size_t offset = _offset.load(std::memory_order_relaxed);
+    size_t start, end;
+    do {
+        start = (offset + align - 1) & ~(align - 1);
+        end = start + size;
+        if (_base == nullptr || end > _capacity) {
+            _failures.fetch_add(1, std::memory_order_relaxed);
+            ESP_LOGE(TAG, "Arena %s exhausted (%u bytes requested)", _name, (unsigned)size);
+            return nullptr;
+        }
+    } while (!_offset.compare_exchange_weak(offset, end, std::memory_order_relaxed));
+
+    update_peak(_peak, end);
+    return _base + start;
+}
+
+void MemArena::reset()
+{
+    _offset.store(0, std::memory_order_relaxed);
+}
+
+void MemArena::stats(mem_region_stats_t *out) const
+{
+    out->name = _name;
+    out->pool = false;
+    out->capacity = _capacity;
+    out->used = _offset.load(std::memory_order_relaxed);
+    out->peak = _peak.load(std::memory_order_relaxed);
+    out->failures = _failures.load(std::memory_order_relaxed);
+    out->block_size = 0;
+}
+
+void MemArena::reset_peak()
+{
+    _peak.store(_offset.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    _failures.store(0, std::memory_order_relaxed);
+}
+
+esp_err_t MemPool::init(size_t block_size, uint16_t count, mem_caps_t caps)
+{
+    if (_blocks != nullptr) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (count == 0 || count >= POOL_END) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    // Keep every block aligned for any type
+    block_size = (block_size + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+    _blocks = (uint8_t *)reserve(block_size * count, caps);
+    _next = (std::atomic<uint16_t> *)reserve(count * sizeof(std::atomic<uint16_t>), MEM_INTERNAL);
+    if (_blocks == nullptr || _next == nullptr) {
+        ESP_LOGE(TAG, "No room for pool %s (%u x %u bytes)", _name, count, (unsigned)block_size);
+        ::free(_blocks);
+        ::free(_next);
+        _blocks = nullptr;
+        _next = nullptr;
+        return ESP_ERR_NO_MEM;
+    }
+
+    _block_size = block_size;
+    _count = count;
+    for (uint16_t i = 0; i < count; i++) {
+        new (&_next[i]) std::atomic<uint16_t>(i + 1 < count ? i + 1 : POOL_END);
+    }
+    _head.store(0, std::memory_order_release);
+    register_region(this);
+    return ESP_OK;
+}
+
+void *MemPool::alloc()
+{
+    uint32_t head = _head.load(std::memory_order_acquire);
+    while (1) {
+        uint16_t index = head & 0xFFFF;
+        if (_blocks == nullptr || index == POOL_END) {
+            _failures.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        uint32_t next = ((head + 0x10000) & 0xFFFF0000) | _next[index].load(std::memory_order_relaxed);
+        if (_head.compare_exchange_weak(head, next, std::memory_order_acq_rel)) {
+            uint32_t in_use = _in_use.fetch_add(1, std::memory_order_relaxed) + 1;
+            uint32_t peak = _peak.load(std::memory_order_relaxed);
+            while (in_use > peak && !_peak.compare_exchange_weak(peak, in_use, std::memory_order_relaxed)) {
+            }
+            return _blocks + (size_t)index * _block_size;
+        }
+    }
+}
+
+void MemPool::free(void *block)
+{
+    if (block == nullptr) {
+        return;
+    }
+    uint16_t index = (uint16_t)(((uint8_t *)block - _blocks) / _block_size);
+    uint32_t head = _head.load(std::memory_order_relaxed);
+    do {
+        _next[index].store(head & 0xFFFF, std::memory_order_relaxed);
+    } while (!_head.compare_exchange_weak(head, ((head + 0x10000) & 0xFFFF0000) | index,
+                                          std::memory_order_release, std::memory_order_relaxed));
+    _in_use.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void MemPool::stats(mem_region_stats_t *out) const
+{
+    out->name = _name;
+    out->pool = true;
+    out->capacity = _block_size * _count;
+    out->used = _in_use.load(std::memory_order_relaxed) * _block_size;
+    out->peak = _peak.load(std::memory_order_relaxed) * _block_size;
+    out->failures = _failures.load(std::memory_order_relaxed);
+    out->block_size = _block_size;
+}
+
+void MemPool::reset_peak()
+{
+    _peak.store(_in_use.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    _failures.store(0, std::memory_order_relaxed);
+}
+
+size_t mem_region_stats(mem_region_stats_t *out, size_t max)
+{
+    size_t n = n_regions.load(std::memory_order_acquire);
+    if (n > max) {
+        n = max;
+    }
+    for (size_t i = 0; i < n; i++) {
+        regions[i]->stats(&out[i]);
+    }
+    return n;
+}
+
+void mem_reset_peaks(void)
+{
+    size_t n = n_regions.load(std::memory_order_acquire);
+    for (size_t i = 0; i < n; i++) {
+        regions[i]->reset_peak();
+    }
+}
@@ -0,0 +1,121 @@
+#ifndef MCHACKS_MEM_POOL_H
+#define MCHACKS_MEM_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include "esp_err.h"
+
+/*
+ * Boot-time memory regions
+ * ------------------------
+ * Each subsystem reserves its memory once at boot, as either
+ *
+ *   MemArena  a bump allocator for buffers that live as long as the
+ *             subsystem (or until an explicit reset())
+ *   MemPool   fixed-size blocks handed out and returned at run time
+ *
+ * After that the hot paths never touch the heap, so long uptimes can't
+ * fragment internal SRAM. Allocation and release are lock-free and safe from
+ * any task; init() belongs in the boot sequence. Every initialised region
+ * shows up in mem_region_stats().
+ */
+
+#define MEM_MAX_REGIONS 8
+
+typedef enum {
+    MEM_INTERNAL,   // internal SRAM
+    MEM_PSRAM,      // external RAM when fitted, internal otherwise
+    MEM_DMA,        // DMA-capable internal SRAM
+} mem_caps_t;
+
+typedef struct {
+    const char *name;
+    bool pool;
+    size_t capacity;        // bytes reserved
+    size_t used;            // bytes handed out right now
+    size_t peak;            // high water mark of used
+    uint32_t failures;      // requests that did not fit
+    size_t block_size;      // pools only
+} mem_region_stats_t;
+
+class MemRegion {
+public:
+    virtual ~MemRegion() {}
+    virtual void stats(mem_region_stats_t *out) const = 0;
+    virtual void reset_peak() = 0;
+};
+
+class MemArena : public MemRegion {
+    const char *_name;
+    uint8_t *_base = nullptr;
+    size_t _capacity = 0;
+    std::atomic<size_t> _offset{0};
+    std::atomic<size_t> _peak{0};
+    std::atomic<uint32_t> _failures{0};
+
+public:
+    explicit MemArena(const char *name) : _name(name) {}
+
+    // Reserve the backing store; call once at boot
+    esp_err_t init(size_t capacity, mem_caps_t caps = MEM_INTERNAL);
+
+    // NULL when the arena is full; memory is not zeroed
+    void *alloc(size_t size, size_t align = alignof(max_align_t));
+
+    template <typename T>
+    T *alloc_array(size_t count)
+    {
+        return (T *)alloc(count * sizeof(T), alignof(T));
+    }
+
+    // Drop every allocation at once. Only for arenas whose users are done.
+    void reset();
+
+    void stats(mem_region_stats_t *out) const override;
+    void reset_peak() override;
+};
+
+class MemPool : public MemRegion {
+    const char *_name;
+    uint8_t *_blocks = nullptr;
+    // Next free block per block; atomic because alloc() may read an entry a
+    // concurrent free() is rewriting (the head tag then rejects that read)
+    std::atomic<uint16_t> *_next = nullptr;
+    size_t _block_size = 0;
+    uint16_t _count = 0;
+    // Free list head: block index in the low 16 bits, ABA tag in the high 16
+    std::atomic<uint32_t> _head{0};
+    std::atomic<uint32_t> _in_use{0};
+    std::atomic<uint32_t> _peak{0};
+    std::atomic<uint32_t> _failures{0};
+
+public:
+    explicit MemPool(const char *name) : _name(name) {}
+
+    // Reserve count blocks of block_size bytes; call once at boot
+    esp_err_t init(size_t block_size, uint16_t count, mem_caps_t caps = MEM_INTERNAL);
+
+    // NULL when every block is in use
+    void *alloc();
+    void free(void *block);
+
+    size_t block_size() const { return _block_size; }
+
+    void stats(mem_region_stats_t *out) const override;
+    void reset_peak() override;
+};
+
+/**
+ * @brief Stats of every initialised arena and pool
+ *
+ * @return Number of entries written to out
+ */
+size_t mem_region_stats(mem_region_stats_t *out, size_t max);
+
+/**
+ * @brief Restart the peak counters of every region
+ */
+void mem_reset_peaks(void);
+
+#endif // MCHACKS_MEM_POOL_H
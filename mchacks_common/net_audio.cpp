@@ -0,0 +1,399 @@
+#include <string.h>
+#include "net_audio.h"
+
+// Depth error to rate correction: one packet (256 frames) too deep speeds
+// play-out up by ~1000 ppm. The integral settles on the sender's clock offset.
+#define DRIFT_KP 4.0f                   // ppm per frame of error
+#define DRIFT_KI 0.002f                 // ppm per frame of error, per pull
+#define DEPTH_SMOOTHING 64.0f           // pulls; evens out the sawtooth of packets arriving
+#define JITTER_MARGIN 4                 // target = two packets + this many jitters
+#define TARGET_DECAY_SHIFT 8            // the target comes down 1/256 of the excess per packet
+#define RESTART_GAP 1000                // sequence jumps further than this are a new sender
+#define RESTART_LATE NET_AUDIO_SLOTS    // so are this many late packets in a row
+
+static const int16_t ima_steps[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+    253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+    11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+    32767,
+};
+
+static const int8_t ima_index_step[8] = {-1, -1, -1, -1, 2, 4, 6, 8};
+
+void net_audio_adpcm_decode(net_audio_adpcm_state_t *state, const uint8_t *codes, size_t first,
+                            size_t count, size_t channels, int16_t *out)
+{
+    int32_t predictor = state->predictor;
+    int32_t index = state->index;
+    for (size_t i = 0, n = first; i < count; i++, n += channels) {
+        uint8_t code = (codes[n >> 1] >> ((n & 1) * 4)) & 0x0F;
+        int32_t step = ima_steps[index];
+        int32_t diff = step >> 3;
+        if (code & 4) diff += step;
+        if (code & 2) diff += step >> 1;
+        if (code & 1) diff += step >> 2;
+        predictor += (code & 8) ? -diff : diff;
+        if (predictor > INT16_MAX) predictor = INT16_MAX;
+        if (predictor < INT16_MIN) predictor = INT16_MIN;
+        index += ima_index_step[code & 7];
+        if (index < 0) index = 0;
+        if (index > 88) index = 88;
+        out[i * channels] = (int16_t)predictor;
+    }
+    state->predictor = (int16_t)predictor;
+    state->index = (uint8_t)index;
+}
+
+size_t net_audio_payload_bytes(net_audio_format_t format, size_t channels, size_t frames)
+{
+    if (format == NET_AUDIO_ADPCM) {
+        return channels * NET_AUDIO_ADPCM_STATE_BYTES + (frames * channels + 1) / 2;
+    }
+    return frames * channels * sizeof(int16_t);
+}
+
+void NetAudioRx::init(int16_t *storage)
+{
+    for (size_t i = 0; i < NET_AUDIO_SLOTS; i++) {
+        _slots[i].samples = storage + i * NET_AUDIO_MAX_FRAMES * NET_AUDIO_MAX_CHANNELS;
+    }
+    _conceal_samples = storage + NET_AUDIO_SLOTS * NET_AUDIO_MAX_FRAMES * NET_AUDIO_MAX_CHANNELS;
+    _stats = {};
+    _have_format = false;
+    _last_arrival_us = 0;
+    _late_run = 0;
+    clear();
+}
+
+// Forget the stream but keep the format and counters
+void NetAudioRx::clear()
+{
+    for (size_t i = 0; i < NET_AUDIO_SLOTS; i++) {
+        _slots[i].filled = false;
+    }
+    _have_newest = false;
+    _end_seen = false;
+    _jitter_q4 = 0;
+    _target = 0;
+    _started = false;
+    _ended = false;
+    _cur = nullptr;
+    _cur_frames = 0;
+    _cur_offset = 0;
+    _cur_end = false;
+    _conceal_run = 0;
+    _have_conceal = false;
+    _depth_avg = 0;
+    _integral_ppm = 0;
+    _step = 1ull << 32;
+}
+
+void NetAudioRx::clamp_target()
+{
+    uint32_t max_target = (NET_AUDIO_SLOTS - 2) * _nominal_frames;
+    if (_target > max_target) {
+        _target = max_target;
+    }
+}
+
+uint32_t NetAudioRx::depth() const
+{
+    if (!_have_newest) {
+        return 0;
+    }
+    int32_t d = (int32_t)(_newest_end - _play_ts);
+    return d > 0 ? (uint32_t)d : 0;
+}
+
+// RFC 3550 jitter: how much the arrival spacing differs from the send
+// spacing, smoothed over ~16 packets. The target keeps a few of those in
+// hand on top of two packets (one playing, one ready).
+void NetAudioRx::adapt_target(int64_t arrival_us, uint32_t timestamp)
+{
+    if (_jitter_arrival_us != 0) {
+        int64_t sent_us = (int64_t)(int32_t)(timestamp - _jitter_timestamp) * 1000000 / _rate;
+        int64_t d = (arrival_us - _jitter_arrival_us) - sent_us;
+        if (d < 0) {
+            d = -d;
+        }
+        if (d > 1000000) {
+            d = 1000000;
+        }
+        _jitter_q4 += (uint32_t)d - ((_jitter_q4 + 8) >> 4);
+    }
+    _jitter_arrival_us = arrival_us;
+    _jitter_timestamp = timestamp;
+
+    uint32_t jitter_frames = (uint32_t)((uint64_t)(_jitter_q4 >> 4) * _rate / 1000000);
+    uint32_t wanted = 2 * _nominal_frames + JITTER_MARGIN * jitter_frames;
+    if (wanted > _target) {
+        _target = wanted;
+    } else {
+        _target -= (_target - wanted) >> TARGET_DECAY_SHIFT;
+    }
+    clamp_target();
+}
+
+bool NetAudioRx::push(const uint8_t *packet, size_t len, int64_t arrival_us)
+{
+    net_audio_header_t h;
+    if (len < sizeof(h)) {
+        _stats.malformed++;
+        return false;
+    }
+    memcpy(&h, packet, sizeof(h));
+    if (h.magic != NET_AUDIO_MAGIC || h.version != NET_AUDIO_VERSION ||
+        (h.format != NET_AUDIO_PCM16 && h.format != NET_AUDIO_ADPCM) ||
+        h.channels == 0 || h.channels > NET_AUDIO_MAX_CHANNELS ||
+        h.frames == 0 || h.frames > NET_AUDIO_MAX_FRAMES || h.sample_rate == 0 ||
+        len != sizeof(h) + net_audio_payload_bytes((net_audio_format_t)h.format, h.channels, h.frames)) {
+        _stats.malformed++;
+        return false;
+    }
+
+    if (_have_format && (h.sample_rate != _rate || h.channels != _channels)) {
+        _stats.resets++;
+        clear();
+    }
+    if (_have_newest) {
+        int32_t diff = (int32_t)(h.seq - _next_seq);
+        if (diff < -RESTART_GAP || diff > RESTART_GAP || (diff < 0 && _late_run >= RESTART_LATE)) {
+            _stats.resets++;
+            clear();
+        } else if (diff < 0) {
+            _stats.late++;
+            _late_run++;
+            // The depth was too shallow for this network; keep more in hand
+            _target += _nominal_frames / 2;
+            clamp_target();
+            return false;
+        } else if (diff >= NET_AUDIO_SLOTS - 1) {
+            // The slot before _next_seq may still be playing
+            _stats.overflows++;
+            return false;
+        }
+    }
+    _have_format = true;
+    _rate = h.sample_rate;
+    _channels = h.channels;
+    _nominal_frames = h.frames;
+
+    Slot &slot = _slots[h.seq % NET_AUDIO_SLOTS];
+    if (slot.filled && slot.seq == h.seq) {
+        _stats.duplicates++;
+        return false;
+    }
+    const uint8_t *payload = packet + sizeof(h);
+    if (h.format == NET_AUDIO_PCM16) {
+        memcpy(slot.samples, payload, (size_t)h.frames * h.channels * sizeof(int16_t));
+    } else {
+        const uint8_t *codes = payload + h.channels * NET_AUDIO_ADPCM_STATE_BYTES;
+        for (size_t c = 0; c < h.channels; c++) {
+            const uint8_t *s = payload + c * NET_AUDIO_ADPCM_STATE_BYTES;
+            net_audio_adpcm_state_t state = {(int16_t)(s[0] | (s[1] << 8)), s[2] > 88 ? (uint8_t)88 : s[2]};
+            net_audio_adpcm_decode(&state, codes, c, h.frames, h.channels, slot.samples + c);
+        }
+    }
+    slot.seq = h.seq;
+    slot.timestamp = h.timestamp;
+    slot.frames = h.frames;
+    slot.flags = h.flags;
+    slot.filled = true;
+    _stats.packets++;
+    _late_run = 0;
+
+    if (!_have_newest) {
+        // The first packet sets where play-out starts
+        _have_newest = true;
+        _newest_seq = h.seq;
+        _newest_end = h.timestamp + h.frames;
+        _next_seq = h.seq;
+        _play_ts = h.timestamp;
+        _jitter_arrival_us = 0;
+        adapt_target(arrival_us, h.timestamp);
+    } else if ((int32_t)(h.seq - _newest_seq) > 0) {
+        _newest_seq = h.seq;
+        _newest_end = h.timestamp + h.frames;
+        // Only in-order arrivals measure jitter; reordered ones already show as late or early
+        adapt_target(arrival_us, h.timestamp);
+    }
+    _last_arrival_us = arrival_us;
+    if (h.flags & NET_AUDIO_FLAG_END) {
+        _end_seen = true;
+    }
+
+    uint32_t d = depth();
+    if (d > _stats.max_depth_frames) {
+        _stats.max_depth_frames = d;
+    }
+    return true;
+}
+
+// Move play-out on to packet _next_seq, or a stand-in for it. false when
+// nothing that new has arrived at all: the buffer ran dry.
+bool NetAudioRx::begin_packet()
+{
+    if ((int32_t)(_next_seq - _newest_seq) > 0) {
+        return false;
+    }
+
+    Slot &slot = _slots[_next_seq % NET_AUDIO_SLOTS];
+    if (slot.filled && slot.seq == _next_seq) {
+        // Slots arriving after this one can't reach it (see push), so it
+        // stays intact while it plays
+        slot.filled = false;
+        _cur = slot.samples;
+        _cur_frames = slot.frames;
+        _cur_end = (slot.flags & NET_AUDIO_FLAG_END) != 0;
+        _play_ts = slot.timestamp;
+        _gain_start = _gain_end = 0;
+        _conceal_run = 0;
+        _have_conceal = false;
+    } else {
+        // Lost or too late: replay the last packet, half as loud each time
+        _stats.concealed++;
+        if (!_have_conceal && _cur != nullptr && _cur != _conceal_samples) {
+            memcpy(_conceal_samples, _cur, (size_t)_cur_frames * _channels * sizeof(int16_t));
+            _have_conceal = true;
+        }
+        if (!_have_conceal || _conceal_run >= NET_AUDIO_CONCEAL_REPEATS) {
+            _gain_start = _gain_end = 1;        // silence
+        } else {
+            _gain_start = 32768 >> _conceal_run;
+            _gain_end = _gain_start >> 1;
+        }
+        _cur = _conceal_samples;
+        _cur_frames = _have_conceal ? _cur_frames : _nominal_frames;
+        _cur_end = false;
+        _conceal_run++;
+    }
+    _cur_offset = 0;
+    _next_seq++;
+    return true;
+}
+
+bool NetAudioRx::next_frame(int16_t *frame)
+{
+    if (_cur == nullptr || _cur_offset >= _cur_frames) {
+        if (_cur_end) {
+            _ended = true;
+            return false;
+        }
+        if (!begin_packet()) {
+            return false;
+        }
+    }
+
+    const int16_t *in = _cur + (size_t)_cur_offset * _channels;
+    if (_gain_start == 0) {
+        for (uint16_t c = 0; c < _channels; c++) {
+            frame[c] = in[c];
+        }
+    } else if (_gain_start == 1) {
+        for (uint16_t c = 0; c < _channels; c++) {
+            frame[c] = 0;
+        }
+    } else {
+        int32_t gain = _gain_start - (_gain_start - _gain_end) * _cur_offset / _cur_frames;
+        for (uint16_t c = 0; c < _channels; c++) {
+            frame[c] = (int16_t)((in[c] * gain) >> 15);
+        }
+    }
+    _cur_offset++;
+    _play_ts++;
+    return true;
+}
+
+void NetAudioRx::stop_playing(bool dry)
+{
+    _started = false;
+    if (dry) {
+        _stats.underruns++;
+        // Re-buffer with one packet more in hand than last time
+        _target += _nominal_frames;
+        clamp_target();
+    }
+}
+
+// Proportional-integral control of the play-out rate on the buffer depth.
+// A sender whose clock runs fast fills the buffer; the integral settles on
+// its offset and the proportional part pulls the depth back to the target.
+void NetAudioRx::steer()
+{
+    float err = _depth_avg - (float)_target;
+    _integral_ppm += err * DRIFT_KI;
+    if (_integral_ppm > NET_AUDIO_MAX_PPM) _integral_ppm = NET_AUDIO_MAX_PPM;
+    if (_integral_ppm < -NET_AUDIO_MAX_PPM) _integral_ppm = -NET_AUDIO_MAX_PPM;
+
+    float ppm = err * DRIFT_KP + _integral_ppm;
+    if (ppm > NET_AUDIO_MAX_PPM) ppm = NET_AUDIO_MAX_PPM;
+    if (ppm < -NET_AUDIO_MAX_PPM) ppm = -NET_AUDIO_MAX_PPM;
+    _step = (1ull << 32) + (int64_t)(ppm * 4294.967296f);
+    _stats.drift_ppm = (int32_t)ppm;
+}
+
+size_t NetAudioRx::pull(int16_t *out, size_t frames)
+{
+    if (!_have_format) {
+        return 0;
+    }
+    size_t samples = frames * _channels;
+
+    if (!_started) {
+        if (_ended || !_have_newest || (!_end_seen && depth() < _target)) {
+            memset(out, 0, samples * sizeof(int16_t));
+            return samples;
+        }
+        // Prime the interpolator with the first two frames
+        _phase = 0;
+        if (!next_frame(_s0) || !next_frame(_s1)) {
+            stop_playing(!_ended);
+            memset(out, 0, samples * sizeof(int16_t));
+            return samples;
+        }
+        _started = true;
+        _depth_avg = (float)depth();
+    }
+
+    _depth_avg += ((float)depth() - _depth_avg) / DEPTH_SMOOTHING;
+    steer();
+
+    size_t f = 0;
+    for (; f < frames; f++) {
+        int32_t frac = (int32_t)(_phase >> 17);     // Q15
+        for (uint16_t c = 0; c < _channels; c++) {
+            out[f * _channels + c] = (int16_t)(_s0[c] + (((_s1[c] - _s0[c]) * frac) >> 15));
+        }
+        uint64_t acc = (uint64_t)_phase + _step;
+        _phase = (uint32_t)acc;
+        for (uint32_t advance = (uint32_t)(acc >> 32); advance > 0; advance--) {
+            memcpy(_s0, _s1, sizeof(_s0));
+            if (!next_frame(_s1)) {
+                stop_playing(!_ended);
+                break;
+            }
+        }
+        if (!_started) {
+            f++;
+            break;
+        }
+    }
+    if (f < frames) {
+        memset(out + f * _channels, 0, (frames - f) * _channels * sizeof(int16_t));
+    }
+    return samples;
+}
+
+void NetAudioRx::stats(net_audio_stats_t *out) const
+{
+    *out = _stats;
+    out->depth_frames = depth();
+    out->target_frames = _target;
+    out->jitter_us = _jitter_q4 >> 4;
+    out->sample_rate = _have_format ? _rate : 0;
+    out->channels = _have_format ? _channels : 0;
+    out->playing = _started;
+}
@@ -0,0 +1,207 @@
+#ifndef MCHACKS_NET_AUDIO_H
+#define MCHACKS_NET_AUDIO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Network audio source
+ * --------------------
+ * A sender streams audio to the main board as UDP datagrams on
+ * NET_AUDIO_PORT, over the same WiFi link the IMU nodes use. Each datagram
+ * is a net_audio_header_t followed by frames of 16-bit PCM or IMA ADPCM
+ * (4 bits per sample, a quarter of the bytes). tools/net_audio_send.py is a
+ * sender for testing.
+ *
+ * NetAudioRx turns the datagrams back into a steady stream:
+ *
+ *   jitter buffer   packets sit in slots by sequence number until their
+ *                   play-out time, so late and reordered arrivals are
+ *                   absorbed. The depth it aims for follows the measured
+ *                   inter-arrival jitter: up at once when the network gets
+ *                   worse, down slowly when it calms.
+ *   concealment     a packet still missing at its play-out time is replaced
+ *                   by the last one that arrived, fading out over repeats.
+ *   drift           the sender's clock and the I2S clock never run at quite
+ *                   the same rate. Play-out resamples by a few hundred ppm,
+ *                   steered by how far the buffer depth is from its target,
+ *                   so the buffer neither drains nor overflows.
+ *
+ * A NetAudioRx has one owner (the audio task): push() what arrived, then
+ * pull() the next block for the output.
+ */
+
+#define NET_AUDIO_PORT 47110
+#define NET_AUDIO_MAGIC 0x414E          // "NA" on the wire
+#define NET_AUDIO_VERSION 1
+
+#define NET_AUDIO_MAX_FRAMES 256        // per packet, ~6 ms at 44.1 kHz
+#define NET_AUDIO_MAX_CHANNELS 2
+#define NET_AUDIO_SLOTS 16              // jitter buffer packets, ~90 ms at 256 frames and 44.1 kHz
+#define NET_AUDIO_CONCEAL_REPEATS 4     // missing packets in a row covered before going silent
+#define NET_AUDIO_MAX_PPM 2000          // largest drift correction, well under audible pitch change
+
+// Samples of storage init() needs: every slot plus the concealment copy
+#define NET_AUDIO_STORAGE_SAMPLES ((NET_AUDIO_SLOTS + 1) * NET_AUDIO_MAX_FRAMES * NET_AUDIO_MAX_CHANNELS)
+
+#define NET_AUDIO_FLAG_END 0x01         // last packet of the stream
+
+typedef enum {
+    NET_AUDIO_PCM16,                    // signed 16-bit little-endian, interleaved
+    NET_AUDIO_ADPCM,                    // IMA ADPCM, see below
+} net_audio_format_t;
+
+// Datagram header; both ends are little-endian
+typedef struct __attribute__((packed)) {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t format;                     // net_audio_format_t
+    uint8_t channels;                   // 1 or 2
+    uint8_t flags;                      // NET_AUDIO_FLAG_*
+    uint16_t frames;                    // 1 to NET_AUDIO_MAX_FRAMES
+    uint32_t sample_rate;
+    uint32_t seq;                       // +1 per packet
+    uint32_t timestamp;                 // sender's sample clock at the first frame
+} net_audio_header_t;
+
+// ADPCM payload: per channel the decoder state before the first sample
+// (int16 predictor, uint8 step index, one pad byte), then one 4-bit code per
+// sample, frame by frame and channel by channel, low nibble first. The state
+// is carried from packet to packet, so each packet decodes on its own.
+#define NET_AUDIO_ADPCM_STATE_BYTES 4
+
+typedef struct {
+    int16_t predictor;
+    uint8_t index;
+} net_audio_adpcm_state_t;
+
+typedef struct {
+    uint32_t packets;                   // taken into the buffer
+    uint32_t late;                      // arrived after their play-out time, dropped
+    uint32_t duplicates;
+    uint32_t overflows;                 // too far ahead of play-out to fit, dropped
+    uint32_t malformed;
+    uint32_t concealed;                 // packets missing at play-out, covered up
+    uint32_t underruns;                 // times the buffer ran empty and play-out re-buffered
+    uint32_t resets;                    // sender restarts and format changes
+    uint32_t depth_frames;              // buffered ahead of play-out
+    uint32_t target_frames;             // depth the buffer adapts towards
+    uint32_t max_depth_frames;
+    uint32_t jitter_us;                 // smoothed inter-arrival jitter
+    int32_t drift_ppm;                  // play-out rate correction, + when the sender runs fast
+    uint32_t sample_rate;               // 0 until the first packet
+    uint16_t channels;
+    bool playing;                       // false while buffering
+} net_audio_stats_t;
+
+/**
+ * @brief Decode count ADPCM codes, stride samples apart in out
+ */
+void net_audio_adpcm_decode(net_audio_adpcm_state_t *state, const uint8_t *codes, size_t first,
+                            size_t count, size_t channels, int16_t *out);
+
+/**
+ * @brief Bytes of payload after the header for a packet of this shape
+ */
+size_t net_audio_payload_bytes(net_audio_format_t format, size_t channels, size_t frames);
+
+class NetAudioRx {
+    struct Slot {
+        uint32_t seq;
+        uint32_t timestamp;
+        uint16_t frames;
+        uint8_t flags;
+        bool filled;
+        int16_t *samples;
+    };
+
+    Slot _slots[NET_AUDIO_SLOTS] = {};
+    int16_t *_conceal_samples = nullptr;   // last packet played, replayed for missing ones
+    net_audio_stats_t _stats = {};
+
+    // Sender format
+    bool _have_format = false;
+    uint32_t _rate = 0;
+    uint16_t _channels = 0;
+    uint16_t _nominal_frames = 0;       // frames of the latest packet, the size of a concealed one
+
+    // Arrivals
+    bool _have_newest = false;
+    uint32_t _newest_seq = 0;
+    uint32_t _newest_end = 0;           // timestamp just past the newest packet
+    bool _end_seen = false;
+    int64_t _last_arrival_us = 0;
+    uint32_t _late_run = 0;
+    int64_t _jitter_arrival_us = 0;     // latest in-order arrival
+    uint32_t _jitter_timestamp = 0;
+    uint32_t _jitter_q4 = 0;            // us, x16 (RFC 3550 estimator)
+    uint32_t _target = 0;               // frames
+
+    // Play-out
+    bool _started = false;
+    bool _ended = false;
+    uint32_t _next_seq = 0;             // next packet play-out starts
+    uint32_t _play_ts = 0;              // sender timestamp of the next input frame
+    const int16_t *_cur = nullptr;      // packet being played
+    uint16_t _cur_frames = 0;
+    uint16_t _cur_offset = 0;
+    bool _cur_end = false;
+    int32_t _gain_start = 0;            // Q15 fade of a concealed packet; 0 plays a real
+                                        // one as is, 1 is silence
+    int32_t _gain_end = 0;
+    uint32_t _conceal_run = 0;
+    bool _have_conceal = false;
+
+    // Fine resampler: linear interpolation between s0 and s1, phase in Q32
+    int16_t _s0[NET_AUDIO_MAX_CHANNELS] = {};
+    int16_t _s1[NET_AUDIO_MAX_CHANNELS] = {};
+    uint32_t _phase = 0;
+    uint64_t _step = 1ull << 32;
+    float _depth_avg = 0;
+    float _integral_ppm = 0;
+
+    void clear();
+    void clamp_target();
+    uint32_t depth() const;
+    void adapt_target(int64_t arrival_us, uint32_t timestamp);
+    void steer();
+    bool begin_packet();
+    bool next_frame(int16_t *frame);
+    void stop_playing(bool dry);
+
+public:
+    /**
+     * @brief Reset everything, stats included
+     *
+     * @param storage NET_AUDIO_STORAGE_SAMPLES samples, kept for the life of the object
+     */
+    void init(int16_t *storage);
+
+    /**
+     * @brief Take one datagram; arrival_us is when it reached the link
+     *
+     * @return false if it was malformed, late, a duplicate or didn't fit
+     */
+    bool push(const uint8_t *packet, size_t len, int64_t arrival_us);
+
+    /**
+     * @brief Produce the next frames output frames at the sender's rate,
+     *        silence while buffering
+     *
+     * @return Samples written (frames * channels()), 0 before the first packet
+     */
+    size_t pull(int16_t *out, size_t frames);
+
+    bool has_format() const { return _have_format; }
+    uint32_t sample_rate() const { return _rate; }
+    uint16_t channels() const { return _channels; }
+    // The sender's last packet has been played
+    bool ended() const { return _ended; }
+    // esp_timer time of the latest datagram, 0 if none
+    int64_t last_arrival_us() const { return _last_arrival_us; }
+    uint32_t concealed() const { return _stats.concealed; }
+
+    void stats(net_audio_stats_t *out) const;
+};
+
+#endif // MCHACKS_NET_AUDIO_H
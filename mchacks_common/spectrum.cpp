@@ -0,0 +1,99 @@
+#include "spectrum.h"
+
+#include <math.h>
+
+void spectrum_plan_init(spectrum_plan_t *plan)
+{
+    const float pi = 3.14159265f;
+    for (size_t i = 0; i < SPECTRUM_FFT_SIZE; i++) {
+        float w = 0.5f - 0.5f * cosf(2.0f * pi * (float)i / SPECTRUM_FFT_SIZE);
+        plan->window[i] = (int16_t)lrintf(w * 32767.0f);
+
+        size_t r = 0;
+        for (size_t b = 0; b < SPECTRUM_FFT_BITS; b++) {
+            r |= ((i >> b) & 1) << (SPECTRUM_FFT_BITS - 1 - b);
+        }
+        plan->bitrev[i] = (uint8_t)r;
+    }
+    for (size_t k = 0; k < SPECTRUM_FFT_SIZE / 2; k++) {
+        float angle = 2.0f * pi * (float)k / SPECTRUM_FFT_SIZE;
+        plan->cos_q15[k] = (int16_t)lrintf(cosf(angle) * 32767.0f);
+        plan->sin_q15[k] = (int16_t)lrintf(sinf(angle) * 32767.0f);
+    }
+
+    // Log-spaced from bin 1 to the top, every band at least one bin wide
+    plan->band_edges[0] = 1;
+    for (size_t b = 1; b <= SPECTRUM_BANDS; b++) {
+        float edge = powf((float)SPECTRUM_BINS, (float)b / SPECTRUM_BANDS);
+        uint16_t bin = (uint16_t)lrintf(edge);
+        if (bin <= plan->band_edges[b - 1]) {
+            bin = plan->band_edges[b - 1] + 1;
+        }
+        plan->band_edges[b] = bin;
+    }
+    plan->band_edges[SPECTRUM_BANDS] = SPECTRUM_BINS;
+}
+
+void spectrum_fft(const spectrum_plan_t *plan, int16_t *re, int16_t *im)
+{
+    for (size_t i = 0; i < SPECTRUM_FFT_SIZE; i++) {
+        size_t j = plan->bitrev[i];
+        if (j > i) {
+            int16_t t = re[i];
+            re[i] = re[j];
+            re[j] = t;
+            t = im[i];
+            im[i] = im[j];
+            im[j] = t;
+        }
+    }
+
+    for (size_t half = 1, step = SPECTRUM_FFT_SIZE / 2; half < SPECTRUM_FFT_SIZE; half <<= 1, step >>= 1) {
+        for (size_t j = 0; j < half; j++) {
+            // e^(-2 pi i j / (2 half))
+            int32_t wr = plan->cos_q15[j * step];
+            int32_t wi = -plan->sin_q15[j * step];
+            for (size_t a = j; a < SPECTRUM_FFT_SIZE; a += 2 * half) {
+                size_t b = a + half;
+                int32_t tr = (re[b] * wr - im[b] * wi) >> 15;
+                int32_t ti = (re[b] * wi + im[b] * wr) >> 15;
+                int32_t ar = re[a];
+                int32_t ai = im[a];
+                re[a] = (int16_t)((ar + tr) >> 1);
+                im[a] = (int16_t)((ai + ti) >> 1);
+                re[b] = (int16_t)((ar - tr) >> 1);
+                im[b] = (int16_t)((ai - ti) >> 1);
+            }
+        }
+    }
+}
+
+uint8_t spectrum_level(uint64_t energy)
+{
+    if (energy == 0) {
+        return 0;
+    }
+    // Integer log2, with the three bits below the top one as the fraction
+    uint32_t msb = 63 - (uint32_t)__builtin_clzll(energy);
+    uint32_t frac = msb >= 3 ? (uint32_t)(energy >> (msb - 3)) & 7 : (uint32_t)(energy << (3 - msb)) & 7;
+    uint32_t level = msb * SPECTRUM_LEVEL_STEPS + frac + 1;
+    return level > 255 ? 255 : (uint8_t)level;
+}
+
+void spectrum_analyze(const spectrum_plan_t *plan, const int16_t *samples, spectrum_work_t *work,
+                      uint8_t *levels)
+{
+    for (size_t i = 0; i < SPECTRUM_FFT_SIZE; i++) {
+        work->re[i] = (int16_t)((samples[i] * plan->window[i]) >> 15);
+        work->im[i] = 0;
+    }
+    spectrum_fft(plan, work->re, work->im);
+
+    for (size_t b = 0; b < SPECTRUM_BANDS; b++) {
+        uint64_t energy = 0;
+        for (size_t k = plan->band_edges[b]; k < plan->band_edges[b + 1]; k++) {
+            energy += (uint32_t)(work->re[k] * work->re[k]) + (uint32_t)(work->im[k] * work->im[k]);
+        }
+        levels[b] = spectrum_level(energy);
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef MCHACKS_SPECTRUM_H
+#define MCHACKS_SPECTRUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Spectrum analysis
+ * -----------------
+ * Fixed-point kernels behind the audio-reactive visuals: a Hann window, a
+ * 16-bit radix-2 FFT and log-spaced band energies. Like audio_dsp.h they do
+ * no I/O, so esp_bench times the same code the analyzer job runs.
+ *
+ * The FFT halves its data at every stage, so it can't overflow; the result
+ * is the transform divided by SPECTRUM_FFT_SIZE. Band energies are turned
+ * into 8-bit levels on a log scale, SPECTRUM_LEVEL_STEPS per doubling: a
+ * full-scale tone lands near 210, the transform's own rounding noise around
+ * 40, and digital silence at 0.
+ */
+
+#define SPECTRUM_FFT_BITS 8
+#define SPECTRUM_FFT_SIZE (1 << SPECTRUM_FFT_BITS)  // samples per analysis, ~6 ms at 44.1 kHz
+#define SPECTRUM_BINS (SPECTRUM_FFT_SIZE / 2)       // up to half the sample rate
+#define SPECTRUM_BANDS 16
+#define SPECTRUM_LEVEL_STEPS 8                      // levels per doubling of energy, ~0.4 dB each
+
+// Tables built once by spectrum_plan_init(); read-only afterwards
+typedef struct {
+    int16_t window[SPECTRUM_FFT_SIZE];              // Hann, Q15
+    int16_t cos_q15[SPECTRUM_FFT_SIZE / 2];
+    int16_t sin_q15[SPECTRUM_FFT_SIZE / 2];
+    uint8_t bitrev[SPECTRUM_FFT_SIZE];
+    // First bin of each band, then one past the last band. Bin 0 (DC) is
+    // left out; the low bands are one bin wide, the top one ~35.
+    uint16_t band_edges[SPECTRUM_BANDS + 1];
+} spectrum_plan_t;
+
+// Scratch for one analysis; the FFT runs in place here
+typedef struct {
+    int16_t re[SPECTRUM_FFT_SIZE];
+    int16_t im[SPECTRUM_FFT_SIZE];
+} spectrum_work_t;
+
+void spectrum_plan_init(spectrum_plan_t *plan);
+
+/**
+ * @brief In-place forward FFT of SPECTRUM_FFT_SIZE points, scaled by 1/N
+ */
+void spectrum_fft(const spectrum_plan_t *plan, int16_t *re, int16_t *im);
+
+/**
+ * @brief Log level (0-255) of a band energy, SPECTRUM_LEVEL_STEPS per doubling
+ */
+uint8_t spectrum_level(uint64_t energy);
+
+/**
+ * @brief Window SPECTRUM_FFT_SIZE mono samples, transform them and sum the
+ *        power of each band
+ *
+ * @param levels SPECTRUM_BANDS levels out, lowest band first
+ */
+void spectrum_analyze(const spectrum_plan_t *plan, const int16_t *samples, spectrum_work_t *work,
+                      uint8_t *levels);
+
+#endif // MCHACKS_SPECTRUM_H
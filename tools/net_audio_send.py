@@ -0,0 +1,193 @@
+#!/usr/bin/env python3
+"""Stream a WAV file to the main board's network audio source.
+
+Stand-in for a real sender (see mchacks_common/net_audio.h for the packet
+format). Packets leave on the sender's own sample clock, which can be made
+to run fast or slow, and the network can be made worse on purpose, to
+exercise the board's jitter buffer, concealment and drift compensation:
+
+    net_audio_send.py test.wav                          # host build on 127.0.0.1
+    net_audio_send.py test.wav --host 192.168.4.1       # the board, over WiFi
+    net_audio_send.py test.wav --adpcm --skew-ppm 300 --jitter-ms 8 --loss 0.02
+
+Then "audio net" on the board's console (or CONFIG_MCHACKS_MUSIC_FROM_NET)
+and "audio" to read back buffer depth, late packets and concealment.
+"""
+
+import argparse
+import heapq
+import random
+import socket
+import struct
+import sys
+import time
+import wave
+
+MAGIC = 0x414E
+VERSION = 1
+PCM16 = 0
+ADPCM = 1
+FLAG_END = 0x01
+MAX_FRAMES = 256
+DEFAULT_PORT = 47110
+
+HEADER = struct.Struct("<HBBBBHIII")
+
+IMA_STEPS = [
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+    253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+    11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+    32767,
+]
+IMA_INDEX_STEP = [-1, -1, -1, -1, 2, 4, 6, 8]
+
+
+class AdpcmEncoder:
+    """IMA ADPCM, one per channel; its state carries over from packet to packet."""
+
+    def __init__(self):
+        self.predictor = 0
+        self.index = 0
+
+    def encode(self, sample):
+        step = IMA_STEPS[self.index]
+        diff = sample - self.predictor
+        code = 0
+        if diff < 0:
+            code = 8
+            diff = -diff
+        delta = step >> 3
+        if diff >= step:
+            code |= 4
+            diff -= step
+            delta += step
+        if diff >= step >> 1:
+            code |= 2
+            diff -= step >> 1
+            delta += step >> 1
+        if diff >= step >> 2:
+            code |= 1
+            delta += step >> 2
+        self.predictor += -delta if code & 8 else delta
+        self.predictor = max(-32768, min(32767, self.predictor))
+        self.index = max(0, min(88, self.index + IMA_INDEX_STEP[code & 7]))
+        return code
+
+
+def read_wav(path):
+    with wave.open(path, "rb") as w:
+        channels = w.getnchannels()
+        rate = w.getframerate()
+        width = w.getsampwidth()
+        raw = w.readframes(w.getnframes())
+    if channels not in (1, 2):
+        sys.exit("only mono and stereo files can be sent")
+    if width == 1:
+        samples = [(b - 128) << 8 for b in raw]
+    elif width == 2:
+        samples = list(struct.unpack("<%dh" % (len(raw) // 2), raw))
+    else:
+        sys.exit("only 8-bit and 16-bit files can be sent")
+    return rate, channels, samples
+
+
+def packets(args, rate, channels, samples):
+    """Yield (frames, payload) for each packet of the file, looping if asked."""
+    encoders = [AdpcmEncoder() for _ in range(channels)]
+    total = len(samples) // channels
+    while True:
+        for start in range(0, total, args.frames):
+            frames = min(args.frames, total - start)
+            chunk = samples[start * channels:(start + frames) * channels]
+            if not args.adpcm:
+                yield frames, struct.pack("<%dh" % len(chunk), *chunk)
+                continue
+            payload = bytearray()
+            for e in encoders:
+                payload += struct.pack("<hBB", e.predictor, e.index, 0)
+            codes = bytearray((len(chunk) + 1) // 2)
+            for n, s in enumerate(chunk):
+                codes[n >> 1] |= encoders[n % channels].encode(s) << ((n & 1) * 4)
+            yield frames, bytes(payload + codes)
+        if not args.loop:
+            return
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("wav")
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=DEFAULT_PORT)
+    parser.add_argument("--adpcm", action="store_true", help="send IMA ADPCM instead of 16-bit PCM")
+    parser.add_argument("--frames", type=int, default=MAX_FRAMES, help="frames per packet (max %d)" % MAX_FRAMES)
+    parser.add_argument("--skew-ppm", type=float, default=0.0,
+                        help="run the sender's sample clock this much fast (+) or slow (-)")
+    parser.add_argument("--jitter-ms", type=float, default=0.0,
+                        help="hold each packet back by up to this long, at random (reorders)")
+    parser.add_argument("--loss", type=float, default=0.0, help="fraction of packets to drop")
+    parser.add_argument("--duplicate", type=float, default=0.0, help="fraction of packets to send twice")
+    parser.add_argument("--loop", action="store_true", help="repeat the file until interrupted")
+    parser.add_argument("--seed", type=int, default=None)
+    args = parser.parse_args()
+    if not 1 <= args.frames <= MAX_FRAMES:
+        sys.exit("--frames must be 1 to %d" % MAX_FRAMES)
+
+    rng = random.Random(args.seed)
+    rate, channels, samples = read_wav(args.wav)
+    fmt = ADPCM if args.adpcm else PCM16
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    dest = (args.host, args.port)
+    print("sending %s: %d Hz, %d ch, %s, %d frames per packet to %s:%d"
+          % (args.wav, rate, channels, "adpcm" if args.adpcm else "pcm16", args.frames, args.host, args.port))
+
+    # A random start, so the board sees a restarted sender as a new stream
+    seq = rng.randrange(1 << 32)
+    timestamp = rng.randrange(1 << 32)
+    seconds_per_frame = 1.0 / (rate * (1.0 + args.skew_ppm * 1e-6))
+    start = time.monotonic()
+    pending = []            # (departure, order, datagram) so jitter reorders
+    sent = dropped = 0
+    frames_sent = 0
+
+    def flush(until):
+        nonlocal sent
+        while pending and pending[0][0] <= until:
+            departure, _, datagram = heapq.heappop(pending)
+            delay = departure - time.monotonic()
+            if delay > 0:
+                time.sleep(delay)
+            sock.sendto(datagram, dest)
+            sent += 1
+
+    try:
+        source = packets(args, rate, channels, samples)
+        current = next(source, None)
+        while current is not None:
+            following = next(source, None)
+            frames, payload = current
+            flags = FLAG_END if following is None else 0
+            header = HEADER.pack(MAGIC, VERSION, fmt, channels, flags, frames, rate,
+                                 seq & 0xFFFFFFFF, timestamp & 0xFFFFFFFF)
+            due = start + frames_sent * seconds_per_frame
+            if rng.random() < args.loss and flags == 0:
+                dropped += 1
+            else:
+                copies = 2 if rng.random() < args.duplicate else 1
+                for _ in range(copies):
+                    heapq.heappush(pending, (due + rng.uniform(0, args.jitter_ms / 1000.0), seq, header + payload))
+            flush(due)
+            seq += 1
+            timestamp += frames
+            frames_sent += frames
+            current = following
+        flush(float("inf"))
+    except KeyboardInterrupt:
+        pass
+    print("%d packets sent, %d dropped on purpose, %.1f s of audio" % (sent, dropped, frames_sent / rate))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,252 @@
+#!/usr/bin/env python3
+"""Run end-to-end performance scenarios on the Linux target and check them
+against the baselines in perf_baselines.json.
+
+Each scenario boots the host build of esp_main (see esp_main/main/scenario.h)
+in a scratch directory next to a number of host esp_imu nodes, lets it run a
+fixed window and reads back frame times, audio underruns, IMU ingest latency
+and memory peaks. A metric fails when it is worse than its baseline by more
+than the baseline's tolerance; the exit status is 1 if anything failed.
+
+Build both firmwares for the host first (idf.py --preview set-target linux
+&& idf.py build in esp_main and esp_imu), then:
+
+    perf_scenarios.py                          # every scenario
+    perf_scenarios.py duo_music -o results.json
+    perf_scenarios.py --update                 # take this run as the new baseline
+
+The checked-in baselines start at the firmware's own budgets rather than at a
+measured run: the render period (RENDER_PERIOD_US) for frame times, one game
+tick for IMU ingest latency, HIT_SFX_BUDGET_US for the hit sound, the nodes'
+default rate for IMU throughput and zero for underruns, lost datagrams, bus
+losses, dropped recording blocks, allocation violations and deadline misses.
+Memory peaks have no baseline until one is measured. Run --update on the
+reference host to replace the values with measured ones; the tolerances are
+kept. Timings from another host are not comparable to a measured baseline.
+"""
+
+import argparse
+import json
+import math
+import os
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+BASELINES = os.path.join(ROOT, "tools", "perf_baselines.json")
+
+# nodes: host IMU nodes to start; music: put a track and a hit effect on the
+# card so the audio service plays; env: extra environment for the firmware
+SCENARIOS = {
+    "duo_music": {
+        "description": "two IMUs, music and the full-screen animation",
+        "nodes": 2,
+        "seconds": 60,
+        "music": True,
+        "env": {},
+    },
+    "swarm_logging": {
+        "description": "32 IMU nodes, session recording and verbose logs",
+        "nodes": 32,
+        "seconds": 30,
+        "music": False,
+        "env": {"MCHACKS_LOG_LEVEL": "4"},
+    },
+}
+
+# Everything else is better when lower
+HIGHER_IS_BETTER = {"frames_per_s", "imu_samples_per_s"}
+
+# Tolerance given to metrics new to a baseline: relative, plus an absolute
+# allowance so metrics that sit at zero don't fail on a single event
+DEFAULT_TOLERANCE = {"rel": 0.15, "abs": 0}
+TOLERANCE_BY_PREFIX = [
+    ("frame_", {"rel": 0.15, "abs": 2000}),
+    ("imu_latency_", {"rel": 0.25, "abs": 1000}),
+    ("sfx_", {"rel": 0.25, "abs": 2000}),
+    ("rss_", {"rel": 0.10, "abs": 1024}),
+    ("peak_", {"rel": 0.05, "abs": 0}),
+    ("audio_underruns", {"rel": 0, "abs": 0}),
+    ("imu_lost", {"rel": 0.5, "abs": 10}),
+    ("deadline_misses", {"rel": 0.5, "abs": 5}),
+]
+
+
+def tolerance_for(name):
+    for prefix, tolerance in TOLERANCE_BY_PREFIX:
+        if name.startswith(prefix):
+            return dict(tolerance)
+    return dict(DEFAULT_TOLERANCE)
+
+
+def write_wav(path, seconds, rate=44100, tones=(220.0, 277.2, 329.6)):
+    """A stereo chord, loud enough that gain and mixing are exercised."""
+    frames = int(seconds * rate)
+    with open(path, "wb") as f:
+        data_bytes = frames * 4
+        f.write(b"RIFF" + struct.pack("<I", 36 + data_bytes) + b"WAVEfmt ")
+        f.write(struct.pack("<IHHIIHH", 16, 1, 2, rate, rate * 4, 4, 16))
+        f.write(b"data" + struct.pack("<I", data_bytes))
+        # One second is generated and repeated; the tones loop cleanly
+        second = bytearray()
+        for i in range(rate):
+            t = i / rate
+            v = sum(math.sin(2 * math.pi * tone * t) for tone in tones) / len(tones)
+            s = int(v * 12000)
+            second += struct.pack("<hh", s, s)
+        whole, rest = divmod(frames, rate)
+        for _ in range(whole):
+            f.write(second)
+        f.write(second[:rest * 4])
+
+
+def run_scenario(name, spec, args):
+    work = tempfile.mkdtemp(prefix="mchacks-%s-" % name)
+    os.makedirs(os.path.join(work, "sdcard"))
+    if spec["music"]:
+        length = spec["seconds"] + args.warmup + 10
+        write_wav(os.path.join(work, "sdcard", "test.wav"), length)
+        write_wav(os.path.join(work, "sdcard", "hit.wav"), 0.1, tones=(880.0,))
+
+    env = dict(os.environ)
+    env.update({
+        "MCHACKS_LOOPBACK_PORT": str(args.port),
+        "MCHACKS_PPM_EVERY": "0",      # the stand-in's PPM dumps are not the firmware's cost
+        "MCHACKS_AUDIO_REALTIME": "1",
+    })
+
+    nodes = []
+    main = None
+    out_path = os.path.join(work, "scenario.json")
+    log_path = os.path.join(work, "main.log")
+    try:
+        for device in range(spec["nodes"]):
+            node_env = dict(env, MCHACKS_DEVICE_ID=str(device))
+            nodes.append(subprocess.Popen([args.imu], cwd=work, env=node_env,
+                                          stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL))
+
+        main_env = dict(env, **spec["env"])
+        main_env.update({
+            "MCHACKS_SCENARIO_SECONDS": str(spec["seconds"]),
+            "MCHACKS_SCENARIO_WARMUP_S": str(args.warmup),
+            "MCHACKS_SCENARIO_OUT": out_path,
+        })
+        with open(log_path, "w") as log:
+            main = subprocess.Popen([args.main], cwd=work, env=main_env, stdout=log, stderr=log)
+            status = main.wait(timeout=spec["seconds"] + args.warmup + 60)
+    except subprocess.TimeoutExpired:
+        status = None
+    finally:
+        for p in nodes + ([main] if main else []):
+            if p.poll() is None:
+                p.kill()
+                p.wait()
+
+    if status != 0 or not os.path.exists(out_path):
+        print("%s: firmware %s, log in %s" % (name, "timed out" if status is None else
+                                              "exited with %s" % status, log_path), file=sys.stderr)
+        return None
+    with open(out_path) as f:
+        return json.load(f)["metrics"]
+
+
+def compare(name, metrics, baseline):
+    """Print one line per metric and return the number of regressions."""
+    failures = 0
+    print("%s" % name)
+    for metric in sorted(metrics):
+        value = metrics[metric]
+        entry = baseline.get(metric)
+        if entry is None:
+            print("  %-24s %12g   (no baseline)" % (metric, value))
+            continue
+        base = entry["value"]
+        if metric in HIGHER_IS_BETTER:
+            limit = base * (1 - entry["rel"]) - entry["abs"]
+            ok = value >= limit
+        else:
+            limit = base * (1 + entry["rel"]) + entry["abs"]
+            ok = value <= limit
+        failures += not ok
+        print("  %-24s %12g   baseline %g, limit %g%s" % (metric, value, base, limit,
+                                                          "" if ok else "   REGRESSION"))
+    return failures
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("scenarios", nargs="*", help="scenarios to run (default: all)")
+    parser.add_argument("--main", default=os.path.join(ROOT, "esp_main", "build", "McHacks.elf"),
+                        help="host build of esp_main")
+    parser.add_argument("--imu", default=os.path.join(ROOT, "esp_imu", "build", "McHacks.elf"),
+                        help="host build of esp_imu")
+    parser.add_argument("--baselines", default=BASELINES)
+    parser.add_argument("--warmup", type=int, default=2, help="seconds after boot before measuring")
+    parser.add_argument("--port", type=int, default=47150, help="loopback port for the IMU nodes")
+    parser.add_argument("--update", action="store_true",
+                        help="write this run's results as the new baselines, keeping tolerances")
+    parser.add_argument("-o", "--output", help="also write the raw results here as JSON")
+    parser.add_argument("--list", action="store_true", help="list the scenarios and exit")
+    args = parser.parse_args()
+
+    if args.list:
+        for name, spec in SCENARIOS.items():
+            print("%-16s %3d s  %s" % (name, spec["seconds"], spec["description"]))
+        return 0
+
+    names = args.scenarios or list(SCENARIOS)
+    for name in names:
+        if name not in SCENARIOS:
+            parser.error("unknown scenario %s" % name)
+    # The firmwares run in scratch directories
+    args.main = os.path.abspath(args.main)
+    args.imu = os.path.abspath(args.imu)
+    for binary in (args.main, args.imu):
+        if not os.path.exists(binary):
+            parser.error("%s not found; build it for the linux target first" % binary)
+
+    baselines = {}
+    if os.path.exists(args.baselines):
+        with open(args.baselines) as f:
+            baselines = json.load(f)
+    elif not args.update:
+        print("no baselines in %s: nothing can fail. Run with --update on the "
+              "reference host to record them." % args.baselines)
+
+    results = {}
+    failures = 0
+    for name in names:
+        started = time.time()
+        metrics = run_scenario(name, SCENARIOS[name], args)
+        if metrics is None:
+            failures += 1
+            continue
+        results[name] = metrics
+        failures += compare(name, metrics, baselines.get(name, {}))
+        print("  (%.0f s)" % (time.time() - started))
+
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(results, f, indent=2, sort_keys=True)
+
+    if args.update:
+        for name, metrics in results.items():
+            old = baselines.get(name, {})
+            baselines[name] = {
+                metric: dict(old.get(metric, tolerance_for(metric)), value=value)
+                for metric, value in metrics.items()
+            }
+        with open(args.baselines, "w") as f:
+            json.dump(baselines, f, indent=2, sort_keys=True)
+            f.write("\n")
+        print("baselines written to %s" % args.baselines)
+        return 0
+
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,126 @@
+#!/usr/bin/env python3
+"""Convert an event tracer dump (see esp_main/main/trace.h) to Chrome trace JSON.
+
+The output opens in chrome://tracing or https://ui.perfetto.dev. Each core
+shows up as a process and each FreeRTOS task as a thread within it.
+
+    trace_to_chrome.py trace.bin -o trace.json
+    trace_to_chrome.py --listen 47200 -o trace.json   # then on the board: trace send <host ip> 47200
+"""
+
+import argparse
+import json
+import socket
+import struct
+import sys
+
+EVENT = struct.Struct("<qIHBB")
+PHASES = {0: "B", 1: "E", 2: "i"}
+
+
+class Reader:
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+
+    def take(self, n):
+        if self.pos + n > len(self.data):
+            raise ValueError("truncated trace")
+        chunk = self.data[self.pos:self.pos + n]
+        self.pos += n
+        return chunk
+
+    def u8(self):
+        return self.take(1)[0]
+
+    def u16(self):
+        return struct.unpack("<H", self.take(2))[0]
+
+    def u32(self):
+        return struct.unpack("<I", self.take(4))[0]
+
+    def string(self):
+        return self.take(self.u8()).decode("utf-8", "replace")
+
+
+def convert(data):
+    r = Reader(data)
+    if r.take(4) != b"MHTR":
+        raise ValueError("not a trace dump")
+    version = r.u8()
+    if version != 1:
+        raise ValueError("unsupported trace version %d" % version)
+    cores = r.u8()
+    names = [r.string() for _ in range(r.u16())]
+    tasks = {}
+    for _ in range(r.u16()):
+        number = r.u16()
+        tasks[number] = r.string()
+
+    events = []
+    seen_threads = set()
+    for core in range(cores):
+        events.append({"ph": "M", "name": "process_name", "pid": core, "args": {"name": "core %d" % core}})
+        for _ in range(r.u32()):
+            time_us, arg, task, name_id, kind = EVENT.unpack(r.take(EVENT.size))
+            if (core, task) not in seen_threads:
+                seen_threads.add((core, task))
+                events.append({"ph": "M", "name": "thread_name", "pid": core, "tid": task,
+                               "args": {"name": tasks.get(task, "task %d" % task)}})
+            event = {
+                "name": names[name_id] if name_id < len(names) else "event %d" % name_id,
+                "ph": PHASES.get(kind, "i"),
+                "ts": time_us,
+                "pid": core,
+                "tid": task,
+            }
+            if kind == 2:
+                event["s"] = "t"
+            if kind != 0:
+                event["args"] = {"arg": arg}
+            events.append(event)
+
+    return {"traceEvents": events, "displayTimeUnit": "ms"}
+
+
+def receive(port):
+    with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as server:
+        server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        server.bind(("0.0.0.0", port))
+        server.listen(1)
+        print("waiting for a trace on port %d" % port, file=sys.stderr)
+        conn, addr = server.accept()
+        chunks = []
+        with conn:
+            while True:
+                chunk = conn.recv(65536)
+                if not chunk:
+                    break
+                chunks.append(chunk)
+        print("received %d bytes from %s" % (sum(len(c) for c in chunks), addr[0]), file=sys.stderr)
+        return b"".join(chunks)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("input", nargs="?", help="dump file written by 'trace dump'")
+    parser.add_argument("--listen", type=int, metavar="PORT", help="receive the dump over TCP instead")
+    parser.add_argument("-o", "--output", default="trace.json")
+    args = parser.parse_args()
+
+    if args.listen:
+        data = receive(args.listen)
+    elif args.input:
+        with open(args.input, "rb") as f:
+            data = f.read()
+    else:
+        parser.error("give a dump file or --listen PORT")
+
+    trace = convert(data)
+    with open(args.output, "w") as f:
+        json.dump(trace, f)
+    print("wrote %d events to %s" % (len(trace["traceEvents"]), args.output), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()